@@ -0,0 +1,550 @@
+/*==============================================================================
+
+  Program: 3D Slicer
+
+  Portions (c) Copyright Brigham and Women's Hospital (BWH) All Rights Reserved.
+
+  See COPYRIGHT.txt
+  or http://www.slicer.org/copyright/copyright.txt for details.
+
+  Unless required by applicable law or agreed to in writing, software
+  distributed under the License is distributed on an "AS IS" BASIS,
+  WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+  See the License for the specific language governing permissions and
+  limitations under the License.
+
+==============================================================================*/
+
+
+// Batch s-rep fitting for a cohort of surface meshes.
+// For each subject of a manifest: forward flow, s-rep generation for the fitted ellipsoid,
+// backward flow and refinement against the subject's own mesh.
+// Usage: SkeletalRepresentationBatch <manifest> <outputDir> [numThreads] [memoryBudgetMB]
+//
+// The manifest is a text file. Lines "name = value" change a setting for all subjects listed
+// after them, lines "id, meshFile" add a subject, '#' starts a comment:
+//
+//   rows = 5
+//   cols = 9
+//   case01, /data/case01.vtk
+//   refineIter = 500
+//   case02, /data/case02.vtk
+//
+// Every subject gets its own folder <outputDir>/<id> with the initial s-rep (header.xml),
+// the refined s-rep (refined_header.xml) and a scratch folder for the flow.
+// A summary of all subjects is written to <outputDir>/summary.csv.
+// Distance maps are cached in <outputDir>/distanceMaps, so running the batch again with other
+// refinement settings skips the preprocessing of unchanged meshes.
+// Subjects with the same nonzero "group" setting, e.g. the neighboring objects of one patient, share
+// one narrow band distance map of all their meshes, built in a single pass before the fitting starts.
+
+#include "vtkBrickedLayout.h"
+#include "vtkMultiLabelDistanceMap.h"
+#include "vtkWorkStealingPool.h"
+#include "vtkSlicerSkeletalRepresentationInitializerLogic.h"
+#include "vtkSlicerSkeletalRepresentationRefinerLogic.h"
+
+// Slicer includes
+#include <vtkSlicerApplicationLogic.h>
+
+// MRML includes
+#include <vtkMRMLScene.h>
+
+// VTK includes
+#include <vtkSmartPointer.h>
+#include <vtksys/SystemTools.hxx>
+
+// STD includes
+#include <algorithm>
+#include <chrono>
+#include <cstdlib>
+#include <exception>
+#include <fstream>
+#include <iostream>
+#include <map>
+#include <math.h>
+#include <memory>
+#include <mutex>
+#include <sstream>
+#include <string>
+#include <vector>
+
+namespace
+{
+
+// Settings of one subject. Defaults are the ones of the module widgets.
+struct BatchSettings
+{
+    int rows = 5;
+    int cols = 9;
+    double dt = 0.001;
+    double smooth = 0.01;
+    int flowIter = 500;
+    int flowOutputFreq = 100;
+    double stepSize = 0.01;
+    double endCriterion = 0.001;
+    int refineIter = 2000;
+    int interpolationLevel = 3;
+    double wtImageMatch = 0.004;
+    double wtNormal = 20;
+    double wtSrad = 50;
+    // optimize with the single precision kernels, polish in double precision
+    int singlePrecision = 0;
+    // grid of the distance maps in the unit cube: voxel size and margin around the mesh
+    double voxelSpacing = 0.005;
+    double gridMargin = 0.1;
+    // half-width of the narrow band distance map in the unit cube, 0 for the dense map
+    double narrowBand = 0;
+    // exact distance to the mesh instead of a distance map
+    int exactDistance = 0;
+    // normals of the dense distance map: 0 gradient volume, 1 computed at the samples, 2 octahedral codes
+    int normalMode = 0;
+    // keep the distance map as 16 bit fixed point values
+    int quantizeDistance = 0;
+    // lay the distance maps out in 8x8x8 bricks and sort the samples by brick
+    int brickDistanceMaps = 0;
+    // distance map reads between voxels: 0 nearest voxel, 1 trilinear, 2 tricubic B-spline
+    int interpolation = 0;
+    // peak memory (MB) of one subject, used to admit jobs under the memory budget,
+    // 0 estimates it from the distance map grid and the mesh size
+    double memory = 0;
+    // keep the forward flow meshes and the ellipsoid s-rep of each subject
+    int keepTemporary = 0;
+    // reuse distance maps of <outputDir>/distanceMaps
+    int cacheDistanceMaps = 1;
+    // subjects with the same nonzero group share one distance map of all their meshes
+    int group = 0;
+};
+
+struct BatchSubject
+{
+    std::string id;
+    std::string meshFile;
+    BatchSettings settings;
+};
+
+struct BatchResult
+{
+    std::string status = "not run";
+    int forwardSteps = 0;
+    double initSeconds = 0;
+    double refineSeconds = 0;
+    std::string header;
+};
+
+std::string Trim(const std::string &s)
+{
+    const char *space = " \t\r\n";
+    size_t begin = s.find_first_not_of(space);
+    if(begin == std::string::npos)
+    {
+        return "";
+    }
+    size_t end = s.find_last_not_of(space);
+    return s.substr(begin, end - begin + 1);
+}
+
+bool SetSetting(BatchSettings &settings, const std::string &name, double value)
+{
+    std::map<std::string, double*> reals;
+    reals["dt"] = &settings.dt;
+    reals["smooth"] = &settings.smooth;
+    reals["stepSize"] = &settings.stepSize;
+    reals["endCriterion"] = &settings.endCriterion;
+    reals["wtImageMatch"] = &settings.wtImageMatch;
+    reals["wtNormal"] = &settings.wtNormal;
+    reals["wtSrad"] = &settings.wtSrad;
+    reals["memory"] = &settings.memory;
+    reals["narrowBand"] = &settings.narrowBand;
+    reals["voxelSpacing"] = &settings.voxelSpacing;
+    reals["gridMargin"] = &settings.gridMargin;
+    std::map<std::string, int*> integers;
+    integers["rows"] = &settings.rows;
+    integers["cols"] = &settings.cols;
+    integers["flowIter"] = &settings.flowIter;
+    integers["flowOutputFreq"] = &settings.flowOutputFreq;
+    integers["refineIter"] = &settings.refineIter;
+    integers["interpolationLevel"] = &settings.interpolationLevel;
+    integers["keepTemporary"] = &settings.keepTemporary;
+    integers["singlePrecision"] = &settings.singlePrecision;
+    integers["cacheDistanceMaps"] = &settings.cacheDistanceMaps;
+    integers["exactDistance"] = &settings.exactDistance;
+    integers["normalMode"] = &settings.normalMode;
+    integers["quantizeDistance"] = &settings.quantizeDistance;
+    integers["brickDistanceMaps"] = &settings.brickDistanceMaps;
+    integers["interpolation"] = &settings.interpolation;
+    integers["group"] = &settings.group;
+
+    if(reals.count(name))
+    {
+        *reals[name] = value;
+        return true;
+    }
+    if(integers.count(name))
+    {
+        *integers[name] = static_cast<int>(value);
+        return true;
+    }
+    return false;
+}
+
+bool ReadManifest(const std::string &fileName, std::vector<BatchSubject> &subjects)
+{
+    std::ifstream in(fileName);
+    if(!in)
+    {
+        std::cerr << "Cannot open manifest " << fileName << std::endl;
+        return false;
+    }
+    BatchSettings settings;
+    std::string line;
+    int lineNumber = 0;
+    while(std::getline(in, line))
+    {
+        ++lineNumber;
+        line = Trim(line.substr(0, line.find('#')));
+        if(line.empty())
+        {
+            continue;
+        }
+        size_t equal = line.find('=');
+        if(equal != std::string::npos)
+        {
+            std::string name = Trim(line.substr(0, equal));
+            std::istringstream valueStream(line.substr(equal + 1));
+            double value = 0;
+            if(!(valueStream >> value) || !SetSetting(settings, name, value))
+            {
+                std::cerr << fileName << ":" << lineNumber << ": invalid setting " << line << std::endl;
+                return false;
+            }
+            continue;
+        }
+        size_t comma = line.find(',');
+        if(comma == std::string::npos)
+        {
+            std::cerr << fileName << ":" << lineNumber << ": expected \"id, meshFile\"" << std::endl;
+            return false;
+        }
+        BatchSubject subject;
+        subject.id = Trim(line.substr(0, comma));
+        subject.meshFile = Trim(line.substr(comma + 1));
+        subject.settings = settings;
+        if(subject.id.empty() || subject.meshFile.empty())
+        {
+            std::cerr << fileName << ":" << lineNumber << ": expected \"id, meshFile\"" << std::endl;
+            return false;
+        }
+        if(subject.settings.rows % 2 == 0 || subject.settings.cols % 2 == 0)
+        {
+            std::cerr << fileName << ":" << lineNumber << ": rows and cols of s-rep must be odd" << std::endl;
+            return false;
+        }
+        subjects.push_back(subject);
+    }
+    return true;
+}
+
+double SecondsSince(const std::chrono::steady_clock::time_point &start)
+{
+    return std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+}
+
+// Peak memory (MB) of fitting one subject. The mesh is mapped into the unit cube, so the grid of the
+// distance map is at most the unit cube plus its margin on every axis. Bytes per voxel at the peak:
+// the inside mask with the distances while the distance transform runs, then the distances with the
+// normals kept and the 16 bit copy of a quantized map. A narrow band keeps the mask and the bricks
+// that cross a shell of the band around the surface, the exact distance a hierarchy of the triangles.
+double EstimateMemory(const BatchSubject &subject, bool grouped)
+{
+    const BatchSettings &settings = subject.settings;
+    if(settings.memory > 0)
+    {
+        return settings.memory;
+    }
+    const double megabyte = 1024.0 * 1024.0;
+    const double meshBytes = static_cast<double>(vtksys::SystemTools::FileLength(subject.meshFile));
+    // scene, logic, the s-reps and the meshes of the flow, several copies of the input mesh
+    double bytes = 64 * megabyte + 8 * meshBytes;
+    // the distance map of a group is built once before the jobs and shared
+    if(grouped)
+    {
+        return bytes / megabyte;
+    }
+    if(settings.exactDistance)
+    {
+        return (bytes + 4 * meshBytes) / megabyte;
+    }
+    const double spacing = settings.voxelSpacing;
+    const int first = static_cast<int>(floor(-settings.gridMargin / spacing));
+    const int last = static_cast<int>(ceil((1 + settings.gridMargin) / spacing));
+    const double side = vtkBrickedLayout::RoundUp(last - first + 1);
+    const double numVoxels = side * side * side;
+    if(settings.narrowBand > 0)
+    {
+        const double extent = side * spacing;
+        const double brickExtent = vtkBrickedLayout::BrickSize * spacing;
+        const double bandFraction = std::min(1.0, 6 * 2 * (settings.narrowBand + brickExtent)
+                                             / (extent * extent * extent));
+        return (bytes + numVoxels * (1 + sizeof(float) * bandFraction)) / megabyte;
+    }
+    double normalBytes = 0;
+    if(settings.normalMode == vtkImageDistanceSampler::StoredGradient)
+    {
+        normalBytes = 3 * sizeof(float);
+    }
+    else if(settings.normalMode == vtkImageDistanceSampler::OctahedralNormals)
+    {
+        normalBytes = sizeof(unsigned int);
+    }
+    const double quantizedBytes = settings.quantizeDistance ? sizeof(short) : 0;
+    const double voxelBytes = std::max(1.0 + sizeof(float), sizeof(float) + normalBytes + quantizedBytes);
+    return (bytes + numVoxels * voxelBytes) / megabyte;
+}
+
+// Fit the s-rep of one subject. Each subject gets its own scene and its own temporary folder,
+// so that concurrent subjects never share the forward flow files.
+// groupMap is the distance map of the group of the subject, nullptr if it has none.
+void ProcessSubject(const BatchSubject &subject, const std::string &outputDir,
+                    std::shared_ptr<const vtkMultiLabelDistanceMap> groupMap, BatchResult *result)
+{
+    const BatchSettings &settings = subject.settings;
+    const std::string subjectDir = outputDir + "/" + subject.id;
+    const std::string tempDir = subjectDir + "/temp";
+    if(!vtksys::SystemTools::MakeDirectory(tempDir))
+    {
+        result->status = "cannot create " + tempDir;
+        return;
+    }
+    if(!vtksys::SystemTools::FileExists(subject.meshFile, true))
+    {
+        result->status = "missing mesh";
+        return;
+    }
+
+    vtkSmartPointer<vtkMRMLScene> scene = vtkSmartPointer<vtkMRMLScene>::New();
+    vtkSmartPointer<vtkSlicerApplicationLogic> appLogic = vtkSmartPointer<vtkSlicerApplicationLogic>::New();
+    appLogic->SetMRMLScene(scene);
+    appLogic->SetTemporaryPath(tempDir.c_str());
+
+    // 1. forward flow, s-rep of the fitted ellipsoid and backward flow
+    std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+    vtkSmartPointer<vtkSlicerSkeletalRepresentationInitializerLogic> initializer =
+        vtkSmartPointer<vtkSlicerSkeletalRepresentationInitializerLogic>::New();
+    initializer->SetMRMLApplicationLogic(appLogic);
+    initializer->SetMRMLScene(scene);
+    initializer->SetOutputPath(subjectDir);
+    initializer->SetRows(settings.rows);
+    initializer->SetCols(settings.cols);
+    initializer->FlowSurfaceMesh(subject.meshFile, settings.dt, settings.smooth,
+                                 settings.flowIter, std::max(1, settings.flowOutputFreq));
+    result->forwardSteps = initializer->GetForwardCount();
+    if(result->forwardSteps <= 0)
+    {
+        result->status = "forward flow failed";
+        return;
+    }
+    initializer->BackwardFlow(result->forwardSteps);
+    result->initSeconds = SecondsSince(start);
+    const std::string initialHeader = subjectDir + "/header.xml";
+    if(!vtksys::SystemTools::FileExists(initialHeader, true))
+    {
+        result->status = "backward flow failed";
+        return;
+    }
+
+    // 2. refinement against the input mesh
+    start = std::chrono::steady_clock::now();
+    vtkSmartPointer<vtkSlicerSkeletalRepresentationRefinerLogic> refiner =
+        vtkSmartPointer<vtkSlicerSkeletalRepresentationRefinerLogic>::New();
+    refiner->SetMRMLApplicationLogic(appLogic);
+    refiner->SetMRMLScene(scene);
+    refiner->SetSrepFileName(initialHeader);
+    refiner->SetOutputPath(subjectDir);
+    refiner->SetWeights(settings.wtImageMatch, settings.wtNormal, settings.wtSrad);
+    refiner->SetSinglePrecision(settings.singlePrecision != 0);
+    refiner->SetVoxelSpacing(settings.voxelSpacing);
+    refiner->SetGridMargin(settings.gridMargin);
+    refiner->SetNarrowBand(settings.narrowBand);
+    refiner->SetExactMeshDistance(settings.exactDistance != 0);
+    refiner->SetNormalMode(settings.normalMode);
+    refiner->SetQuantizedDistanceMap(settings.quantizeDistance != 0);
+    refiner->SetBrickedDistanceMaps(settings.brickDistanceMaps != 0);
+    refiner->SetDistanceInterpolation(settings.interpolation);
+    if(groupMap)
+    {
+        refiner->SetSharedDistanceMap(groupMap, groupMap->FindObject(subject.meshFile));
+    }
+    else if(settings.cacheDistanceMaps)
+    {
+        refiner->SetDistanceMapCacheDirectory(outputDir + "/distanceMaps");
+        // file-backed pages can be dropped under memory pressure instead of swapped
+        refiner->SetMemoryMappedDistanceMaps(true);
+    }
+    // selecting the mesh starts its distance map, so the settings of the map go first
+    refiner->SetImageFileName(subject.meshFile);
+    refiner->Refine(settings.stepSize, settings.endCriterion, settings.refineIter, settings.interpolationLevel);
+    result->refineSeconds = SecondsSince(start);
+    result->header = subjectDir + "/refined_header.xml";
+    if(!vtksys::SystemTools::FileExists(result->header, true))
+    {
+        result->status = "refinement failed";
+        result->header = initialHeader;
+        return;
+    }
+
+    if(!settings.keepTemporary)
+    {
+        vtksys::SystemTools::RemoveADirectory(tempDir);
+    }
+    result->status = "ok";
+}
+
+bool WriteSummary(const std::string &fileName, const std::vector<BatchSubject> &subjects,
+                  const std::vector<BatchResult> &results)
+{
+    std::ofstream out(fileName);
+    if(!out)
+    {
+        std::cerr << "Cannot write summary " << fileName << std::endl;
+        return false;
+    }
+    out << "subject,mesh,status,forwardSteps,initSeconds,refineSeconds,header" << std::endl;
+    for(size_t i = 0; i < subjects.size(); ++i)
+    {
+        out << subjects[i].id << "," << subjects[i].meshFile << "," << results[i].status << ","
+            << results[i].forwardSteps << "," << results[i].initSeconds << ","
+            << results[i].refineSeconds << "," << results[i].header << std::endl;
+    }
+    return true;
+}
+
+} // end of anonymous namespace
+
+int main(int argc, char *argv[])
+{
+    if(argc < 3)
+    {
+        std::cerr << "Usage: " << argv[0] << " <manifest> <outputDir> [numThreads] [memoryBudgetMB]" << std::endl;
+        return EXIT_FAILURE;
+    }
+    const std::string manifest(argv[1]);
+    const std::string outputDir(argv[2]);
+    const int numThreads = argc > 3 ? atoi(argv[3]) : 0;
+    const double memoryBudget = argc > 4 ? atof(argv[4]) : 0;
+
+    std::vector<BatchSubject> subjects;
+    if(!ReadManifest(manifest, subjects))
+    {
+        return EXIT_FAILURE;
+    }
+    if(subjects.empty())
+    {
+        std::cerr << "No subject in manifest " << manifest << std::endl;
+        return EXIT_FAILURE;
+    }
+    if(!vtksys::SystemTools::MakeDirectory(outputDir))
+    {
+        std::cerr << "Cannot create output folder " << outputDir << std::endl;
+        return EXIT_FAILURE;
+    }
+
+    // Deal the largest meshes first, so that long subjects do not end up last on one worker.
+    std::vector<size_t> order(subjects.size());
+    std::vector<unsigned long> meshSizes(subjects.size());
+    for(size_t i = 0; i < subjects.size(); ++i)
+    {
+        order[i] = i;
+        meshSizes[i] = vtksys::SystemTools::FileLength(subjects[i].meshFile);
+    }
+    std::stable_sort(order.begin(), order.end(), [&](size_t a, size_t b) {
+        return meshSizes[a] > meshSizes[b];
+    });
+
+    // One distance map per group from the meshes of all its subjects, on the grid of its first subject.
+    // The maps are narrow band, the margin of the grid is the band if there is none.
+    std::map<int, std::vector<size_t> > groups;
+    for(size_t i = 0; i < subjects.size(); ++i)
+    {
+        if(subjects[i].settings.group != 0)
+        {
+            groups[subjects[i].settings.group].push_back(i);
+        }
+    }
+    std::vector<BatchResult> results(subjects.size());
+    std::vector<std::shared_ptr<const vtkMultiLabelDistanceMap> > groupMaps(subjects.size());
+    for(std::map<int, std::vector<size_t> >::const_iterator it = groups.begin(); it != groups.end(); ++it)
+    {
+        const std::vector<size_t> &members = it->second;
+        std::vector<std::string> meshFiles;
+        for(size_t k = 0; k < members.size(); ++k)
+        {
+            if(std::find(meshFiles.begin(), meshFiles.end(), subjects[members[k]].meshFile) == meshFiles.end())
+            {
+                meshFiles.push_back(subjects[members[k]].meshFile);
+            }
+        }
+        const BatchSettings &settings = subjects[members[0]].settings;
+        const double band = settings.narrowBand > 0 ? settings.narrowBand : settings.gridMargin;
+        std::shared_ptr<vtkMultiLabelDistanceMap> map = std::make_shared<vtkMultiLabelDistanceMap>();
+        map->SetInterpolation(static_cast<vtkImageDistanceSampler::Interpolation>(settings.interpolation));
+        const bool built = map->Build(meshFiles, settings.voxelSpacing, band);
+        for(size_t k = 0; k < members.size(); ++k)
+        {
+            if(built)
+            {
+                groupMaps[members[k]] = map;
+            }
+            else
+            {
+                results[members[k]].status = "group distance map failed";
+            }
+        }
+    }
+
+    std::mutex logLock;
+    vtkWorkStealingPool pool(numThreads, static_cast<size_t>(memoryBudget));
+    for(size_t k = 0; k < order.size(); ++k)
+    {
+        const size_t i = order[k];
+        if(subjects[i].settings.group != 0 && !groupMaps[i])
+        {
+            continue;
+        }
+        pool.AddJob([&, i]() {
+            std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+            // one failing subject must not end the run of the others
+            try
+            {
+                ProcessSubject(subjects[i], outputDir, groupMaps[i], &results[i]);
+            }
+            catch(const std::exception &e)
+            {
+                results[i].status = std::string("failed: ") + e.what();
+            }
+            std::lock_guard<std::mutex> guard(logLock);
+            std::cout << "Subject " << subjects[i].id << ": " << results[i].status
+                      << " (" << SecondsSince(start) << " s)" << std::endl;
+        }, static_cast<size_t>(ceil(EstimateMemory(subjects[i], groupMaps[i] != nullptr))));
+    }
+    std::cout << "Fitting " << subjects.size() << " subjects on "
+              << pool.GetNumberOfThreads() << " threads." << std::endl;
+    pool.Run();
+
+    const std::string summaryFile = outputDir + "/summary.csv";
+    if(!WriteSummary(summaryFile, subjects, results))
+    {
+        return EXIT_FAILURE;
+    }
+    std::cout << "Summary written to " << summaryFile << std::endl;
+
+    int numFailed = 0;
+    for(size_t i = 0; i < results.size(); ++i)
+    {
+        if(results[i].status != "ok")
+        {
+            ++numFailed;
+        }
+    }
+    return numFailed == 0 ? EXIT_SUCCESS : EXIT_FAILURE;
+}
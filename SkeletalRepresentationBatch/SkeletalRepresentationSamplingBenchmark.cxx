@@ -0,0 +1,325 @@
+/*==============================================================================
+
+  Program: 3D Slicer
+
+  Portions (c) Copyright Brigham and Women's Hospital (BWH) All Rights Reserved.
+
+  See COPYRIGHT.txt
+  or http://www.slicer.org/copyright/copyright.txt for details.
+
+  Unless required by applicable law or agreed to in writing, software
+  distributed under the License is distributed on an "AS IS" BASIS,
+  WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+  See the License for the specific language governing permissions and
+  limitations under the License.
+
+==============================================================================*/
+
+
+
+// Accuracy of the distance map against its voxel spacing.
+// Builds the dense distance map of a mesh at each spacing and compares the distances and normals
+// sampled by each interpolation with the exact distance to the mesh near its surface.
+// Usage: SkeletalRepresentationSamplingBenchmark <mesh> [spacing ...] [--fit <srep> <outputDir>]
+//
+// The spacings default to 0.005 (the refiner's default), 0.0075, 0.01, 0.015 and 0.02.
+// One tab separated row per spacing and interpolation is printed.
+// With --fit the s-rep (a header.xml or a .srep container) is also refined against the mesh at each
+// spacing with each interpolation, in <outputDir>/<spacing>_<interpolation>. Another table then gives
+// the exact distance of the refined spoke tips to the mesh, in the units of the mesh, and the refinement time.
+
+#include "vtkDistanceSampler.h"
+#include "vtkGradientDistanceFilter.h"
+#include "vtkMeshDistanceOracle.h"
+#include "vtkPolyData2ImageData.h"
+#include "vtkSignedDistanceTransform.h"
+#include "vtkSlicerSkeletalRepresentationRefinerLogic.h"
+#include "vtkSrepFile.h"
+#include "vtkSurfaceMeshReader.h"
+
+// Slicer includes
+#include <vtkSlicerApplicationLogic.h>
+
+// MRML includes
+#include <vtkMRMLScene.h>
+
+// VTK includes
+#include <vtkImageData.h>
+#include <vtkMath.h>
+#include <vtkPolyData.h>
+#include <vtkSmartPointer.h>
+#include <vtksys/SystemTools.hxx>
+
+// STD includes
+#include <algorithm>
+#include <chrono>
+#include <cstdlib>
+#include <cstring>
+#include <iostream>
+#include <math.h>
+#include <random>
+#include <sstream>
+#include <string>
+#include <vector>
+
+namespace
+{
+
+typedef vtkSlicerSkeletalRepresentationRefinerLogic::RealImage RealImage;
+typedef vtkSlicerSkeletalRepresentationRefinerLogic::VectorImage VectorImage;
+
+const char *interpolationNames[3] = {"nearest", "trilinear", "tricubic"};
+
+double SecondsSince(const std::chrono::steady_clock::time_point &start)
+{
+    return std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+}
+
+// Build the exact distance to the triangles of mesh. Return false if it has none
+bool BuildOracle(vtkPolyData *mesh, vtkMeshDistanceOracle *oracle, std::vector<float> *points)
+{
+    std::vector<int> ids;
+    vtkPolyData2ImageData::ExtractTriangles(mesh, *points, ids);
+    if(ids.empty())
+    {
+        return false;
+    }
+    oracle->Build(points->data(), points->size() / 3, ids.data(), ids.size() / 3);
+    return true;
+}
+
+// Print the error of the distances and normals sampled from distance maps of each spacing against
+// the exact distance to the mesh, at numPoints points within band of the surface in the unit cube
+bool BenchmarkSampling(vtkPolyData *mesh, const std::vector<double> &spacings, double band, int numPoints)
+{
+    // the exact distance is the reference
+    vtkPolyData2ImageData polyDataConverter;
+    vtkSmartPointer<vtkPolyData> unitCubeMesh = vtkSmartPointer<vtkPolyData>::New();
+    polyDataConverter.TransformToUnitCube(mesh, unitCubeMesh);
+    vtkMeshDistanceOracle oracle;
+    std::vector<float> meshPoints;
+    if(!BuildOracle(unitCubeMesh, &oracle, &meshPoints))
+    {
+        return false;
+    }
+
+    // random points within band of the surface: mesh vertices moved along random directions
+    std::mt19937 generator(12345);
+    std::uniform_int_distribution<size_t> pickVertex(0, meshPoints.size() / 3 - 1);
+    std::uniform_real_distribution<double> uniform(-1.0, 1.0);
+    std::vector<double> samples(3 * static_cast<size_t>(numPoints)), exactDist(numPoints),
+            exactNormals(3 * static_cast<size_t>(numPoints));
+    for(int i = 0; i < numPoints; ++i)
+    {
+        const float *vertex = &meshPoints[3 * pickVertex(generator)];
+        double dir[3] = {uniform(generator), uniform(generator), uniform(generator)};
+        double norm = sqrt(dir[0] * dir[0] + dir[1] * dir[1] + dir[2] * dir[2]);
+        double offset = band * uniform(generator) / std::max(norm, 1e-12);
+        double *point = &samples[3 * i];
+        for(int k = 0; k < 3; ++k)
+        {
+            point[k] = vertex[k] + offset * dir[k];
+        }
+        exactDist[i] = oracle.Sample(point, &exactNormals[3 * i]);
+    }
+
+    std::cout << "spacing	MB	build s	interpolation	mean error	max error	mean angle (deg)	ns/sample"
+              << std::endl;
+    for(size_t s = 0; s < spacings.size(); ++s)
+    {
+        auto start = std::chrono::steady_clock::now();
+        polyDataConverter.SetVoxelSpacing(spacings[s]);
+        vtkSmartPointer<vtkImageData> img = vtkSmartPointer<vtkImageData>::New();
+        polyDataConverter.Convert(mesh, img, nullptr);
+        RealImage::Pointer dist = RealImage::New();
+        VectorImage::Pointer grad = VectorImage::New();
+        vtkSignedDistanceTransform ssdGenerator;
+        if(!ssdGenerator.Convert(img, dist))
+        {
+            continue;
+        }
+        img = nullptr;
+        vtkGradientDistanceFilter gradDistFilter;
+        gradDistFilter.Filter(dist, grad);
+        const double buildSeconds = SecondsSince(start);
+
+        RealImage::SizeType size = dist->GetBufferedRegion().GetSize();
+        const int dims[3] = {static_cast<int>(size[0]), static_cast<int>(size[1]), static_cast<int>(size[2])};
+        const double origin[3] = {dist->GetOrigin()[0], dist->GetOrigin()[1], dist->GetOrigin()[2]};
+        const double megaBytes = 16.0 * dist->GetBufferedRegion().GetNumberOfPixels() / (1024 * 1024);
+        vtkImageDistanceSampler sampler;
+        sampler.SetVolumes(dist->GetBufferPointer(), reinterpret_cast<const float*>(grad->GetBufferPointer()),
+                           dims, origin, spacings[s]);
+        for(int interpolation = vtkImageDistanceSampler::Nearest;
+            interpolation <= vtkImageDistanceSampler::TricubicBSpline; ++interpolation)
+        {
+            sampler.SetInterpolation(static_cast<vtkImageDistanceSampler::Interpolation>(interpolation));
+            double sumError = 0.0, maxError = 0.0, sumAngle = 0.0;
+            start = std::chrono::steady_clock::now();
+            for(int i = 0; i < numPoints; ++i)
+            {
+                double normal[3];
+                double error = fabs(sampler.Sample(&samples[3 * i], normal) - exactDist[i]);
+                sumError += error;
+                maxError = std::max(maxError, error);
+                double norm = sqrt(normal[0] * normal[0] + normal[1] * normal[1] + normal[2] * normal[2]);
+                const double *exactNormal = &exactNormals[3 * i];
+                double cosAngle = norm > 0 ? (normal[0] * exactNormal[0] + normal[1] * exactNormal[1]
+                                              + normal[2] * exactNormal[2]) / norm : -1.0;
+                sumAngle += acos(std::max(-1.0, std::min(1.0, cosAngle))) * 180.0 / vtkMath::Pi();
+            }
+            const double sampleSeconds = SecondsSince(start);
+            std::cout << spacings[s] << "\t" << megaBytes << "\t" << buildSeconds << "\t"
+                      << interpolationNames[interpolation] << "\t" << sumError / numPoints << "\t" << maxError
+                      << "\t" << sumAngle / numPoints << "\t" << 1e9 * sampleSeconds / numPoints << std::endl;
+        }
+    }
+    return true;
+}
+
+// the header Refine writes into outputDir for srepFileName
+std::string RefinedHeaderFileName(const std::string &srepFileName, const std::string &outputDir)
+{
+    if(vtkSrepFile::IsSrepFile(srepFileName))
+    {
+        return outputDir + "/refined_" + vtksys::SystemTools::GetFilenameWithoutLastExtension(srepFileName) + ".xml";
+    }
+    return outputDir + "/refined_" + vtksys::SystemTools::GetFilenameName(srepFileName);
+}
+
+// Refine the s-rep against the mesh at each spacing with each interpolation and print how close the tips of
+// the refined up, down and crest spokes are to the mesh
+bool CompareFits(const std::string &meshFileName, vtkPolyData *mesh, const std::string &srepFileName,
+                 const std::string &outputDir, const std::vector<double> &spacings)
+{
+    // the s-rep is fitted in the coordinates of the mesh
+    vtkMeshDistanceOracle oracle;
+    std::vector<float> meshPoints;
+    if(!BuildOracle(mesh, &oracle, &meshPoints))
+    {
+        return false;
+    }
+
+    std::cout << "spacing	interpolation	refine s	spokes	mean |distance|	max |distance|" << std::endl;
+    for(size_t s = 0; s < spacings.size(); ++s)
+    {
+        for(int interpolation = vtkImageDistanceSampler::Nearest;
+            interpolation <= vtkImageDistanceSampler::TricubicBSpline; ++interpolation)
+        {
+            std::stringstream runName;
+            runName << spacings[s] << "_" << interpolationNames[interpolation];
+            const std::string runDir = outputDir + "/" + runName.str();
+            if(!vtksys::SystemTools::MakeDirectory(runDir))
+            {
+                std::cerr << "Cannot create " << runDir << std::endl;
+                return false;
+            }
+
+            // the settings of the batch tool, the distance map is built again for each run
+            vtkSmartPointer<vtkMRMLScene> scene = vtkSmartPointer<vtkMRMLScene>::New();
+            vtkSmartPointer<vtkSlicerApplicationLogic> appLogic = vtkSmartPointer<vtkSlicerApplicationLogic>::New();
+            appLogic->SetMRMLScene(scene);
+            appLogic->SetTemporaryPath(runDir.c_str());
+            vtkSmartPointer<vtkSlicerSkeletalRepresentationRefinerLogic> refiner =
+                vtkSmartPointer<vtkSlicerSkeletalRepresentationRefinerLogic>::New();
+            refiner->SetMRMLApplicationLogic(appLogic);
+            refiner->SetMRMLScene(scene);
+            refiner->SetSrepFileName(srepFileName);
+            refiner->SetOutputPath(runDir);
+            refiner->SetWeights(0.004, 20, 50);
+            refiner->SetVoxelSpacing(spacings[s]);
+            refiner->SetDistanceInterpolation(interpolation);
+            const auto start = std::chrono::steady_clock::now();
+            refiner->SetImageFileName(meshFileName);
+            refiner->Refine(0.01, 0.001, 2000, 3);
+            const double refineSeconds = SecondsSince(start);
+
+            // the refined sides in one container, to read the spokes without parsing XML
+            const std::string containerFileName = runDir + "/refined.srep";
+            vtkSrepFile refined;
+            if(!refiner->ExportSrepContainer(RefinedHeaderFileName(srepFileName, runDir), containerFileName)
+                    || !refined.Open(containerFileName))
+            {
+                std::cerr << "The refinement at " << runName.str() << " failed." << std::endl;
+                continue;
+            }
+            size_t numSpokes = 0;
+            double sumDistance = 0.0, maxDistance = 0.0;
+            for(int side = vtkSrepFile::Up; side <= vtkSrepFile::Crest; ++side)
+            {
+                const double *points = refined.GetSection(side, vtkSrepFile::SkeletalPoints);
+                const double *dirs = refined.GetSection(side, vtkSrepFile::Directions);
+                const double *radii = refined.GetSection(side, vtkSrepFile::Radii);
+                for(size_t i = 0; i < refined.GetNumberOfSpokes(side); ++i)
+                {
+                    double tip[3], normal[3];
+                    for(int k = 0; k < 3; ++k)
+                    {
+                        tip[k] = points[3 * i + k] + radii[i] * dirs[3 * i + k];
+                    }
+                    const double distance = fabs(oracle.Sample(tip, normal));
+                    sumDistance += distance;
+                    maxDistance = std::max(maxDistance, distance);
+                    ++numSpokes;
+                }
+            }
+            std::cout << spacings[s] << "\t" << interpolationNames[interpolation] << "\t" << refineSeconds << "\t"
+                      << numSpokes << "\t" << sumDistance / std::max<size_t>(numSpokes, 1) << "\t" << maxDistance
+                      << std::endl;
+        }
+    }
+    return true;
+}
+
+} // end of anonymous namespace
+
+int main(int argc, char *argv[])
+{
+    if(argc < 2)
+    {
+        std::cerr << "Usage: " << argv[0] << " <mesh> [spacing ...] [--fit <srep> <outputDir>]" << std::endl;
+        return EXIT_FAILURE;
+    }
+    const std::string meshFile(argv[1]);
+    std::vector<double> spacings;
+    std::string srepFile, outputDir;
+    for(int i = 2; i < argc; ++i)
+    {
+        if(strcmp(argv[i], "--fit") == 0)
+        {
+            if(i + 2 >= argc)
+            {
+                std::cerr << "--fit needs an s-rep and an output directory" << std::endl;
+                return EXIT_FAILURE;
+            }
+            srepFile = argv[i + 1];
+            outputDir = argv[i + 2];
+            i += 2;
+            continue;
+        }
+        double spacing = atof(argv[i]);
+        if(spacing <= 0)
+        {
+            std::cerr << "Invalid spacing " << argv[i] << std::endl;
+            return EXIT_FAILURE;
+        }
+        spacings.push_back(spacing);
+    }
+    if(spacings.empty())
+    {
+        spacings = {0.005, 0.0075, 0.01, 0.015, 0.02};
+    }
+
+    vtkSmartPointer<vtkPolyData> mesh = vtkSurfaceMeshReader::Read(meshFile);
+    // points up to 0.02 from the surface in the unit cube, where the boundary of a fitted s-rep lies
+    if(!BenchmarkSampling(mesh, spacings, 0.02, 100000))
+    {
+        std::cerr << "No triangles in " << meshFile << std::endl;
+        return EXIT_FAILURE;
+    }
+    if(!srepFile.empty() && !CompareFits(meshFile, mesh, srepFile, outputDir, spacings))
+    {
+        return EXIT_FAILURE;
+    }
+    return EXIT_SUCCESS;
+}
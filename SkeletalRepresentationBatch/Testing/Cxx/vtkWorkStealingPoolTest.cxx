@@ -0,0 +1,237 @@
+/*==============================================================================
+
+  Program: 3D Slicer
+
+  Portions (c) Copyright Brigham and Women's Hospital (BWH) All Rights Reserved.
+
+  See COPYRIGHT.txt
+  or http://www.slicer.org/copyright/copyright.txt for details.
+
+  Unless required by applicable law or agreed to in writing, software
+  distributed under the License is distributed on an "AS IS" BASIS,
+  WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+  See the License for the specific language governing permissions and
+  limitations under the License.
+
+==============================================================================*/
+
+
+// Work-stealing pool of the batch tool: every job runs once, a worker blocked on a long job has the rest
+// of its queue stolen, running jobs stay within the memory budget, a job over the budget runs alone, and a
+// job that throws gives its memory back while the others still run.
+// Usage: vtkWorkStealingPoolTest
+
+#include "vtkWorkStealingPool.h"
+
+// STD includes
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cstdlib>
+#include <future>
+#include <iostream>
+#include <mutex>
+#include <stdexcept>
+#include <string>
+#include <thread>
+#include <vector>
+
+namespace
+{
+
+// Run the pool, a run that doesn't finish in time is a deadlock and ends the test
+void RunOrAbort(vtkWorkStealingPool &pool)
+{
+    std::future<void> run = std::async(std::launch::async, [&pool]() { pool.Run(); });
+    if(run.wait_for(std::chrono::seconds(30)) == std::future_status::timeout)
+    {
+        std::cerr << "The pool did not finish its jobs." << std::endl;
+        std::_Exit(EXIT_FAILURE);
+    }
+    run.get();
+}
+
+// memory of the running jobs and its peak
+class MemoryMonitor
+{
+public:
+    void Start(size_t memory)
+    {
+        std::lock_guard<std::mutex> guard(mLock);
+        mInUse += memory;
+        mPeak = std::max(mPeak, mInUse);
+    }
+    void Stop(size_t memory)
+    {
+        std::lock_guard<std::mutex> guard(mLock);
+        mInUse -= memory;
+    }
+    size_t GetPeak() const { return mPeak; }
+
+private:
+    std::mutex mLock;
+    size_t mInUse = 0;
+    size_t mPeak = 0;
+};
+
+bool TestEveryJobOnce()
+{
+    const int numJobs = 500;
+    std::vector<std::atomic<int> > runs(numJobs);
+    for(std::atomic<int> &count : runs)
+    {
+        count = 0;
+    }
+    vtkWorkStealingPool pool(4, 0);
+    for(int i = 0; i < numJobs; ++i)
+    {
+        pool.AddJob([&runs, i]() { ++runs[i]; }, 1);
+    }
+    RunOrAbort(pool);
+    // the pool can run again
+    pool.AddJob([&runs]() { ++runs[0]; }, 1);
+    RunOrAbort(pool);
+    for(int i = 0; i < numJobs; ++i)
+    {
+        if(runs[i] != (i == 0 ? 2 : 1))
+        {
+            std::cerr << "Job " << i << " ran " << runs[i] << " times." << std::endl;
+            return false;
+        }
+    }
+    return pool.GetNumberOfThreads() == 4 && vtkWorkStealingPool(0, 0).GetNumberOfThreads() >= 1;
+}
+
+bool TestStealing()
+{
+    // jobs are dealt round-robin: worker 0 gets jobs 0, 3, 6, ... and job 0 only ends once the others
+    // have run the rest of its queue
+    const int numThreads = 3, numJobs = 30;
+    std::atomic<int> stolen(0);
+    std::atomic<bool> waitedOut(false);
+    vtkWorkStealingPool pool(numThreads, 0);
+    for(int i = 0; i < numJobs; ++i)
+    {
+        if(i == 0)
+        {
+            pool.AddJob([&]()
+            {
+                const auto deadline = std::chrono::steady_clock::now() + std::chrono::seconds(20);
+                while(stolen < numJobs / numThreads - 1)
+                {
+                    if(std::chrono::steady_clock::now() > deadline)
+                    {
+                        waitedOut = true;
+                        return;
+                    }
+                    std::this_thread::sleep_for(std::chrono::milliseconds(1));
+                }
+            }, 1);
+        }
+        else if(i % numThreads == 0)
+        {
+            pool.AddJob([&stolen]() { ++stolen; }, 1);
+        }
+        else
+        {
+            pool.AddJob([]() {}, 1);
+        }
+    }
+    RunOrAbort(pool);
+    if(waitedOut)
+    {
+        std::cerr << "The jobs queued behind a long job were not stolen." << std::endl;
+        return false;
+    }
+    return true;
+}
+
+bool TestMemoryBudget()
+{
+    // four threads, but only two jobs of 4 MB fit into 10 MB
+    MemoryMonitor monitor;
+    vtkWorkStealingPool pool(4, 10);
+    for(int i = 0; i < 40; ++i)
+    {
+        pool.AddJob([&monitor]()
+        {
+            monitor.Start(4);
+            std::this_thread::sleep_for(std::chrono::milliseconds(2));
+            monitor.Stop(4);
+        }, 4);
+    }
+    RunOrAbort(pool);
+    if(monitor.GetPeak() > 10)
+    {
+        std::cerr << "The running jobs took " << monitor.GetPeak() << " MB of a 10 MB budget." << std::endl;
+        return false;
+    }
+
+    // a job over the budget runs alone: it takes the whole budget, any other job running with it exceeds it
+    MemoryMonitor oversized;
+    for(int i = 0; i < 20; ++i)
+    {
+        const size_t memory = i == 7 ? 1000 : 1;
+        pool.AddJob([&oversized, memory]()
+        {
+            oversized.Start(std::min<size_t>(memory, 10));
+            std::this_thread::sleep_for(std::chrono::milliseconds(2));
+            oversized.Stop(std::min<size_t>(memory, 10));
+        }, memory);
+    }
+    RunOrAbort(pool);
+    if(oversized.GetPeak() > 10)
+    {
+        std::cerr << "A job over the memory budget did not run alone." << std::endl;
+        return false;
+    }
+    return true;
+}
+
+bool TestFailingJob()
+{
+    std::atomic<int> finished(0);
+    vtkWorkStealingPool pool(3, 8);
+    for(int i = 0; i < 12; ++i)
+    {
+        if(i == 5)
+        {
+            pool.AddJob([]() { throw std::runtime_error("subject 5 failed"); }, 8);
+        }
+        else
+        {
+            pool.AddJob([&finished]() { ++finished; }, 3);
+        }
+    }
+    try
+    {
+        RunOrAbort(pool);
+        std::cerr << "The failure of a job was not reported." << std::endl;
+        return false;
+    }
+    catch(const std::runtime_error &error)
+    {
+        if(std::string(error.what()) != "subject 5 failed")
+        {
+            std::cerr << "The pool reported " << error.what() << std::endl;
+            return false;
+        }
+    }
+    if(finished != 11)
+    {
+        std::cerr << finished << " of the 11 other jobs finished." << std::endl;
+        return false;
+    }
+    // memory kept by the failed job would stall a job of the whole budget
+    pool.AddJob([&finished]() { ++finished; }, 8);
+    RunOrAbort(pool);
+    return finished == 12;
+}
+
+} // end of anonymous namespace
+
+int vtkWorkStealingPoolTest(int, char*[])
+{
+    return TestEveryJobOnce() && TestStealing() && TestMemoryBudget() && TestFailingJob()
+           ? EXIT_SUCCESS : EXIT_FAILURE;
+}
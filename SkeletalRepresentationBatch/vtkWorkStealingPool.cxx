@@ -0,0 +1,151 @@
+/*==============================================================================
+
+  Program: 3D Slicer
+
+  Portions (c) Copyright Brigham and Women's Hospital (BWH) All Rights Reserved.
+
+  See COPYRIGHT.txt
+  or http://www.slicer.org/copyright/copyright.txt for details.
+
+  Unless required by applicable law or agreed to in writing, software
+  distributed under the License is distributed on an "AS IS" BASIS,
+  WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+  See the License for the specific language governing permissions and
+  limitations under the License.
+
+==============================================================================*/
+
+
+#include "vtkWorkStealingPool.h"
+
+#include <algorithm>
+#include <thread>
+
+vtkWorkStealingPool::vtkWorkStealingPool(int numThreads, size_t memoryBudget)
+    : mMemoryBudget(memoryBudget)
+{
+    if(numThreads <= 0)
+    {
+        numThreads = std::max(1, static_cast<int>(std::thread::hardware_concurrency()));
+    }
+    for(int i = 0; i < numThreads; ++i)
+    {
+        mQueues.push_back(std::unique_ptr<Queue>(new Queue));
+    }
+}
+
+void vtkWorkStealingPool::AddJob(const Job &job, size_t memoryEstimate)
+{
+    if(mMemoryBudget > 0)
+    {
+        memoryEstimate = std::min(memoryEstimate, mMemoryBudget);
+    }
+    Task task;
+    task.job = job;
+    task.memory = memoryEstimate;
+    mQueues[mNextQueue]->tasks.push_back(task);
+    mNextQueue = (mNextQueue + 1) % mQueues.size();
+}
+
+void vtkWorkStealingPool::Run()
+{
+    std::vector<std::thread> workers;
+    for(size_t i = 0; i < mQueues.size(); ++i)
+    {
+        workers.push_back(std::thread(&vtkWorkStealingPool::Work, this, static_cast<int>(i)));
+    }
+    for(size_t i = 0; i < workers.size(); ++i)
+    {
+        workers[i].join();
+    }
+    mNextQueue = 0;
+    if(mFailure)
+    {
+        std::exception_ptr failure = mFailure;
+        mFailure = nullptr;
+        std::rethrow_exception(failure);
+    }
+}
+
+int vtkWorkStealingPool::GetNumberOfThreads() const
+{
+    return static_cast<int>(mQueues.size());
+}
+
+void vtkWorkStealingPool::Work(int worker)
+{
+    Task task;
+    // No job is added while running, so once every queue is empty the worker is done.
+    while(PopOrSteal(worker, &task))
+    {
+        AcquireMemory(task.memory);
+        try
+        {
+            task.job();
+        }
+        catch(...)
+        {
+            // keep the first failure for Run, the other jobs still run
+            std::lock_guard<std::mutex> guard(mMemoryLock);
+            if(!mFailure)
+            {
+                mFailure = std::current_exception();
+            }
+        }
+        ReleaseMemory(task.memory);
+    }
+}
+
+bool vtkWorkStealingPool::PopOrSteal(int worker, Task *task)
+{
+    {
+        Queue &own = *mQueues[worker];
+        std::lock_guard<std::mutex> guard(own.lock);
+        if(!own.tasks.empty())
+        {
+            *task = own.tasks.front();
+            own.tasks.pop_front();
+            return true;
+        }
+    }
+    const size_t n = mQueues.size();
+    for(size_t k = 1; k < n; ++k)
+    {
+        Queue &victim = *mQueues[(worker + k) % n];
+        std::lock_guard<std::mutex> guard(victim.lock);
+        if(!victim.tasks.empty())
+        {
+            *task = victim.tasks.back();
+            victim.tasks.pop_back();
+            return true;
+        }
+    }
+    return false;
+}
+
+void vtkWorkStealingPool::AcquireMemory(size_t memory)
+{
+    if(mMemoryBudget == 0)
+    {
+        return;
+    }
+    std::unique_lock<std::mutex> guard(mMemoryLock);
+    // An idle pool always admits the job, so an oversized estimate cannot stall the run.
+    mMemoryReleased.wait(guard, [&]() {
+        return mMemoryInUse == 0 || mMemoryInUse + memory <= mMemoryBudget;
+    });
+    mMemoryInUse += memory;
+}
+
+void vtkWorkStealingPool::ReleaseMemory(size_t memory)
+{
+    if(mMemoryBudget == 0)
+    {
+        return;
+    }
+    {
+        std::lock_guard<std::mutex> guard(mMemoryLock);
+        mMemoryInUse -= memory;
+    }
+    mMemoryReleased.notify_all();
+}
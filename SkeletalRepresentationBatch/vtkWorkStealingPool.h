@@ -0,0 +1,85 @@
+/*==============================================================================
+
+  Program: 3D Slicer
+
+  Portions (c) Copyright Brigham and Women's Hospital (BWH) All Rights Reserved.
+
+  See COPYRIGHT.txt
+  or http://www.slicer.org/copyright/copyright.txt for details.
+
+  Unless required by applicable law or agreed to in writing, software
+  distributed under the License is distributed on an "AS IS" BASIS,
+  WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+  See the License for the specific language governing permissions and
+  limitations under the License.
+
+==============================================================================*/
+
+
+#ifndef VTKWORKSTEALINGPOOL_H
+#define VTKWORKSTEALINGPOOL_H
+
+#include <condition_variable>
+#include <cstddef>
+#include <deque>
+#include <exception>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <vector>
+
+/**
+ * @brief The vtkWorkStealingPool class
+ * Runs a fixed set of jobs on worker threads. Each worker owns a queue, takes jobs from its front
+ * and steals from the back of the other queues once its own queue runs dry.
+ * A job is only started when its memory estimate fits into the memory budget together with
+ * the jobs that are already running, so a large cohort does not exhaust the machine.
+ */
+class vtkWorkStealingPool
+{
+public:
+    typedef std::function<void()> Job;
+
+    // Input: numThreads is the number of workers, 0 means one per hardware thread
+    // Input: memoryBudget is the total memory (MB) available to running jobs, 0 means unlimited
+    vtkWorkStealingPool(int numThreads, size_t memoryBudget);
+
+    // Queue a job before Run. Jobs are dealt round-robin to the workers in the order they are added.
+    // Input: memoryEstimate is the peak memory (MB) of the job.
+    // A job larger than the whole budget is clamped to it, i.e. it runs alone.
+    void AddJob(const Job &job, size_t memoryEstimate);
+
+    // Run all queued jobs and return when every one has finished. A job that throws gives its
+    // memory back and the other jobs still run, Run then rethrows the first exception
+    void Run();
+
+    int GetNumberOfThreads() const;
+
+private:
+    struct Task
+    {
+        Job job;
+        size_t memory;
+    };
+    struct Queue
+    {
+        std::mutex lock;
+        std::deque<Task> tasks;
+    };
+
+    void Work(int worker);
+    bool PopOrSteal(int worker, Task *task);
+    void AcquireMemory(size_t memory);
+    void ReleaseMemory(size_t memory);
+
+private:
+    std::vector<std::unique_ptr<Queue> > mQueues;
+    size_t mNextQueue = 0;
+    size_t mMemoryBudget = 0;
+    size_t mMemoryInUse = 0;
+    std::mutex mMemoryLock;
+    std::condition_variable mMemoryReleased;
+    std::exception_ptr mFailure;
+};
+
+#endif // VTKWORKSTEALINGPOOL_H
@@ -0,0 +1,323 @@
+/*==============================================================================
+
+  Program: 3D Slicer
+
+  Portions (c) Copyright Brigham and Women's Hospital (BWH) All Rights Reserved.
+
+  See COPYRIGHT.txt
+  or http://www.slicer.org/copyright/copyright.txt for details.
+
+  Unless required by applicable law or agreed to in writing, software
+  distributed under the License is distributed on an "AS IS" BASIS,
+  WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+  See the License for the specific language governing permissions and
+  limitations under the License.
+
+==============================================================================*/
+
+
+// The parsers of vtkSurfaceMeshReader against the VTK readers: the legacy file of the test data,
+// a legacy file of double coordinates with every significant digit and a binary STL file
+// with corners at -0 and +0 have to give the same points and polygons bit for bit.
+// Usage: vtkSurfaceMeshReaderTest <legacyMeshFile> <temporaryDirectory>
+
+#include "vtkSurfaceMeshReader.h"
+
+// VTK includes
+#include <vtkCellArray.h>
+#include <vtkIdList.h>
+#include <vtkPoints.h>
+#include <vtkPolyData.h>
+#include <vtkPolyDataReader.h>
+#include <vtkSTLReader.h>
+#include <vtkSmartPointer.h>
+
+// STD includes
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <fstream>
+#include <iostream>
+#include <iterator>
+#include <random>
+#include <stdint.h>
+#include <string>
+#include <vector>
+
+namespace
+{
+
+bool ReadBytes(const std::string &fileName, std::vector<char> *bytes)
+{
+    std::ifstream in(fileName.c_str(), std::ios::binary);
+    if(!in)
+    {
+        std::cerr << "Can't open " << fileName << std::endl;
+        return false;
+    }
+    bytes->assign(std::istreambuf_iterator<char>(in), std::istreambuf_iterator<char>());
+    return true;
+}
+
+bool WriteBytes(const std::string &fileName, const std::vector<char> &bytes)
+{
+    std::ofstream out(fileName.c_str(), std::ios::binary);
+    out.write(bytes.data(), static_cast<std::streamsize>(bytes.size()));
+    if(!out)
+    {
+        std::cerr << "Can't write " << fileName << std::endl;
+        return false;
+    }
+    return true;
+}
+
+// same coordinates to the bit, -0 and +0 differ
+bool SamePoints(vtkPolyData *expected, vtkPolyData *actual, const std::string &what)
+{
+    if(actual->GetNumberOfPoints() != expected->GetNumberOfPoints())
+    {
+        std::cerr << what << ": " << actual->GetNumberOfPoints() << " points, the VTK reader has "
+                  << expected->GetNumberOfPoints() << "." << std::endl;
+        return false;
+    }
+    if(actual->GetNumberOfPoints() > 0 && actual->GetPoints()->GetDataType() != expected->GetPoints()->GetDataType())
+    {
+        std::cerr << what << ": the points have another type than those of the VTK reader." << std::endl;
+        return false;
+    }
+    for(vtkIdType i = 0; i < expected->GetNumberOfPoints(); ++i)
+    {
+        double a[3], b[3];
+        expected->GetPoint(i, a);
+        actual->GetPoint(i, b);
+        if(memcmp(a, b, sizeof(a)) != 0)
+        {
+            std::cerr.precision(17);
+            std::cerr << what << ": point " << i << " is " << b[0] << " " << b[1] << " " << b[2]
+                      << ", the VTK reader has " << a[0] << " " << a[1] << " " << a[2] << "." << std::endl;
+            return false;
+        }
+    }
+    return true;
+}
+
+bool SamePolys(vtkPolyData *expected, vtkPolyData *actual, const std::string &what)
+{
+    if(actual->GetNumberOfPolys() != expected->GetNumberOfPolys())
+    {
+        std::cerr << what << ": " << actual->GetNumberOfPolys() << " polygons, the VTK reader has "
+                  << expected->GetNumberOfPolys() << "." << std::endl;
+        return false;
+    }
+    vtkSmartPointer<vtkIdList> a = vtkSmartPointer<vtkIdList>::New();
+    vtkSmartPointer<vtkIdList> b = vtkSmartPointer<vtkIdList>::New();
+    for(vtkIdType i = 0; i < expected->GetNumberOfPolys(); ++i)
+    {
+        expected->GetCellPoints(i, a);
+        actual->GetCellPoints(i, b);
+        bool same = a->GetNumberOfIds() == b->GetNumberOfIds();
+        for(vtkIdType k = 0; same && k < a->GetNumberOfIds(); ++k)
+        {
+            same = a->GetId(k) == b->GetId(k);
+        }
+        if(!same)
+        {
+            std::cerr << what << ": polygon " << i << " has other points than in the VTK reader." << std::endl;
+            return false;
+        }
+    }
+    return true;
+}
+
+bool CompareLegacy(const std::string &fileName, const std::string &what)
+{
+    vtkSmartPointer<vtkPolyDataReader> reader = vtkSmartPointer<vtkPolyDataReader>::New();
+    reader->SetFileName(fileName.c_str());
+    reader->Update();
+    std::vector<char> bytes;
+    if(!ReadBytes(fileName, &bytes))
+    {
+        return false;
+    }
+    // one thread and several, the numbers are split between the threads at whitespace
+    for(unsigned int numThreads = 1; numThreads <= 4; numThreads += 3)
+    {
+        vtkSmartPointer<vtkPolyData> mesh = vtkSmartPointer<vtkPolyData>::New();
+        if(!vtkSurfaceMeshReader::ParseLegacy(bytes.data(), bytes.size(), mesh, numThreads))
+        {
+            std::cerr << what << ": the legacy parser rejected " << fileName << "." << std::endl;
+            return false;
+        }
+        if(!SamePoints(reader->GetOutput(), mesh, what) || !SamePolys(reader->GetOutput(), mesh, what))
+        {
+            return false;
+        }
+    }
+    return true;
+}
+
+// The points of the mesh moved by random amounts so that every one takes 17 significant digits,
+// and numbers only the slow path of the parser takes
+bool WriteDoubleLegacy(vtkPolyData *mesh, const std::string &fileName)
+{
+    std::mt19937 random(1);
+    std::uniform_real_distribution<double> shift(-1e-3, 1e-3);
+    std::vector<double> coordinates;
+    for(vtkIdType i = 0; i < mesh->GetNumberOfPoints(); ++i)
+    {
+        double point[3];
+        mesh->GetPoint(i, point);
+        for(int k = 0; k < 3; ++k)
+        {
+            coordinates.push_back(point[k] + shift(random));
+        }
+    }
+    const double extremes[] = {-0.0, 0.0, 1e-300, -1.7976931348623157e308, 123456789012345678901234.0,
+                               0.1, 3.0000000000000004, 1e22, 9007199254740993.0};
+    coordinates.insert(coordinates.end(), extremes, extremes + sizeof(extremes) / sizeof(extremes[0]));
+
+    std::string text = "# vtk DataFile Version 3.0\nvtk output\nASCII\nDATASET POLYDATA\nPOINTS "
+            + std::to_string(coordinates.size() / 3) + " double\n";
+    char number[32];
+    for(size_t i = 0; i < coordinates.size(); ++i)
+    {
+        snprintf(number, sizeof(number), i % 3 == 2 ? "%.17g\n" : "%.17g ", coordinates[i]);
+        text += number;
+    }
+    text += "POLYGONS " + std::to_string(mesh->GetNumberOfPolys()) + " "
+            + std::to_string(4 * mesh->GetNumberOfPolys()) + "\n";
+    vtkSmartPointer<vtkIdList> ids = vtkSmartPointer<vtkIdList>::New();
+    for(vtkIdType i = 0; i < mesh->GetNumberOfPolys(); ++i)
+    {
+        mesh->GetCellPoints(i, ids);
+        text += std::to_string(ids->GetNumberOfIds());
+        for(vtkIdType k = 0; k < ids->GetNumberOfIds(); ++k)
+        {
+            text += " " + std::to_string(ids->GetId(k));
+        }
+        text += "\n";
+    }
+    return WriteBytes(fileName, std::vector<char>(text.begin(), text.end()));
+}
+
+void AppendLittleEndian(uint32_t value, std::vector<char> *bytes)
+{
+    for(int b = 0; b < 4; ++b)
+    {
+        bytes->push_back(static_cast<char>((value >> (8 * b)) & 0xFF));
+    }
+}
+
+void AppendTriangle(const float corners[3][3], std::vector<char> *bytes)
+{
+    // the normal is not read
+    for(int k = 0; k < 3; ++k)
+    {
+        AppendLittleEndian(0, bytes);
+    }
+    for(int c = 0; c < 3; ++c)
+    {
+        for(int k = 0; k < 3; ++k)
+        {
+            uint32_t bits;
+            memcpy(&bits, &corners[c][k], sizeof(bits));
+            AppendLittleEndian(bits, bytes);
+        }
+    }
+    bytes->push_back(0);
+    bytes->push_back(0);
+}
+
+// The triangles of the mesh, then two sharing a corner at +0 and -0 and one collapsed by merging
+// a new corner at -0 with one at +0
+std::vector<char> MakeBinaryStl(vtkPolyData *mesh)
+{
+    std::vector<char> bytes(80, 0);
+    const vtkIdType numTriangles = mesh->GetNumberOfPolys() + 3;
+    AppendLittleEndian(static_cast<uint32_t>(numTriangles), &bytes);
+    vtkSmartPointer<vtkIdList> ids = vtkSmartPointer<vtkIdList>::New();
+    for(vtkIdType i = 0; i < mesh->GetNumberOfPolys(); ++i)
+    {
+        mesh->GetCellPoints(i, ids);
+        float corners[3][3];
+        for(int c = 0; c < 3; ++c)
+        {
+            double point[3];
+            mesh->GetPoint(ids->GetId(c), point);
+            for(int k = 0; k < 3; ++k)
+            {
+                corners[c][k] = static_cast<float>(point[k]);
+            }
+        }
+        AppendTriangle(corners, &bytes);
+    }
+    const float positiveZero[3][3] = {{0.0f, 0.0f, 0.0f}, {1.0f, 0.0f, 0.0f}, {0.0f, 1.0f, 0.0f}};
+    const float negativeZero[3][3] = {{-0.0f, 0.0f, -0.0f}, {0.0f, 0.0f, 1.0f}, {1.0f, 0.0f, 0.0f}};
+    const float collapsed[3][3] = {{2.0f, -0.0f, 0.0f}, {2.0f, 0.0f, 0.0f}, {1.0f, 0.0f, 0.0f}};
+    AppendTriangle(positiveZero, &bytes);
+    AppendTriangle(negativeZero, &bytes);
+    AppendTriangle(collapsed, &bytes);
+    return bytes;
+}
+
+}
+
+int vtkSurfaceMeshReaderTest(int argc, char* argv[])
+{
+    if(argc < 3)
+    {
+        std::cerr << "Usage: " << argv[0] << " <legacyMeshFile> <temporaryDirectory>" << std::endl;
+        return EXIT_FAILURE;
+    }
+    const std::string meshFileName = argv[1];
+    const std::string directory = argv[2];
+
+    // 1. the ASCII float file of the test data
+    if(!CompareLegacy(meshFileName, "float legacy file"))
+    {
+        return EXIT_FAILURE;
+    }
+
+    vtkSmartPointer<vtkPolyDataReader> reader = vtkSmartPointer<vtkPolyDataReader>::New();
+    reader->SetFileName(meshFileName.c_str());
+    reader->Update();
+    vtkPolyData *mesh = reader->GetOutput();
+    if(mesh->GetNumberOfPolys() == 0)
+    {
+        std::cerr << "No polygons in " << meshFileName << std::endl;
+        return EXIT_FAILURE;
+    }
+
+    // 2. double coordinates, each number has to be rounded correctly
+    const std::string doubleFileName = directory + "/vtkSurfaceMeshReaderTestDouble.vtk";
+    if(!WriteDoubleLegacy(mesh, doubleFileName) || !CompareLegacy(doubleFileName, "double legacy file"))
+    {
+        return EXIT_FAILURE;
+    }
+
+    // 3. binary STL, corners are merged like vtkSTLReader does
+    const std::string stlFileName = directory + "/vtkSurfaceMeshReaderTest.stl";
+    const std::vector<char> stl = MakeBinaryStl(mesh);
+    if(!WriteBytes(stlFileName, stl))
+    {
+        return EXIT_FAILURE;
+    }
+    vtkSmartPointer<vtkSTLReader> stlReader = vtkSmartPointer<vtkSTLReader>::New();
+    stlReader->SetFileName(stlFileName.c_str());
+    stlReader->Update();
+    vtkSmartPointer<vtkPolyData> stlMesh = vtkSmartPointer<vtkPolyData>::New();
+    if(!vtkSurfaceMeshReader::ParseBinaryStl(stl.data(), stl.size(), stlMesh))
+    {
+        std::cerr << "The STL parser rejected " << stlFileName << "." << std::endl;
+        return EXIT_FAILURE;
+    }
+    if(!SamePoints(stlReader->GetOutput(), stlMesh, "binary STL file")
+            || !SamePolys(stlReader->GetOutput(), stlMesh, "binary STL file"))
+    {
+        return EXIT_FAILURE;
+    }
+
+    std::remove(doubleFileName.c_str());
+    std::remove(stlFileName.c_str());
+    return EXIT_SUCCESS;
+}
@@ -0,0 +1,92 @@
+/*==============================================================================
+
+  Program: 3D Slicer
+
+  Portions (c) Copyright Brigham and Women's Hospital (BWH) All Rights Reserved.
+
+  See COPYRIGHT.txt
+  or http://www.slicer.org/copyright/copyright.txt for details.
+
+  Unless required by applicable law or agreed to in writing, software
+  distributed under the License is distributed on an "AS IS" BASIS,
+  WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+  See the License for the specific language governing permissions and
+  limitations under the License.
+
+==============================================================================*/
+
+
+
+#ifndef VTKBRICKEDLAYOUT_H
+#define VTKBRICKEDLAYOUT_H
+
+#include <stddef.h>
+#include <algorithm>
+#include <vector>
+
+/**
+ * @brief The vtkBrickedLayout class
+ * Voxel order of the dense distance volumes in bricks of 8x8x8 voxels. Voxels of a brick are
+ * contiguous with x varying fastest, bricks follow each other with x varying fastest.
+ * Samples close in 3D then share cache lines and pages, while the x-fastest layout of ITK puts
+ * z neighbors a whole slice apart. The dimensions must be multiples of the brick size.
+ */
+class vtkBrickedLayout
+{
+public:
+    enum { BrickSize = 8, BrickVoxels = BrickSize * BrickSize * BrickSize };
+
+    // true if a volume of dims can be laid out in bricks
+    static bool Fits(const int *dims)
+    {
+        return dims[0] % BrickSize == 0 && dims[1] % BrickSize == 0 && dims[2] % BrickSize == 0;
+    }
+
+    // the smallest multiple of the brick size not less than n
+    static int RoundUp(int n)
+    {
+        return (n + BrickSize - 1) / BrickSize * BrickSize;
+    }
+
+    // position of voxel (x, y, z) in a bricked volume
+    static size_t Index(const int *dims, int x, int y, int z)
+    {
+        const size_t brick = (static_cast<size_t>(z / BrickSize) * static_cast<size_t>(dims[1] / BrickSize)
+                              + static_cast<size_t>(y / BrickSize)) * static_cast<size_t>(dims[0] / BrickSize)
+                           + static_cast<size_t>(x / BrickSize);
+        const size_t inBrick = (static_cast<size_t>(z % BrickSize) * BrickSize + static_cast<size_t>(y % BrickSize))
+                               * BrickSize + static_cast<size_t>(x % BrickSize);
+        return brick * BrickVoxels + inBrick;
+    }
+
+    // position of voxel (x, y, z) in either layout
+    static size_t Index(const int *dims, bool bricked, int x, int y, int z)
+    {
+        return bricked ? Index(dims, x, y, z)
+                       : (static_cast<size_t>(z) * static_cast<size_t>(dims[1]) + static_cast<size_t>(y))
+                         * static_cast<size_t>(dims[0]) + static_cast<size_t>(x);
+    }
+
+    // Reorder an x-fastest volume with components values per voxel into bricks, in place.
+    // A copy of the volume is held while reordering
+    template<typename T>
+    static void Reorder(T *data, const int *dims, int components)
+    {
+        const size_t numValues = static_cast<size_t>(dims[0]) * static_cast<size_t>(dims[1])
+                               * static_cast<size_t>(dims[2]) * static_cast<size_t>(components);
+        std::vector<T> linear(data, data + numValues);
+        const T *source = linear.data();
+        for(int z = 0; z < dims[2]; ++z)
+        {
+            for(int y = 0; y < dims[1]; ++y)
+            {
+                for(int x = 0; x < dims[0]; ++x, source += components)
+                {
+                    std::copy(source, source + components, data + Index(dims, x, y, z) * components);
+                }
+            }
+        }
+    }
+};
+
+#endif // VTKBRICKEDLAYOUT_H
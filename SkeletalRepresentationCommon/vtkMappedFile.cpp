@@ -0,0 +1,173 @@
+/*==============================================================================
+
+  Program: 3D Slicer
+
+  Portions (c) Copyright Brigham and Women's Hospital (BWH) All Rights Reserved.
+
+  See COPYRIGHT.txt
+  or http://www.slicer.org/copyright/copyright.txt for details.
+
+  Unless required by applicable law or agreed to in writing, software
+  distributed under the License is distributed on an "AS IS" BASIS,
+  WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+  See the License for the specific language governing permissions and
+  limitations under the License.
+
+==============================================================================*/
+
+#include "vtkMappedFile.h"
+
+#ifdef _WIN32
+#include <windows.h>
+#else
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+
+#include <cstdio>
+#include <iostream>
+
+vtkMappedFile::vtkMappedFile()
+{
+}
+
+vtkMappedFile::~vtkMappedFile()
+{
+    Close();
+}
+
+bool vtkMappedFile::Open(const std::string &fileName)
+{
+    Close();
+#ifdef _WIN32
+    HANDLE file = CreateFileA(fileName.c_str(), GENERIC_READ, FILE_SHARE_READ, nullptr,
+                              OPEN_EXISTING, FILE_ATTRIBUTE_NORMAL, nullptr);
+    if(file == INVALID_HANDLE_VALUE)
+    {
+        std::cerr << "Cannot open " << fileName << std::endl;
+        return false;
+    }
+    LARGE_INTEGER fileSize;
+    if(!GetFileSizeEx(file, &fileSize))
+    {
+        std::cerr << "Cannot get the size of " << fileName << std::endl;
+        CloseHandle(file);
+        return false;
+    }
+    if(fileSize.QuadPart == 0)
+    {
+        std::cerr << fileName << " is empty." << std::endl;
+        CloseHandle(file);
+        return false;
+    }
+    HANDLE mapping = CreateFileMappingA(file, nullptr, PAGE_READONLY, 0, 0, nullptr);
+    void *address = mapping ? MapViewOfFile(mapping, FILE_MAP_READ, 0, 0, 0) : nullptr;
+    if(address == nullptr)
+    {
+        std::cerr << "Cannot map " << fileName << std::endl;
+        if(mapping)
+        {
+            CloseHandle(mapping);
+        }
+        CloseHandle(file);
+        return false;
+    }
+    mFileHandle = file;
+    mMappingHandle = mapping;
+    mSize = static_cast<size_t>(fileSize.QuadPart);
+#else
+    int fd = open(fileName.c_str(), O_RDONLY);
+    if(fd < 0)
+    {
+        std::cerr << "Cannot open " << fileName << std::endl;
+        return false;
+    }
+    struct stat fileStat;
+    if(fstat(fd, &fileStat) != 0)
+    {
+        std::cerr << "Cannot get the size of " << fileName << std::endl;
+        close(fd);
+        return false;
+    }
+    if(fileStat.st_size == 0)
+    {
+        std::cerr << fileName << " is empty." << std::endl;
+        close(fd);
+        return false;
+    }
+    void *address = mmap(nullptr, static_cast<size_t>(fileStat.st_size), PROT_READ, MAP_SHARED, fd, 0);
+    // the mapping stays valid after the descriptor is closed
+    close(fd);
+    if(address == MAP_FAILED)
+    {
+        std::cerr << "Cannot map " << fileName << std::endl;
+        return false;
+    }
+    mSize = static_cast<size_t>(fileStat.st_size);
+#endif
+    mAddress = address;
+    return true;
+}
+
+vtkMappedFile::Stamp vtkMappedFile::GetStamp(const std::string &fileName)
+{
+    Stamp stamp;
+#ifdef _WIN32
+    WIN32_FILE_ATTRIBUTE_DATA attributes;
+    if(!GetFileAttributesExA(fileName.c_str(), GetFileExInfoStandard, &attributes))
+    {
+        return stamp;
+    }
+    const FILETIME &modified = attributes.ftLastWriteTime;
+    stamp.ModifiedTime = static_cast<long long>((static_cast<unsigned long long>(modified.dwHighDateTime) << 32)
+                                                | modified.dwLowDateTime);
+    stamp.Length = (static_cast<unsigned long long>(attributes.nFileSizeHigh) << 32) | attributes.nFileSizeLow;
+#else
+    struct stat fileStat;
+    if(stat(fileName.c_str(), &fileStat) != 0)
+    {
+        return stamp;
+    }
+#ifdef __APPLE__
+    const struct timespec &modified = fileStat.st_mtimespec;
+#else
+    const struct timespec &modified = fileStat.st_mtim;
+#endif
+    stamp.ModifiedTime = static_cast<long long>(modified.tv_sec) * 1000000000LL + modified.tv_nsec;
+    stamp.Length = static_cast<unsigned long long>(fileStat.st_size);
+    // a file replaced by a rename, like Replace does, has a new serial number
+    stamp.FileId = static_cast<unsigned long long>(fileStat.st_ino);
+#endif
+    return stamp;
+}
+
+bool vtkMappedFile::Replace(const std::string &tempFileName, const std::string &fileName)
+{
+#ifdef _WIN32
+    // rename fails on an existing file here, MoveFileEx replaces it
+    return MoveFileExA(tempFileName.c_str(), fileName.c_str(), MOVEFILE_REPLACE_EXISTING) != 0;
+#else
+    return std::rename(tempFileName.c_str(), fileName.c_str()) == 0;
+#endif
+}
+
+void vtkMappedFile::Close()
+{
+    if(mAddress == nullptr)
+    {
+        return;
+    }
+#ifdef _WIN32
+    UnmapViewOfFile(mAddress);
+    CloseHandle(mMappingHandle);
+    CloseHandle(mFileHandle);
+    mMappingHandle = nullptr;
+    mFileHandle = nullptr;
+#else
+    munmap(mAddress, mSize);
+#endif
+    mAddress = nullptr;
+    mSize = 0;
+}
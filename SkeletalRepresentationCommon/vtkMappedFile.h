@@ -0,0 +1,84 @@
+/*==============================================================================
+
+  Program: 3D Slicer
+
+  Portions (c) Copyright Brigham and Women's Hospital (BWH) All Rights Reserved.
+
+  See COPYRIGHT.txt
+  or http://www.slicer.org/copyright/copyright.txt for details.
+
+  Unless required by applicable law or agreed to in writing, software
+  distributed under the License is distributed on an "AS IS" BASIS,
+  WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+  See the License for the specific language governing permissions and
+  limitations under the License.
+
+==============================================================================*/
+
+#ifndef VTKMAPPEDFILE_H
+#define VTKMAPPEDFILE_H
+
+#include "vtkSlicerSkeletalRepresentationCommonExport.h"
+
+#include <stddef.h>
+#include <string>
+
+/**
+ * @brief The vtkMappedFile class
+ * Read-only memory mapping of a whole file. The pages are read on first access and shared
+ * with other processes mapping the same file.
+ */
+class VTK_SLICER_SKELETALREPRESENTATIONCOMMON_EXPORT vtkMappedFile
+{
+public:
+    vtkMappedFile();
+    ~vtkMappedFile();
+
+    // Map the file. Return false if it can't be opened, is empty or can't be mapped
+    bool Open(const std::string &fileName);
+
+    // Unmap the file
+    void Close();
+
+    bool IsOpen() const { return mAddress != nullptr; }
+
+    const char *GetData() const { return static_cast<const char*>(mAddress); }
+
+    size_t GetSize() const { return mSize; }
+
+    // What tells a rewritten file apart: the modification time in the finest unit the platform
+    // keeps (nanoseconds, 100 ns on Windows), the size and the file serial number where there is one.
+    // A file replaced within the same second still gets a new stamp
+    struct Stamp
+    {
+        long long ModifiedTime = 0;
+        unsigned long long Length = 0;
+        unsigned long long FileId = 0;
+
+        bool operator==(const Stamp &other) const
+        {
+            return ModifiedTime == other.ModifiedTime && Length == other.Length && FileId == other.FileId;
+        }
+        bool operator!=(const Stamp &other) const { return !(*this == other); }
+    };
+
+    // Return the stamp of the file, all zero if it doesn't exist
+    static Stamp GetStamp(const std::string &fileName);
+
+    // Move the file tempFileName to fileName, replacing an existing file in one step, so a reader
+    // opens either the old or the new file. Return false if the file can't be moved
+    static bool Replace(const std::string &tempFileName, const std::string &fileName);
+
+private:
+    void *mAddress = nullptr;
+    size_t mSize = 0;
+#ifdef _WIN32
+    void *mFileHandle = nullptr;
+    void *mMappingHandle = nullptr;
+#endif
+
+    vtkMappedFile(const vtkMappedFile&); // Not implemented
+    void operator=(const vtkMappedFile&); // Not implemented
+};
+
+#endif // VTKMAPPEDFILE_H
@@ -0,0 +1,156 @@
+/*==============================================================================
+
+  Program: 3D Slicer
+
+  Portions (c) Copyright Brigham and Women's Hospital (BWH) All Rights Reserved.
+
+  See COPYRIGHT.txt
+  or http://www.slicer.org/copyright/copyright.txt for details.
+
+  Unless required by applicable law or agreed to in writing, software
+  distributed under the License is distributed on an "AS IS" BASIS,
+  WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+  See the License for the specific language governing permissions and
+  limitations under the License.
+
+==============================================================================*/
+
+
+#include "vtkSrepKernelDispatch.h"
+
+// STD includes
+#include <cstdlib>
+#include <iostream>
+
+#if defined(SREP_KERNELS_X86) && defined(_MSC_VER)
+#include <intrin.h>
+#include <immintrin.h>
+#endif
+
+// one table per instruction set, defined in vtkSrepKernels*.cxx
+const vtkSrepKernelTable &vtkSrepKernelTableScalar();
+#ifdef SREP_KERNELS_X86
+const vtkSrepKernelTable &vtkSrepKernelTableSSE42();
+const vtkSrepKernelTable &vtkSrepKernelTableAVX2();
+const vtkSrepKernelTable &vtkSrepKernelTableAVX512();
+#endif
+
+namespace
+{
+enum { ScalarLevel = 0, SSE42Level, AVX2Level, AVX512Level };
+
+const char *levelNames[] = {"scalar", "sse4.2", "avx2", "avx512"};
+
+// highest level supported by both the CPU and the operating system
+int DetectLevel()
+{
+#if !defined(SREP_KERNELS_X86)
+    return ScalarLevel;
+#elif defined(_MSC_VER)
+    int info[4];
+    __cpuid(info, 0);
+    const int maxLeaf = info[0];
+    __cpuid(info, 1);
+    const unsigned int ecx1 = static_cast<unsigned int>(info[2]);
+    const bool sse42 = (ecx1 & (1u << 20)) != 0;
+    const bool fma = (ecx1 & (1u << 12)) != 0;
+    const bool avx = (ecx1 & (1u << 28)) != 0;
+    const bool osxsave = (ecx1 & (1u << 27)) != 0;
+    // registers saved by the operating system: ymm needs xmm and ymm state, zmm also opmask and zmm state
+    const unsigned long long xcr0 = osxsave ? _xgetbv(0) : 0;
+    const bool ymmState = (xcr0 & 0x6) == 0x6;
+    const bool zmmState = (xcr0 & 0xe6) == 0xe6;
+    bool avx2 = false, avx512 = false;
+    if(maxLeaf >= 7)
+    {
+        __cpuidex(info, 7, 0);
+        const unsigned int ebx7 = static_cast<unsigned int>(info[1]);
+        avx2 = (ebx7 & (1u << 5)) != 0;
+        // F, DQ, BW and VL
+        const unsigned int avx512Bits = (1u << 16) | (1u << 17) | (1u << 30) | (1u << 31);
+        avx512 = (ebx7 & avx512Bits) == avx512Bits;
+    }
+    if(avx512 && avx2 && fma && zmmState)
+    {
+        return AVX512Level;
+    }
+    if(avx2 && avx && fma && ymmState)
+    {
+        return AVX2Level;
+    }
+    return sse42 ? SSE42Level : ScalarLevel;
+#else
+    __builtin_cpu_init();
+    if(__builtin_cpu_supports("avx512f") && __builtin_cpu_supports("avx512dq") &&
+       __builtin_cpu_supports("avx512bw") && __builtin_cpu_supports("avx512vl") &&
+       __builtin_cpu_supports("fma"))
+    {
+        return AVX512Level;
+    }
+    if(__builtin_cpu_supports("avx2") && __builtin_cpu_supports("fma"))
+    {
+        return AVX2Level;
+    }
+    return __builtin_cpu_supports("sse4.2") ? SSE42Level : ScalarLevel;
+#endif
+}
+
+const vtkSrepKernelTable &TableOfLevel(int level)
+{
+    switch(level)
+    {
+#ifdef SREP_KERNELS_X86
+    case AVX512Level:
+        return vtkSrepKernelTableAVX512();
+    case AVX2Level:
+        return vtkSrepKernelTableAVX2();
+    case SSE42Level:
+        return vtkSrepKernelTableSSE42();
+#endif
+    default:
+        return vtkSrepKernelTableScalar();
+    }
+}
+} // end of anonymous namespace
+
+const vtkSrepKernelTable &vtkSrepKernelDispatch::GetTable()
+{
+    static const vtkSrepKernelTable &table = SelectTable();
+    return table;
+}
+
+std::string vtkSrepKernelDispatch::GetName()
+{
+    return GetTable().name;
+}
+
+const vtkSrepKernelTable &vtkSrepKernelDispatch::SelectTable()
+{
+    int level = DetectLevel();
+    const char *requested = getenv("SREP_KERNEL_ISA");
+    if(requested != nullptr && requested[0] != '\0')
+    {
+        int requestedLevel = -1;
+        for(int i = ScalarLevel; i <= AVX512Level; ++i)
+        {
+            if(std::string(requested) == levelNames[i])
+            {
+                requestedLevel = i;
+            }
+        }
+        if(requestedLevel < 0)
+        {
+            std::cerr << "Unknown SREP_KERNEL_ISA " << requested << ", expected scalar, sse4.2, avx2 or avx512." << std::endl;
+        }
+        else if(requestedLevel > level)
+        {
+            std::cerr << "SREP_KERNEL_ISA " << requested << " is not supported here, using "
+                      << levelNames[level] << "." << std::endl;
+        }
+        else
+        {
+            level = requestedLevel;
+        }
+    }
+    return TableOfLevel(level);
+}
@@ -0,0 +1,82 @@
+/*==============================================================================
+
+  Program: 3D Slicer
+
+  Portions (c) Copyright Brigham and Women's Hospital (BWH) All Rights Reserved.
+
+  See COPYRIGHT.txt
+  or http://www.slicer.org/copyright/copyright.txt for details.
+
+  Unless required by applicable law or agreed to in writing, software
+  distributed under the License is distributed on an "AS IS" BASIS,
+  WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+  See the License for the specific language governing permissions and
+  limitations under the License.
+
+==============================================================================*/
+
+
+#ifndef VTKSREPKERNELDISPATCH_H
+#define VTKSREPKERNELDISPATCH_H
+
+#include "vtkSlicerSkeletalRepresentationCommonExport.h"
+#include "vtkSrepKernels.h"
+
+#include <string>
+
+// Batch kernels of one instruction set, see vtkSrepKernels for their arguments
+struct vtkSrepKernelTable
+{
+    const char *name;
+    void (*interpolateFloat)(const vtkSrepQuad<float> &quad, const float *uv, size_t n, vtkSpokeData<float> *output);
+    void (*interpolateOnTableFloat)(const vtkSrepQuad<float> &quad, const float *uv, const float *points, size_t n,
+                                    vtkSpokeData<float> *output);
+    void (*sampleImageMatchFloat)(const float *points, const float *dirs, const float *weights, size_t n,
+                                  const float *scale, const float *shift, float spacing,
+                                  const int *dims, int maxIndex, bool bricked, int interpolation,
+                                  const float *dist, const float *grad,
+                                  double *imageDist, double *normalMatch);
+    void (*sampleImageMatchQuantizedFloat)(const float *points, const float *dirs, const float *weights, size_t n,
+                                           const float *scale, const float *shift, float spacing,
+                                           const int *dims, int maxIndex, bool bricked, int interpolation,
+                                           const short *dist, float distScale, float distOffset, const float *grad,
+                                           double *imageDist, double *normalMatch);
+    double (*rSradPenaltyFloat)(const vtkSrepRSradInput<float> *inputs, size_t n, float stepSize);
+    void (*interpolateDouble)(const vtkSrepQuad<double> &quad, const double *uv, size_t n,
+                              vtkSpokeData<double> *output);
+    void (*interpolateOnTableDouble)(const vtkSrepQuad<double> &quad, const double *uv, const double *points,
+                                     size_t n, vtkSpokeData<double> *output);
+    void (*sampleImageMatchDouble)(const double *points, const double *dirs, const double *weights, size_t n,
+                                   const double *scale, const double *shift, double spacing,
+                                   const int *dims, int maxIndex, bool bricked, int interpolation,
+                                   const float *dist, const float *grad,
+                                   double *imageDist, double *normalMatch);
+    void (*sampleImageMatchQuantizedDouble)(const double *points, const double *dirs, const double *weights,
+                                            size_t n, const double *scale, const double *shift, double spacing,
+                                            const int *dims, int maxIndex, bool bricked, int interpolation,
+                                            const short *dist, double distScale, double distOffset,
+                                            const float *grad, double *imageDist, double *normalMatch);
+    double (*rSradPenaltyDouble)(const vtkSrepRSradInput<double> *inputs, size_t n, double stepSize);
+    void (*flowVertexUpdateFloat)(float *points, const float *normals, const double *curvature, size_t n, double dt);
+};
+
+/**
+ * @brief The vtkSrepKernelDispatch class
+ * Picks the kernels compiled for the best instruction set of this CPU: AVX-512, AVX2, SSE4.2
+ * or the scalar fallback. The extension is shipped as one binary, so the choice is made at runtime.
+ * The environment variable SREP_KERNEL_ISA (scalar, sse4.2, avx2 or avx512) forces a lower level for testing.
+ */
+class VTK_SLICER_SKELETALREPRESENTATIONCOMMON_EXPORT vtkSrepKernelDispatch
+{
+public:
+    // kernels selected at the first call
+    static const vtkSrepKernelTable &GetTable();
+
+    // name of the instruction set of the selected kernels
+    static std::string GetName();
+
+private:
+    static const vtkSrepKernelTable &SelectTable();
+};
+
+#endif // VTKSREPKERNELDISPATCH_H
@@ -0,0 +1,47 @@
+/*==============================================================================
+
+  Program: 3D Slicer
+
+  Portions (c) Copyright Brigham and Women's Hospital (BWH) All Rights Reserved.
+
+  See COPYRIGHT.txt
+  or http://www.slicer.org/copyright/copyright.txt for details.
+
+  Unless required by applicable law or agreed to in writing, software
+  distributed under the License is distributed on an "AS IS" BASIS,
+  WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+  See the License for the specific language governing permissions and
+  limitations under the License.
+
+==============================================================================*/
+
+
+// Kernel table of one instruction set.
+// Included by vtkSrepKernels<ISA>.cxx; each of them is compiled with the flags of its instruction set
+// and defines VTK_SREP_KERNEL_ISA, VTK_SREP_KERNEL_NAME and VTK_SREP_KERNEL_TABLE before the include.
+
+#include "vtkSrepKernelDispatch.h"
+
+const vtkSrepKernelTable &VTK_SREP_KERNEL_TABLE();
+
+const vtkSrepKernelTable &VTK_SREP_KERNEL_TABLE()
+{
+    typedef vtkSrepKernels<float, VTK_SREP_KERNEL_ISA> FloatKernels;
+    typedef vtkSrepKernels<double, VTK_SREP_KERNEL_ISA> DoubleKernels;
+    static const vtkSrepKernelTable table =
+    {
+        VTK_SREP_KERNEL_NAME,
+        &FloatKernels::InterpolateBatch,
+        &FloatKernels::InterpolateBatchOnTable,
+        &FloatKernels::SampleImageMatch,
+        &FloatKernels::SampleImageMatchQuantized,
+        &FloatKernels::RSradPenaltyBatch,
+        &DoubleKernels::InterpolateBatch,
+        &DoubleKernels::InterpolateBatchOnTable,
+        &DoubleKernels::SampleImageMatch,
+        &DoubleKernels::SampleImageMatchQuantized,
+        &DoubleKernels::RSradPenaltyBatch,
+        &FloatKernels::FlowVertexUpdate
+    };
+    return table;
+}
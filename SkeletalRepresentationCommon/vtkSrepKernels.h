@@ -0,0 +1,929 @@
+/*==============================================================================
+
+  Program: 3D Slicer
+
+  Portions (c) Copyright Brigham and Women's Hospital (BWH) All Rights Reserved.
+
+  See COPYRIGHT.txt
+  or http://www.slicer.org/copyright/copyright.txt for details.
+
+  Unless required by applicable law or agreed to in writing, software
+  distributed under the License is distributed on an "AS IS" BASIS,
+  WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+  See the License for the specific language governing permissions and
+  limitations under the License.
+
+==============================================================================*/
+
+
+#ifndef VTKSREPKERNELS_H
+#define VTKSREPKERNELS_H
+
+#include <math.h>
+#include <cstddef>
+#include <algorithm>
+
+#include "vtkBrickedLayout.h"
+
+// Only the copies built with -mavx2 or -mavx512f (/arch:AVX2, /arch:AVX512) see these, see vtkSrepKernelDispatch.
+// The gathers take 64 bit voxel indices, so they are used on 64 bit targets only.
+#if (defined(__x86_64__) || defined(_M_X64)) && (defined(__AVX2__) || defined(__AVX512F__))
+#include <immintrin.h>
+#define VTK_SREP_KERNELS_GATHER
+#endif
+
+// Plain-array form of a spoke: radius, skeletal point and unit direction
+template<typename T>
+struct vtkSpokeData
+{
+    T radius;
+    T point[3];
+    T dir[3];
+};
+
+// A quad of the skeletal grid with the derivatives of the skeletal sheet at its corners.
+// Corners are ordered 11, 21, 22, 12 (ccw from top-left) as in the interpolater.
+template<typename T>
+struct vtkSrepQuad
+{
+    const vtkSpokeData<T> *corners[4];
+    T dxdu[4][3];
+    T dxdv[4][3];
+};
+
+// A spoke with its interpolated neighbors in u and v for the rSrad penalty.
+// One neighbor gives a forward or backward difference, two give a central difference.
+template<typename T>
+struct vtkSrepRSradInput
+{
+    const vtkSpokeData<T> *spoke;
+    const vtkSpokeData<T> *neighborsU[2];
+    const vtkSpokeData<T> *neighborsV[2];
+    int numU;
+    int numV;
+    bool isForwardU;
+    bool isForwardV;
+};
+
+/**
+ * @brief The vtkSrepKernels class
+ * Hot kernels of the objective function written on plain arrays, so that they can be
+ * instantiated in single precision (float doubles the SIMD lane width) as well as in double.
+ * They follow vtkSlicerSkeletalRepresentationInterpolater, vtkSpoke::GetRSradPenalty and
+ * vtkDistanceSampler::Sample step by step, so both precisions are expected to give
+ * the same objective up to rounding.
+ *
+ * ISA tells apart the copies compiled for different instruction sets (see vtkSrepKernelDispatch).
+ * Every copy is a distinct instantiation, so the linker never merges inline code built for
+ * a wide instruction set into the scalar copy. Math goes through the C library for the same reason.
+ */
+template<typename T, int ISA = 0>
+class vtkSrepKernels
+{
+public:
+    typedef vtkSpokeData<T> Spoke;
+    typedef vtkSrepQuad<T> Quad;
+    typedef vtkSrepRSradInput<T> RSradInput;
+
+    // reads of the distance image between voxels, the values of vtkImageDistanceSampler::Interpolation
+    enum Interpolation
+    {
+        Nearest = 0,
+        Trilinear,
+        TricubicBSpline
+    };
+
+    static void Normalize(T *u)
+    {
+        T norm = Sqrt(u[0] * u[0] + u[1] * u[1] + u[2] * u[2]);
+        if(norm != T(0))
+        {
+            u[0] /= norm;
+            u[1] /= norm;
+            u[2] /= norm;
+        }
+    }
+
+    static void Slerp(const T *U1, const T *U2, T u, T *output)
+    {
+        T u1Tu2 = U1[0] * U2[0] + U1[1] * U2[1] + U1[2] * U2[2];
+        if(u1Tu2 > T(1))
+        {
+            u1Tu2 = T(1);
+        }
+        else if(u1Tu2 < T(-1))
+        {
+            u1Tu2 = T(-1);
+        }
+        T phi = Acos(u1Tu2);
+        T sinPhi = Sin(phi);
+        // parallel directions, which single precision rounds to more often: the limit of the weights
+        T w1 = 1 - u;
+        T w2 = u;
+        if(sinPhi != T(0))
+        {
+            w1 = Sin((1 - u) * phi) / sinPhi;
+            w2 = Sin(u * phi) / sinPhi;
+        }
+
+        output[0] = w1 * U1[0] + w2 * U2[0];
+        output[1] = w1 * U1[1] + w2 * U2[1];
+        output[2] = w1 * U1[2] + w2 * U2[2];
+    }
+
+    static void InterpolateMiddleSpoke(const Spoke &startS, const Spoke &endS, T d, Spoke *output)
+    {
+        // 1. second derivative of the direction at both ends
+        const T del = T(1e-5);
+        T Uvv_start[3], Uvv_end[3];
+        Compute2ndDerivative(startS.dir, endS.dir, endS.dir, d, del, Uvv_end);
+        Compute2ndDerivative(startS.dir, endS.dir, startS.dir, 0, del, Uvv_start);
+
+        // 2. average of the two spokes S = rU
+        T avg[3];
+        for(int k = 0; k < 3; ++k)
+        {
+            avg[k] = (startS.radius * startS.dir[k] + endS.radius * endS.dir[k]) / 2;
+        }
+
+        T halfDist = d / 2;
+        T uMiddle[3];
+        Slerp(startS.dir, endS.dir, halfDist, uMiddle);
+
+        T innerProd1 = uMiddle[0] * avg[0] + uMiddle[1] * avg[1] + uMiddle[2] * avg[2];
+        T innerProd2 = startS.dir[0] * Uvv_start[0] + startS.dir[1] * Uvv_start[1] + startS.dir[2] * Uvv_start[2];
+        T innerProd3 = endS.dir[0] * Uvv_end[0] + endS.dir[1] * Uvv_end[1] + endS.dir[2] * Uvv_end[2];
+
+        output->radius = innerProd1 - halfDist * halfDist * T(0.25) * (innerProd2 + innerProd3);
+        Normalize(uMiddle);
+        output->dir[0] = uMiddle[0];
+        output->dir[1] = uMiddle[1];
+        output->dir[2] = uMiddle[2];
+    }
+
+    static void InterpolateSegment(const Spoke &start, const Spoke &end, T dist, T lambda, Spoke *output)
+    {
+        Spoke middleSpoke = start;
+        InterpolateMiddleSpoke(start, end, lambda, &middleSpoke);
+        T halfDist = lambda / 2;
+        if(Abs(dist - halfDist) < Tolerance())
+        {
+            *output = middleSpoke;
+        }
+        else if(dist < halfDist)
+        {
+            InterpolateSegment(start, middleSpoke, dist, halfDist, output);
+        }
+        else if(dist > halfDist)
+        {
+            InterpolateSegment(middleSpoke, end, dist - halfDist, halfDist, output);
+        }
+    }
+
+    // Radius and direction of the spoke at (u, v) of a quad, by recursive subdivision
+    static void InterpolateQuad(const Spoke *const *cornerSpokes, T u, T v, T lambda, Spoke *output)
+    {
+        const Spoke &Sp11 = *cornerSpokes[0];
+        const Spoke &Sp21 = *cornerSpokes[1];
+        const Spoke &Sp22 = *cornerSpokes[2];
+        const Spoke &Sp12 = *cornerSpokes[3];
+
+        Spoke topMiddle = Sp11, leftMiddle = Sp11, rightMiddle = Sp11, botMiddle = Sp11;
+        InterpolateMiddleSpoke(Sp11, Sp12, lambda, &topMiddle);
+        InterpolateMiddleSpoke(Sp11, Sp21, lambda, &leftMiddle);
+        InterpolateMiddleSpoke(Sp21, Sp22, lambda, &botMiddle);
+        InterpolateMiddleSpoke(Sp22, Sp12, lambda, &rightMiddle);
+
+        // center spoke of this quad
+        Spoke centerA = Sp11, centerB = Sp11, center = Sp11;
+        InterpolateMiddleSpoke(topMiddle, botMiddle, lambda, &centerA);
+        InterpolateMiddleSpoke(leftMiddle, rightMiddle, lambda, &centerB);
+        center.radius = T(0.5) * (centerA.radius + centerB.radius);
+        for(int k = 0; k < 3; ++k)
+        {
+            center.dir[k] = T(0.5) * (centerA.dir[k] + centerB.dir[k]);
+        }
+        Normalize(center.dir);
+
+        const T tolerance = Tolerance();
+        T halfDist = lambda / 2;
+        const Spoke *result = nullptr;
+        if(Abs(u - halfDist) <= tolerance && Abs(v - halfDist) <= tolerance)
+        {
+            result = &center;
+        }
+        else if(Abs(u) < tolerance && Abs(v) < tolerance)
+        {
+            result = &Sp11;
+        }
+        else if(Abs(u - lambda) < tolerance && Abs(v) < tolerance)
+        {
+            result = &Sp21;
+        }
+        else if(Abs(v - lambda) < tolerance && Abs(u) < tolerance)
+        {
+            result = &Sp12;
+        }
+        else if(Abs(v - lambda) < tolerance && Abs(u - lambda) < tolerance)
+        {
+            result = &Sp22;
+        }
+        else if(Abs(u - halfDist) <= tolerance && Abs(v) < tolerance)
+        {
+            result = &leftMiddle;
+        }
+        else if(Abs(u) < tolerance && Abs(v - halfDist) < tolerance)
+        {
+            result = &topMiddle;
+        }
+        else if(Abs(u - halfDist) < tolerance && Abs(v - lambda) < tolerance)
+        {
+            result = &rightMiddle;
+        }
+        else if(Abs(u - lambda) < tolerance && Abs(v - halfDist) < tolerance)
+        {
+            result = &botMiddle;
+        }
+        if(result != nullptr)
+        {
+            output->radius = result->radius;
+            output->dir[0] = result->dir[0];
+            output->dir[1] = result->dir[1];
+            output->dir[2] = result->dir[2];
+            return;
+        }
+
+        const Spoke *newCorner[4];
+        if(u < halfDist && v > halfDist)
+        {
+            newCorner[0] = &topMiddle;
+            newCorner[1] = &center;
+            newCorner[2] = &rightMiddle;
+            newCorner[3] = &Sp12;
+            InterpolateQuad(newCorner, u, v - halfDist, lambda / 2, output);
+        }
+        else if(u < halfDist && v < halfDist)
+        {
+            newCorner[0] = &Sp11;
+            newCorner[1] = &leftMiddle;
+            newCorner[2] = &center;
+            newCorner[3] = &topMiddle;
+            InterpolateQuad(newCorner, u, v, lambda / 2, output);
+        }
+        else if(u > halfDist && v < halfDist)
+        {
+            newCorner[0] = &leftMiddle;
+            newCorner[1] = &Sp21;
+            newCorner[2] = &botMiddle;
+            newCorner[3] = &center;
+            InterpolateQuad(newCorner, u - halfDist, v, lambda / 2, output);
+        }
+        else if(u > halfDist && v > halfDist)
+        {
+            newCorner[0] = &center;
+            newCorner[1] = &botMiddle;
+            newCorner[2] = &Sp22;
+            newCorner[3] = &rightMiddle;
+            InterpolateQuad(newCorner, u - halfDist, v - halfDist, lambda / 2, output);
+        }
+        // degenerate quads on the axes; the interpolater subdivides these with lambda = 1
+        else if(Abs(v - halfDist) < tolerance)
+        {
+            InterpolateSegment(topMiddle, botMiddle, u, 1, output);
+        }
+        else if(Abs(u - halfDist) < tolerance)
+        {
+            InterpolateSegment(leftMiddle, rightMiddle, v, 1, output);
+        }
+    }
+
+    // Hermite interpolation of the skeletal point at (u, v) of a quad
+    static void InterpolateSkeletalPoint(const Quad &quad, T u, T v, T *output)
+    {
+        T hu[4], hv[4];
+        HermiteBasis(u, hu);
+        HermiteBasis(v, hv);
+        for(int k = 0; k < 3; ++k)
+        {
+            // rows of the Hermite matrix: x11 x12 dxdv11 dxdv12 / x21 x22 dxdv21 dxdv22 / dxdu11 dxdu12 0 0 / dxdu21 dxdu22 0 0
+            T h[4][4];
+            h[0][0] = quad.corners[0]->point[k]; h[0][1] = quad.corners[3]->point[k];
+            h[1][0] = quad.corners[1]->point[k]; h[1][1] = quad.corners[2]->point[k];
+            h[2][0] = quad.dxdu[0][k];           h[2][1] = quad.dxdu[3][k];
+            h[3][0] = quad.dxdu[1][k];           h[3][1] = quad.dxdu[2][k];
+            h[0][2] = quad.dxdv[0][k];           h[0][3] = quad.dxdv[3][k];
+            h[1][2] = quad.dxdv[1][k];           h[1][3] = quad.dxdv[2][k];
+            h[2][2] = 0;                         h[2][3] = 0;
+            h[3][2] = 0;                         h[3][3] = 0;
+
+            T huTh[4];
+            for(int j = 0; j < 4; ++j)
+            {
+                huTh[j] = hu[0] * h[0][j] + hu[1] * h[1][j] + hu[2] * h[2][j] + hu[3] * h[3][j];
+            }
+            // the interpolater leaves out the last column as well
+            output[k] = huTh[0] * hv[0] + huTh[1] * hv[1] + huTh[2] * hv[2];
+        }
+    }
+
+    // Spoke at (u, v) of a quad: radius and direction by subdivision, skeletal point by Hermite interpolation
+    static void Interpolate(const Quad &quad, T u, T v, Spoke *output)
+    {
+        InterpolateQuad(quad.corners, u, v, T(1), output);
+        InterpolateSkeletalPoint(quad, u, v, output->point);
+    }
+
+    // Interpolate n spokes at positions uv (u, v interleaved) of one quad
+    static void InterpolateBatch(const Quad &quad, const T *uv, size_t n, Spoke *output)
+    {
+        for(size_t i = 0; i < n; ++i)
+        {
+            Interpolate(quad, uv[2 * i], uv[2 * i + 1], output + i);
+        }
+    }
+
+    // Same as InterpolateBatch with the skeletal points read from points, 3 per position.
+    // They only depend on the skeletal sheet, so the caller can keep them from one evaluation to the next.
+    static void InterpolateBatchOnTable(const Quad &quad, const T *uv, const T *points, size_t n, Spoke *output)
+    {
+        for(size_t i = 0; i < n; ++i)
+        {
+            InterpolateQuad(quad.corners, uv[2 * i], uv[2 * i + 1], T(1), output + i);
+            output[i].point[0] = points[3 * i];
+            output[i].point[1] = points[3 * i + 1];
+            output[i].point[2] = points[3 * i + 2];
+        }
+    }
+
+    static void GetBoundaryPoint(const Spoke &spoke, T *output)
+    {
+        output[0] = spoke.point[0] + spoke.radius * spoke.dir[0];
+        output[1] = spoke.point[1] + spoke.radius * spoke.dir[1];
+        output[2] = spoke.point[2] + spoke.radius * spoke.dir[2];
+    }
+
+    // Image match of a batch of boundary points against the distance map and its gradient.
+    // Input: points, dirs are n boundary points and unit spoke directions, xyz interleaved
+    // Input: weights is how many times each sample counts in the objective
+    // Input: scale, shift map s-rep coordinates into the unit cube, spacing is the voxel size there
+    // Input: dims are the image dimensions, maxIndex the largest voxel index allowed per axis
+    // Input: dist and grad are the raw buffers of the distance image and of its gradient (xyz per voxel),
+    // x-fastest or in the order of vtkBrickedLayout if bricked
+    // Input: interpolation is one of Interpolation. The B-spline takes its normal from its own gradient
+    // and does not read grad, which may be nullptr then
+    // Output: imageDist and normalMatch are incremented by the weighted squared distances and
+    // normal mismatches: weight * d^2 and weight * d^2 * (1 - normal . dir) for the distance d
+    static void SampleImageMatch(const T *points, const T *dirs, const T *weights, size_t n,
+                                 const T *scale, const T *shift, T spacing,
+                                 const int *dims, int maxIndex, bool bricked, int interpolation,
+                                 const float *dist, const float *grad,
+                                 double *imageDist, double *normalMatch)
+    {
+        SampleImageMatchDispatch(points, dirs, weights, n, scale, shift, spacing, dims, maxIndex, bricked,
+                                 interpolation, dist, T(1), T(0), grad, imageDist, normalMatch);
+    }
+
+    // Same as SampleImageMatch on a fixed point distance image, the distance of a voxel is
+    // distScale * dist[voxel] + distOffset
+    static void SampleImageMatchQuantized(const T *points, const T *dirs, const T *weights, size_t n,
+                                          const T *scale, const T *shift, T spacing,
+                                          const int *dims, int maxIndex, bool bricked, int interpolation,
+                                          const short *dist, T distScale, T distOffset, const float *grad,
+                                          double *imageDist, double *normalMatch)
+    {
+        SampleImageMatchDispatch(points, dirs, weights, n, scale, shift, spacing, dims, maxIndex, bricked,
+                                 interpolation, dist, distScale, distOffset, grad, imageDist, normalMatch);
+    }
+
+    // rSrad penalty of a spoke from its interpolated neighbors in u and v,
+    // same finite differences as vtkSpoke::GetRSradPenalty
+    static T RSradPenalty(const Spoke &spoke,
+                          const Spoke *const *neighborsU, int numU, bool isForwardU,
+                          const Spoke *const *neighborsV, int numV, bool isForwardV,
+                          T stepSize)
+    {
+        T dxdu[3] = {0, 0, 0}, dxdv[3] = {0, 0, 0}, dSdu[3] = {0, 0, 0}, dSdv[3] = {0, 0, 0};
+        T drdu = 0, drdv = 0;
+        ComputeDerivatives(spoke, neighborsU, numU, isForwardU, stepSize, dxdu, dSdu, &drdu);
+        ComputeDerivatives(spoke, neighborsV, numV, isForwardV, stepSize, dxdv, dSdv, &drdv);
+        const T *U = spoke.dir;
+
+        // Q = [dxdu; dxdv] * (U^T U - I), leftSide = [dSdu - drdu U; dSdv - drdv U]
+        T Q[2][3], leftSide[2][3];
+        const T *dx[2] = {dxdu, dxdv};
+        for(int i = 0; i < 2; ++i)
+        {
+            T dxTU = dx[i][0] * U[0] + dx[i][1] * U[1] + dx[i][2] * U[2];
+            for(int k = 0; k < 3; ++k)
+            {
+                Q[i][k] = dxTU * U[k] - dx[i][k];
+            }
+        }
+        for(int k = 0; k < 3; ++k)
+        {
+            leftSide[0][k] = dSdu[k] - drdu * U[k];
+            leftSide[1][k] = dSdv[k] - drdv * U[k];
+        }
+
+        // det(leftSide Q^T (Q Q^T)^-1) = det(leftSide Q^T) / det(Q Q^T)
+        T LQ[2][2], QQ[2][2];
+        for(int i = 0; i < 2; ++i)
+        {
+            for(int j = 0; j < 2; ++j)
+            {
+                LQ[i][j] = leftSide[i][0] * Q[j][0] + leftSide[i][1] * Q[j][1] + leftSide[i][2] * Q[j][2];
+                QQ[i][j] = Q[i][0] * Q[j][0] + Q[i][1] * Q[j][1] + Q[i][2] * Q[j][2];
+            }
+        }
+        T detRSrad = (LQ[0][0] * LQ[1][1] - LQ[0][1] * LQ[1][0]) /
+                     (QQ[0][0] * QQ[1][1] - QQ[0][1] * QQ[1][0]);
+        if(detRSrad < 0) return T(100);
+        else if(detRSrad < 1) return T(0);
+        else return detRSrad - 1;
+    }
+
+    // Sum of the rSrad penalties of n spokes
+    static double RSradPenaltyBatch(const RSradInput *inputs, size_t n, T stepSize)
+    {
+        double penalty = 0.0;
+        for(size_t i = 0; i < n; ++i)
+        {
+            const RSradInput &in = inputs[i];
+            penalty += static_cast<double>(RSradPenalty(*in.spoke, in.neighborsU, in.numU, in.isForwardU,
+                                                        in.neighborsV, in.numV, in.isForwardV, stepSize));
+        }
+        return penalty;
+    }
+
+    // One step of mean curvature flow: move every vertex by -dt * H * N.
+    // Input: points and normals are n xyz triples, curvature holds the mean curvature per vertex
+    static void FlowVertexUpdate(T *points, const T *normals, const double *curvature, size_t n, double dt)
+    {
+        for(size_t i = 0; i < n; ++i)
+        {
+            double step = dt * curvature[i];
+            points[3 * i] = static_cast<T>(points[3 * i] - step * normals[3 * i]);
+            points[3 * i + 1] = static_cast<T>(points[3 * i + 1] - step * normals[3 * i + 1]);
+            points[3 * i + 2] = static_cast<T>(points[3 * i + 2] - step * normals[3 * i + 2]);
+        }
+    }
+
+private:
+    // shared by the float and the fixed point distance images
+    template<typename D>
+    static void SampleImageMatchImpl(const T *points, const T *dirs, const T *weights, size_t n,
+                                     const T *scale, const T *shift, T spacing,
+                                     const int *dims, int maxIndex, bool bricked,
+                                     const D *dist, T distScale, T distOffset, const float *grad,
+                                     double *imageDist, double *normalMatch)
+    {
+        const int maxX = maxIndex < dims[0] - 1 ? maxIndex : dims[0] - 1;
+        const int maxY = maxIndex < dims[1] - 1 ? maxIndex : dims[1] - 1;
+        const int maxZ = maxIndex < dims[2] - 1 ? maxIndex : dims[2] - 1;
+        const size_t sliceSize = static_cast<size_t>(dims[0]) * static_cast<size_t>(dims[1]);
+        // partial sums are kept in T for short blocks only, so long batches do not lose precision
+        const size_t blockSize = 64;
+        T sumDist = 0, sumNormal = 0;
+        for(size_t i = 0; i < n; ++i)
+        {
+            if(i % blockSize == 0)
+            {
+                *imageDist += static_cast<double>(sumDist);
+                *normalMatch += static_cast<double>(sumNormal);
+                sumDist = 0;
+                sumNormal = 0;
+            }
+            const T *pt = points + 3 * i;
+            int x = static_cast<int>((pt[0] * scale[0] + shift[0]) / spacing + T(0.5));
+            int y = static_cast<int>((pt[1] * scale[1] + shift[1]) / spacing + T(0.5));
+            int z = static_cast<int>((pt[2] * scale[2] + shift[2]) / spacing + T(0.5));
+            x = x > maxX ? maxX : (x < 0 ? 0 : x);
+            y = y > maxY ? maxY : (y < 0 ? 0 : y);
+            z = z > maxZ ? maxZ : (z < 0 ? 0 : z);
+
+            size_t voxel = bricked ? BrickedIndex(dims, x, y, z)
+                                   : static_cast<size_t>(z) * sliceSize
+                                     + static_cast<size_t>(y) * static_cast<size_t>(dims[0]) + static_cast<size_t>(x);
+            T d = static_cast<T>(dist[voxel]) * distScale + distOffset;
+            T normal[3] = {static_cast<T>(grad[3 * voxel]),
+                           static_cast<T>(grad[3 * voxel + 1]),
+                           static_cast<T>(grad[3 * voxel + 2])};
+            Normalize(normal);
+            const T *dir = dirs + 3 * i;
+            T dotProduct = normal[0] * dir[0] + normal[1] * dir[1] + normal[2] * dir[2];
+            T distSqr = d * d;
+            sumDist += weights[i] * distSqr;
+            sumNormal += weights[i] * distSqr * (1 - dotProduct);
+        }
+        *imageDist += static_cast<double>(sumDist);
+        *normalMatch += static_cast<double>(sumNormal);
+    }
+
+    template<typename D>
+    static void SampleImageMatchDispatch(const T *points, const T *dirs, const T *weights, size_t n,
+                                         const T *scale, const T *shift, T spacing,
+                                         const int *dims, int maxIndex, bool bricked, int interpolation,
+                                         const D *dist, T distScale, T distOffset, const float *grad,
+                                         double *imageDist, double *normalMatch)
+    {
+        if(interpolation == Trilinear)
+        {
+            SampleImageMatchTrilinearImpl(points, dirs, weights, n, scale, shift, spacing, dims, maxIndex, bricked,
+                                          dist, distScale, distOffset, grad, imageDist, normalMatch);
+        }
+        else if(interpolation == TricubicBSpline)
+        {
+            SampleImageMatchTricubicImpl(points, dirs, weights, n, scale, shift, spacing, dims, maxIndex, bricked,
+                                         dist, distScale, distOffset, imageDist, normalMatch);
+        }
+        else
+        {
+            SampleImageMatchImpl(points, dirs, weights, n, scale, shift, spacing, dims, maxIndex, bricked,
+                                 dist, distScale, distOffset, grad, imageDist, normalMatch);
+        }
+    }
+
+    // The interpolated kernels work on blocks of samples in structure-of-arrays form: the cells and
+    // fractions of all points of a block, then one loop over the block per voxel around the cell, which
+    // gathers that voxel for every sample and blends it in. The compilers don't emit gathers on their own
+    // for generic tuning, so the AVX2 and AVX-512 copies blend float volumes with explicit gathers of
+    // 4 and 8 samples, see GatherTrilinear and GatherTricubic. The other loops are left to the compiler.
+    enum { SampleBlock = 64 };
+
+    // Cell (first voxel of the 2x2x2 neighborhood) and fraction within it of count points along each axis.
+    // maxI is the largest voxel index per axis
+    static void BlockCells(const T *points, size_t count, const T *scale, const T *shift, T spacing,
+                           const int *maxI, int cell[3][SampleBlock], T fraction[3][SampleBlock])
+    {
+        for(int k = 0; k < 3; ++k)
+        {
+            const T maxCoord = static_cast<T>(maxI[k]);
+            // the last cell starts one voxel before the border
+            const int maxCell = maxI[k] > 0 ? maxI[k] - 1 : 0;
+            for(size_t j = 0; j < count; ++j)
+            {
+                T c = (points[3 * j + k] * scale[k] + shift[k]) / spacing;
+                c = c > maxCoord ? maxCoord : (c < T(0) ? T(0) : c);
+                int i = static_cast<int>(c);
+                i = i > maxCell ? maxCell : i;
+                cell[k][j] = i;
+                fraction[k][j] = c - static_cast<T>(i);
+            }
+        }
+    }
+
+    // Voxel indices of count samples at x, y, z
+    static void BlockVoxels(const int *dims, bool bricked, const int *x, const int *y, const int *z, size_t count,
+                            size_t *voxels)
+    {
+        if(bricked)
+        {
+            for(size_t j = 0; j < count; ++j)
+            {
+                voxels[j] = BrickedIndex(dims, x[j], y[j], z[j]);
+            }
+            return;
+        }
+        const size_t rowSize = static_cast<size_t>(dims[0]);
+        const size_t sliceSize = rowSize * static_cast<size_t>(dims[1]);
+        for(size_t j = 0; j < count; ++j)
+        {
+            voxels[j] = static_cast<size_t>(z[j]) * sliceSize + static_cast<size_t>(y[j]) * rowSize
+                        + static_cast<size_t>(x[j]);
+        }
+    }
+
+    // Image match terms of count blended samples, normals need not be normalized
+    static void AccumulateBlock(const T *d, const T normal[3][SampleBlock], const T *dirs, const T *weights,
+                                size_t count, T distScale, T distOffset, double *imageDist, double *normalMatch)
+    {
+        T sumDist = 0, sumNormal = 0;
+        for(size_t j = 0; j < count; ++j)
+        {
+            const T nx = normal[0][j], ny = normal[1][j], nz = normal[2][j];
+            const T norm = Sqrt(nx * nx + ny * ny + nz * nz);
+            const T *dir = dirs + 3 * j;
+            const T dotProduct = norm > T(0) ? (nx * dir[0] + ny * dir[1] + nz * dir[2]) / norm : T(0);
+            const T sampleDist = d[j] * distScale + distOffset;
+            const T distSqr = sampleDist * sampleDist;
+            sumDist += weights[j] * distSqr;
+            sumNormal += weights[j] * distSqr * (1 - dotProduct);
+        }
+        *imageDist += static_cast<double>(sumDist);
+        *normalMatch += static_cast<double>(sumNormal);
+    }
+
+    // Trilinear form of SampleImageMatchImpl, distances and gradients are blended from the 8 voxels around
+    // each point
+    template<typename D>
+    static void SampleImageMatchTrilinearImpl(const T *points, const T *dirs, const T *weights, size_t n,
+                                              const T *scale, const T *shift, T spacing,
+                                              const int *dims, int maxIndex, bool bricked,
+                                              const D *dist, T distScale, T distOffset, const float *grad,
+                                              double *imageDist, double *normalMatch)
+    {
+        const int maxI[3] = {maxIndex < dims[0] - 1 ? maxIndex : dims[0] - 1,
+                             maxIndex < dims[1] - 1 ? maxIndex : dims[1] - 1,
+                             maxIndex < dims[2] - 1 ? maxIndex : dims[2] - 1};
+        int cell[3][SampleBlock], corner[3][SampleBlock];
+        T fraction[3][SampleBlock], axisWeights[3][2][SampleBlock];
+        T d[SampleBlock], normal[3][SampleBlock];
+        size_t voxels[SampleBlock];
+        for(size_t begin = 0; begin < n; begin += SampleBlock)
+        {
+            const size_t count = std::min<size_t>(n - begin, SampleBlock);
+            BlockCells(points + 3 * begin, count, scale, shift, spacing, maxI, cell, fraction);
+            for(int k = 0; k < 3; ++k)
+            {
+                for(size_t j = 0; j < count; ++j)
+                {
+                    axisWeights[k][0][j] = 1 - fraction[k][j];
+                    axisWeights[k][1][j] = fraction[k][j];
+                }
+            }
+            for(size_t j = 0; j < count; ++j)
+            {
+                d[j] = 0;
+                normal[0][j] = normal[1][j] = normal[2][j] = 0;
+            }
+            for(int c = 0; c < 8; ++c)
+            {
+                const int offset[3] = {c & 1, (c >> 1) & 1, c >> 2};
+                for(int k = 0; k < 3; ++k)
+                {
+                    for(size_t j = 0; j < count; ++j)
+                    {
+                        // a single voxel along an axis is its own neighbor
+                        const int i = cell[k][j] + offset[k];
+                        corner[k][j] = i > maxI[k] ? maxI[k] : i;
+                    }
+                }
+                BlockVoxels(dims, bricked, corner[0], corner[1], corner[2], count, voxels);
+                const T *wx = axisWeights[0][offset[0]];
+                const T *wy = axisWeights[1][offset[1]];
+                const T *wz = axisWeights[2][offset[2]];
+                for(size_t j = GatherTrilinear(dist, grad, voxels, wx, wy, wz, count, d, normal); j < count; ++j)
+                {
+                    const size_t voxel = voxels[j];
+                    const T w = wx[j] * wy[j] * wz[j];
+                    d[j] += w * static_cast<T>(dist[voxel]);
+                    normal[0][j] += w * static_cast<T>(grad[3 * voxel]);
+                    normal[1][j] += w * static_cast<T>(grad[3 * voxel + 1]);
+                    normal[2][j] += w * static_cast<T>(grad[3 * voxel + 2]);
+                }
+            }
+            AccumulateBlock(d, normal, dirs + 3 * begin, weights + begin, count, distScale, distOffset,
+                            imageDist, normalMatch);
+        }
+    }
+
+    // Tricubic form of SampleImageMatchImpl: the uniform cubic B-spline through the 4x4x4 voxels around
+    // each point, with the gradient of the spline as normal, the same as vtkImageDistanceSampler.
+    // Voxels beyond the border repeat the border ones
+    template<typename D>
+    static void SampleImageMatchTricubicImpl(const T *points, const T *dirs, const T *weights, size_t n,
+                                             const T *scale, const T *shift, T spacing,
+                                             const int *dims, int maxIndex, bool bricked,
+                                             const D *dist, T distScale, T distOffset,
+                                             double *imageDist, double *normalMatch)
+    {
+        const int maxI[3] = {maxIndex < dims[0] - 1 ? maxIndex : dims[0] - 1,
+                             maxIndex < dims[1] - 1 ? maxIndex : dims[1] - 1,
+                             maxIndex < dims[2] - 1 ? maxIndex : dims[2] - 1};
+        int cell[3][SampleBlock], tap[3][4][SampleBlock];
+        T fraction[3][SampleBlock], w[3][4][SampleBlock], dw[3][4][SampleBlock];
+        T d[SampleBlock], normal[3][SampleBlock];
+        size_t voxels[SampleBlock];
+        for(size_t begin = 0; begin < n; begin += SampleBlock)
+        {
+            const size_t count = std::min<size_t>(n - begin, SampleBlock);
+            BlockCells(points + 3 * begin, count, scale, shift, spacing, maxI, cell, fraction);
+            for(int k = 0; k < 3; ++k)
+            {
+                for(size_t j = 0; j < count; ++j)
+                {
+                    const T t = fraction[k][j];
+                    const T s = 1 - t;
+                    w[k][0][j] = s * s * s / 6;
+                    w[k][1][j] = (3 * t * t * t - 6 * t * t + 4) / 6;
+                    w[k][2][j] = (-3 * t * t * t + 3 * t * t + 3 * t + 1) / 6;
+                    w[k][3][j] = t * t * t / 6;
+                    dw[k][0][j] = -s * s / 2;
+                    dw[k][1][j] = (3 * t * t - 4 * t) / 2;
+                    dw[k][2][j] = (-3 * t * t + 2 * t + 1) / 2;
+                    dw[k][3][j] = t * t / 2;
+                }
+                for(int i = 0; i < 4; ++i)
+                {
+                    for(size_t j = 0; j < count; ++j)
+                    {
+                        const int index = cell[k][j] + i - 1;
+                        tap[k][i][j] = index < 0 ? 0 : (index > maxI[k] ? maxI[k] : index);
+                    }
+                }
+            }
+            for(size_t j = 0; j < count; ++j)
+            {
+                d[j] = 0;
+                normal[0][j] = normal[1][j] = normal[2][j] = 0;
+            }
+            for(int tz = 0; tz < 4; ++tz)
+            {
+                for(int ty = 0; ty < 4; ++ty)
+                {
+                    for(int tx = 0; tx < 4; ++tx)
+                    {
+                        BlockVoxels(dims, bricked, tap[0][tx], tap[1][ty], tap[2][tz], count, voxels);
+                        const T *wx = w[0][tx], *wy = w[1][ty], *wz = w[2][tz];
+                        const T *dwx = dw[0][tx], *dwy = dw[1][ty], *dwz = dw[2][tz];
+                        const T *const tapWeights[6] = {wx, wy, wz, dwx, dwy, dwz};
+                        for(size_t j = GatherTricubic(dist, voxels, tapWeights, count, d, normal); j < count; ++j)
+                        {
+                            const T voxelDist = static_cast<T>(dist[voxels[j]]);
+                            d[j] += wx[j] * wy[j] * wz[j] * voxelDist;
+                            normal[0][j] += dwx[j] * wy[j] * wz[j] * voxelDist;
+                            normal[1][j] += wx[j] * dwy[j] * wz[j] * voxelDist;
+                            normal[2][j] += wx[j] * wy[j] * dwz[j] * voxelDist;
+                        }
+                    }
+                }
+            }
+            // the fixed point scale is positive, so the gradient of the raw values has the right direction
+            AccumulateBlock(d, normal, dirs + 3 * begin, weights + begin, count, distScale, distOffset,
+                            imageDist, normalMatch);
+        }
+    }
+
+    // Blend one voxel around each of the first samples of a block into d and normal with vector gathers:
+    // d += wx * wy * wz * dist[voxel], normal += wx * wy * wz * grad[voxel].
+    // Return the number of samples done, the caller blends the rest. Fixed point distances,
+    // double precision and the builds without gathers do none here
+    template<typename D, typename U>
+    static size_t GatherTrilinear(const D *, const float *, const size_t *, const U *, const U *, const U *,
+                                  size_t, U *, U [3][SampleBlock])
+    {
+        return 0;
+    }
+
+    static size_t GatherTrilinear(const float *dist, const float *grad, const size_t *voxels,
+                                  const float *wx, const float *wy, const float *wz, size_t count,
+                                  float *d, float normal[3][SampleBlock])
+    {
+        size_t j = 0;
+#if defined(VTK_SREP_KERNELS_GATHER) && defined(__AVX512F__)
+        for(; j + 8 <= count; j += 8)
+        {
+            const __m512i voxel = _mm512_loadu_si512(voxels + j);
+            const __m512i component = _mm512_add_epi64(_mm512_slli_epi64(voxel, 1), voxel);
+            const __m256 w = _mm256_mul_ps(_mm256_mul_ps(_mm256_loadu_ps(wx + j), _mm256_loadu_ps(wy + j)),
+                                           _mm256_loadu_ps(wz + j));
+            _mm256_storeu_ps(d + j, _mm256_fmadd_ps(w, _mm512_i64gather_ps(voxel, dist, 4), _mm256_loadu_ps(d + j)));
+            for(int k = 0; k < 3; ++k)
+            {
+                const __m256 g = _mm512_i64gather_ps(component, grad + k, 4);
+                _mm256_storeu_ps(normal[k] + j, _mm256_fmadd_ps(w, g, _mm256_loadu_ps(normal[k] + j)));
+            }
+        }
+#elif defined(VTK_SREP_KERNELS_GATHER)
+        for(; j + 4 <= count; j += 4)
+        {
+            const __m256i voxel = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(voxels + j));
+            const __m256i component = _mm256_add_epi64(_mm256_slli_epi64(voxel, 1), voxel);
+            const __m128 w = _mm_mul_ps(_mm_mul_ps(_mm_loadu_ps(wx + j), _mm_loadu_ps(wy + j)), _mm_loadu_ps(wz + j));
+            _mm_storeu_ps(d + j, _mm_fmadd_ps(w, _mm256_i64gather_ps(dist, voxel, 4), _mm_loadu_ps(d + j)));
+            for(int k = 0; k < 3; ++k)
+            {
+                const __m128 g = _mm256_i64gather_ps(grad + k, component, 4);
+                _mm_storeu_ps(normal[k] + j, _mm_fmadd_ps(w, g, _mm_loadu_ps(normal[k] + j)));
+            }
+        }
+#else
+        (void)dist; (void)grad; (void)voxels; (void)wx; (void)wy; (void)wz; (void)count; (void)d; (void)normal;
+#endif
+        return j;
+    }
+
+    // Same as GatherTrilinear for one of the 4x4x4 voxels of the B-spline. weights are wx, wy, wz and their
+    // derivatives dwx, dwy, dwz: d += wx * wy * wz * dist[voxel], normal[0] += dwx * wy * wz * dist[voxel] ...
+    template<typename D, typename U>
+    static size_t GatherTricubic(const D *, const size_t *, const U *const *, size_t, U *, U [3][SampleBlock])
+    {
+        return 0;
+    }
+
+    static size_t GatherTricubic(const float *dist, const size_t *voxels, const float *const *weights, size_t count,
+                                 float *d, float normal[3][SampleBlock])
+    {
+        size_t j = 0;
+#if defined(VTK_SREP_KERNELS_GATHER) && defined(__AVX512F__)
+        for(; j + 8 <= count; j += 8)
+        {
+            const __m256 value = _mm512_i64gather_ps(_mm512_loadu_si512(voxels + j), dist, 4);
+            const __m256 wx = _mm256_loadu_ps(weights[0] + j), wy = _mm256_loadu_ps(weights[1] + j);
+            const __m256 wz = _mm256_loadu_ps(weights[2] + j);
+            const __m256 wyz = _mm256_mul_ps(wy, wz);
+            _mm256_storeu_ps(d + j, _mm256_fmadd_ps(_mm256_mul_ps(wx, wyz), value, _mm256_loadu_ps(d + j)));
+            const __m256 dx = _mm256_mul_ps(_mm256_loadu_ps(weights[3] + j), wyz);
+            const __m256 dy = _mm256_mul_ps(_mm256_mul_ps(wx, _mm256_loadu_ps(weights[4] + j)), wz);
+            const __m256 dz = _mm256_mul_ps(_mm256_mul_ps(wx, wy), _mm256_loadu_ps(weights[5] + j));
+            _mm256_storeu_ps(normal[0] + j, _mm256_fmadd_ps(dx, value, _mm256_loadu_ps(normal[0] + j)));
+            _mm256_storeu_ps(normal[1] + j, _mm256_fmadd_ps(dy, value, _mm256_loadu_ps(normal[1] + j)));
+            _mm256_storeu_ps(normal[2] + j, _mm256_fmadd_ps(dz, value, _mm256_loadu_ps(normal[2] + j)));
+        }
+#elif defined(VTK_SREP_KERNELS_GATHER)
+        for(; j + 4 <= count; j += 4)
+        {
+            const __m256i voxel = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(voxels + j));
+            const __m128 value = _mm256_i64gather_ps(dist, voxel, 4);
+            const __m128 wx = _mm_loadu_ps(weights[0] + j), wy = _mm_loadu_ps(weights[1] + j);
+            const __m128 wz = _mm_loadu_ps(weights[2] + j);
+            const __m128 wyz = _mm_mul_ps(wy, wz);
+            _mm_storeu_ps(d + j, _mm_fmadd_ps(_mm_mul_ps(wx, wyz), value, _mm_loadu_ps(d + j)));
+            const __m128 dx = _mm_mul_ps(_mm_loadu_ps(weights[3] + j), wyz);
+            const __m128 dy = _mm_mul_ps(_mm_mul_ps(wx, _mm_loadu_ps(weights[4] + j)), wz);
+            const __m128 dz = _mm_mul_ps(_mm_mul_ps(wx, wy), _mm_loadu_ps(weights[5] + j));
+            _mm_storeu_ps(normal[0] + j, _mm_fmadd_ps(dx, value, _mm_loadu_ps(normal[0] + j)));
+            _mm_storeu_ps(normal[1] + j, _mm_fmadd_ps(dy, value, _mm_loadu_ps(normal[1] + j)));
+            _mm_storeu_ps(normal[2] + j, _mm_fmadd_ps(dz, value, _mm_loadu_ps(normal[2] + j)));
+        }
+#else
+        (void)dist; (void)voxels; (void)weights; (void)count; (void)d; (void)normal;
+#endif
+        return j;
+    }
+
+    // vtkBrickedLayout::Index, repeated here so that each instruction set gets its own copy
+    static size_t BrickedIndex(const int *dims, int x, int y, int z)
+    {
+        const int brickSize = vtkBrickedLayout::BrickSize;
+        const size_t brick = (static_cast<size_t>(z / brickSize) * static_cast<size_t>(dims[1] / brickSize)
+                              + static_cast<size_t>(y / brickSize)) * static_cast<size_t>(dims[0] / brickSize)
+                           + static_cast<size_t>(x / brickSize);
+        const size_t inBrick = (static_cast<size_t>(z % brickSize) * brickSize + static_cast<size_t>(y % brickSize))
+                               * brickSize + static_cast<size_t>(x % brickSize);
+        return brick * vtkBrickedLayout::BrickVoxels + inBrick;
+    }
+
+    static float Sqrt(float x) { return sqrtf(x); }
+    static double Sqrt(double x) { return sqrt(x); }
+    static float Acos(float x) { return acosf(x); }
+    static double Acos(double x) { return acos(x); }
+    static float Sin(float x) { return sinf(x); }
+    static double Sin(double x) { return sin(x); }
+    static float Abs(float x) { return fabsf(x); }
+    static double Abs(double x) { return fabs(x); }
+
+    static T Tolerance()
+    {
+        return T(1e-6);
+    }
+
+    static void HermiteBasis(T s, T *h)
+    {
+        h[0] = 2 * (s * s * s) - 3 * (s * s) + 1;
+        h[1] = -2 * (s * s * s) + 3 * (s * s);
+        h[2] = (s * s * s) - 2 * (s * s) + s;
+        h[3] = (s * s * s) - (s * s);
+    }
+
+    static void Compute2ndDerivative(const T *startU, const T *endU, const T *targetU, T d, T del, T *output)
+    {
+        T Upv1[3], Upv5[3];
+        Slerp(startU, endU, d + 2 * del, Upv1);
+        Slerp(startU, endU, d - 2 * del, Upv5);
+        for(int k = 0; k < 3; ++k)
+        {
+            output[k] = T(0.25) * (Upv5[k] + Upv1[k] - 2 * targetU[k]);
+        }
+    }
+
+    static void ComputeDerivatives(const Spoke &spoke, const Spoke *const *neighbors, int num, bool isForward,
+                                   T stepSize, T *dxdu, T *dSdu, T *drdu)
+    {
+        if(num == 1)
+        {
+            const Spoke &n = *neighbors[0];
+            T sign = isForward ? T(1) : T(-1);
+            for(int k = 0; k < 3; ++k)
+            {
+                dxdu[k] = sign * (n.point[k] - spoke.point[k]) / stepSize;
+                dSdu[k] = sign * (n.radius * n.dir[k] - spoke.radius * spoke.dir[k]) / stepSize;
+            }
+            *drdu = sign * (n.radius - spoke.radius) / stepSize;
+        }
+        else if(num == 2)
+        {
+            const Spoke &n0 = *neighbors[0];
+            const Spoke &n1 = *neighbors[1];
+            for(int k = 0; k < 3; ++k)
+            {
+                // vtkSpoke does not scale the central difference of S by the step
+                dSdu[k] = n1.radius * n1.dir[k] - n0.radius * n0.dir[k];
+                dxdu[k] = (n1.point[k] - n0.point[k]) / stepSize / 2;
+            }
+            *drdu = (n1.radius - n0.radius) / stepSize / 2;
+        }
+    }
+};
+
+#endif // VTKSREPKERNELS_H
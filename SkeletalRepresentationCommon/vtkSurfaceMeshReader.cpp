@@ -0,0 +1,828 @@
+/*==============================================================================
+
+  Program: 3D Slicer
+
+  Portions (c) Copyright Brigham and Women's Hospital (BWH) All Rights Reserved.
+
+  See COPYRIGHT.txt
+  or http://www.slicer.org/copyright/copyright.txt for details.
+
+  Unless required by applicable law or agreed to in writing, software
+  distributed under the License is distributed on an "AS IS" BASIS,
+  WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+  See the License for the specific language governing permissions and
+  limitations under the License.
+
+==============================================================================*/
+
+#include "vtkSurfaceMeshReader.h"
+
+#include <vtkCellArray.h>
+#include <vtkDoubleArray.h>
+#include <vtkFloatArray.h>
+#include <vtkIdTypeArray.h>
+#include <vtkPLYReader.h>
+#include <vtkPointData.h>
+#include <vtkPoints.h>
+#include <vtkPolyData.h>
+#include <vtkPolyDataReader.h>
+#include <vtkSTLReader.h>
+#include <vtkVersion.h>
+#include <vtkXMLPolyDataReader.h>
+#include <vtksys/SystemTools.hxx>
+
+#include <algorithm>
+#include <iostream>
+#include <math.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <thread>
+#include <unordered_map>
+#include <vector>
+
+namespace
+{
+// below this many bytes the numbers are parsed on one thread
+const size_t ParallelBlockSize = 1 << 20;
+
+inline bool IsSpace(char c)
+{
+    return c == ' ' || c == '\t' || c == '\n' || c == '\r';
+}
+
+inline bool IsDigit(char c)
+{
+    return c >= '0' && c <= '9';
+}
+
+// position in the text of a legacy file
+struct Cursor
+{
+    const char *pos;
+    const char *end;
+};
+
+// next word separated by whitespace, empty at the end
+std::string NextWord(Cursor &c)
+{
+    while(c.pos < c.end && IsSpace(*c.pos))
+    {
+        ++c.pos;
+    }
+    const char *begin = c.pos;
+    while(c.pos < c.end && !IsSpace(*c.pos))
+    {
+        ++c.pos;
+    }
+    return std::string(begin, c.pos);
+}
+
+// skip past the next newline
+void SkipLine(Cursor &c)
+{
+    const void *newline = memchr(c.pos, '\n', static_cast<size_t>(c.end - c.pos));
+    c.pos = newline ? static_cast<const char*>(newline) + 1 : c.end;
+}
+
+// Scan the decimal number at p, it has to end at whitespace or end, into up to 19 significant digits
+// and a power of ten. Return the position after it, nullptr if there is none
+const char *ScanNumber(const char *p, const char *end, bool *negative, uint64_t *mantissa, int *exponent)
+{
+    *negative = false;
+    if(p < end && (*p == '-' || *p == '+'))
+    {
+        *negative = *p == '-';
+        ++p;
+    }
+    // digits beyond the 19th only scale the number
+    *mantissa = 0;
+    *exponent = 0;
+    int numDigits = 0;
+    for(; p < end && IsDigit(*p); ++p, ++numDigits)
+    {
+        if(*mantissa < 1000000000000000000ULL)
+        {
+            *mantissa = *mantissa * 10 + static_cast<uint64_t>(*p - '0');
+        }
+        else
+        {
+            ++*exponent;
+        }
+    }
+    if(p < end && *p == '.')
+    {
+        for(++p; p < end && IsDigit(*p); ++p, ++numDigits)
+        {
+            if(*mantissa < 1000000000000000000ULL)
+            {
+                *mantissa = *mantissa * 10 + static_cast<uint64_t>(*p - '0');
+                --*exponent;
+            }
+        }
+    }
+    if(numDigits == 0)
+    {
+        return nullptr;
+    }
+    if(p < end && (*p == 'e' || *p == 'E'))
+    {
+        ++p;
+        bool negativeExponent = false;
+        if(p < end && (*p == '-' || *p == '+'))
+        {
+            negativeExponent = *p == '-';
+            ++p;
+        }
+        int e = 0;
+        const char *exponentBegin = p;
+        for(; p < end && IsDigit(*p); ++p)
+        {
+            e = std::min(e * 10 + (*p - '0'), 100000);
+        }
+        if(p == exponentBegin)
+        {
+            return nullptr;
+        }
+        *exponent += negativeExponent ? -e : e;
+    }
+    if(p < end && !IsSpace(*p))
+    {
+        return nullptr;
+    }
+    return p;
+}
+
+// The mantissa and the power of ten are exact in T, one multiplication or division rounds correctly then
+inline bool ExactValue(uint64_t mantissa, int exponent, double *value)
+{
+    static const double powers[] = {1e0, 1e1, 1e2, 1e3, 1e4, 1e5, 1e6, 1e7, 1e8, 1e9, 1e10, 1e11,
+                                    1e12, 1e13, 1e14, 1e15, 1e16, 1e17, 1e18, 1e19, 1e20, 1e21, 1e22};
+    if(mantissa > (1ULL << 53) || exponent < -22 || exponent > 22)
+    {
+        return false;
+    }
+    const double v = static_cast<double>(mantissa);
+    *value = exponent < 0 ? v / powers[-exponent] : v * powers[exponent];
+    return true;
+}
+
+inline bool ExactValue(uint64_t mantissa, int exponent, float *value)
+{
+    static const float powers[] = {1e0f, 1e1f, 1e2f, 1e3f, 1e4f, 1e5f, 1e6f, 1e7f, 1e8f, 1e9f, 1e10f};
+    if(mantissa > (1ULL << 24) || exponent < -10 || exponent > 10)
+    {
+        return false;
+    }
+    const float v = static_cast<float>(mantissa);
+    *value = exponent < 0 ? v / powers[-exponent] : v * powers[exponent];
+    return true;
+}
+
+inline double ConvertText(const char *text, char **textEnd, double *)
+{
+    return strtod(text, textEnd);
+}
+
+inline float ConvertText(const char *text, char **textEnd, float *)
+{
+    return strtof(text, textEnd);
+}
+
+// Parse the decimal number at p into the nearest float or double, it has to end at whitespace or end.
+// Return the position after it, nullptr if there is none
+template<typename T>
+const char *ParseReal(const char *p, const char *end, T *value)
+{
+    bool negative;
+    uint64_t mantissa;
+    int exponent;
+    const char *numberEnd = ScanNumber(p, end, &negative, &mantissa, &exponent);
+    if(numberEnd == nullptr)
+    {
+        return nullptr;
+    }
+    T v;
+    if(ExactValue(mantissa, exponent, &v))
+    {
+        *value = negative ? -v : v;
+        return numberEnd;
+    }
+    // more digits or a larger power of ten than the fast path takes: the C library rounds correctly.
+    // Another decimal point than '.' in the numeric locale stops it early, the file goes to the VTK reader then
+    const std::string text(p, numberEnd);
+    char *textEnd = nullptr;
+    *value = ConvertText(text.c_str(), &textEnd, value);
+    return textEnd == text.c_str() + text.size() ? numberEnd : nullptr;
+}
+
+const char *ParseNumber(const char *p, const char *end, double *value)
+{
+    return ParseReal(p, end, value);
+}
+
+const char *ParseNumber(const char *p, const char *end, float *value)
+{
+    return ParseReal(p, end, value);
+}
+
+// ids and offsets
+template<typename T>
+const char *ParseNumber(const char *p, const char *end, T *value)
+{
+    double v = 0.0;
+    p = ParseReal(p, end, &v);
+    *value = static_cast<T>(v);
+    return p;
+}
+
+// the start of the first line from p on that begins with a letter, the next keyword, or end
+const char *FindBlockEnd(const char *p, const char *end)
+{
+    while(p < end)
+    {
+        const char *first = p;
+        while(first < end && (*first == ' ' || *first == '\t'))
+        {
+            ++first;
+        }
+        if(first < end && ((*first >= 'A' && *first <= 'Z') || (*first >= 'a' && *first <= 'z')))
+        {
+            return p;
+        }
+        const void *newline = memchr(p, '\n', static_cast<size_t>(end - p));
+        p = newline ? static_cast<const char*>(newline) + 1 : end;
+    }
+    return end;
+}
+
+// run work(t) for t in [0, numThreads), t = 0 on the calling thread
+template<typename Work>
+void RunThreads(unsigned int numThreads, Work work)
+{
+    std::vector<std::thread> threads;
+    for(unsigned int t = 1; t < numThreads; ++t)
+    {
+        threads.push_back(std::thread(work, t));
+    }
+    work(0u);
+    for(size_t t = 0; t < threads.size(); ++t)
+    {
+        threads[t].join();
+    }
+}
+
+// Parse the numbers in [begin, end) on numThreads threads, the text is split at whitespace.
+// Return false unless there are exactly count valid numbers
+template<typename T>
+bool ParseNumbers(const char *begin, const char *end, size_t count, T *output, unsigned int numThreads)
+{
+    const size_t length = static_cast<size_t>(end - begin);
+    numThreads = length < ParallelBlockSize ? 1u : std::max(1u, numThreads);
+    std::vector<const char*> bounds(numThreads + 1, end);
+    bounds[0] = begin;
+    for(unsigned int t = 1; t < numThreads; ++t)
+    {
+        const char *p = std::max(bounds[t - 1], begin + length / numThreads * t);
+        while(p < end && !IsSpace(*p))
+        {
+            ++p;
+        }
+        bounds[t] = p;
+    }
+
+    // 1. count the numbers of each chunk to know where its values go
+    std::vector<size_t> first(numThreads + 1, 0);
+    RunThreads(numThreads, [&](unsigned int t)
+    {
+        size_t n = 0;
+        bool inWord = false;
+        for(const char *p = bounds[t]; p < bounds[t + 1]; ++p)
+        {
+            const bool space = IsSpace(*p);
+            n += !space && !inWord;
+            inWord = !space;
+        }
+        first[t + 1] = n;
+    });
+    for(unsigned int t = 0; t < numThreads; ++t)
+    {
+        first[t + 1] += first[t];
+    }
+    if(first[numThreads] != count)
+    {
+        return false;
+    }
+
+    // 2. parse each chunk into its place
+    std::vector<char> valid(numThreads, 1);
+    RunThreads(numThreads, [&](unsigned int t)
+    {
+        T *out = output + first[t];
+        const char *p = bounds[t];
+        const char *chunkEnd = bounds[t + 1];
+        while(true)
+        {
+            while(p < chunkEnd && IsSpace(*p))
+            {
+                ++p;
+            }
+            if(p == chunkEnd)
+            {
+                return;
+            }
+            p = ParseNumber(p, chunkEnd, out++);
+            if(p == nullptr)
+            {
+                valid[t] = 0;
+                return;
+            }
+        }
+    });
+    return std::find(valid.begin(), valid.end(), 0) == valid.end();
+}
+
+inline bool IsLittleEndianHost()
+{
+    const uint16_t one = 1;
+    return *reinterpret_cast<const unsigned char*>(&one) == 1;
+}
+
+// a value of type T stored at p in the given byte order
+template<typename T>
+inline T ReadValue(const char *p, bool bigEndian)
+{
+    char bytes[sizeof(T)];
+    memcpy(bytes, p, sizeof(T));
+    if(bigEndian == IsLittleEndianHost())
+    {
+        std::reverse(bytes, bytes + sizeof(T));
+    }
+    T value;
+    memcpy(&value, bytes, sizeof(T));
+    return value;
+}
+
+template<typename T, typename FileType>
+void ConvertBinary(const char *p, size_t count, T *output)
+{
+    for(size_t i = 0; i < count; ++i)
+    {
+        output[i] = static_cast<T>(ReadValue<FileType>(p + i * sizeof(FileType), true));
+    }
+}
+
+// Read count values of fileType after a keyword line, big endian if binary, and move the cursor past them
+template<typename T>
+bool ReadValues(Cursor &c, bool binary, const std::string &fileType, size_t count, T *output,
+                unsigned int numThreads)
+{
+    if(!binary)
+    {
+        const char *blockEnd = FindBlockEnd(c.pos, c.end);
+        if(!ParseNumbers(c.pos, blockEnd, count, output, numThreads))
+        {
+            return false;
+        }
+        c.pos = blockEnd;
+        return true;
+    }
+
+    size_t width = 0;
+    if(fileType == "float" || fileType == "int" || fileType == "vtktypeint32")
+    {
+        width = 4;
+    }
+    else if(fileType == "double" || fileType == "vtktypeint64")
+    {
+        width = 8;
+    }
+    if(width == 0 || static_cast<size_t>(c.end - c.pos) / width < count)
+    {
+        return false;
+    }
+    if(fileType == "float")
+    {
+        ConvertBinary<T, float>(c.pos, count, output);
+    }
+    else if(fileType == "double")
+    {
+        ConvertBinary<T, double>(c.pos, count, output);
+    }
+    else if(width == 4)
+    {
+        ConvertBinary<T, int32_t>(c.pos, count, output);
+    }
+    else
+    {
+        ConvertBinary<T, int64_t>(c.pos, count, output);
+    }
+    c.pos += count * width;
+    return true;
+}
+
+// points or normals of fileType, float or double
+vtkSmartPointer<vtkDataArray> ReadVectors(Cursor &c, bool binary, const std::string &fileType, vtkIdType numTuples,
+                                          unsigned int numThreads)
+{
+    const size_t count = 3 * static_cast<size_t>(numTuples);
+    if(fileType == "float")
+    {
+        vtkSmartPointer<vtkFloatArray> array = vtkSmartPointer<vtkFloatArray>::New();
+        array->SetNumberOfComponents(3);
+        array->SetNumberOfTuples(numTuples);
+        if(ReadValues(c, binary, fileType, count, array->GetPointer(0), numThreads))
+        {
+            return array;
+        }
+    }
+    else if(fileType == "double")
+    {
+        vtkSmartPointer<vtkDoubleArray> array = vtkSmartPointer<vtkDoubleArray>::New();
+        array->SetNumberOfComponents(3);
+        array->SetNumberOfTuples(numTuples);
+        if(ReadValues(c, binary, fileType, count, array->GetPointer(0), numThreads))
+        {
+            return array;
+        }
+    }
+    return nullptr;
+}
+
+// cells from offsets into connectivity. Return false if they don't fit together or refer to missing points
+bool MakeCells(const std::vector<vtkIdType> &offsets, const std::vector<vtkIdType> &connectivity, vtkIdType numPoints,
+               vtkCellArray *cells)
+{
+    if(offsets.empty() || offsets.front() != 0 || offsets.back() != static_cast<vtkIdType>(connectivity.size()))
+    {
+        return false;
+    }
+    for(size_t i = 1; i < offsets.size(); ++i)
+    {
+        if(offsets[i] < offsets[i - 1])
+        {
+            return false;
+        }
+    }
+    for(size_t i = 0; i < connectivity.size(); ++i)
+    {
+        if(connectivity[i] < 0 || connectivity[i] >= numPoints)
+        {
+            return false;
+        }
+    }
+    const vtkIdType numCells = static_cast<vtkIdType>(offsets.size()) - 1;
+#if VTK_MAJOR_VERSION >= 9
+    vtkSmartPointer<vtkIdTypeArray> offsetArray = vtkSmartPointer<vtkIdTypeArray>::New();
+    offsetArray->SetNumberOfValues(numCells + 1);
+    std::copy(offsets.begin(), offsets.end(), offsetArray->GetPointer(0));
+    vtkSmartPointer<vtkIdTypeArray> connectivityArray = vtkSmartPointer<vtkIdTypeArray>::New();
+    connectivityArray->SetNumberOfValues(static_cast<vtkIdType>(connectivity.size()));
+    std::copy(connectivity.begin(), connectivity.end(), connectivityArray->GetPointer(0));
+    cells->SetData(offsetArray, connectivityArray);
+#else
+    // the legacy layout: the number of points of each cell followed by its point ids
+    vtkSmartPointer<vtkIdTypeArray> legacy = vtkSmartPointer<vtkIdTypeArray>::New();
+    legacy->SetNumberOfValues(numCells + static_cast<vtkIdType>(connectivity.size()));
+    vtkIdType *out = legacy->GetPointer(0);
+    for(vtkIdType i = 0; i < numCells; ++i)
+    {
+        *out++ = offsets[i + 1] - offsets[i];
+        out = std::copy(connectivity.begin() + offsets[i], connectivity.begin() + offsets[i + 1], out);
+    }
+    cells->SetCells(numCells, legacy);
+#endif
+    return true;
+}
+
+// bits of a point of an STL file, equal corners are merged.
+// -0 is stored as +0, the two compare equal as the floats vtkSTLReader merges do
+struct StlPoint
+{
+    uint32_t bits[3];
+
+    bool operator==(const StlPoint &other) const
+    {
+        return bits[0] == other.bits[0] && bits[1] == other.bits[1] && bits[2] == other.bits[2];
+    }
+};
+
+struct StlPointHash
+{
+    size_t operator()(const StlPoint &p) const
+    {
+        uint64_t h = p.bits[0];
+        h = h * 0x9E3779B97F4A7C15ULL + p.bits[1];
+        h = h * 0x9E3779B97F4A7C15ULL + p.bits[2];
+        return static_cast<size_t>(h ^ (h >> 29));
+    }
+};
+}
+
+vtkSurfaceMeshReader::vtkSurfaceMeshReader()
+{
+}
+
+vtkSmartPointer<vtkPolyData> vtkSurfaceMeshReader::Get(const std::string &fileName)
+{
+    const vtkMappedFile::Stamp stamp = vtkMappedFile::GetStamp(fileName);
+    std::map<std::string, Entry>::const_iterator found = mMeshes.find(fileName);
+    if(found != mMeshes.end() && found->second.FileStamp == stamp)
+    {
+        return found->second.Mesh;
+    }
+
+    vtkSmartPointer<vtkPolyData> mesh = Read(fileName);
+    if(mesh->GetNumberOfPoints() > 0)
+    {
+        Entry entry;
+        entry.Mesh = mesh;
+        entry.FileStamp = stamp;
+        mMeshes[fileName] = entry;
+    }
+    else
+    {
+        mMeshes.erase(fileName);
+    }
+    return mesh;
+}
+
+void vtkSurfaceMeshReader::Clear()
+{
+    mMeshes.clear();
+}
+
+vtkSmartPointer<vtkPolyData> vtkSurfaceMeshReader::Read(const std::string &fileName)
+{
+    vtkSmartPointer<vtkPolyData> mesh = vtkSmartPointer<vtkPolyData>::New();
+    if(!vtksys::SystemTools::FileExists(fileName, true))
+    {
+        std::cerr << "The mesh file " << fileName << " doesn't exist." << std::endl;
+        return mesh;
+    }
+
+    const std::string extension = vtksys::SystemTools::LowerCase(
+                vtksys::SystemTools::GetFilenameLastExtension(fileName));
+    if(extension == ".vtp")
+    {
+        vtkSmartPointer<vtkXMLPolyDataReader> reader = vtkSmartPointer<vtkXMLPolyDataReader>::New();
+        reader->SetFileName(fileName.c_str());
+        reader->Update();
+        mesh = reader->GetOutput();
+    }
+    else if(extension == ".ply")
+    {
+        vtkSmartPointer<vtkPLYReader> reader = vtkSmartPointer<vtkPLYReader>::New();
+        reader->SetFileName(fileName.c_str());
+        reader->Update();
+        mesh = reader->GetOutput();
+    }
+    else if(extension == ".stl")
+    {
+        vtkMappedFile file;
+        if(!file.Open(fileName) || !ParseBinaryStl(file.GetData(), file.GetSize(), mesh))
+        {
+            // ASCII
+            vtkSmartPointer<vtkSTLReader> reader = vtkSmartPointer<vtkSTLReader>::New();
+            reader->SetFileName(fileName.c_str());
+            reader->Update();
+            mesh = reader->GetOutput();
+        }
+    }
+    else
+    {
+        vtkMappedFile file;
+        if(!file.Open(fileName)
+           || !ParseLegacy(file.GetData(), file.GetSize(), mesh, std::thread::hardware_concurrency()))
+        {
+            vtkSmartPointer<vtkPolyDataReader> reader = vtkSmartPointer<vtkPolyDataReader>::New();
+            reader->SetFileName(fileName.c_str());
+            reader->Update();
+            mesh = reader->GetOutput();
+        }
+    }
+    if(mesh->GetNumberOfPoints() == 0)
+    {
+        std::cerr << "No mesh could be read from " << fileName << std::endl;
+    }
+    return mesh;
+}
+
+bool vtkSurfaceMeshReader::ParseLegacy(const char *data, size_t size, vtkPolyData *output, unsigned int numThreads)
+{
+    // header: version, title, ASCII or BINARY, dataset type
+    const char signature[] = "# vtk DataFile Version";
+    const size_t signatureLength = sizeof(signature) - 1;
+    if(size < signatureLength || strncmp(data, signature, signatureLength) != 0)
+    {
+        return false;
+    }
+    Cursor c = {data + signatureLength, data + size};
+    // version 5 files store cells as offsets and connectivity
+    const bool offsetCells = atof(NextWord(c).c_str()) >= 5.0;
+    SkipLine(c);
+    SkipLine(c);
+    const std::string format = NextWord(c);
+    if(format != "ASCII" && format != "BINARY")
+    {
+        return false;
+    }
+    const bool binary = format == "BINARY";
+    if(NextWord(c) != "DATASET" || NextWord(c) != "POLYDATA")
+    {
+        return false;
+    }
+
+    vtkSmartPointer<vtkDataArray> coordinates;
+    vtkSmartPointer<vtkCellArray> polys;
+    vtkSmartPointer<vtkDataArray> normals;
+    std::string normalsName;
+    vtkIdType numPoints = -1;
+    for(std::string keyword = NextWord(c); !keyword.empty(); keyword = NextWord(c))
+    {
+        if(keyword == "POINTS" && !coordinates)
+        {
+            numPoints = atoll(NextWord(c).c_str());
+            const std::string type = NextWord(c);
+            SkipLine(c);
+            coordinates = numPoints >= 0 ? ReadVectors(c, binary, type, numPoints, numThreads) : nullptr;
+            if(!coordinates)
+            {
+                return false;
+            }
+        }
+        else if(keyword == "POLYGONS" && coordinates && !polys)
+        {
+            const long long first = atoll(NextWord(c).c_str());
+            const long long second = atoll(NextWord(c).c_str());
+            SkipLine(c);
+            if(first < 0 || second < 0)
+            {
+                return false;
+            }
+            std::vector<vtkIdType> offsets, connectivity;
+            if(offsetCells)
+            {
+                // POLYGONS numOffsets connectivitySize, then the two arrays
+                offsets.resize(static_cast<size_t>(first));
+                connectivity.resize(static_cast<size_t>(second));
+                if(NextWord(c) != "OFFSETS")
+                {
+                    return false;
+                }
+                std::string type = NextWord(c);
+                SkipLine(c);
+                if(!ReadValues(c, binary, type, offsets.size(), offsets.data(), numThreads)
+                   || NextWord(c) != "CONNECTIVITY")
+                {
+                    return false;
+                }
+                type = NextWord(c);
+                SkipLine(c);
+                if(!ReadValues(c, binary, type, connectivity.size(), connectivity.data(), numThreads))
+                {
+                    return false;
+                }
+            }
+            else
+            {
+                // POLYGONS numCells size, then the number of points of each cell followed by its ids
+                std::vector<vtkIdType> legacy(static_cast<size_t>(second));
+                if(!ReadValues(c, binary, "int", legacy.size(), legacy.data(), numThreads))
+                {
+                    return false;
+                }
+                offsets.reserve(static_cast<size_t>(first) + 1);
+                offsets.push_back(0);
+                connectivity.reserve(legacy.size());
+                for(size_t i = 0; i < legacy.size(); i += static_cast<size_t>(legacy[i]) + 1)
+                {
+                    if(legacy[i] < 0 || legacy.size() - i - 1 < static_cast<size_t>(legacy[i]))
+                    {
+                        return false;
+                    }
+                    connectivity.insert(connectivity.end(), legacy.begin() + static_cast<ptrdiff_t>(i) + 1,
+                                        legacy.begin() + static_cast<ptrdiff_t>(i + 1 + legacy[i]));
+                    offsets.push_back(static_cast<vtkIdType>(connectivity.size()));
+                }
+                if(offsets.size() != static_cast<size_t>(first) + 1)
+                {
+                    return false;
+                }
+            }
+            polys = vtkSmartPointer<vtkCellArray>::New();
+            if(!MakeCells(offsets, connectivity, numPoints, polys))
+            {
+                return false;
+            }
+        }
+        else if(keyword == "POINT_DATA" && coordinates && !normals)
+        {
+            // only point normals are read here
+            if(atoll(NextWord(c).c_str()) != numPoints || NextWord(c) != "NORMALS")
+            {
+                return false;
+            }
+            normalsName = NextWord(c);
+            const std::string type = NextWord(c);
+            SkipLine(c);
+            normals = ReadVectors(c, binary, type, numPoints, numThreads);
+            if(!normals)
+            {
+                return false;
+            }
+        }
+        else
+        {
+            return false;
+        }
+    }
+    if(!coordinates)
+    {
+        return false;
+    }
+
+    vtkSmartPointer<vtkPoints> points = vtkSmartPointer<vtkPoints>::New();
+    points->SetData(coordinates);
+    output->Initialize();
+    output->SetPoints(points);
+    if(polys)
+    {
+        output->SetPolys(polys);
+    }
+    if(normals)
+    {
+        normals->SetName(normalsName.c_str());
+        output->GetPointData()->SetNormals(normals);
+    }
+    return true;
+}
+
+bool vtkSurfaceMeshReader::ParseBinaryStl(const char *data, size_t size, vtkPolyData *output)
+{
+    // 80 bytes of header, the number of triangles, then per triangle its normal, 3 corners and 2 bytes
+    const size_t headerSize = 84, triangleSize = 50;
+    if(size < headerSize)
+    {
+        return false;
+    }
+    const size_t numTriangles = ReadValue<uint32_t>(data + 80, false);
+    if(size != headerSize + numTriangles * triangleSize)
+    {
+        return false;
+    }
+
+    std::unordered_map<StlPoint, vtkIdType, StlPointHash> pointIds;
+    pointIds.reserve(numTriangles);
+    std::vector<float> coordinates;
+    coordinates.reserve(3 * numTriangles);
+    std::vector<vtkIdType> offsets(1, 0), connectivity;
+    connectivity.reserve(3 * numTriangles);
+    for(size_t t = 0; t < numTriangles; ++t)
+    {
+        const char *corners = data + headerSize + t * triangleSize + 12;
+        vtkIdType ids[3];
+        for(int k = 0; k < 3; ++k)
+        {
+            StlPoint point;
+            uint32_t bits[3];
+            for(int a = 0; a < 3; ++a)
+            {
+                bits[a] = ReadValue<uint32_t>(corners + 12 * k + 4 * a, false);
+                point.bits[a] = bits[a] == 0x80000000u ? 0u : bits[a];
+            }
+            const std::pair<std::unordered_map<StlPoint, vtkIdType, StlPointHash>::iterator, bool> inserted =
+                    pointIds.insert(std::make_pair(point, static_cast<vtkIdType>(coordinates.size() / 3)));
+            // the first of the merged corners gives the coordinates
+            if(inserted.second)
+            {
+                for(int a = 0; a < 3; ++a)
+                {
+                    float value;
+                    memcpy(&value, &bits[a], sizeof(float));
+                    coordinates.push_back(value);
+                }
+            }
+            ids[k] = inserted.first->second;
+        }
+        // triangles collapsed by merging are dropped, as vtkSTLReader does
+        if(ids[0] != ids[1] && ids[1] != ids[2] && ids[0] != ids[2])
+        {
+            connectivity.insert(connectivity.end(), ids, ids + 3);
+            offsets.push_back(static_cast<vtkIdType>(connectivity.size()));
+        }
+    }
+
+    vtkSmartPointer<vtkFloatArray> coordinateArray = vtkSmartPointer<vtkFloatArray>::New();
+    coordinateArray->SetNumberOfComponents(3);
+    coordinateArray->SetNumberOfTuples(static_cast<vtkIdType>(coordinates.size() / 3));
+    std::copy(coordinates.begin(), coordinates.end(), coordinateArray->GetPointer(0));
+    vtkSmartPointer<vtkCellArray> polys = vtkSmartPointer<vtkCellArray>::New();
+    MakeCells(offsets, connectivity, coordinateArray->GetNumberOfTuples(), polys);
+    vtkSmartPointer<vtkPoints> points = vtkSmartPointer<vtkPoints>::New();
+    points->SetData(coordinateArray);
+    output->Initialize();
+    output->SetPoints(points);
+    output->SetPolys(polys);
+    return true;
+}
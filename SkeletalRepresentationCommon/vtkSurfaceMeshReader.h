@@ -0,0 +1,73 @@
+/*==============================================================================
+
+  Program: 3D Slicer
+
+  Portions (c) Copyright Brigham and Women's Hospital (BWH) All Rights Reserved.
+
+  See COPYRIGHT.txt
+  or http://www.slicer.org/copyright/copyright.txt for details.
+
+  Unless required by applicable law or agreed to in writing, software
+  distributed under the License is distributed on an "AS IS" BASIS,
+  WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+  See the License for the specific language governing permissions and
+  limitations under the License.
+
+==============================================================================*/
+
+#ifndef VTKSURFACEMESHREADER_H
+#define VTKSURFACEMESHREADER_H
+
+#include "vtkSlicerSkeletalRepresentationCommonExport.h"
+#include "vtkMappedFile.h"
+
+#include <vtkSmartPointer.h>
+
+#include <map>
+#include <stddef.h>
+#include <string>
+
+class vtkPolyData;
+
+/**
+ * @brief The vtkSurfaceMeshReader class
+ * Reads the surface meshes of the initializer and the refiner: legacy .vtk files, ASCII or binary,
+ * .vtp, .stl and .ply. Legacy files and binary .stl files are memory mapped and parsed here,
+ * the numbers of ASCII legacy files on several threads. Legacy files with more than points,
+ * polygons and point normals, ASCII .stl, .vtp and .ply files go to the VTK readers.
+ * An instance keeps the meshes it has read, so every step of a logic shares one read of a file.
+ */
+class VTK_SLICER_SKELETALREPRESENTATIONCOMMON_EXPORT vtkSurfaceMeshReader
+{
+public:
+    vtkSurfaceMeshReader();
+
+    // The mesh in fileName, read unless this instance has read the same file unchanged before.
+    // The mesh is shared, copy it before changing it. Not thread safe.
+    // An empty mesh if the file can't be read
+    vtkSmartPointer<vtkPolyData> Get(const std::string &fileName);
+
+    // forget the meshes read so far
+    void Clear();
+
+    // Read fileName without keeping the mesh. An empty mesh if the file can't be read
+    static vtkSmartPointer<vtkPolyData> Read(const std::string &fileName);
+
+    // Parse a legacy VTK polydata file in memory.
+    // Return false if it has other content than points, polygons and point normals, output is unchanged then
+    static bool ParseLegacy(const char *data, size_t size, vtkPolyData *output, unsigned int numThreads);
+
+    // Parse a binary STL file in memory, equal corners of triangles are merged into one point.
+    // Return false if it is not a binary STL file
+    static bool ParseBinaryStl(const char *data, size_t size, vtkPolyData *output);
+
+private:
+    struct Entry
+    {
+        vtkSmartPointer<vtkPolyData> Mesh;
+        vtkMappedFile::Stamp FileStamp;
+    };
+    std::map<std::string, Entry> mMeshes;
+};
+
+#endif // VTKSURFACEMESHREADER_H
@@ -28,11 +28,15 @@
 #include <vtkMRMLMarkupsNode.h>
 #include "vtkSlicerMarkupsLogic.h"
 
+// SkeletalRepresentationCommon includes
+#include "vtkSrepKernelDispatch.h"
+
 // VTK includes
 #include <vtkCenterOfMass.h>
 #include <vtkCurvatures.h>
 #include <vtkDataArray.h>
 #include <vtkDoubleArray.h>
+#include <vtkFloatArray.h>
 #include <vtkImplicitPolyDataDistance.h>
 #include <vtkIntArray.h>
 #include <vtkLine.h>
@@ -127,11 +131,8 @@ void vtkSlicerSkeletalRepresentationInitializerLogic
 // TODO: cleanup the hard disk when the module exits
 int vtkSlicerSkeletalRepresentationInitializerLogic::FlowSurfaceOneStep(const std::string &filename, double dt, double smooth_amount)
 {
-    vtkSmartPointer<vtkPolyDataReader> reader = vtkSmartPointer<vtkPolyDataReader>::New();
-    reader->SetFileName(filename.c_str());
-    reader->Update();
-    vtkSmartPointer<vtkPolyData> mesh = reader->GetOutput();
-    if(mesh == nullptr)
+    vtkSmartPointer<vtkPolyData> mesh = vtkSurfaceMeshReader::Read(filename);
+    if(mesh->GetNumberOfPoints() == 0)
     {
         vtkErrorMacro("No mesh has read in this module. Please select input mesh file first.");
         return -1;
@@ -292,13 +293,10 @@ int vtkSlicerSkeletalRepresentationInitializerLogic::FlowSurfaceOneStep(const st
 }
 void vtkSlicerSkeletalRepresentationInitializerLogic::SetInputFileName(const std::string &filename)
 {
-    vtkSmartPointer<vtkPolyDataReader> reader =
-        vtkSmartPointer<vtkPolyDataReader>::New();
-    reader->SetFileName(filename.c_str());
-    reader->Update();
-
-    vtkSmartPointer<vtkPolyData> mesh;
-    mesh = reader->GetOutput();
+    // the scene gets a copy, the kept mesh stays as read
+    vtkSmartPointer<vtkPolyData> mesh =
+        vtkSmartPointer<vtkPolyData>::New();
+    mesh->DeepCopy(mMeshReader.Get(filename));
     // output the original mesh
     const std::string modelName("original");
     AddModelNodeToScene(mesh, modelName.c_str(), true, 0.88, 0.88, 0.88);
@@ -318,14 +316,10 @@ void vtkSlicerSkeletalRepresentationInitializerLogic::SetInputFileName(const std
 // flow surface to the end: either it's ellipsoidal enough or reach max_iter
 int vtkSlicerSkeletalRepresentationInitializerLogic::FlowSurfaceMesh(const std::string &filename, double dt, double smooth_amount, int max_iter, int freq_output)
 {
-    vtkSmartPointer<vtkPolyDataReader> reader =
-        vtkSmartPointer<vtkPolyDataReader>::New();
-    reader->SetFileName(filename.c_str());
-    reader->Update();
-
+    // the flow moves the points, so it works on a copy of the kept mesh
     vtkSmartPointer<vtkPolyData> mesh =
         vtkSmartPointer<vtkPolyData>::New();
-    mesh = reader->GetOutput();
+    mesh->DeepCopy(mMeshReader.Get(filename));
 
     vtkSmartPointer<vtkMassProperties> mass_filter =
         vtkSmartPointer<vtkMassProperties>::New();
@@ -399,16 +393,26 @@ int vtkSlicerSkeletalRepresentationInitializerLogic::FlowSurfaceMesh(const std::
 
         // perform the flow
         vtkSmartPointer<vtkPoints> points = mesh->GetPoints();
-        for(int i = 0; i < points->GetNumberOfPoints(); ++i) {
-            double p[3];
-            points->GetPoint(i, p);
-            double curr_N[3];
-            N->GetTuple(i, curr_N);
-            double curr_H = H->GetValue(i);
-            for(int idx = 0; idx < 3; ++idx) {
-                p[idx] -= dt * curr_H * curr_N[idx];
+        vtkFloatArray* floatPoints = vtkFloatArray::SafeDownCast(points->GetData());
+        vtkFloatArray* floatNormals = vtkFloatArray::SafeDownCast(N);
+        if(floatPoints != nullptr && floatNormals != nullptr) {
+            // meshes are usually float, update them with the kernels of this CPU
+            vtkSrepKernelDispatch::GetTable().flowVertexUpdateFloat(floatPoints->GetPointer(0), floatNormals->GetPointer(0),
+                                                                    H->GetPointer(0),
+                                                                    static_cast<size_t>(points->GetNumberOfPoints()), dt);
+        }
+        else {
+            for(int i = 0; i < points->GetNumberOfPoints(); ++i) {
+                double p[3];
+                points->GetPoint(i, p);
+                double curr_N[3];
+                N->GetTuple(i, curr_N);
+                double curr_H = H->GetValue(i);
+                for(int idx = 0; idx < 3; ++idx) {
+                    p[idx] -= dt * curr_H * curr_N[idx];
+                }
+                points->SetPoint(i, p);
             }
-            points->SetPoint(i, p);
         }
         points->Modified();
         mass_filter->SetInputData(mesh);
@@ -1228,14 +1232,7 @@ int vtkSlicerSkeletalRepresentationInitializerLogic::InklingFlow(const std::stri
     std::string tempFileName(this->GetApplicationLogic()->GetTemporaryPath());
     tempFileName += "/temp_output.vtk";
 
-    vtkSmartPointer<vtkPolyDataReader> reader =
-        vtkSmartPointer<vtkPolyDataReader>::New();
-    reader->SetFileName(tempFileName.c_str());
-    reader->Update();
-
-    vtkSmartPointer<vtkPolyData> mesh =
-        vtkSmartPointer<vtkPolyData>::New();
-    mesh = reader->GetOutput();
+    vtkSmartPointer<vtkPolyData> mesh = vtkSurfaceMeshReader::Read(tempFileName);
 
     vtkSmartPointer<vtkMassProperties> mass_filter =
         vtkSmartPointer<vtkMassProperties>::New();
@@ -1466,24 +1463,17 @@ void vtkSlicerSkeletalRepresentationInitializerLogic::ComputePairwiseTps(int tot
 
     // compute transformation matrix by current surface and backward surface
 
-    vtkSmartPointer<vtkPolyDataReader> sourceSurfaceReader = vtkSmartPointer<vtkPolyDataReader>::New();
-    vtkSmartPointer<vtkPolyDataReader> targetSurfaceReader = vtkSmartPointer<vtkPolyDataReader>::New();
-
     std::cout << "Computing pairwise transformation matrix via TPS for " << totalNum << " cases..." << std::endl;
     for(int stepNum = totalNum; stepNum > 1; --stepNum)
     {
         const std::string inputMeshFile = tempFolder + "/forward/" + std::to_string(stepNum) + ".vtk";
         const std::string nextMeshFile = tempFolder + "/forward/" + std::to_string(stepNum - 1) + ".vtk";
-        sourceSurfaceReader->SetFileName(inputMeshFile.c_str());
-        sourceSurfaceReader->Update();
 
         // current surface mesh
-        vtkSmartPointer<vtkPolyData> polyData_source = sourceSurfaceReader->GetOutput();
+        vtkSmartPointer<vtkPolyData> polyData_source = vtkSurfaceMeshReader::Read(inputMeshFile);
 
-        targetSurfaceReader->SetFileName(nextMeshFile.c_str());
-        targetSurfaceReader->Update();
         // next surface mesh which back flow to
-        vtkSmartPointer<vtkPolyData> polyData_target = targetSurfaceReader->GetOutput();
+        vtkSmartPointer<vtkPolyData> polyData_target = vtkSurfaceMeshReader::Read(nextMeshFile);
 
         PointSetType::Pointer sourceLandMarks = PointSetType::New();
         PointSetType::Pointer targetLandMarks = PointSetType::New();
@@ -1592,6 +1582,11 @@ void vtkSlicerSkeletalRepresentationInitializerLogic::BackwardFlow(int totalNum)
     DisplayResultSrep();
 }
 
+int vtkSlicerSkeletalRepresentationInitializerLogic::GetForwardCount() const
+{
+    return forwardCount;
+}
+
 void vtkSlicerSkeletalRepresentationInitializerLogic::SetOutputPath(const std::string &outputPath)
 {
     mOutputPath = outputPath;
@@ -1666,8 +1661,8 @@ void vtkSlicerSkeletalRepresentationInitializerLogic::DisplayResultSrep(bool fli
     std::string outputDownFileName = mOutputPath + "/down.vtp";
     std::string outputCrestFileName = mOutputPath + "/crest.vtp";
 
+    // appended binary data, which reads much faster than ASCII
     vtkSmartPointer<vtkXMLPolyDataWriter> vtpWriter = vtkSmartPointer<vtkXMLPolyDataWriter>::New();
-    vtpWriter->SetDataModeToAscii();
     vtpWriter->SetFileName(outputUpFileName.c_str());
     vtpWriter->SetInputData(vtpUpSpoke);
     vtpWriter->Update();
@@ -1711,14 +1706,7 @@ void vtkSlicerSkeletalRepresentationInitializerLogic::RotateSkeleton(bool rotate
     const std::string tempFolder(this->GetApplicationLogic()->GetTemporaryPath());
     const std::string newEllSurfaceFile = tempFolder + "/forward/" + std::to_string(forwardCount) + ".vtk";
 
-    vtkSmartPointer<vtkPolyDataReader> reader =
-        vtkSmartPointer<vtkPolyDataReader>::New();
-    reader->SetFileName(newEllSurfaceFile.c_str());
-    reader->Update();
-
-    vtkSmartPointer<vtkPolyData> mesh =
-        vtkSmartPointer<vtkPolyData>::New();
-    mesh = reader->GetOutput();
+    vtkSmartPointer<vtkPolyData> mesh = vtkSurfaceMeshReader::Read(newEllSurfaceFile);
     GenerateSrepForEllipsoid(mesh, mRows, mCols, forwardCount, rotateX, rotateY, rotateZ);
 }
 
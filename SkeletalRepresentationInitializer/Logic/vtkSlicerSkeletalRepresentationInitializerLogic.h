@@ -31,6 +31,9 @@
 #include "vtkSlicerSkeletalRepresentationInitializerModuleLogicExport.h"
 #include <itkThinPlateSplineExtended.h>
 
+// SkeletalRepresentationCommon includes
+#include "vtkSurfaceMeshReader.h"
+
 // ITK includes
 #include <itkPointSet.h>
 
@@ -88,6 +91,9 @@ public:
   // output: files and srep of initial object
   void BackwardFlow(int totalNum);
 
+  // number of surface files written by the last forward flow
+  int GetForwardCount() const;
+
   // set output path for initialized s-rep
   void SetOutputPath(const std::string &outputPath);
 
@@ -140,6 +146,8 @@ private:
   int mRows = 5;
   int mCols = 9;
   std::string mOutputPath;
+  // the input meshes, read once and shared by the flow steps
+  vtkSurfaceMeshReader mMeshReader;
 };
 
 #endif
@@ -0,0 +1,355 @@
+/*==============================================================================
+
+  Program: 3D Slicer
+
+  Portions (c) Copyright Brigham and Women's Hospital (BWH) All Rights Reserved.
+
+  See COPYRIGHT.txt
+  or http://www.slicer.org/copyright/copyright.txt for details.
+
+  Unless required by applicable law or agreed to in writing, software
+  distributed under the License is distributed on an "AS IS" BASIS,
+  WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+  See the License for the specific language governing permissions and
+  limitations under the License.
+
+==============================================================================*/
+
+
+#include "vtkDistanceMapCache.h"
+#include "vtkBrickedLayout.h"
+#include "vtkMappedFile.h"
+
+#include <vtksys/Directory.hxx>
+#include <vtksys/SystemTools.hxx>
+
+#include <algorithm>
+#include <chrono>
+#include <cstdio>
+#include <cstring>
+#include <fstream>
+#include <iostream>
+#include <sstream>
+#include <thread>
+#include <vector>
+
+namespace
+{
+const char cacheMagic[8] = {'S', 'R', 'E', 'P', 'S', 'D', 'F', '\0'};
+// bump when the distance or gradient pipeline changes, so that old entries are not reused
+const uint32_t cacheVersion = 5;
+static_assert(sizeof(vtkDistanceMapFileHeader) == 128, "the header of cached distance maps must be 128 bytes");
+
+// 64-bit FNV-1a
+void HashBytes(const char *data, size_t size, uint64_t *hash)
+{
+    for(size_t i = 0; i < size; ++i)
+    {
+        *hash ^= static_cast<unsigned char>(data[i]);
+        *hash *= 1099511628211ULL;
+    }
+}
+}
+
+const unsigned long long vtkDistanceMapCache::DefaultMaximumSize;
+
+vtkDistanceMapCache::vtkDistanceMapCache(const std::string &cacheDirectory, unsigned long long maximumSize)
+    : mCacheDirectory(cacheDirectory), mMaximumSize(maximumSize)
+{
+}
+
+std::string vtkDistanceMapCache::ComputeKey(const std::string &meshFileName, double voxelSpacing,
+                                            double margin, bool bricked, int normalMode) const
+{
+    std::ifstream meshFile(meshFileName.c_str(), std::ios::binary);
+    if(!meshFile)
+    {
+        return "";
+    }
+    uint64_t hash = 14695981039346656037ULL;
+    char buffer[65536];
+    while(meshFile)
+    {
+        meshFile.read(buffer, sizeof(buffer));
+        HashBytes(buffer, static_cast<size_t>(meshFile.gcount()), &hash);
+    }
+    HashBytes(reinterpret_cast<const char*>(&voxelSpacing), sizeof(voxelSpacing), &hash);
+    HashBytes(reinterpret_cast<const char*>(&margin), sizeof(margin), &hash);
+    const uint32_t layout = bricked ? 1 : 0;
+    HashBytes(reinterpret_cast<const char*>(&layout), sizeof(layout), &hash);
+    const int32_t normals = normalMode;
+    HashBytes(reinterpret_cast<const char*>(&normals), sizeof(normals), &hash);
+    HashBytes(reinterpret_cast<const char*>(&cacheVersion), sizeof(cacheVersion), &hash);
+
+    char key[17];
+    snprintf(key, sizeof(key), "%016llx", static_cast<unsigned long long>(hash));
+    return key;
+}
+
+std::string vtkDistanceMapCache::GetFileName(const std::string &key) const
+{
+    return mCacheDirectory + "/" + key + ".sdf";
+}
+
+bool vtkDistanceMapCache::ReadHeader(const std::string &fileName, vtkDistanceMapFileHeader *header)
+{
+    std::ifstream file(fileName.c_str(), std::ios::binary);
+    if(!file)
+    {
+        return false;
+    }
+    file.read(reinterpret_cast<char*>(header), sizeof(vtkDistanceMapFileHeader));
+    if(!file)
+    {
+        return false;
+    }
+    file.seekg(0, std::ios::end);
+    return CheckHeader(*header, static_cast<unsigned long long>(file.tellg()));
+}
+
+bool vtkDistanceMapCache::CheckHeader(const vtkDistanceMapFileHeader &header, unsigned long long fileSize)
+{
+    if(std::memcmp(header.magic, cacheMagic, sizeof(cacheMagic)) != 0 || header.version != cacheVersion
+       || header.dims[0] <= 0 || header.dims[1] <= 0 || header.dims[2] <= 0 || header.layout > 1
+       || (header.layout == 1 && !vtkBrickedLayout::Fits(header.dims)) || header.normals > OctahedralNormals
+       || fileSize < sizeof(header))
+    {
+        return false;
+    }
+    // a truncated file is a miss. The voxel count is bounded by the file as it grows, so it can't overflow
+    const unsigned long long voxelSize = GetVoxelSize(header.normals);
+    const unsigned long long maxVoxels = (fileSize - sizeof(header)) / voxelSize;
+    unsigned long long numVoxels = 1;
+    for(int i = 0; i < 3; ++i)
+    {
+        const unsigned long long dim = static_cast<unsigned long long>(header.dims[i]);
+        if(dim > maxVoxels / numVoxels)
+        {
+            return false;
+        }
+        numVoxels *= dim;
+    }
+    return fileSize == sizeof(header) + numVoxels * voxelSize;
+}
+
+unsigned long long vtkDistanceMapCache::GetVoxelSize(uint32_t normals)
+{
+    switch(normals)
+    {
+    case GradientNormals:
+        return 4 * sizeof(float);
+    case OctahedralNormals:
+        return sizeof(float) + sizeof(uint32_t);
+    default:
+        return sizeof(float);
+    }
+}
+
+bool vtkDistanceMapCache::Load(const std::string &key, RealImage::Pointer dist, VectorImage::Pointer grad,
+                               std::vector<unsigned int> *octahedralNormals, bool *bricked) const
+{
+    if(key.empty())
+    {
+        return false;
+    }
+    const std::string fileName = GetFileName(key);
+    vtkDistanceMapFileHeader header;
+    if(!ReadHeader(fileName, &header))
+    {
+        return false;
+    }
+
+    RealImage::RegionType region;
+    RealImage::SizeType size;
+    RealImage::IndexType start;
+    RealImage::SpacingType spacing;
+    RealImage::PointType origin;
+    for(int i = 0; i < 3; ++i)
+    {
+        size[i] = static_cast<RealImage::SizeValueType>(header.dims[i]);
+        start[i] = 0;
+        spacing[i] = header.spacing[i];
+        origin[i] = header.origin[i];
+    }
+    region.SetSize(size);
+    region.SetIndex(start);
+
+    dist->SetRegions(region);
+    dist->SetSpacing(spacing);
+    dist->SetOrigin(origin);
+    dist->Allocate();
+
+    const size_t numVoxels = region.GetNumberOfPixels();
+    std::ifstream file(fileName.c_str(), std::ios::binary);
+    file.seekg(sizeof(vtkDistanceMapFileHeader));
+    file.read(reinterpret_cast<char*>(dist->GetBufferPointer()),
+              static_cast<std::streamsize>(numVoxels * sizeof(float)));
+    if(header.normals == GradientNormals)
+    {
+        grad->SetRegions(region);
+        grad->SetSpacing(spacing);
+        grad->SetOrigin(origin);
+        grad->Allocate();
+        file.read(reinterpret_cast<char*>(grad->GetBufferPointer()),
+                  static_cast<std::streamsize>(3 * numVoxels * sizeof(float)));
+    }
+    else if(header.normals == OctahedralNormals)
+    {
+        static_assert(sizeof(unsigned int) == sizeof(uint32_t), "octahedral codes are stored in 32 bits");
+        octahedralNormals->resize(numVoxels);
+        file.read(reinterpret_cast<char*>(octahedralNormals->data()),
+                  static_cast<std::streamsize>(numVoxels * sizeof(uint32_t)));
+    }
+    if(!file)
+    {
+        std::cerr << "Failed to read the cached distance map " << fileName << std::endl;
+        return false;
+    }
+    *bricked = header.layout == 1;
+    MarkUsed(key);
+    return true;
+}
+
+bool vtkDistanceMapCache::Store(const std::string &key, RealImage::Pointer dist, VectorImage::Pointer grad,
+                                const std::vector<unsigned int> &octahedralNormals, bool bricked) const
+{
+    if(key.empty() || dist->GetBufferPointer() == nullptr)
+    {
+        return false;
+    }
+    RealImage::RegionType region = dist->GetBufferedRegion();
+    const size_t numVoxels = region.GetNumberOfPixels();
+    uint32_t normals = NoNormals;
+    if(grad->GetBufferPointer() != nullptr)
+    {
+        normals = GradientNormals;
+        if(grad->GetBufferedRegion().GetSize() != region.GetSize())
+        {
+            std::cerr << "The distance map and its gradient have different sizes, not cached." << std::endl;
+            return false;
+        }
+    }
+    else if(!octahedralNormals.empty())
+    {
+        normals = OctahedralNormals;
+        if(octahedralNormals.size() != numVoxels)
+        {
+            std::cerr << "The distance map and its normals have different sizes, not cached." << std::endl;
+            return false;
+        }
+    }
+    const int dims[3] = {static_cast<int>(region.GetSize()[0]), static_cast<int>(region.GetSize()[1]),
+                         static_cast<int>(region.GetSize()[2])};
+    if(bricked && !vtkBrickedLayout::Fits(dims))
+    {
+        // Load would never take such an entry
+        std::cerr << "The bricked distance map is not a whole number of bricks, not cached." << std::endl;
+        return false;
+    }
+    if(!vtksys::SystemTools::MakeDirectory(mCacheDirectory))
+    {
+        std::cerr << "Cannot create the distance map cache " << mCacheDirectory << std::endl;
+        return false;
+    }
+
+    vtkDistanceMapFileHeader header;
+    std::memset(&header, 0, sizeof(header));
+    std::memcpy(header.magic, cacheMagic, sizeof(cacheMagic));
+    header.version = cacheVersion;
+    header.layout = bricked ? 1 : 0;
+    header.normals = normals;
+    for(int i = 0; i < 3; ++i)
+    {
+        header.dims[i] = dims[i];
+        header.spacing[i] = dist->GetSpacing()[i];
+        header.origin[i] = dist->GetOrigin()[i];
+    }
+
+    // unique temporary name per process and thread
+    std::stringstream tempName;
+    tempName << GetFileName(key) << ".tmp" << std::chrono::steady_clock::now().time_since_epoch().count()
+             << "_" << std::this_thread::get_id();
+    {
+        std::ofstream file(tempName.str().c_str(), std::ios::binary);
+        file.write(reinterpret_cast<const char*>(&header), sizeof(header));
+        file.write(reinterpret_cast<const char*>(dist->GetBufferPointer()),
+                   static_cast<std::streamsize>(numVoxels * sizeof(float)));
+        if(normals == GradientNormals)
+        {
+            file.write(reinterpret_cast<const char*>(grad->GetBufferPointer()),
+                       static_cast<std::streamsize>(3 * numVoxels * sizeof(float)));
+        }
+        else if(normals == OctahedralNormals)
+        {
+            file.write(reinterpret_cast<const char*>(octahedralNormals.data()),
+                       static_cast<std::streamsize>(numVoxels * sizeof(uint32_t)));
+        }
+        if(!file)
+        {
+            std::cerr << "Failed to write the distance map cache " << tempName.str() << std::endl;
+            file.close();
+            std::remove(tempName.str().c_str());
+            return false;
+        }
+    }
+    if(std::rename(tempName.str().c_str(), GetFileName(key).c_str()) != 0)
+    {
+        // another process stored the same entry first
+        std::remove(tempName.str().c_str());
+    }
+    Trim(key);
+    return true;
+}
+
+void vtkDistanceMapCache::MarkUsed(const std::string &key) const
+{
+    // the modification time orders the entries, access times are often not kept
+    vtksys::SystemTools::Touch(GetFileName(key), false);
+}
+
+void vtkDistanceMapCache::Trim(const std::string &keepKey) const
+{
+    vtksys::Directory directory;
+    if(!directory.Load(mCacheDirectory))
+    {
+        return;
+    }
+    struct Entry
+    {
+        long long ModifiedTime;
+        unsigned long long Size;
+        std::string FileName;
+    };
+    std::vector<Entry> entries;
+    unsigned long long totalSize = 0;
+    const std::string keepFileName = GetFileName(keepKey);
+    for(unsigned long i = 0; i < directory.GetNumberOfFiles(); ++i)
+    {
+        // entries of older cache versions count too, temporary files of running stores don't
+        const std::string fileName = mCacheDirectory + "/" + directory.GetFile(i);
+        if(vtksys::SystemTools::GetFilenameLastExtension(fileName) != ".sdf")
+        {
+            continue;
+        }
+        // in nanoseconds, entries stored or used within the same second keep their order
+        const vtkMappedFile::Stamp stamp = vtkMappedFile::GetStamp(fileName);
+        const Entry entry = {stamp.ModifiedTime, stamp.Length, fileName};
+        totalSize += entry.Size;
+        if(fileName != keepFileName)
+        {
+            entries.push_back(entry);
+        }
+    }
+    std::sort(entries.begin(), entries.end(), [](const Entry &a, const Entry &b)
+    {
+        return a.ModifiedTime < b.ModifiedTime;
+    });
+    for(size_t i = 0; i < entries.size() && totalSize > mMaximumSize; ++i)
+    {
+        // processes mapping the file keep their pages. Where a mapped file can't be removed it stays
+        if(std::remove(entries[i].FileName.c_str()) == 0)
+        {
+            totalSize -= entries[i].Size;
+        }
+    }
+}
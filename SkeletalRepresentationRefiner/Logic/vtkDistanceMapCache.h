@@ -0,0 +1,117 @@
+/*==============================================================================
+
+  Program: 3D Slicer
+
+  Portions (c) Copyright Brigham and Women's Hospital (BWH) All Rights Reserved.
+
+  See COPYRIGHT.txt
+  or http://www.slicer.org/copyright/copyright.txt for details.
+
+  Unless required by applicable law or agreed to in writing, software
+  distributed under the License is distributed on an "AS IS" BASIS,
+  WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+  See the License for the specific language governing permissions and
+  limitations under the License.
+
+==============================================================================*/
+
+
+#ifndef VTKDISTANCEMAPCACHE_H
+#define VTKDISTANCEMAPCACHE_H
+
+#include <string>
+#include <stdint.h>
+#include <vector>
+
+#include "itkImage.h"
+#include "itkCovariantVector.h"
+
+// Fixed-size header of a cached distance map file.
+// It is followed by dims[0]*dims[1]*dims[2] floats of signed distance, then the normals of the voxels:
+// none, 3 floats of gradient or one octahedral code per voxel, see normals.
+// Both volumes are x-fastest or both in the bricks of vtkBrickedLayout.
+// The header is 128 bytes so that both volumes stay aligned when the file is mapped into memory.
+struct vtkDistanceMapFileHeader
+{
+    char magic[8];       // "SREPSDF"
+    uint32_t version;
+    int32_t dims[3];
+    double spacing[3];
+    double origin[3];    // center of voxel (0, 0, 0) in the unit cube
+    uint32_t layout;     // 0 x-fastest, 1 bricked
+    uint32_t normals;    // vtkDistanceMapCache::NormalVolume
+    char reserved[48];
+};
+
+/**
+ * @brief The vtkDistanceMapCache class
+ * Stores the signed distance map and its gradient of a target mesh in a cache directory,
+ * so refining the same mesh again loads two volumes instead of voxelizing the mesh,
+ * running the distance transform and the gradient filter.
+ * Files are named by a hash of the mesh file content and the grid parameters,
+ * thus an edited mesh or a different voxel spacing never hits a stale entry.
+ * The directory is kept under a maximum size by removing the least recently used entries.
+ */
+class vtkDistanceMapCache
+{
+public:
+    typedef itk::Image<float, 3> RealImage;
+    typedef itk::Image<itk::CovariantVector<float, 3>, 3> VectorImage;
+
+    // 2 GiB, about 30 maps of 200^3 voxels with gradients
+    static const unsigned long long DefaultMaximumSize = 2ULL << 30;
+
+    // what follows the distances in a file. Only what the refiner samples in its normal mode is kept
+    enum NormalVolume
+    {
+        NoNormals = 0,
+        GradientNormals,
+        OctahedralNormals
+    };
+
+    explicit vtkDistanceMapCache(const std::string &cacheDirectory,
+                                 unsigned long long maximumSize = DefaultMaximumSize);
+
+    // Hash of the mesh file content, the grid, the voxel layout and the normal mode of the refiner
+    // (vtkImageDistanceSampler::NormalMode), which decides the normals kept. Empty if the mesh can't be read
+    std::string ComputeKey(const std::string &meshFileName, double voxelSpacing, double margin, bool bricked,
+                           int normalMode) const;
+
+    // path of the cache file for key
+    std::string GetFileName(const std::string &key) const;
+
+    // Load the cached volumes into dist and, if the entry has them, grad or octahedralNormals.
+    // The normals it doesn't have are left untouched. bricked tells the layout of the volumes.
+    // Return false on a miss or a corrupted file
+    bool Load(const std::string &key, RealImage::Pointer dist, VectorImage::Pointer grad,
+              std::vector<unsigned int> *octahedralNormals, bool *bricked) const;
+
+    // Write the distances with the gradient if grad has a buffer, else with octahedralNormals if it isn't empty.
+    // The file is written under a temporary name and renamed, so concurrent processes never read
+    // a partial entry. Older entries are removed then, see Trim.
+    // bricked tells if the buffers have been reordered by vtkBrickedLayout
+    bool Store(const std::string &key, RealImage::Pointer dist, VectorImage::Pointer grad,
+               const std::vector<unsigned int> &octahedralNormals, bool bricked) const;
+
+    // Mark the entry as used now, Load does it on a hit. For entries read another way, e.g. mapped
+    void MarkUsed(const std::string &key) const;
+
+    // Remove the least recently used entries until the directory fits the maximum size.
+    // The entry of keepKey stays even if it is larger alone
+    void Trim(const std::string &keepKey) const;
+
+    // Read and validate the header of a cache file
+    static bool ReadHeader(const std::string &fileName, vtkDistanceMapFileHeader *header);
+
+    // Validate a header read from a file of fileSize bytes, which has to hold exactly its volumes
+    static bool CheckHeader(const vtkDistanceMapFileHeader &header, unsigned long long fileSize);
+
+    // bytes of one voxel in the volumes of a file with these normals
+    static unsigned long long GetVoxelSize(uint32_t normals);
+
+private:
+    std::string mCacheDirectory;
+    unsigned long long mMaximumSize;
+};
+
+#endif // VTKDISTANCEMAPCACHE_H
@@ -0,0 +1,439 @@
+/*==============================================================================
+
+  Program: 3D Slicer
+
+  Portions (c) Copyright Brigham and Women's Hospital (BWH) All Rights Reserved.
+
+  See COPYRIGHT.txt
+  or http://www.slicer.org/copyright/copyright.txt for details.
+
+  Unless required by applicable law or agreed to in writing, software
+  distributed under the License is distributed on an "AS IS" BASIS,
+  WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+  See the License for the specific language governing permissions and
+  limitations under the License.
+
+==============================================================================*/
+
+
+#include "vtkDistanceSampler.h"
+
+#include <algorithm>
+#include <math.h>
+#include <utility>
+#include <vector>
+
+namespace
+{
+// gradient of the distance map at voxel (x, y, z), one-sided at the border like itk::GradientImageFilter
+template<typename Distance>
+void CentralDifference(const Distance &dist, const int *dims, bool bricked, double spacing, int x, int y, int z,
+                       double *grad)
+{
+    for(int i = 0; i < 3; ++i)
+    {
+        // the border voxel stands in for its missing neighbor
+        int prev[3] = {x, y, z}, next[3] = {x, y, z};
+        prev[i] = std::max(prev[i] - 1, 0);
+        next[i] = std::min(next[i] + 1, dims[i] - 1);
+        grad[i] = (dist(vtkBrickedLayout::Index(dims, bricked, next[0], next[1], next[2]))
+                   - dist(vtkBrickedLayout::Index(dims, bricked, prev[0], prev[1], prev[2]))) / (2 * spacing);
+    }
+}
+
+// vtkDistanceSampler::SampleImageMatch on samples of either precision
+template<typename T>
+void AccumulateImageMatch(const vtkDistanceSampler &sampler, const T *points, const T *dirs, const T *weights,
+                          size_t n, const T *scale, const T *shift, double *imageDist, double *normalMatch)
+{
+    for(size_t i = 0; i < n; ++i)
+    {
+        const T *pt = points + 3 * i;
+        double point[3] = {static_cast<double>(pt[0] * scale[0] + shift[0]),
+                           static_cast<double>(pt[1] * scale[1] + shift[1]),
+                           static_cast<double>(pt[2] * scale[2] + shift[2])};
+        double normal[3];
+        double d = sampler.Sample(point, normal);
+        double norm = sampler.HasUnitNormals() ? 1.0 : sqrt(normal[0] * normal[0] + normal[1] * normal[1] + normal[2] * normal[2]);
+        double dotProduct = 0.0;
+        if(norm > 0)
+        {
+            const T *dir = dirs + 3 * i;
+            dotProduct = (normal[0] * dir[0] + normal[1] * dir[1] + normal[2] * dir[2]) / norm;
+        }
+        double distSqr = d * d;
+        *imageDist += weights[i] * distSqr;
+        *normalMatch += weights[i] * distSqr * (1 - dotProduct);
+    }
+}
+}
+
+void vtkDistanceSampler::BSplineWeights(double t, double *w, double *dw)
+{
+    const double s = 1 - t;
+    w[0] = s * s * s / 6;
+    w[1] = (3 * t * t * t - 6 * t * t + 4) / 6;
+    w[2] = (-3 * t * t * t + 3 * t * t + 3 * t + 1) / 6;
+    w[3] = t * t * t / 6;
+    dw[0] = -s * s / 2;
+    dw[1] = (3 * t * t - 4 * t) / 2;
+    dw[2] = (-3 * t * t + 2 * t + 1) / 2;
+    dw[3] = t * t / 2;
+}
+
+void vtkDistanceSampler::Normalize(double *v)
+{
+    double norm = sqrt(v[0] * v[0] + v[1] * v[1] + v[2] * v[2]);
+    if(norm > 0)
+    {
+        v[0] /= norm;
+        v[1] /= norm;
+        v[2] /= norm;
+    }
+}
+
+void vtkDistanceSampler::SampleImageMatch(const float *points, const float *dirs, const float *weights, size_t n,
+                                          const float *scale, const float *shift,
+                                          double *imageDist, double *normalMatch) const
+{
+    AccumulateImageMatch(*this, points, dirs, weights, n, scale, shift, imageDist, normalMatch);
+}
+
+void vtkDistanceSampler::SampleImageMatch(const double *points, const double *dirs, const double *weights, size_t n,
+                                          const double *scale, const double *shift,
+                                          double *imageDist, double *normalMatch) const
+{
+    AccumulateImageMatch(*this, points, dirs, weights, n, scale, shift, imageDist, normalMatch);
+}
+
+vtkImageDistanceSampler::vtkImageDistanceSampler()
+    : mNormalMode(StoredGradient), mInterpolation(Nearest), mDistance(nullptr), mQuantized(nullptr), mDistanceScale(1.0),
+      mDistanceOffset(0.0), mGradient(nullptr), mNormals(nullptr), mSpacing(1.0), mBricked(false)
+{
+    mDims[0] = mDims[1] = mDims[2] = 0;
+    mOrigin[0] = mOrigin[1] = mOrigin[2] = 0.0;
+}
+
+void vtkImageDistanceSampler::SetVolumes(const float *dist, const float *grad, const int *dims,
+                                         const double *origin, double spacing)
+{
+    SetDistanceVolume(dist, dims, origin, spacing);
+    mNormalMode = StoredGradient;
+    mGradient = grad;
+}
+
+void vtkImageDistanceSampler::SetDistanceVolume(const float *dist, const int *dims, const double *origin,
+                                                double spacing)
+{
+    Clear();
+    mNormalMode = OnDemandGradient;
+    mDistance = dist;
+    for(int i = 0; i < 3; ++i)
+    {
+        mDims[i] = dims[i];
+        mOrigin[i] = origin[i];
+    }
+    mSpacing = spacing;
+}
+
+void vtkImageDistanceSampler::SetOctahedralVolumes(const float *dist, const unsigned int *normals, const int *dims,
+                                                   const double *origin, double spacing)
+{
+    SetDistanceVolume(dist, dims, origin, spacing);
+    mNormalMode = OctahedralNormals;
+    mNormals = normals;
+}
+
+void vtkImageDistanceSampler::SetQuantizedDistance(const short *dist, double scale, double offset)
+{
+    mDistance = nullptr;
+    mQuantized = dist;
+    mDistanceScale = scale;
+    mDistanceOffset = offset;
+}
+
+void vtkImageDistanceSampler::Clear()
+{
+    mNormalMode = StoredGradient;
+    mDistance = nullptr;
+    mQuantized = nullptr;
+    mDistanceScale = 1.0;
+    mDistanceOffset = 0.0;
+    mGradient = nullptr;
+    mNormals = nullptr;
+    mDims[0] = mDims[1] = mDims[2] = 0;
+    mBricked = false;
+}
+
+void vtkImageDistanceSampler::NearestVoxel(const double *point, int *index) const
+{
+    for(int i = 0; i < 3; ++i)
+    {
+        int maxI = mDims[i] - 1;
+        index[i] = static_cast<int>((point[i] - mOrigin[i]) / mSpacing + 0.5);
+        index[i] = index[i] > maxI ? maxI : (index[i] < 0 ? 0 : index[i]);
+    }
+}
+
+void vtkImageDistanceSampler::GridCoordinates(const double *point, double *coords) const
+{
+    for(int i = 0; i < 3; ++i)
+    {
+        coords[i] = (point[i] - mOrigin[i]) / mSpacing;
+        coords[i] = std::max(0.0, std::min(static_cast<double>(mDims[i] - 1), coords[i]));
+    }
+}
+
+double vtkImageDistanceSampler::Sample(const double *point, double *normal) const
+{
+    if(mInterpolation == Trilinear)
+    {
+        return SampleTrilinear(point, normal);
+    }
+    if(mInterpolation == TricubicBSpline)
+    {
+        return SampleTricubic(point, normal);
+    }
+    int index[3];
+    NearestVoxel(point, index);
+    size_t voxel = VoxelIndex(index[0], index[1], index[2]);
+    switch(mNormalMode)
+    {
+    case OctahedralNormals:
+        DecodeOctahedral(mNormals[voxel], normal);
+        break;
+    case OnDemandGradient:
+    {
+        CentralDifference([this](size_t v) { return DistanceAt(v); }, mDims, mBricked, mSpacing,
+                          index[0], index[1], index[2], normal);
+        Normalize(normal);
+        break;
+    }
+    default:
+        normal[0] = static_cast<double>(mGradient[3 * voxel]);
+        normal[1] = static_cast<double>(mGradient[3 * voxel + 1]);
+        normal[2] = static_cast<double>(mGradient[3 * voxel + 2]);
+        break;
+    }
+    return DistanceAt(voxel);
+}
+
+double vtkImageDistanceSampler::SampleTrilinear(const double *point, double *normal) const
+{
+    double coords[3];
+    GridCoordinates(point, coords);
+    int cell[3], next[3];
+    double f[3];
+    for(int i = 0; i < 3; ++i)
+    {
+        // the last cell starts one voxel before the border, a single voxel is its own neighbor
+        cell[i] = std::min(static_cast<int>(coords[i]), std::max(mDims[i] - 2, 0));
+        next[i] = cell[i] < mDims[i] - 1 ? 1 : 0;
+        f[i] = coords[i] - cell[i];
+    }
+    double d = 0.0;
+    normal[0] = normal[1] = normal[2] = 0.0;
+    for(int corner = 0; corner < 8; ++corner)
+    {
+        const int c[3] = {corner & 1, (corner >> 1) & 1, corner >> 2};
+        const double w[3] = {c[0] ? f[0] : 1 - f[0], c[1] ? f[1] : 1 - f[1], c[2] ? f[2] : 1 - f[2]};
+        const double weight = w[0] * w[1] * w[2];
+        const size_t voxel = VoxelIndex(cell[0] + c[0] * next[0], cell[1] + c[1] * next[1],
+                                        cell[2] + c[2] * next[2]);
+        const double cornerDist = DistanceAt(voxel);
+        d += weight * cornerDist;
+        switch(mNormalMode)
+        {
+        case OctahedralNormals:
+        {
+            double cornerNormal[3];
+            DecodeOctahedral(mNormals[voxel], cornerNormal);
+            for(int i = 0; i < 3; ++i)
+            {
+                normal[i] += weight * cornerNormal[i];
+            }
+            break;
+        }
+        case OnDemandGradient:
+            // gradient of the trilinear blend itself
+            normal[0] += (c[0] ? 1 : -1) * next[0] * w[1] * w[2] * cornerDist;
+            normal[1] += (c[1] ? 1 : -1) * next[1] * w[0] * w[2] * cornerDist;
+            normal[2] += (c[2] ? 1 : -1) * next[2] * w[0] * w[1] * cornerDist;
+            break;
+        default:
+            for(int i = 0; i < 3; ++i)
+            {
+                normal[i] += weight * static_cast<double>(mGradient[3 * voxel + i]);
+            }
+            break;
+        }
+    }
+    if(mNormalMode != StoredGradient)
+    {
+        Normalize(normal);
+    }
+    return d;
+}
+
+double vtkImageDistanceSampler::SampleTricubic(const double *point, double *normal) const
+{
+    double coords[3];
+    GridCoordinates(point, coords);
+    int cell[3];
+    double w[3][4], dw[3][4];
+    for(int i = 0; i < 3; ++i)
+    {
+        cell[i] = std::min(static_cast<int>(coords[i]), std::max(mDims[i] - 2, 0));
+        BSplineWeights(coords[i] - cell[i], w[i], dw[i]);
+    }
+    double d = 0.0;
+    normal[0] = normal[1] = normal[2] = 0.0;
+    for(int k = 0; k < 4; ++k)
+    {
+        // voxels beyond the border repeat the border ones
+        const int z = std::max(0, std::min(mDims[2] - 1, cell[2] + k - 1));
+        for(int j = 0; j < 4; ++j)
+        {
+            const int y = std::max(0, std::min(mDims[1] - 1, cell[1] + j - 1));
+            for(int i = 0; i < 4; ++i)
+            {
+                const int x = std::max(0, std::min(mDims[0] - 1, cell[0] + i - 1));
+                const double voxelDist = DistanceAt(VoxelIndex(x, y, z));
+                d += w[0][i] * w[1][j] * w[2][k] * voxelDist;
+                normal[0] += dw[0][i] * w[1][j] * w[2][k] * voxelDist;
+                normal[1] += w[0][i] * dw[1][j] * w[2][k] * voxelDist;
+                normal[2] += w[0][i] * w[1][j] * dw[2][k] * voxelDist;
+            }
+        }
+    }
+    Normalize(normal);
+    return d;
+}
+
+void vtkImageDistanceSampler::SortSamples(float *points, float *dirs, float *weights, size_t n,
+                                          const float *scale, const float *shift) const
+{
+    SortSamplesImpl(points, dirs, weights, n, scale, shift);
+}
+
+void vtkImageDistanceSampler::SortSamples(double *points, double *dirs, double *weights, size_t n,
+                                          const double *scale, const double *shift) const
+{
+    SortSamplesImpl(points, dirs, weights, n, scale, shift);
+}
+
+template<typename T>
+void vtkImageDistanceSampler::SortSamplesImpl(T *points, T *dirs, T *weights, size_t n,
+                                              const T *scale, const T *shift) const
+{
+    // (brick, sample) pairs, samples keep their order within a brick
+    std::vector<std::pair<size_t, size_t> > order(n);
+    for(size_t i = 0; i < n; ++i)
+    {
+        const T *pt = points + 3 * i;
+        double point[3] = {static_cast<double>(pt[0] * scale[0] + shift[0]),
+                           static_cast<double>(pt[1] * scale[1] + shift[1]),
+                           static_cast<double>(pt[2] * scale[2] + shift[2])};
+        int index[3];
+        NearestVoxel(point, index);
+        order[i].first = vtkBrickedLayout::Index(mDims, mBricked, index[0], index[1], index[2])
+                         / vtkBrickedLayout::BrickVoxels;
+        order[i].second = i;
+    }
+    std::sort(order.begin(), order.end());
+
+    std::vector<T> sortedPoints(3 * n), sortedDirs(3 * n), sortedWeights(n);
+    for(size_t i = 0; i < n; ++i)
+    {
+        const size_t from = order[i].second;
+        std::copy(points + 3 * from, points + 3 * from + 3, sortedPoints.begin() + 3 * i);
+        std::copy(dirs + 3 * from, dirs + 3 * from + 3, sortedDirs.begin() + 3 * i);
+        sortedWeights[i] = weights[from];
+    }
+    std::copy(sortedPoints.begin(), sortedPoints.end(), points);
+    std::copy(sortedDirs.begin(), sortedDirs.end(), dirs);
+    std::copy(sortedWeights.begin(), sortedWeights.end(), weights);
+}
+
+void vtkImageDistanceSampler::ComputeOctahedralNormals(const float *dist, const int *dims, double spacing,
+                                                       bool bricked, unsigned int *normals)
+{
+    for(int z = 0; z < dims[2]; ++z)
+    {
+        for(int y = 0; y < dims[1]; ++y)
+        {
+            for(int x = 0; x < dims[0]; ++x)
+            {
+                double grad[3];
+                CentralDifference([dist](size_t v) { return static_cast<double>(dist[v]); }, dims, bricked, spacing,
+                                  x, y, z, grad);
+                normals[vtkBrickedLayout::Index(dims, bricked, x, y, z)] = EncodeOctahedral(grad);
+            }
+        }
+    }
+}
+
+unsigned int vtkImageDistanceSampler::EncodeOctahedral(const double *normal)
+{
+    double l1 = fabs(normal[0]) + fabs(normal[1]) + fabs(normal[2]);
+    if(l1 == 0)
+    {
+        // undefined normal, decodes to +z
+        return 0;
+    }
+    double u = normal[0] / l1, v = normal[1] / l1;
+    if(normal[2] < 0)
+    {
+        // fold the lower half over the diagonals
+        double foldedU = (1 - fabs(v)) * (u >= 0 ? 1 : -1);
+        double foldedV = (1 - fabs(u)) * (v >= 0 ? 1 : -1);
+        u = foldedU;
+        v = foldedV;
+    }
+    int qu = static_cast<int>(floor(u * 32767 + 0.5));
+    int qv = static_cast<int>(floor(v * 32767 + 0.5));
+    return (static_cast<unsigned int>(qu) & 0xffffu) | ((static_cast<unsigned int>(qv) & 0xffffu) << 16);
+}
+
+void vtkImageDistanceSampler::DecodeOctahedral(unsigned int code, double *normal)
+{
+    double u = static_cast<short>(code & 0xffffu) / 32767.0;
+    double v = static_cast<short>(code >> 16) / 32767.0;
+    double w = 1 - fabs(u) - fabs(v);
+    if(w < 0)
+    {
+        double t = -w;
+        u += u >= 0 ? -t : t;
+        v += v >= 0 ? -t : t;
+    }
+    double norm = sqrt(u * u + v * v + w * w);
+    normal[0] = u / norm;
+    normal[1] = v / norm;
+    normal[2] = w / norm;
+}
+
+void vtkImageDistanceSampler::QuantizeDistance(const float *dist, size_t n, double maxDistance, short *quantized,
+                                               double *scale, double *offset, double *maxError, double *rmsError)
+{
+    double low = maxDistance, high = -maxDistance;
+    for(size_t i = 0; i < n; ++i)
+    {
+        double d = std::max(-maxDistance, std::min(maxDistance, static_cast<double>(dist[i])));
+        low = std::min(low, d);
+        high = std::max(high, d);
+    }
+    *offset = 0.5 * (low + high);
+    *scale = high > low ? (high - low) / 65534 : 1.0;
+    double sumSqr = 0.0;
+    *maxError = 0.0;
+    for(size_t i = 0; i < n; ++i)
+    {
+        double d = std::max(-maxDistance, std::min(maxDistance, static_cast<double>(dist[i])));
+        double q = floor((d - *offset) / *scale + 0.5);
+        quantized[i] = static_cast<short>(std::max(-32767.0, std::min(32767.0, q)));
+        double error = fabs(*scale * quantized[i] + *offset - d);
+        *maxError = std::max(*maxError, error);
+        sumSqr += error * error;
+    }
+    *rmsError = n > 0 ? sqrt(sumSqr / n) : 0.0;
+}
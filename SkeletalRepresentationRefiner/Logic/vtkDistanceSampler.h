@@ -0,0 +1,195 @@
+/*==============================================================================
+
+  Program: 3D Slicer
+
+  Portions (c) Copyright Brigham and Women's Hospital (BWH) All Rights Reserved.
+
+  See COPYRIGHT.txt
+  or http://www.slicer.org/copyright/copyright.txt for details.
+
+  Unless required by applicable law or agreed to in writing, software
+  distributed under the License is distributed on an "AS IS" BASIS,
+  WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+  See the License for the specific language governing permissions and
+  limitations under the License.
+
+==============================================================================*/
+
+
+#ifndef VTKDISTANCESAMPLER_H
+#define VTKDISTANCESAMPLER_H
+
+#include <stddef.h>
+
+#include "vtkBrickedLayout.h"
+
+/**
+ * @brief The vtkDistanceSampler class
+ * Common interface of the sources of signed distance to the target surface used by the image match:
+ * the dense distance map, the narrow band map and the exact distance to the mesh.
+ * Points are given in the unit cube the target mesh is mapped into. Distances are negative inside.
+ */
+class vtkDistanceSampler
+{
+public:
+    virtual ~vtkDistanceSampler() {}
+
+    // Signed distance at point. normal is the outward direction of the surface seen from point,
+    // not necessarily normalized, zero where it is undefined
+    virtual double Sample(const double *point, double *normal) const = 0;
+
+    // True if Sample returns normals of unit length, so callers can skip normalizing them
+    virtual bool HasUnitNormals() const { return false; }
+
+    // Weighted squared distances and normal mismatches of n boundary points, the same terms as vtkSrepKernels.
+    // Input: points and dirs are in s-rep coordinates, scale and shift map them into the unit cube
+    // Output: imageDist and normalMatch are incremented
+    void SampleImageMatch(const float *points, const float *dirs, const float *weights, size_t n,
+                          const float *scale, const float *shift, double *imageDist, double *normalMatch) const;
+    void SampleImageMatch(const double *points, const double *dirs, const double *weights, size_t n,
+                          const double *scale, const double *shift, double *imageDist, double *normalMatch) const;
+
+protected:
+    // uniform cubic B-spline weights of the 4 voxels around t in [0, 1) and their derivatives
+    static void BSplineWeights(double t, double *w, double *dw);
+
+    // scale v to unit length, a zero vector stays zero
+    static void Normalize(double *v);
+};
+
+/**
+ * @brief The vtkImageDistanceSampler class
+ * Dense distance map and its normal at a point, the volumes are not owned by the sampler.
+ * The distance is read from the nearest voxel, blended trilinearly from the 8 voxels around the point
+ * or taken from the cubic B-spline through the 4x4x4 voxels around it. The last two make the image
+ * match continuous in the point, so coarser grids fit as well as fine nearest voxel ones.
+ * The normal comes from a stored gradient volume, from central differences of the distance map
+ * at the sampled voxel, or from unit normals packed into 4 bytes by the octahedral mapping.
+ * Voxel (i, j, k) is centered at origin + (i, j, k) * spacing, points beyond the grid read its border voxels.
+ * The volumes are either x-fastest or laid out in bricks by vtkBrickedLayout.
+ */
+class vtkImageDistanceSampler : public vtkDistanceSampler
+{
+public:
+    enum NormalMode
+    {
+        StoredGradient = 0, // 3 floats per voxel, not normalized
+        OnDemandGradient,   // no normal volume
+        OctahedralNormals   // 4 bytes per voxel, unit length
+    };
+
+    enum Interpolation
+    {
+        Nearest = 0,
+        Trilinear,          // normals are blended like the distances
+        TricubicBSpline     // normals are the gradient of the spline, the normal volumes are not read
+    };
+
+    vtkImageDistanceSampler();
+
+    // Input: dist has dims[0]*dims[1]*dims[2] voxels, x varies fastest. grad has 3 components per voxel
+    // Input: origin is the center of voxel (0, 0, 0) in the unit cube
+    void SetVolumes(const float *dist, const float *grad, const int *dims, const double *origin, double spacing);
+
+    // Normals are central differences of dist at the sampled voxel
+    void SetDistanceVolume(const float *dist, const int *dims, const double *origin, double spacing);
+
+    // normals has one octahedral code per voxel, see ComputeOctahedralNormals
+    void SetOctahedralVolumes(const float *dist, const unsigned int *normals, const int *dims,
+                              const double *origin, double spacing);
+
+    // Replace the float distances set before by fixed point ones: distance = scale * dist[voxel] + offset
+    void SetQuantizedDistance(const short *dist, double scale, double offset);
+
+    // Kept when the volumes change
+    void SetInterpolation(Interpolation interpolation) { mInterpolation = interpolation; }
+    Interpolation GetInterpolation() const { return mInterpolation; }
+
+    // The volumes set before are in the order of vtkBrickedLayout, cleared with them
+    void SetBrickedLayout(bool bricked) { mBricked = bricked; }
+    bool IsBricked() const { return mBricked; }
+
+    // forget the volumes
+    void Clear();
+
+    bool IsEmpty() const { return mDistance == nullptr && mQuantized == nullptr; }
+
+    NormalMode GetNormalMode() const { return mNormalMode; }
+    // nullptr if the distances are quantized
+    const float *GetDistance() const { return mDistance; }
+    const short *GetQuantizedDistance() const { return mQuantized; }
+    double GetDistanceScale() const { return mDistanceScale; }
+    double GetDistanceOffset() const { return mDistanceOffset; }
+    // nullptr unless the normal mode is StoredGradient
+    const float *GetGradient() const { return mGradient; }
+    const unsigned int *GetOctahedralNormals() const { return mNormals; }
+    const int *GetDimensions() const { return mDims; }
+    double GetSpacing() const { return mSpacing; }
+    const double *GetOrigin() const { return mOrigin; }
+
+    double Sample(const double *point, double *normal) const override;
+
+    bool HasUnitNormals() const override
+    {
+        return mNormalMode != StoredGradient || mInterpolation == TricubicBSpline;
+    }
+
+    // Reorder n samples by the brick of the voxel they read, so that consecutive samples
+    // hit the same pages and cache lines. Sums over the samples change only by rounding
+    void SortSamples(float *points, float *dirs, float *weights, size_t n,
+                     const float *scale, const float *shift) const;
+    void SortSamples(double *points, double *dirs, double *weights, size_t n,
+                     const double *scale, const double *shift) const;
+
+    // Unit normals of the distance map from central differences, packed by EncodeOctahedral.
+    // Output: normals has dims[0]*dims[1]*dims[2] codes in the layout of dist
+    static void ComputeOctahedralNormals(const float *dist, const int *dims, double spacing, bool bricked,
+                                         unsigned int *normals);
+
+    // Map a direction onto the octahedron and unfold it into the square, 16 bits per coordinate
+    static unsigned int EncodeOctahedral(const double *normal);
+    // Output: normal has unit length
+    static void DecodeOctahedral(unsigned int code, double *normal);
+
+    // 16 bit fixed point copy of n distances, clamped to +/- maxDistance. The steps are spread over
+    // the range of the values, the error is at most half a step.
+    // Output: scale and offset for SetQuantizedDistance, maxError and rmsError against the clamped input
+    static void QuantizeDistance(const float *dist, size_t n, double maxDistance, short *quantized,
+                                 double *scale, double *offset, double *maxError, double *rmsError);
+
+private:
+    template<typename T>
+    void SortSamplesImpl(T *points, T *dirs, T *weights, size_t n, const T *scale, const T *shift) const;
+
+    // index of the voxel nearest to point
+    void NearestVoxel(const double *point, int *index) const;
+
+    // continuous voxel coordinates of point, clamped to the grid
+    void GridCoordinates(const double *point, double *coords) const;
+
+    double SampleTrilinear(const double *point, double *normal) const;
+    double SampleTricubic(const double *point, double *normal) const;
+
+    size_t VoxelIndex(int x, int y, int z) const { return vtkBrickedLayout::Index(mDims, mBricked, x, y, z); }
+
+    double DistanceAt(size_t voxel) const
+    {
+        return mQuantized != nullptr ? mDistanceScale * mQuantized[voxel] + mDistanceOffset
+                                     : static_cast<double>(mDistance[voxel]);
+    }
+
+    NormalMode mNormalMode;
+    Interpolation mInterpolation;
+    const float *mDistance;
+    const short *mQuantized;
+    double mDistanceScale;
+    double mDistanceOffset;
+    const float *mGradient;
+    const unsigned int *mNormals;
+    int mDims[3];
+    double mOrigin[3];
+    double mSpacing;
+    bool mBricked;
+};
+
+#endif // VTKDISTANCESAMPLER_H
@@ -36,9 +36,8 @@ void vtkGradientDistanceFilter::Filter(RealImage::Pointer input, VectorImage::Po
 
     try {
         gradientFilter->Update();
-        VectorImage::Pointer gradImage = gradientFilter->GetOutput();
-        DeepCopy(gradImage, output);
-        //std::cout << "The two images are same:" << CompareImages(gradImage, output) << std::endl;
+        // take over the buffer of the filter output instead of copying it
+        output->Graft(gradientFilter->GetOutput());
 
     } catch (itk::ExceptionObject & excep) {
         std::cerr << "Exception caught !" << std::endl;
@@ -48,24 +47,3 @@ void vtkGradientDistanceFilter::Filter(RealImage::Pointer input, VectorImage::Po
 
 
 }
-
-void vtkGradientDistanceFilter::DeepCopy(VectorImage::Pointer input, VectorImage::Pointer output)
-{
-    VectorImage::RegionType region = input->GetLargestPossibleRegion();
-    output->SetRegions(region);
-    output->Allocate();
-
-    VectorImage::SizeType imageSize = region.GetSize();
-    for(VectorImage::SizeValueType i = 0; i < imageSize[0]; ++i)
-    {
-        for (VectorImage::SizeValueType j = 0; j < imageSize[1]; ++j) {
-            for (VectorImage::SizeValueType k = 0; k < imageSize[2]; ++k) {
-                VectorImage::IndexType index = {{static_cast<VectorImage::IndexValueType>(i),
-                                                 static_cast<VectorImage::IndexValueType>(j),
-                                                 static_cast<VectorImage::IndexValueType>(k)}};
-                VectorImage::PixelType pixel = input->GetPixel(index);
-                output->SetPixel(index, pixel);
-            }
-        }
-    }
-}
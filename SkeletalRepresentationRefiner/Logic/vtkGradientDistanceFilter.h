@@ -15,7 +15,6 @@ public:
     void Filter(RealImage::Pointer input, VectorImage::Pointer output);
 
 private:
-    void DeepCopy(VectorImage::Pointer input, VectorImage::Pointer output);
     bool CompareImages(VectorImage::Pointer input, VectorImage::Pointer output);
 };
 
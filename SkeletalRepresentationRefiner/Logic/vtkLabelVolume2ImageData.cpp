@@ -0,0 +1,334 @@
+/*==============================================================================
+
+  Program: 3D Slicer
+
+  Portions (c) Copyright Brigham and Women's Hospital (BWH) All Rights Reserved.
+
+  See COPYRIGHT.txt
+  or http://www.slicer.org/copyright/copyright.txt for details.
+
+  Unless required by applicable law or agreed to in writing, software
+  distributed under the License is distributed on an "AS IS" BASIS,
+  WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+  See the License for the specific language governing permissions and
+  limitations under the License.
+
+==============================================================================*/
+
+
+
+#include "vtkLabelVolume2ImageData.h"
+#include "vtkPolyData2ImageData.h"
+
+#include "itkImage.h"
+#include "itkImageFileReader.h"
+#include "itkImageRegionConstIterator.h"
+
+#include <vtkImageData.h>
+#include <vtksys/SystemTools.hxx>
+
+#include <algorithm>
+#include <iostream>
+#include <limits>
+#include <math.h>
+#include <thread>
+#include <vector>
+
+namespace
+{
+// output = a * b of two affine maps, the linear part first then the translation in column 3
+void Compose(const double a[3][4], const double b[3][4], double output[3][4])
+{
+    for(int r = 0; r < 3; ++r)
+    {
+        for(int c = 0; c < 4; ++c)
+        {
+            output[r][c] = a[r][0] * b[0][c] + a[r][1] * b[1][c] + a[r][2] * b[2][c] + (c == 3 ? a[r][3] : 0.0);
+        }
+    }
+}
+
+// Return false if the linear part is singular
+bool Invert(const double a[3][4], double output[3][4])
+{
+    double det = a[0][0] * (a[1][1] * a[2][2] - a[1][2] * a[2][1])
+               - a[0][1] * (a[1][0] * a[2][2] - a[1][2] * a[2][0])
+               + a[0][2] * (a[1][0] * a[2][1] - a[1][1] * a[2][0]);
+    if(det == 0)
+    {
+        return false;
+    }
+    for(int r = 0; r < 3; ++r)
+    {
+        for(int c = 0; c < 3; ++c)
+        {
+            // cofactor of the transposed element
+            const int r1 = (c + 1) % 3, r2 = (c + 2) % 3, c1 = (r + 1) % 3, c2 = (r + 2) % 3;
+            output[r][c] = (a[r1][c1] * a[r2][c2] - a[r1][c2] * a[r2][c1]) / det;
+        }
+    }
+    for(int r = 0; r < 3; ++r)
+    {
+        output[r][3] = -(output[r][0] * a[0][3] + output[r][1] * a[1][3] + output[r][2] * a[2][3]);
+    }
+    return true;
+}
+
+double Apply(const double m[3][4], int row, double x, double y, double z)
+{
+    return m[row][0] * x + m[row][1] * y + m[row][2] * z + m[row][3];
+}
+}
+
+vtkLabelVolume2ImageData::vtkLabelVolume2ImageData()
+    : mVoxelSpacing(vtkPolyData2ImageData::DefaultVoxelSpacing), mMargin(vtkPolyData2ImageData::DefaultMargin)
+{
+}
+
+bool vtkLabelVolume2ImageData::IsLabelVolumeFile(const std::string &fileName)
+{
+    const std::string extension = vtksys::SystemTools::LowerCase(
+                vtksys::SystemTools::GetFilenameLastExtension(fileName));
+    return extension == ".nrrd" || extension == ".mha";
+}
+
+bool vtkLabelVolume2ImageData::Convert(const std::string &inputFileName, vtkSmartPointer<vtkImageData> output)
+{
+    typedef itk::Image<int, 3> LabelImage;
+    typedef itk::ImageFileReader<LabelImage> ReaderType;
+
+    // 1. read the geometry only
+    ReaderType::Pointer reader = ReaderType::New();
+    reader->SetFileName(inputFileName);
+    try
+    {
+        reader->UpdateOutputInformation();
+    }
+    catch(itk::ExceptionObject &excep)
+    {
+        std::cerr << "Cannot read the label volume " << inputFileName << std::endl;
+        std::cerr << excep << std::endl;
+        return false;
+    }
+    LabelImage::Pointer image = reader->GetOutput();
+    const LabelImage::RegionType largest = image->GetLargestPossibleRegion();
+    const int labelDims[3] = {static_cast<int>(largest.GetSize()[0]), static_cast<int>(largest.GetSize()[1]),
+                              static_cast<int>(largest.GetSize()[2])};
+
+    // voxel indices from the start of the region to RAS, ITK is LPS
+    double indexToWorld[3][4];
+    for(int r = 0; r < 3; ++r)
+    {
+        const double sign = r < 2 ? -1.0 : 1.0;
+        indexToWorld[r][3] = sign * image->GetOrigin()[r];
+        for(int c = 0; c < 3; ++c)
+        {
+            indexToWorld[r][c] = sign * image->GetDirection()[r][c] * image->GetSpacing()[c];
+            indexToWorld[r][3] += indexToWorld[r][c] * largest.GetIndex()[c];
+        }
+    }
+
+    // 2. one slice at a time if the format allows it, the whole volume otherwise
+    const bool streaming = reader->GetImageIO()->CanStreamRead();
+    if(!streaming)
+    {
+        try
+        {
+            reader->Update();
+        }
+        catch(itk::ExceptionObject &excep)
+        {
+            std::cerr << "Cannot read the label volume " << inputFileName << std::endl;
+            std::cerr << excep << std::endl;
+            return false;
+        }
+    }
+    SliceReader readSlice = [&](int slice, unsigned char *inside) -> bool
+    {
+        LabelImage::RegionType region = largest;
+        region.SetIndex(2, largest.GetIndex()[2] + slice);
+        region.SetSize(2, 1);
+        if(streaming)
+        {
+            image->SetRequestedRegion(region);
+            try
+            {
+                image->Update();
+            }
+            catch(itk::ExceptionObject &excep)
+            {
+                std::cerr << "Cannot read slice " << slice << " of " << inputFileName << std::endl;
+                std::cerr << excep << std::endl;
+                return false;
+            }
+        }
+        itk::ImageRegionConstIterator<LabelImage> it(image, region);
+        for(size_t i = 0; !it.IsAtEnd(); ++it, ++i)
+        {
+            inside[i] = it.Get() != 0 ? 1 : 0;
+        }
+        return true;
+    };
+
+    // 3. the only pass over the file, then map the labeled voxels into the unit cube like a mesh
+    double bounds[6], newBounds[6];
+    InsideBits inside;
+    if(!ComputeBounds(readSlice, labelDims, indexToWorld, bounds, &inside))
+    {
+        std::cerr << "No labeled voxel in " << inputFileName << std::endl;
+        return false;
+    }
+    // the bits replace the image
+    image = nullptr;
+    reader = nullptr;
+    vtkPolyData2ImageData::MapBoundsToUnitCube(bounds, newBounds);
+    vtkPolyData2ImageData::AllocateGrid(newBounds, mVoxelSpacing, mMargin, output);
+    int dims[3];
+    double origin[3];
+    output->GetDimensions(dims);
+    output->GetOrigin(origin);
+
+    // 4. grid voxel -> unit cube -> RAS -> voxel index of the label volume
+    double gridToWorld[3][4] = {{0, 0, 0, 0}, {0, 0, 0, 0}, {0, 0, 0, 0}};
+    for(int r = 0; r < 3; ++r)
+    {
+        const double scale = (bounds[2 * r + 1] - bounds[2 * r]) / (newBounds[2 * r + 1] - newBounds[2 * r]);
+        gridToWorld[r][r] = scale * mVoxelSpacing;
+        gridToWorld[r][3] = bounds[2 * r] + (origin[r] - newBounds[2 * r]) * scale;
+    }
+    double worldToIndex[3][4], gridToIndex[3][4];
+    if(!Invert(indexToWorld, worldToIndex))
+    {
+        std::cerr << "The label volume " << inputFileName << " has a singular direction matrix." << std::endl;
+        return false;
+    }
+    Compose(worldToIndex, gridToWorld, gridToIndex);
+    Resample(inside, labelDims, gridToIndex, dims, static_cast<unsigned char*>(output->GetScalarPointer()),
+             std::thread::hardware_concurrency());
+    return true;
+}
+
+bool vtkLabelVolume2ImageData::ComputeBounds(const SliceReader &reader, const int *labelDims,
+                                             const double indexToWorld[3][4], double *bounds, InsideBits *inside)
+{
+    const size_t sliceSize = static_cast<size_t>(labelDims[0]) * static_cast<size_t>(labelDims[1]);
+    inside->assign((sliceSize * static_cast<size_t>(labelDims[2]) + 7) / 8, 0);
+    for(int r = 0; r < 3; ++r)
+    {
+        bounds[2 * r] = std::numeric_limits<double>::max();
+        bounds[2 * r + 1] = -std::numeric_limits<double>::max();
+    }
+    std::vector<unsigned char> slice(sliceSize);
+    bool found = false;
+    for(int z = 0; z < labelDims[2]; ++z)
+    {
+        if(!reader(z, slice.data()))
+        {
+            return false;
+        }
+        const size_t sliceStart = static_cast<size_t>(z) * sliceSize;
+        for(size_t i = 0; i < sliceSize; ++i)
+        {
+            (*inside)[(sliceStart + i) >> 3] |= static_cast<unsigned char>(slice[i] << ((sliceStart + i) & 7));
+        }
+        for(int y = 0; y < labelDims[1]; ++y)
+        {
+            const unsigned char *row = slice.data() + static_cast<size_t>(y) * static_cast<size_t>(labelDims[0]);
+            const unsigned char *first = std::find(row, row + labelDims[0], 1);
+            if(first == row + labelDims[0])
+            {
+                continue;
+            }
+            found = true;
+            // world coordinates are affine along the row, the extremes are at its first and last inside voxel
+            int last = labelDims[0] - 1;
+            while(row[last] == 0)
+            {
+                --last;
+            }
+            const int ends[2] = {static_cast<int>(first - row), last};
+            for(int e = 0; e < 2; ++e)
+            {
+                for(int r = 0; r < 3; ++r)
+                {
+                    const double w = Apply(indexToWorld, r, ends[e], y, z);
+                    bounds[2 * r] = std::min(bounds[2 * r], w);
+                    bounds[2 * r + 1] = std::max(bounds[2 * r + 1], w);
+                }
+            }
+        }
+    }
+    if(!found)
+    {
+        return false;
+    }
+    // from the voxel centers out to the corners of the voxels
+    for(int r = 0; r < 3; ++r)
+    {
+        const double half = 0.5 * (fabs(indexToWorld[r][0]) + fabs(indexToWorld[r][1]) + fabs(indexToWorld[r][2]));
+        bounds[2 * r] -= half;
+        bounds[2 * r + 1] += half;
+    }
+    return true;
+}
+
+void vtkLabelVolume2ImageData::Resample(const InsideBits &inside, const int *labelDims,
+                                        const double gridToIndex[3][4], const int *dims, unsigned char *mask,
+                                        unsigned int numThreads)
+{
+    numThreads = std::max(numThreads, 1u);
+    const size_t rowSize = static_cast<size_t>(labelDims[0]);
+    const size_t sliceSize = rowSize * static_cast<size_t>(labelDims[1]);
+
+    auto resampleRows = [&](size_t firstRow, size_t lastRow)
+    {
+        for(size_t row = firstRow; row < lastRow; ++row)
+        {
+            const int j = static_cast<int>(row % static_cast<size_t>(dims[1]));
+            const int k = static_cast<int>(row / static_cast<size_t>(dims[1]));
+            unsigned char *out = mask + row * static_cast<size_t>(dims[0]);
+            for(int i = 0; i < dims[0]; ++i)
+            {
+                double c[3];
+                int cell[3];
+                for(int r = 0; r < 3; ++r)
+                {
+                    c[r] = Apply(gridToIndex, r, i, j, k);
+                    cell[r] = static_cast<int>(floor(c[r]));
+                    c[r] -= cell[r];
+                }
+                double value = 0.0;
+                for(int corner = 0; corner < 8; ++corner)
+                {
+                    const int x = cell[0] + (corner & 1), y = cell[1] + ((corner >> 1) & 1);
+                    const int z = cell[2] + (corner >> 2);
+                    if(x < 0 || y < 0 || z < 0 || x >= labelDims[0] || y >= labelDims[1] || z >= labelDims[2])
+                    {
+                        continue;
+                    }
+                    const size_t n = static_cast<size_t>(z) * sliceSize + static_cast<size_t>(y) * rowSize
+                                   + static_cast<size_t>(x);
+                    if((inside[n >> 3] >> (n & 7)) & 1)
+                    {
+                        value += ((corner & 1) ? c[0] : 1 - c[0]) * (((corner >> 1) & 1) ? c[1] : 1 - c[1])
+                               * ((corner >> 2) ? c[2] : 1 - c[2]);
+                    }
+                }
+                out[i] = value >= 0.5 ? 255 : 0;
+            }
+        }
+    };
+
+    // rows of the grid split over threads
+    const size_t numRows = static_cast<size_t>(dims[1]) * static_cast<size_t>(dims[2]);
+    const size_t rowsPerThread = (numRows + numThreads - 1) / numThreads;
+    std::vector<std::thread> threads;
+    for(size_t begin = 0; begin < numRows; begin += rowsPerThread)
+    {
+        threads.push_back(std::thread(resampleRows, begin, std::min(begin + rowsPerThread, numRows)));
+    }
+    for(size_t t = 0; t < threads.size(); ++t)
+    {
+        threads[t].join();
+    }
+}
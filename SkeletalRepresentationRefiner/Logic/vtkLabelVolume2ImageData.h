@@ -0,0 +1,84 @@
+/*==============================================================================
+
+  Program: 3D Slicer
+
+  Portions (c) Copyright Brigham and Women's Hospital (BWH) All Rights Reserved.
+
+  See COPYRIGHT.txt
+  or http://www.slicer.org/copyright/copyright.txt for details.
+
+  Unless required by applicable law or agreed to in writing, software
+  distributed under the License is distributed on an "AS IS" BASIS,
+  WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+  See the License for the specific language governing permissions and
+  limitations under the License.
+
+==============================================================================*/
+
+
+
+#ifndef VTKLABELVOLUME2IMAGEDATA_H
+#define VTKLABELVOLUME2IMAGEDATA_H
+
+#include <functional>
+#include <string>
+#include <vector>
+#include <vtkSmartPointer.h>
+
+class vtkImageData;
+
+/**
+ * @brief The vtkLabelVolume2ImageData class
+ * Resamples a binary segmentation into the mask vtkPolyData2ImageData makes of its surface mesh,
+ * so the refiner can fit an s-rep to a label volume without extracting and voxelizing a mesh.
+ * Nonzero voxels are inside. The object is mapped into the unit cube by the bounds of its voxels
+ * in RAS coordinates, as Slicer would place the model made from the segmentation. The indicator of
+ * the inside voxels is interpolated trilinearly and thresholded at 1/2, close to the surface that
+ * marching cubes extracts.
+ * The volume is read once, slice by slice unless the file format can't be streamed, and kept
+ * as one bit per voxel for the resampling.
+ */
+class vtkLabelVolume2ImageData
+{
+public:
+    // Output: inside has the dims[0]*dims[1] voxels of the slice, x varies fastest, 1 inside and 0 outside
+    typedef std::function<bool(int slice, unsigned char *inside)> SliceReader;
+
+    vtkLabelVolume2ImageData();
+
+    void SetVoxelSpacing(double spacing) { mVoxelSpacing = spacing; }
+    double GetVoxelSpacing() const { return mVoxelSpacing; }
+
+    void SetMargin(double margin) { mMargin = margin; }
+    double GetMargin() const { return mMargin; }
+
+    // true for the single file volume formats read here, .nrrd and .mha
+    static bool IsLabelVolumeFile(const std::string &fileName);
+
+    // Fill output with 255 inside and 0 outside on the grid of vtkPolyData2ImageData.
+    // Return false if the volume can't be read or has no labeled voxel
+    bool Convert(const std::string &inputFileName, vtkSmartPointer<vtkImageData> output);
+
+    // Inside voxels of a label volume, one bit per voxel: voxel n = x + labelDims[0] * (y + labelDims[1] * z)
+    // is bit n % 8 of byte n / 8
+    typedef std::vector<unsigned char> InsideBits;
+
+    // Read every slice once for the bounds of the inside voxels, each voxel a box around its center,
+    // and the inside bits.
+    // Input: labelDims are the dimensions of the label volume, indexToWorld is an affine map of voxel indices
+    // Return false if a slice can't be read or no voxel is inside
+    static bool ComputeBounds(const SliceReader &reader, const int *labelDims, const double indexToWorld[3][4],
+                              double *bounds, InsideBits *inside);
+
+    // Trilinear inside indicator at the voxels of mask, thresholded at 1/2. Voxels beyond the volume are outside.
+    // Input: gridToIndex maps voxel (i, j, k) of mask to continuous voxel indices of the label volume
+    // Output: mask has dims[0]*dims[1]*dims[2] values, 255 inside and 0 outside
+    static void Resample(const InsideBits &inside, const int *labelDims, const double gridToIndex[3][4],
+                         const int *dims, unsigned char *mask, unsigned int numThreads);
+
+private:
+    double mVoxelSpacing;
+    double mMargin;
+};
+
+#endif // VTKLABELVOLUME2IMAGEDATA_H
@@ -0,0 +1,88 @@
+/*==============================================================================
+
+  Program: 3D Slicer
+
+  Portions (c) Copyright Brigham and Women's Hospital (BWH) All Rights Reserved.
+
+  See COPYRIGHT.txt
+  or http://www.slicer.org/copyright/copyright.txt for details.
+
+  Unless required by applicable law or agreed to in writing, software
+  distributed under the License is distributed on an "AS IS" BASIS,
+  WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+  See the License for the specific language governing permissions and
+  limitations under the License.
+
+==============================================================================*/
+
+
+#include "vtkMappedDistanceMap.h"
+#include "vtkDistanceMapCache.h"
+
+#include <cstring>
+#include <iostream>
+
+vtkMappedDistanceMap::vtkMappedDistanceMap()
+{
+}
+
+vtkMappedDistanceMap::~vtkMappedDistanceMap()
+{
+    Close();
+}
+
+bool vtkMappedDistanceMap::Open(const std::string &fileName)
+{
+    Close();
+    if(!mFile.Open(fileName))
+    {
+        return false;
+    }
+    // the header and the size are checked on the mapping itself, the volumes are read through it
+    vtkDistanceMapFileHeader header;
+    if(mFile.GetSize() < sizeof(header))
+    {
+        std::cerr << fileName << " is not a valid distance map file." << std::endl;
+        mFile.Close();
+        return false;
+    }
+    std::memcpy(&header, mFile.GetData(), sizeof(header));
+    if(!vtkDistanceMapCache::CheckHeader(header, mFile.GetSize()))
+    {
+        std::cerr << fileName << " is not a valid distance map file." << std::endl;
+        mFile.Close();
+        return false;
+    }
+    mFileName = fileName;
+    for(int i = 0; i < 3; ++i)
+    {
+        mDims[i] = header.dims[i];
+        mOrigin[i] = header.origin[i];
+    }
+    mSpacing = header.spacing[0];
+    mBricked = header.layout == 1;
+    const size_t numVoxels = static_cast<size_t>(mDims[0]) * static_cast<size_t>(mDims[1]) * static_cast<size_t>(mDims[2]);
+    mDistance = reinterpret_cast<const float*>(mFile.GetData() + sizeof(vtkDistanceMapFileHeader));
+    if(header.normals == vtkDistanceMapCache::GradientNormals)
+    {
+        mGradient = mDistance + numVoxels;
+    }
+    else if(header.normals == vtkDistanceMapCache::OctahedralNormals)
+    {
+        mOctahedralNormals = reinterpret_cast<const unsigned int*>(mDistance + numVoxels);
+    }
+    return true;
+}
+
+void vtkMappedDistanceMap::Close()
+{
+    mFile.Close();
+    mFileName.clear();
+    mDims[0] = mDims[1] = mDims[2] = 0;
+    mOrigin[0] = mOrigin[1] = mOrigin[2] = 0.0;
+    mBricked = false;
+    mSpacing = 0.0;
+    mDistance = nullptr;
+    mGradient = nullptr;
+    mOctahedralNormals = nullptr;
+}
@@ -0,0 +1,81 @@
+/*==============================================================================
+
+  Program: 3D Slicer
+
+  Portions (c) Copyright Brigham and Women's Hospital (BWH) All Rights Reserved.
+
+  See COPYRIGHT.txt
+  or http://www.slicer.org/copyright/copyright.txt for details.
+
+  Unless required by applicable law or agreed to in writing, software
+  distributed under the License is distributed on an "AS IS" BASIS,
+  WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+  See the License for the specific language governing permissions and
+  limitations under the License.
+
+==============================================================================*/
+
+
+#ifndef VTKMAPPEDDISTANCEMAP_H
+#define VTKMAPPEDDISTANCEMAP_H
+
+#include "vtkMappedFile.h"
+
+#include <string>
+
+/**
+ * @brief The vtkMappedDistanceMap class
+ * Read-only memory mapping of a distance map file written by vtkDistanceMapCache.
+ * The distance volume and the normals stored with it are sampled in place. Processes that refine against
+ * the same target share the physical pages of one file instead of holding private copies.
+ */
+class vtkMappedDistanceMap
+{
+public:
+    vtkMappedDistanceMap();
+    ~vtkMappedDistanceMap();
+
+    // Map the file. Return false if it is not a valid distance map file
+    bool Open(const std::string &fileName);
+
+    // Unmap the file
+    void Close();
+
+    bool IsOpen() const { return mFile.IsOpen(); }
+
+    const std::string &GetFileName() const { return mFileName; }
+
+    const int *GetDimensions() const { return mDims; }
+
+    // center of voxel (0, 0, 0) in the unit cube and the voxel size, as stored in the header
+    const double *GetOrigin() const { return mOrigin; }
+    double GetSpacing() const { return mSpacing; }
+
+    // true if the volumes are in the order of vtkBrickedLayout
+    bool IsBricked() const { return mBricked; }
+
+    // dims[0]*dims[1]*dims[2] signed distances, x varies fastest unless bricked
+    const float *GetDistance() const { return mDistance; }
+
+    // 3 gradient components per voxel in the order of GetDistance, nullptr if the file has no gradient
+    const float *GetGradient() const { return mGradient; }
+
+    // octahedral normal code of each voxel in the order of GetDistance, nullptr if the file has no codes
+    const unsigned int *GetOctahedralNormals() const { return mOctahedralNormals; }
+
+private:
+    std::string mFileName;
+    vtkMappedFile mFile;
+    int mDims[3] = {0, 0, 0};
+    double mOrigin[3] = {0.0, 0.0, 0.0};
+    double mSpacing = 0.0;
+    bool mBricked = false;
+    const float *mDistance = nullptr;
+    const float *mGradient = nullptr;
+    const unsigned int *mOctahedralNormals = nullptr;
+
+    vtkMappedDistanceMap(const vtkMappedDistanceMap&); // Not implemented
+    void operator=(const vtkMappedDistanceMap&); // Not implemented
+};
+
+#endif // VTKMAPPEDDISTANCEMAP_H
@@ -0,0 +1,400 @@
+/*==============================================================================
+
+  Program: 3D Slicer
+
+  Portions (c) Copyright Brigham and Women's Hospital (BWH) All Rights Reserved.
+
+  See COPYRIGHT.txt
+  or http://www.slicer.org/copyright/copyright.txt for details.
+
+  Unless required by applicable law or agreed to in writing, software
+  distributed under the License is distributed on an "AS IS" BASIS,
+  WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+  See the License for the specific language governing permissions and
+  limitations under the License.
+
+==============================================================================*/
+
+
+#include "vtkMeshDistanceOracle.h"
+
+#include <algorithm>
+#include <limits>
+#include <math.h>
+#include <stdint.h>
+#include <unordered_map>
+
+namespace
+{
+const int leafSize = 4;
+
+double Dot(const double *u, const double *v)
+{
+    return u[0] * v[0] + u[1] * v[1] + u[2] * v[2];
+}
+
+void Cross(const double *u, const double *v, double *output)
+{
+    output[0] = u[1] * v[2] - u[2] * v[1];
+    output[1] = u[2] * v[0] - u[0] * v[2];
+    output[2] = u[0] * v[1] - u[1] * v[0];
+}
+
+double BoxDistanceSquared(const double *p, const double *lo, const double *hi)
+{
+    double d = 0.0;
+    for(int i = 0; i < 3; ++i)
+    {
+        double outside = p[i] < lo[i] ? lo[i] - p[i] : (p[i] > hi[i] ? p[i] - hi[i] : 0.0);
+        d += outside * outside;
+    }
+    return d;
+}
+}
+
+vtkMeshDistanceOracle::vtkMeshDistanceOracle()
+{
+}
+
+int vtkMeshDistanceOracle::ClosestPointOnTriangle(const double *p, const double *a, const double *b, const double *c,
+                                                  double *closest)
+{
+    double ab[3], ac[3], ap[3], bp[3], cp[3];
+    for(int i = 0; i < 3; ++i)
+    {
+        ab[i] = b[i] - a[i];
+        ac[i] = c[i] - a[i];
+        ap[i] = p[i] - a[i];
+        bp[i] = p[i] - b[i];
+        cp[i] = p[i] - c[i];
+    }
+    double d1 = Dot(ab, ap), d2 = Dot(ac, ap);
+    double d3 = Dot(ab, bp), d4 = Dot(ac, bp);
+    double d5 = Dot(ab, cp), d6 = Dot(ac, cp);
+    double va = d3 * d6 - d5 * d4, vb = d5 * d2 - d1 * d6, vc = d1 * d4 - d3 * d2;
+    auto onSegment = [closest](const double *q, const double *r, double t)
+    {
+        for(int i = 0; i < 3; ++i)
+        {
+            closest[i] = q[i] + t * (r[i] - q[i]);
+        }
+    };
+    if(d1 <= 0 && d2 <= 0)
+    {
+        onSegment(a, a, 0);
+        return VertexA;
+    }
+    if(d3 >= 0 && d4 <= d3)
+    {
+        onSegment(b, b, 0);
+        return VertexB;
+    }
+    if(vc <= 0 && d1 >= 0 && d3 <= 0)
+    {
+        onSegment(a, b, d1 / (d1 - d3));
+        return EdgeAB;
+    }
+    if(d6 >= 0 && d5 <= d6)
+    {
+        onSegment(c, c, 0);
+        return VertexC;
+    }
+    if(vb <= 0 && d2 >= 0 && d6 <= 0)
+    {
+        onSegment(a, c, d2 / (d2 - d6));
+        return EdgeCA;
+    }
+    if(va <= 0 && (d4 - d3) >= 0 && (d5 - d6) >= 0)
+    {
+        onSegment(b, c, (d4 - d3) / ((d4 - d3) + (d5 - d6)));
+        return EdgeBC;
+    }
+    double denom = va + vb + vc;
+    if(denom == 0)
+    {
+        // degenerate triangle, all its vertices and edges were tested above
+        onSegment(a, a, 0);
+        return VertexA;
+    }
+    double v = vb / denom, w = vc / denom;
+    for(int i = 0; i < 3; ++i)
+    {
+        closest[i] = a[i] + v * ab[i] + w * ac[i];
+    }
+    return FaceRegion;
+}
+
+void vtkMeshDistanceOracle::Clear()
+{
+    mPoints.clear();
+    mTriangles.clear();
+    mOrder.clear();
+    mNodes.clear();
+    mFaceNormals.clear();
+    mVertexNormals.clear();
+    mEdgeNormals.clear();
+}
+
+void vtkMeshDistanceOracle::Build(const float *points, size_t numPoints, const int *triangles, size_t numTriangles)
+{
+    Clear();
+    if(numTriangles == 0)
+    {
+        return;
+    }
+    mPoints.assign(points, points + 3 * numPoints);
+    mTriangles.assign(triangles, triangles + 3 * numTriangles);
+
+    // the sign test needs outward normals, a negative volume means the mesh faces inward
+    double volume = 0.0;
+    for(size_t t = 0; t < numTriangles; ++t)
+    {
+        const double *a = &mPoints[3 * static_cast<size_t>(mTriangles[3 * t])];
+        const double *b = &mPoints[3 * static_cast<size_t>(mTriangles[3 * t + 1])];
+        const double *c = &mPoints[3 * static_cast<size_t>(mTriangles[3 * t + 2])];
+        double bc[3];
+        Cross(b, c, bc);
+        volume += Dot(a, bc);
+    }
+    if(volume < 0)
+    {
+        for(size_t t = 0; t < numTriangles; ++t)
+        {
+            std::swap(mTriangles[3 * t + 1], mTriangles[3 * t + 2]);
+        }
+    }
+    ComputePseudoNormals();
+
+    std::vector<double> centroids(3 * numTriangles);
+    mOrder.resize(numTriangles);
+    for(size_t t = 0; t < numTriangles; ++t)
+    {
+        mOrder[t] = static_cast<int>(t);
+        for(int i = 0; i < 3; ++i)
+        {
+            centroids[3 * t + i] = (mPoints[3 * static_cast<size_t>(mTriangles[3 * t]) + i]
+                                    + mPoints[3 * static_cast<size_t>(mTriangles[3 * t + 1]) + i]
+                                    + mPoints[3 * static_cast<size_t>(mTriangles[3 * t + 2]) + i]) / 3.0;
+        }
+    }
+    mNodes.reserve(2 * numTriangles / leafSize + 1);
+    mNodes.push_back(Node());
+    BuildNode(0, 0, static_cast<int>(numTriangles), centroids);
+}
+
+void vtkMeshDistanceOracle::BuildNode(int node, int first, int count, const std::vector<double> &centroids)
+{
+    Node box;
+    double centroidLo[3], centroidHi[3];
+    for(int i = 0; i < 3; ++i)
+    {
+        box.lo[i] = centroidLo[i] = std::numeric_limits<double>::max();
+        box.hi[i] = centroidHi[i] = -std::numeric_limits<double>::max();
+    }
+    for(int k = first; k < first + count; ++k)
+    {
+        size_t t = static_cast<size_t>(mOrder[static_cast<size_t>(k)]);
+        for(int v = 0; v < 3; ++v)
+        {
+            const double *pt = &mPoints[3 * static_cast<size_t>(mTriangles[3 * t + v])];
+            for(int i = 0; i < 3; ++i)
+            {
+                box.lo[i] = std::min(box.lo[i], pt[i]);
+                box.hi[i] = std::max(box.hi[i], pt[i]);
+            }
+        }
+        for(int i = 0; i < 3; ++i)
+        {
+            centroidLo[i] = std::min(centroidLo[i], centroids[3 * t + i]);
+            centroidHi[i] = std::max(centroidHi[i], centroids[3 * t + i]);
+        }
+    }
+    if(count <= leafSize)
+    {
+        box.first = first;
+        box.count = count;
+        mNodes[static_cast<size_t>(node)] = box;
+        return;
+    }
+
+    // median split along the longest axis of the centroids
+    int axis = 0;
+    for(int i = 1; i < 3; ++i)
+    {
+        if(centroidHi[i] - centroidLo[i] > centroidHi[axis] - centroidLo[axis])
+        {
+            axis = i;
+        }
+    }
+    const int half = count / 2;
+    std::nth_element(mOrder.begin() + first, mOrder.begin() + first + half, mOrder.begin() + first + count,
+                     [&centroids, axis](int t1, int t2)
+    {
+        return centroids[3 * static_cast<size_t>(t1) + static_cast<size_t>(axis)]
+             < centroids[3 * static_cast<size_t>(t2) + static_cast<size_t>(axis)];
+    });
+
+    const int left = static_cast<int>(mNodes.size());
+    mNodes.push_back(Node());
+    mNodes.push_back(Node());
+    box.first = left;
+    box.count = 0;
+    mNodes[static_cast<size_t>(node)] = box;
+    BuildNode(left, first, half, centroids);
+    BuildNode(left + 1, first + half, count - half, centroids);
+}
+
+void vtkMeshDistanceOracle::ComputePseudoNormals()
+{
+    const size_t numTriangles = mTriangles.size() / 3;
+    mFaceNormals.assign(3 * numTriangles, 0.0);
+    mVertexNormals.assign(mPoints.size(), 0.0);
+    mEdgeNormals.assign(9 * numTriangles, 0.0);
+
+    // sum of the normals of the faces sharing each edge
+    std::unordered_map<uint64_t, std::vector<double> > edgeSums;
+    auto edgeKey = [](int i, int j)
+    {
+        uint64_t lo = static_cast<uint32_t>(std::min(i, j)), hi = static_cast<uint32_t>(std::max(i, j));
+        return (hi << 32) | lo;
+    };
+    for(size_t t = 0; t < numTriangles; ++t)
+    {
+        const int *ids = &mTriangles[3 * t];
+        double edges[3][3];
+        for(int e = 0; e < 3; ++e)
+        {
+            for(int i = 0; i < 3; ++i)
+            {
+                edges[e][i] = mPoints[3 * static_cast<size_t>(ids[(e + 1) % 3]) + i]
+                            - mPoints[3 * static_cast<size_t>(ids[e]) + i];
+            }
+        }
+        double *normal = &mFaceNormals[3 * t];
+        Cross(edges[0], edges[1], normal);
+        Normalize(normal);
+
+        for(int v = 0; v < 3; ++v)
+        {
+            // angle at vertex v between the edges leaving it
+            double out[3], in[3];
+            for(int i = 0; i < 3; ++i)
+            {
+                out[i] = edges[v][i];
+                in[i] = -edges[(v + 2) % 3][i];
+            }
+            double lengths = sqrt(Dot(out, out) * Dot(in, in));
+            double angle = lengths > 0 ? acos(std::max(-1.0, std::min(1.0, Dot(out, in) / lengths))) : 0.0;
+            for(int i = 0; i < 3; ++i)
+            {
+                mVertexNormals[3 * static_cast<size_t>(ids[v]) + i] += angle * normal[i];
+            }
+
+            std::vector<double> &sum = edgeSums[edgeKey(ids[v], ids[(v + 1) % 3])];
+            sum.resize(3, 0.0);
+            for(int i = 0; i < 3; ++i)
+            {
+                sum[i] += normal[i];
+            }
+        }
+    }
+    for(size_t t = 0; t < numTriangles; ++t)
+    {
+        const int *ids = &mTriangles[3 * t];
+        for(int e = 0; e < 3; ++e)
+        {
+            const std::vector<double> &sum = edgeSums[edgeKey(ids[e], ids[(e + 1) % 3])];
+            for(int i = 0; i < 3; ++i)
+            {
+                mEdgeNormals[9 * t + 3 * static_cast<size_t>(e) + static_cast<size_t>(i)] = sum[static_cast<size_t>(i)];
+            }
+        }
+    }
+}
+
+double vtkMeshDistanceOracle::Query(const double *point, double *closest, double *normal) const
+{
+    if(mNodes.empty())
+    {
+        closest[0] = closest[1] = closest[2] = 0.0;
+        normal[0] = normal[1] = normal[2] = 0.0;
+        return 0.0;
+    }
+    double best = std::numeric_limits<double>::max();
+    size_t bestTriangle = 0;
+    int bestRegion = FaceRegion;
+    int stack[128];
+    int top = 0;
+    stack[top++] = 0;
+    while(top > 0)
+    {
+        const Node &node = mNodes[static_cast<size_t>(stack[--top])];
+        if(BoxDistanceSquared(point, node.lo, node.hi) >= best)
+        {
+            continue;
+        }
+        if(node.count > 0)
+        {
+            for(int k = node.first; k < node.first + node.count; ++k)
+            {
+                size_t t = static_cast<size_t>(mOrder[static_cast<size_t>(k)]);
+                double candidate[3];
+                int region = ClosestPointOnTriangle(point,
+                                                    &mPoints[3 * static_cast<size_t>(mTriangles[3 * t])],
+                                                    &mPoints[3 * static_cast<size_t>(mTriangles[3 * t + 1])],
+                                                    &mPoints[3 * static_cast<size_t>(mTriangles[3 * t + 2])],
+                                                    candidate);
+                double diff[3] = {point[0] - candidate[0], point[1] - candidate[1], point[2] - candidate[2]};
+                double d = Dot(diff, diff);
+                if(d < best)
+                {
+                    best = d;
+                    bestTriangle = t;
+                    bestRegion = region;
+                    closest[0] = candidate[0];
+                    closest[1] = candidate[1];
+                    closest[2] = candidate[2];
+                }
+            }
+        }
+        else
+        {
+            // visit the nearer child first
+            const Node &left = mNodes[static_cast<size_t>(node.first)];
+            const Node &right = mNodes[static_cast<size_t>(node.first + 1)];
+            bool leftFirst = BoxDistanceSquared(point, left.lo, left.hi) <= BoxDistanceSquared(point, right.lo, right.hi);
+            stack[top++] = leftFirst ? node.first + 1 : node.first;
+            stack[top++] = leftFirst ? node.first : node.first + 1;
+        }
+    }
+
+    for(int i = 0; i < 3; ++i)
+    {
+        normal[i] = mFaceNormals[3 * bestTriangle + static_cast<size_t>(i)];
+    }
+    const double *pseudoNormal = &mFaceNormals[3 * bestTriangle];
+    switch(bestRegion)
+    {
+    case VertexA:
+    case VertexB:
+    case VertexC:
+        pseudoNormal = &mVertexNormals[3 * static_cast<size_t>(mTriangles[3 * bestTriangle + static_cast<size_t>(bestRegion - VertexA)])];
+        break;
+    case EdgeAB:
+    case EdgeBC:
+    case EdgeCA:
+        pseudoNormal = &mEdgeNormals[9 * bestTriangle + 3 * static_cast<size_t>(bestRegion - EdgeAB)];
+        break;
+    default:
+        break;
+    }
+    double diff[3] = {point[0] - closest[0], point[1] - closest[1], point[2] - closest[2]};
+    double distance = sqrt(best);
+    return Dot(diff, pseudoNormal) < 0 ? -distance : distance;
+}
+
+double vtkMeshDistanceOracle::Sample(const double *point, double *normal) const
+{
+    double closest[3];
+    return Query(point, closest, normal);
+}
@@ -0,0 +1,87 @@
+/*==============================================================================
+
+  Program: 3D Slicer
+
+  Portions (c) Copyright Brigham and Women's Hospital (BWH) All Rights Reserved.
+
+  See COPYRIGHT.txt
+  or http://www.slicer.org/copyright/copyright.txt for details.
+
+  Unless required by applicable law or agreed to in writing, software
+  distributed under the License is distributed on an "AS IS" BASIS,
+  WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+  See the License for the specific language governing permissions and
+  limitations under the License.
+
+==============================================================================*/
+
+
+#ifndef VTKMESHDISTANCEORACLE_H
+#define VTKMESHDISTANCEORACLE_H
+
+#include "vtkDistanceSampler.h"
+
+#include <vector>
+
+/**
+ * @brief The vtkMeshDistanceOracle class
+ * Exact signed distance to a closed triangle mesh through a bounding volume hierarchy.
+ * The sign comes from the angle-weighted pseudo-normal of the closest feature (face, edge or vertex)
+ * of Baerentzen and Aanaes, the normal is the one of the closest triangle.
+ * No volume is sampled, so there is neither a voxel grid to generate nor a voxel size that limits accuracy.
+ */
+class vtkMeshDistanceOracle : public vtkDistanceSampler
+{
+public:
+    vtkMeshDistanceOracle();
+
+    // Input: points are xyz, triangles are 3 point ids each, consistently oriented.
+    // Inward facing meshes are flipped.
+    void Build(const float *points, size_t numPoints, const int *triangles, size_t numTriangles);
+
+    // forget the mesh
+    void Clear();
+
+    bool IsEmpty() const { return mNodes.empty(); }
+
+    size_t GetNumberOfTriangles() const { return mTriangles.size() / 3; }
+
+    // Signed distance from point to the mesh.
+    // Output: closest is the closest point on the mesh, normal the unit normal of its triangle
+    double Query(const double *point, double *closest, double *normal) const;
+
+    double Sample(const double *point, double *normal) const override;
+
+    // closest feature of a triangle
+    enum TriangleRegion { FaceRegion = 0, VertexA, VertexB, VertexC, EdgeAB, EdgeBC, EdgeCA };
+
+    // Closest point of the triangle abc to p, Ericson, Real-Time Collision Detection 5.1.5.
+    // Return the TriangleRegion it lies in
+    static int ClosestPointOnTriangle(const double *p, const double *a, const double *b, const double *c,
+                                      double *closest);
+
+private:
+    // A box of the hierarchy. Leaves hold count triangles from first in mOrder,
+    // inner nodes (count == 0) have their children at first and first + 1
+    struct Node
+    {
+        double lo[3];
+        double hi[3];
+        int first;
+        int count;
+    };
+
+    std::vector<double> mPoints;
+    std::vector<int> mTriangles;
+    std::vector<int> mOrder;
+    std::vector<Node> mNodes;
+    // unit face normals, angle-weighted vertex normals and edge normals (3 per triangle, edges ab, bc, ca)
+    std::vector<double> mFaceNormals;
+    std::vector<double> mVertexNormals;
+    std::vector<double> mEdgeNormals;
+
+    void BuildNode(int node, int first, int count, const std::vector<double> &centroids);
+    void ComputePseudoNormals();
+};
+
+#endif // VTKMESHDISTANCEORACLE_H
@@ -0,0 +1,270 @@
+/*==============================================================================
+
+  Program: 3D Slicer
+
+  Portions (c) Copyright Brigham and Women's Hospital (BWH) All Rights Reserved.
+
+  See COPYRIGHT.txt
+  or http://www.slicer.org/copyright/copyright.txt for details.
+
+  Unless required by applicable law or agreed to in writing, software
+  distributed under the License is distributed on an "AS IS" BASIS,
+  WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+  See the License for the specific language governing permissions and
+  limitations under the License.
+
+==============================================================================*/
+
+#include "vtkMultiLabelDistanceMap.h"
+#include "vtkPolyData2ImageData.h"
+#include "vtkSignedDistanceTransform.h"
+#include "vtkSurfaceMeshReader.h"
+
+#include <vtkImageData.h>
+#include <vtkPolyData.h>
+#include <vtkSmartPointer.h>
+
+#include <algorithm>
+#include <iostream>
+#include <limits>
+#include <math.h>
+#include <thread>
+
+namespace
+{
+// the map p * scale + shift of vtkPolyData2ImageData into the unit cube of bounds, all axes share the scale
+void UnitCubeMap(const double *bounds, double *scale, double *shift)
+{
+    double newBounds[6];
+    vtkPolyData2ImageData::MapBoundsToUnitCube(bounds, newBounds);
+    const double range = std::max(bounds[1] - bounds[0], std::max(bounds[3] - bounds[2], bounds[5] - bounds[4]));
+    *scale = 1.0 / range;
+    for(int i = 0; i < 3; ++i)
+    {
+        shift[i] = newBounds[2 * i] - bounds[2 * i] * *scale;
+    }
+}
+
+// voxel (x, y, z) of the box starting at voxel first of a grid of dims voxels, x varies fastest
+inline size_t GridIndex(const int *dims, const int *first, int x, int y, int z)
+{
+    return (static_cast<size_t>(first[2] + z) * static_cast<size_t>(dims[1]) + static_cast<size_t>(first[1] + y))
+           * static_cast<size_t>(dims[0]) + static_cast<size_t>(first[0] + x);
+}
+}
+
+double vtkMultiLabelDistanceMap::ObjectSampler::Sample(const double *point, double *normal) const
+{
+    // the scale is uniform, so the normal keeps its direction and length
+    const double common[3] = {point[0] * Scale + Shift[0], point[1] * Scale + Shift[1], point[2] * Scale + Shift[2]};
+    return Map->Sample(common, normal) / Scale;
+}
+
+vtkMultiLabelDistanceMap::vtkMultiLabelDistanceMap()
+{
+}
+
+void vtkMultiLabelDistanceMap::Clear()
+{
+    mSamplers.clear();
+    mMaps.clear();
+    mFileNames.clear();
+}
+
+void vtkMultiLabelDistanceMap::SetInterpolation(vtkImageDistanceSampler::Interpolation interpolation)
+{
+    mInterpolation = interpolation;
+    for(size_t i = 0; i < mMaps.size(); ++i)
+    {
+        mMaps[i].SetInterpolation(interpolation);
+    }
+}
+
+bool vtkMultiLabelDistanceMap::Build(const std::vector<std::string> &meshFileNames, double spacing, double band)
+{
+    Clear();
+    const size_t numObjects = meshFileNames.size();
+    if(numObjects == 0 || numObjects > 255)
+    {
+        std::cerr << "A label volume holds 1 to 255 objects, not " << numObjects << "." << std::endl;
+        return false;
+    }
+    const unsigned int numThreads = std::thread::hardware_concurrency();
+
+    // 1. the triangles of every mesh and the bounds of all of them
+    std::vector<std::vector<float> > points(numObjects);
+    std::vector<std::vector<int> > ids(numObjects);
+    std::vector<double> bounds(6 * numObjects);
+    const double inf = std::numeric_limits<double>::infinity();
+    double allBounds[6] = {inf, -inf, inf, -inf, inf, -inf};
+    for(size_t i = 0; i < numObjects; ++i)
+    {
+        vtkSmartPointer<vtkPolyData> mesh = vtkSurfaceMeshReader::Read(meshFileNames[i]);
+        if(mesh->GetNumberOfPoints() == 0)
+        {
+            return false;
+        }
+        mesh->GetBounds(&bounds[6 * i]);
+        for(int a = 0; a < 3; ++a)
+        {
+            allBounds[2 * a] = std::min(allBounds[2 * a], bounds[6 * i + 2 * a]);
+            allBounds[2 * a + 1] = std::max(allBounds[2 * a + 1], bounds[6 * i + 2 * a + 1]);
+        }
+        vtkPolyData2ImageData::ExtractTriangles(mesh, points[i], ids[i]);
+    }
+
+    // 2. one label volume in the unit cube of all meshes, the band has to fit around every object
+    double allScale = 1.0, allShift[3];
+    UnitCubeMap(allBounds, &allScale, allShift);
+    double allNewBounds[6];
+    vtkPolyData2ImageData::MapBoundsToUnitCube(allBounds, allNewBounds);
+    const double margin = band + 2.0 * spacing;
+    vtkSmartPointer<vtkImageData> labelImage = vtkSmartPointer<vtkImageData>::New();
+    vtkPolyData2ImageData::AllocateGrid(allNewBounds, spacing, margin, labelImage);
+    int dims[3];
+    double origin[3];
+    labelImage->GetDimensions(dims);
+    labelImage->GetOrigin(origin);
+    unsigned char *labels = static_cast<unsigned char*>(labelImage->GetScalarPointer());
+    std::fill(labels, labels + static_cast<size_t>(dims[0]) * static_cast<size_t>(dims[1])
+                                * static_cast<size_t>(dims[2]), static_cast<unsigned char>(0));
+
+    // the box of voxels around each object, first voxel and dimensions
+    std::vector<int> boxes(6 * numObjects);
+    for(size_t i = 0; i < numObjects; ++i)
+    {
+        int *box = &boxes[6 * i];
+        for(int a = 0; a < 3; ++a)
+        {
+            const double low = bounds[6 * i + 2 * a] * allScale + allShift[a] - margin;
+            const double high = bounds[6 * i + 2 * a + 1] * allScale + allShift[a] + margin;
+            const int first = std::max(0, static_cast<int>(floor((low - origin[a]) / spacing)));
+            const int last = std::min(dims[a] - 1, static_cast<int>(ceil((high - origin[a]) / spacing)));
+            box[a] = first;
+            box[3 + a] = last - first + 1;
+        }
+    }
+
+    // 3. voxelize each mesh in its box, a voxel inside several meshes keeps the first label
+    std::vector<unsigned char> inside;
+    for(size_t i = 0; i < numObjects; ++i)
+    {
+        const int *box = &boxes[6 * i];
+        const int *boxDims = box + 3;
+        const double boxOrigin[3] = {origin[0] + box[0] * spacing, origin[1] + box[1] * spacing,
+                                     origin[2] + box[2] * spacing};
+        std::vector<float> &objectPoints = points[i];
+        for(size_t j = 0; j < objectPoints.size(); ++j)
+        {
+            objectPoints[j] = static_cast<float>(objectPoints[j] * allScale + allShift[j % 3]);
+        }
+        inside.resize(static_cast<size_t>(boxDims[0]) * static_cast<size_t>(boxDims[1])
+                      * static_cast<size_t>(boxDims[2]));
+        vtkPolyData2ImageData::Voxelize(objectPoints.data(), ids[i].data(), ids[i].size() / 3, boxDims, boxOrigin,
+                                        spacing, inside.data(), numThreads);
+        std::vector<float>().swap(objectPoints);
+        std::vector<int>().swap(ids[i]);
+
+        const unsigned char label = static_cast<unsigned char>(i + 1);
+        size_t boxVoxel = 0;
+        for(int z = 0; z < boxDims[2]; ++z)
+        {
+            for(int y = 0; y < boxDims[1]; ++y)
+            {
+                for(int x = 0; x < boxDims[0]; ++x, ++boxVoxel)
+                {
+                    if(inside[boxVoxel] == 0)
+                    {
+                        continue;
+                    }
+                    unsigned char &voxelLabel = labels[GridIndex(dims, box, x, y, z)];
+                    if(voxelLabel == 0)
+                    {
+                        voxelLabel = label;
+                    }
+                }
+            }
+        }
+    }
+    // 4. exact distances of each label in its box, only the band is kept
+    const double spacing3[3] = {spacing, spacing, spacing};
+    std::vector<float> dist;
+    mMaps.resize(numObjects);
+    for(size_t i = 0; i < numObjects; ++i)
+    {
+        const int *box = &boxes[6 * i];
+        const int *boxDims = box + 3;
+        const double boxOrigin[3] = {origin[0] + box[0] * spacing, origin[1] + box[1] * spacing,
+                                     origin[2] + box[2] * spacing};
+        const unsigned char label = static_cast<unsigned char>(i + 1);
+        inside.resize(static_cast<size_t>(boxDims[0]) * static_cast<size_t>(boxDims[1])
+                      * static_cast<size_t>(boxDims[2]));
+        size_t boxVoxel = 0;
+        for(int z = 0; z < boxDims[2]; ++z)
+        {
+            for(int y = 0; y < boxDims[1]; ++y)
+            {
+                for(int x = 0; x < boxDims[0]; ++x, ++boxVoxel)
+                {
+                    inside[boxVoxel] = labels[GridIndex(dims, box, x, y, z)] == label ? 1 : 0;
+                }
+            }
+        }
+        dist.resize(inside.size());
+        if(!vtkSignedDistanceTransform::Compute(inside.data(), boxDims, spacing3, dist.data(), numThreads))
+        {
+            Clear();
+            return false;
+        }
+        mMaps[i].BuildFromDense(dist.data(), boxDims, boxOrigin, spacing, band);
+        mMaps[i].SetInterpolation(mInterpolation);
+    }
+
+    // 5. samplers in the unit cube of each mesh
+    mSamplers.resize(numObjects);
+    for(size_t i = 0; i < numObjects; ++i)
+    {
+        double scale = 1.0, shift[3];
+        UnitCubeMap(&bounds[6 * i], &scale, shift);
+        ObjectSampler &sampler = mSamplers[i];
+        sampler.Map = &mMaps[i];
+        sampler.Scale = allScale / scale;
+        for(int a = 0; a < 3; ++a)
+        {
+            sampler.Shift[a] = allShift[a] - shift[a] * sampler.Scale;
+        }
+    }
+    mFileNames = meshFileNames;
+    return true;
+}
+
+int vtkMultiLabelDistanceMap::FindObject(const std::string &fileName) const
+{
+    for(size_t i = 0; i < mFileNames.size(); ++i)
+    {
+        if(mFileNames[i] == fileName)
+        {
+            return static_cast<int>(i);
+        }
+    }
+    return -1;
+}
+
+const vtkDistanceSampler *vtkMultiLabelDistanceMap::GetSampler(int object) const
+{
+    if(object < 0 || object >= static_cast<int>(mSamplers.size()))
+    {
+        return nullptr;
+    }
+    return &mSamplers[object];
+}
+
+size_t vtkMultiLabelDistanceMap::GetMemorySize() const
+{
+    size_t size = 0;
+    for(size_t i = 0; i < mMaps.size(); ++i)
+    {
+        size += mMaps[i].GetMemorySize();
+    }
+    return size;
+}
@@ -0,0 +1,93 @@
+/*==============================================================================
+
+  Program: 3D Slicer
+
+  Portions (c) Copyright Brigham and Women's Hospital (BWH) All Rights Reserved.
+
+  See COPYRIGHT.txt
+  or http://www.slicer.org/copyright/copyright.txt for details.
+
+  Unless required by applicable law or agreed to in writing, software
+  distributed under the License is distributed on an "AS IS" BASIS,
+  WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+  See the License for the specific language governing permissions and
+  limitations under the License.
+
+==============================================================================*/
+
+#ifndef VTKMULTILABELDISTANCEMAP_H
+#define VTKMULTILABELDISTANCEMAP_H
+
+#include "vtkDistanceSampler.h"
+#include "vtkSparseDistanceMap.h"
+
+#include <stddef.h>
+#include <string>
+#include <vector>
+
+/**
+ * @brief The vtkMultiLabelDistanceMap class
+ * Narrow band distance maps of several objects computed together, e.g. the neighboring structures of
+ * a multi-object s-rep fit. All meshes are mapped into the unit cube of their common bounds and voxelized
+ * into one label volume, object i is label i + 1. A voxel inside several meshes belongs to the first one,
+ * so the objects don't claim the same voxels. The exact distance transform of each label runs on the part
+ * of the label volume around that object only, and its band is kept in a vtkSparseDistanceMap.
+ * The label volume is released once the maps are built.
+ * The maps don't change after Build, so one instance can be shared by the refiners of all objects.
+ * Each refiner samples its object in the unit cube of that object's own mesh, see GetSampler.
+ */
+class vtkMultiLabelDistanceMap
+{
+public:
+    vtkMultiLabelDistanceMap();
+
+    // Input: meshFileNames are the surface meshes of the objects, at most 255
+    // Input: spacing and band are in the unit cube of all meshes together. A small object among large ones
+    // gets coarser voxels in its own unit cube than the refiner would use for it alone.
+    // Return false if a mesh can't be read, no map is kept then
+    bool Build(const std::vector<std::string> &meshFileNames, double spacing, double band);
+
+    void Clear();
+
+    // Interpolation of the samples of all objects, set it before the map is shared. Kept by Build
+    void SetInterpolation(vtkImageDistanceSampler::Interpolation interpolation);
+
+    int GetNumberOfObjects() const { return static_cast<int>(mFileNames.size()); }
+
+    const std::string &GetFileName(int object) const { return mFileNames[object]; }
+
+    // index of the object built from fileName, -1 if there is none
+    int FindObject(const std::string &fileName) const;
+
+    // Distance to an object at points in the unit cube of its own mesh, where the refiner maps the s-rep
+    // of that object. Distances are in the units of that unit cube. nullptr if object is out of range
+    const vtkDistanceSampler *GetSampler(int object) const;
+
+    // bytes held by the maps of all objects
+    size_t GetMemorySize() const;
+
+private:
+    // maps points from the unit cube of one object into the common one and the distances back
+    class ObjectSampler : public vtkDistanceSampler
+    {
+    public:
+        double Sample(const double *point, double *normal) const override;
+
+        bool HasUnitNormals() const override { return Map->HasUnitNormals(); }
+
+        const vtkSparseDistanceMap *Map = nullptr;
+        double Scale = 1.0;
+        double Shift[3] = {0.0, 0.0, 0.0};
+    };
+
+    vtkMultiLabelDistanceMap(const vtkMultiLabelDistanceMap&); // Not implemented
+    void operator=(const vtkMultiLabelDistanceMap&); // Not implemented
+
+    std::vector<std::string> mFileNames;
+    vtkImageDistanceSampler::Interpolation mInterpolation = vtkImageDistanceSampler::Nearest;
+    std::vector<vtkSparseDistanceMap> mMaps;
+    // point into mMaps
+    std::vector<ObjectSampler> mSamplers;
+};
+
+#endif // VTKMULTILABELDISTANCEMAP_H
@@ -6,46 +6,62 @@
 
 ==============================================================================*/
 #include "vtkPolyData2ImageData.h"
+#include "vtkBrickedLayout.h"
+#include "vtkSurfaceMeshReader.h"
 #include <vtkVersion.h>
 #include <vtkPolyData.h>
 #include <vtkImageData.h>
 #include <vtkSphereSource.h>
 #include <vtkMetaImageWriter.h>
-#include <vtkPolyDataToImageStencil.h>
-#include <vtkImageStencil.h>
 #include <vtkPointData.h>
-#include <vtkGenericDataObjectReader.h>
+#include <vtkTriangleFilter.h>
+#include <vtkCellArray.h>
+#include <vtkIdList.h>
 #include <vtkPolyDataWriter.h>
 #include <math.h>
 
+#include <algorithm>
+#include <functional>
+#include <thread>
+
+const double vtkPolyData2ImageData::DefaultVoxelSpacing = 0.005;
+const double vtkPolyData2ImageData::DefaultMargin = 0.1;
+
 vtkPolyData2ImageData::vtkPolyData2ImageData()
+    : mVoxelSpacing(DefaultVoxelSpacing), mMargin(DefaultMargin), mCancel(nullptr)
 {
 
 }
 
 void vtkPolyData2ImageData::Convert(const std::string &inputFileName, vtkSmartPointer<vtkImageData> output)
 {
-    // Get all data from the file
-    vtkSmartPointer<vtkGenericDataObjectReader> reader = vtkSmartPointer<vtkGenericDataObjectReader>::New();
-    reader->SetFileName(inputFileName.c_str());
-    reader->Update();
+    Convert(inputFileName, output, nullptr);
+}
 
-    vtkPolyData* inputData = reader->GetPolyDataOutput();
-    double bounds[6], range[3];
+void vtkPolyData2ImageData::TransformToUnitCube(const std::string &inputFileName, vtkPolyData *output)
+{
+    TransformToUnitCube(vtkSurfaceMeshReader::Read(inputFileName), output);
+}
 
-    // 1. transform the mesh into unit cube
-    vtkSmartPointer<vtkPolyData> transMesh = vtkSmartPointer<vtkPolyData>::New();
-    inputData->GetBounds(bounds);
+void vtkPolyData2ImageData::TransformToUnitCube(vtkPolyData *mesh, vtkPolyData *output)
+{
+    double newBounds[6];
+    TransformToUnitCube(mesh, output, newBounds);
+}
+
+void vtkPolyData2ImageData::MapBoundsToUnitCube(const double *bounds, double *newBounds)
+{
+    double range[3] = {bounds[1] - bounds[0], bounds[3] - bounds[2], bounds[5] - bounds[4]};
     double newCenter[3] = {0.5, 0.5, 0.5};
-    range[0] = bounds[1] - bounds[0]; // The range of x coordinate
-    range[1] = bounds[3] - bounds[2];
-    range[2] = bounds[5] - bounds[4];
     double ratioYX, ratioZX, ratioZY;
     ratioYX = range[1] / range[0];
     ratioZX = range[2] / range[0];
     ratioZY = range[2] / range[1];
 
-    double newBounds[6] = {0.};
+    for(int i = 0; i < 6; ++i)
+    {
+        newBounds[i] = 0.0;
+    }
     // put the longest axis to [0,1], scale other coordinates accordingly
     if(range[0] >= range[1] && range[0] >= range[2])
     {
@@ -74,6 +90,46 @@ void vtkPolyData2ImageData::Convert(const std::string &inputFileName, vtkSmartPo
         newBounds[4] = 0.0;
         newBounds[5] = 1.0;
     }
+}
+
+void vtkPolyData2ImageData::AllocateGrid(const double *newBounds, double spacing, double margin,
+                                         vtkImageData *output)
+{
+    // the bounds plus the margin rounded out to the lattice of the spacing
+    // and up to whole bricks, so the volumes can be reordered by vtkBrickedLayout in place
+    int dim[3];
+    double origin[3];
+    for (int i = 0; i < 3; i++)
+    {
+        int first = static_cast<int>(floor((newBounds[2 * i] - margin) / spacing));
+        int last = static_cast<int>(ceil((newBounds[2 * i + 1] + margin) / spacing));
+        dim[i] = vtkBrickedLayout::RoundUp(last - first + 1);
+        origin[i] = first * spacing;
+    }
+
+    output->Initialize();
+    output->SetSpacing(spacing, spacing, spacing);
+    output->SetDimensions(dim);
+    output->SetExtent(0, dim[0] - 1, 0, dim[1] - 1, 0, dim[2] - 1);
+    output->SetOrigin(origin);
+#if VTK_MAJOR_VERSION <= 5
+    output->SetScalarTypeToUnsignedChar();
+    output->AllocateScalars();
+#else
+    output->AllocateScalars(VTK_UNSIGNED_CHAR,1);
+#endif
+}
+
+void vtkPolyData2ImageData::TransformToUnitCube(vtkPolyData *inputData, vtkPolyData *output, double *newBounds)
+{
+    double bounds[6], range[3];
+
+    // 1. transform the mesh into unit cube
+    inputData->GetBounds(bounds);
+    range[0] = bounds[1] - bounds[0]; // The range of x coordinate
+    range[1] = bounds[3] - bounds[2];
+    range[2] = bounds[5] - bounds[4];
+    MapBoundsToUnitCube(bounds, newBounds);
 
     double rangeTransMesh[3];
     rangeTransMesh[0] = newBounds[1] - newBounds[0];
@@ -90,76 +146,251 @@ void vtkPolyData2ImageData::Convert(const std::string &inputFileName, vtkSmartPo
         newPts->InsertPoint(i, newPt);
     }
     newPts->Modified();
-    transMesh->SetPoints(newPts);
-    transMesh->SetPolys(inputData->GetPolys());
+    output->SetPoints(newPts);
+    output->SetPolys(inputData->GetPolys());
+}
 
-    vtkSmartPointer<vtkImageData> whiteImage = vtkSmartPointer<vtkImageData>::New();
+void vtkPolyData2ImageData::Convert(const std::string &inputFileName, vtkSmartPointer<vtkImageData> output,
+                                    vtkPolyData *unitCubeMesh)
+{
+    Convert(vtkSurfaceMeshReader::Read(inputFileName), output, unitCubeMesh);
+}
 
-    double spacing[3]; // desired volume spacing
-    double voxel_spacing = 0.005;
-    spacing[0] = voxel_spacing;
-    spacing[1] = voxel_spacing;
-    spacing[2] = voxel_spacing;
-    whiteImage->SetSpacing(spacing);
+void vtkPolyData2ImageData::Convert(vtkPolyData *mesh, vtkSmartPointer<vtkImageData> output, vtkPolyData *unitCubeMesh)
+{
+    // 1. transform the mesh into unit cube
+    vtkSmartPointer<vtkPolyData> transMesh = vtkSmartPointer<vtkPolyData>::New();
+    double newBounds[6] = {0.};
+    TransformToUnitCube(mesh, transMesh, newBounds);
 
-    // compute dimensions
+    // 2. allocate the output once, the voxelizer fills every voxel of it
+    AllocateGrid(newBounds, mVoxelSpacing, mMargin, output);
     int dim[3];
-    for (int i = 0; i < 3; i++)
+    double origin[3];
+    output->GetDimensions(dim);
+    output->GetOrigin(origin);
+
+    // 3. voxelize the mesh in the unit cube, voxel (i, j, k) is at origin + (i, j, k) * spacing
+    std::vector<float> points;
+    std::vector<int> ids;
+    ExtractTriangles(transMesh, points, ids);
+    Voxelize(points.data(), ids.data(), ids.size() / 3, dim, origin, mVoxelSpacing,
+             static_cast<unsigned char*>(output->GetScalarPointer()), std::thread::hardware_concurrency(), mCancel);
+
+    if(unitCubeMesh != nullptr)
     {
-        dim[i] = static_cast<int>(1 / spacing[i]);
+        unitCubeMesh->DeepCopy(transMesh);
     }
-    whiteImage->SetDimensions(dim);
-    whiteImage->SetExtent(0, dim[0] - 1, 0, dim[1] - 1, 0, dim[2] - 1);
+}
 
-    double origin[3];
-    origin[0] = newBounds[0]; //bounds[0] + spacing[0]/2;//0.5 * (bounds[0] + bounds[1]);
-    origin[1] = newBounds[2]; //bounds[2] + spacing[1]/2;//0.5 * (bounds[3] + bounds[2]);
-    origin[2] = newBounds[4]; //bounds[4] + spacing[2]/2;//0.5 * (bounds[5] + bounds[4]);
+namespace
+{
+// triangle projected onto the yz plane, counter-clockwise
+struct ProjectedTriangle
+{
+    double y[3];
+    double z[3];
+    double x[3];
+    double area;
+    // row and slice ranges of voxel centers the triangle can cover
+    int minRow, maxRow, minSlice, maxSlice;
+};
 
-    whiteImage->SetOrigin(origin);
+// edge (y0, z0) -> (y1, z1) owns the points exactly on it, so a ray through an edge shared
+// by two triangles on either side of it crosses only one of them
+inline bool OwnsEdge(double y0, double z0, double y1, double z1)
+{
+    return (z1 - z0) > 0 || ((z1 - z0) == 0 && (y1 - y0) < 0);
+}
 
-#if VTK_MAJOR_VERSION <= 5
-    whiteImage->SetScalarTypeToUnsignedChar();
-    whiteImage->AllocateScalars();
-#else
-    whiteImage->AllocateScalars(VTK_UNSIGNED_CHAR,1);
-#endif
-    // fill the image with foreground voxels:
-    unsigned char inval = 255;
-    unsigned char outval = 0;
-    vtkIdType count = whiteImage->GetNumberOfPoints();
-    for (vtkIdType i = 0; i < count; ++i)
+inline bool InsideEdge(double w, double y0, double z0, double y1, double z1)
+{
+    return w > 0 || (w == 0 && OwnsEdge(y0, z0, y1, z1));
+}
+
+// Evaluated from the same end point whichever way the edge runs, so the two triangles sharing
+// an edge get exactly opposite values and a ray through it is never missed or counted twice
+inline double EdgeFunction(double y0, double z0, double y1, double z1, double py, double pz)
+{
+    if(y0 < y1 || (y0 == y1 && z0 < z1))
     {
-        whiteImage->GetPointData()->GetScalars()->SetTuple1(i, inval);
+        return (y1 - y0) * (pz - z0) - (z1 - z0) * (py - y0);
     }
+    return -((y0 - y1) * (pz - z1) - (z0 - z1) * (py - y1));
+}
 
-    // polygonal data --> image stencil:
-    vtkSmartPointer<vtkPolyDataToImageStencil> pol2stenc = vtkSmartPointer<vtkPolyDataToImageStencil>::New();
-#if VTK_MAJOR_VERSION <= 5
-    pol2stenc->SetInput(transMesh);
-#else
-    pol2stenc->SetInputData(transMesh);
-#endif
-    pol2stenc->SetTolerance(0);
-    double polOrigin[3] = {0.0, 0.0, 0.0};
-    pol2stenc->SetOutputOrigin(polOrigin);
-    pol2stenc->SetOutputSpacing(spacing);
-    pol2stenc->SetOutputWholeExtent(whiteImage->GetExtent());
-    pol2stenc->Update();
-
-    // cut the corresponding white image and set the background:
-    vtkSmartPointer<vtkImageStencil> imgstenc =
-        vtkSmartPointer<vtkImageStencil>::New();
-#if VTK_MAJOR_VERSION <= 5
-    imgstenc->SetInput(whiteImage);
-    imgstenc->SetStencil(pol2stenc->GetOutput());
-#else
-    imgstenc->SetInputData(whiteImage);
-    imgstenc->SetStencilConnection(pol2stenc->GetOutputPort());
-#endif
-    imgstenc->ReverseStencilOff();
-    imgstenc->SetBackgroundValue(outval);
-    imgstenc->Update();
+// x coordinate where the ray along x through (py, pz) crosses the triangle, false if it misses
+inline bool Crossing(const ProjectedTriangle &t, double py, double pz, double &x)
+{
+    double w0 = EdgeFunction(t.y[1], t.z[1], t.y[2], t.z[2], py, pz);
+    double w1 = EdgeFunction(t.y[2], t.z[2], t.y[0], t.z[0], py, pz);
+    double w2 = EdgeFunction(t.y[0], t.z[0], t.y[1], t.z[1], py, pz);
+    if(!InsideEdge(w0, t.y[1], t.z[1], t.y[2], t.z[2]) ||
+       !InsideEdge(w1, t.y[2], t.z[2], t.y[0], t.z[0]) ||
+       !InsideEdge(w2, t.y[0], t.z[0], t.y[1], t.z[1]))
+    {
+        return false;
+    }
+    x = (w0 * t.x[0] + w1 * t.x[1] + w2 * t.x[2]) / t.area;
+    return true;
+}
+
+// fill slices [beginSlice, endSlice) of mask, the slices after *cancel is set stay empty
+void VoxelizeSlab(const std::vector<ProjectedTriangle> &tris, const int *dims, double spacing,
+                  int beginSlice, int endSlice, const std::atomic<bool> *cancel, unsigned char *mask)
+{
+    const size_t nx = static_cast<size_t>(dims[0]), ny = static_cast<size_t>(dims[1]);
+    std::fill(mask + nx * ny * beginSlice, mask + nx * ny * endSlice, 0);
 
-    output->DeepCopy(imgstenc->GetOutput());
+    std::vector<const ProjectedTriangle*> slabTris;
+    for(size_t i = 0; i < tris.size(); ++i)
+    {
+        if(tris[i].maxSlice >= beginSlice && tris[i].minSlice < endSlice)
+        {
+            slabTris.push_back(&tris[i]);
+        }
+    }
+
+    std::vector<std::vector<double> > crossings(ny);
+    for(int k = beginSlice; k < endSlice; ++k)
+    {
+        if(cancel != nullptr && *cancel)
+        {
+            return;
+        }
+        const double pz = k * spacing;
+        for(size_t i = 0; i < slabTris.size(); ++i)
+        {
+            const ProjectedTriangle &t = *slabTris[i];
+            if(k < t.minSlice || k > t.maxSlice)
+            {
+                continue;
+            }
+            for(int j = t.minRow; j <= t.maxRow; ++j)
+            {
+                double x;
+                if(Crossing(t, j * spacing, pz, x))
+                {
+                    crossings[j].push_back(x);
+                }
+            }
+        }
+
+        unsigned char *slice = mask + nx * ny * k;
+        for(size_t j = 0; j < ny; ++j)
+        {
+            std::vector<double> &row = crossings[j];
+            if(row.empty())
+            {
+                continue;
+            }
+            std::sort(row.begin(), row.end());
+            // voxel centers between an odd crossing and the next even one are inside,
+            // an unpaired last crossing of an open mesh is dropped
+            for(size_t c = 0; c + 1 < row.size(); c += 2)
+            {
+                int first = std::max(0, static_cast<int>(ceil(row[c] / spacing)));
+                int last = std::min(dims[0], static_cast<int>(ceil(row[c + 1] / spacing)));
+                if(first < last)
+                {
+                    std::fill(slice + nx * j + first, slice + nx * j + last, 255);
+                }
+            }
+            row.clear();
+        }
+    }
+}
+}
+
+void vtkPolyData2ImageData::Voxelize(const float *points, const int *triangles, size_t numTriangles,
+                                     const int *dims, const double *origin, double spacing, unsigned char *mask,
+                                     unsigned int numThreads, const std::atomic<bool> *cancel)
+{
+    // project triangles that are not parallel to the rays, keep the voxel rows and slices they span.
+    // Coordinates are taken relative to the origin, so voxel (i, j, k) is at (i, j, k) * spacing below
+    std::vector<ProjectedTriangle> tris;
+    tris.reserve(numTriangles);
+    for(size_t i = 0; i < numTriangles; ++i)
+    {
+        ProjectedTriangle t;
+        for(int v = 0; v < 3; ++v)
+        {
+            const float *p = points + 3 * static_cast<size_t>(triangles[3 * i + v]);
+            t.x[v] = p[0] - origin[0];
+            t.y[v] = p[1] - origin[1];
+            t.z[v] = p[2] - origin[2];
+        }
+        t.area = EdgeFunction(t.y[0], t.z[0], t.y[1], t.z[1], t.y[2], t.z[2]);
+        if(t.area == 0)
+        {
+            continue;
+        }
+        if(t.area < 0)
+        {
+            std::swap(t.x[1], t.x[2]);
+            std::swap(t.y[1], t.y[2]);
+            std::swap(t.z[1], t.z[2]);
+            t.area = -t.area;
+        }
+        double minY = std::min(t.y[0], std::min(t.y[1], t.y[2]));
+        double maxY = std::max(t.y[0], std::max(t.y[1], t.y[2]));
+        double minZ = std::min(t.z[0], std::min(t.z[1], t.z[2]));
+        double maxZ = std::max(t.z[0], std::max(t.z[1], t.z[2]));
+        t.minRow = std::max(0, static_cast<int>(ceil(minY / spacing)));
+        t.maxRow = std::min(dims[1] - 1, static_cast<int>(floor(maxY / spacing)));
+        t.minSlice = std::max(0, static_cast<int>(ceil(minZ / spacing)));
+        t.maxSlice = std::min(dims[2] - 1, static_cast<int>(floor(maxZ / spacing)));
+        if(t.minRow <= t.maxRow && t.minSlice <= t.maxSlice)
+        {
+            tris.push_back(t);
+        }
+    }
+
+    // one slab of consecutive slices per thread
+    unsigned int numSlabs = std::max(1u, std::min(numThreads, static_cast<unsigned int>(dims[2])));
+    std::vector<std::thread> threads;
+    for(unsigned int s = 1; s < numSlabs; ++s)
+    {
+        int begin = static_cast<int>(static_cast<long long>(dims[2]) * s / numSlabs);
+        int end = static_cast<int>(static_cast<long long>(dims[2]) * (s + 1) / numSlabs);
+        threads.push_back(std::thread(VoxelizeSlab, std::cref(tris), dims, spacing, begin, end, cancel, mask));
+    }
+    VoxelizeSlab(tris, dims, spacing, 0, static_cast<int>(dims[2] / numSlabs), cancel, mask);
+    for(size_t i = 0; i < threads.size(); ++i)
+    {
+        threads[i].join();
+    }
+}
+
+void vtkPolyData2ImageData::ExtractTriangles(vtkPolyData *mesh, std::vector<float> &points, std::vector<int> &ids)
+{
+    vtkSmartPointer<vtkTriangleFilter> triangleFilter = vtkSmartPointer<vtkTriangleFilter>::New();
+    triangleFilter->SetInputData(mesh);
+    triangleFilter->PassLinesOff();
+    triangleFilter->PassVertsOff();
+    triangleFilter->Update();
+    vtkPolyData *triangles = triangleFilter->GetOutput();
+
+    points.resize(3 * static_cast<size_t>(triangles->GetNumberOfPoints()));
+    for(vtkIdType i = 0; i < triangles->GetNumberOfPoints(); ++i)
+    {
+        double pt[3];
+        triangles->GetPoint(i, pt);
+        points[3 * i] = static_cast<float>(pt[0]);
+        points[3 * i + 1] = static_cast<float>(pt[1]);
+        points[3 * i + 2] = static_cast<float>(pt[2]);
+    }
+    ids.clear();
+    vtkCellArray *polys = triangles->GetPolys();
+    vtkSmartPointer<vtkIdList> cell = vtkSmartPointer<vtkIdList>::New();
+    polys->InitTraversal();
+    while(polys->GetNextCell(cell))
+    {
+        if(cell->GetNumberOfIds() == 3)
+        {
+            ids.push_back(static_cast<int>(cell->GetId(0)));
+            ids.push_back(static_cast<int>(cell->GetId(1)));
+            ids.push_back(static_cast<int>(cell->GetId(2)));
+        }
+    }
 }
@@ -17,17 +17,78 @@
 #ifndef VTKPOLYDATA2IMAGEDATA_H
 #define VTKPOLYDATA2IMAGEDATA_H
 
+#include <atomic>
+#include <cstddef>
 #include <string>
+#include <vector>
 #include <vtkSmartPointer.h>
 
 class vtkImageData;
+class vtkPolyData;
+
+/**
+ * @brief The vtkPolyData2ImageData class
+ * Maps a surface mesh into the unit cube and voxelizes it into a binary image, 255 inside and 0 outside.
+ * The grid covers the bounds of the mapped mesh plus a margin. Its voxel centers lie on multiples of
+ * the voxel spacing, so every grid samples the same lattice of the unit cube.
+ * The voxelizer casts one ray along x through the voxel centers of every (y, z) row
+ * and fills between pairs of triangle crossings. Slabs of z slices are split over threads
+ * and written straight into the buffer of the output image.
+ */
 class vtkPolyData2ImageData
 {
 public:
+    // grid of the distance maps unless set otherwise, in unit cube units
+    static const double DefaultVoxelSpacing;
+    static const double DefaultMargin;
+
     vtkPolyData2ImageData();
 
+    void SetVoxelSpacing(double spacing) { mVoxelSpacing = spacing; }
+    double GetVoxelSpacing() const { return mVoxelSpacing; }
+
+    // distance kept between the bounds of the mesh and the border of the grid
+    void SetMargin(double margin) { mMargin = margin; }
+    double GetMargin() const { return mMargin; }
+
+    // Convert stops voxelizing once *cancel is set and leaves the image incomplete, nullptr if it runs to the end
+    void SetCancelFlag(const std::atomic<bool> *cancel) { mCancel = cancel; }
+
     void Convert(const std::string &inputFileName, vtkSmartPointer<vtkImageData> output);
 
+    // Also output the mesh mapped into the unit cube, voxel (i, j, k) of output is at origin + (i, j, k) * spacing
+    void Convert(const std::string &inputFileName, vtkSmartPointer<vtkImageData> output, vtkPolyData *unitCubeMesh);
+
+    // Only map the mesh into the unit cube, the longest axis to [0, 1] and centered at (0.5, 0.5, 0.5)
+    void TransformToUnitCube(const std::string &inputFileName, vtkPolyData *output);
+
+    // Same as above for a mesh already read, mesh is not changed
+    void Convert(vtkPolyData *mesh, vtkSmartPointer<vtkImageData> output, vtkPolyData *unitCubeMesh);
+    void TransformToUnitCube(vtkPolyData *mesh, vtkPolyData *output);
+
+    // Bounds of an object mapped into the unit cube the same way as TransformToUnitCube maps a mesh
+    static void MapBoundsToUnitCube(const double *bounds, double *newBounds);
+
+    // Allocate the 1 byte mask covering newBounds in the unit cube plus margin, not initialized
+    static void AllocateGrid(const double *newBounds, double spacing, double margin, vtkImageData *output);
+
+    // Input: points are xyz triples in the unit cube, triangles are index triples
+    // Output: mask has dims[0]*dims[1]*dims[2] values, voxel (i, j, k) is at origin + (i, j, k) * spacing,
+    // x varies fastest. The threads stop between slices once *cancel is set, unless it is nullptr
+    static void Voxelize(const float *points, const int *triangles, size_t numTriangles, const int *dims,
+                         const double *origin, double spacing, unsigned char *mask, unsigned int numThreads,
+                         const std::atomic<bool> *cancel = nullptr);
+
+    // Triangulate the polygons of mesh, output xyz triples of points and index triples of triangles
+    static void ExtractTriangles(vtkPolyData *mesh, std::vector<float> &points, std::vector<int> &ids);
+
+private:
+    // Output: newBounds are the bounds of the mapped mesh
+    void TransformToUnitCube(vtkPolyData *mesh, vtkPolyData *output, double *newBounds);
+
+    double mVoxelSpacing;
+    double mMargin;
+    const std::atomic<bool> *mCancel;
 };
 
 #endif // VTKPOLYDATA2IMAGEDATA_H
@@ -0,0 +1,242 @@
+/*==============================================================================
+
+  Program: 3D Slicer
+
+  Portions (c) Copyright Brigham and Women's Hospital (BWH) All Rights Reserved.
+
+  See COPYRIGHT.txt
+  or http://www.slicer.org/copyright/copyright.txt for details.
+
+  Unless required by applicable law or agreed to in writing, software
+  distributed under the License is distributed on an "AS IS" BASIS,
+  WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+  See the License for the specific language governing permissions and
+  limitations under the License.
+
+==============================================================================*/
+
+
+#include "vtkSignedDistanceTransform.h"
+
+#include <vtkImageData.h>
+
+#include <algorithm>
+#include <atomic>
+#include <iostream>
+#include <limits>
+#include <math.h>
+#include <thread>
+#include <vector>
+
+namespace
+{
+// run work(line) for all lines on numThreads threads, no more blocks of lines are started once *cancel is set
+template<typename Work>
+void ParallelLines(size_t numLines, unsigned int numThreads, const std::atomic<bool> *cancel, Work work)
+{
+    std::atomic<size_t> next(0);
+    auto worker = [&]()
+    {
+        // blocks of lines keep neighboring lines on one thread
+        const size_t block = 64;
+        for(size_t begin = next.fetch_add(block); begin < numLines; begin = next.fetch_add(block))
+        {
+            if(cancel != nullptr && *cancel)
+            {
+                return;
+            }
+            for(size_t line = begin; line < std::min(numLines, begin + block); ++line)
+            {
+                work(line);
+            }
+        }
+    };
+    std::vector<std::thread> threads;
+    for(unsigned int i = 1; i < numThreads; ++i)
+    {
+        threads.push_back(std::thread(worker));
+    }
+    worker();
+    for(size_t i = 0; i < threads.size(); ++i)
+    {
+        threads[i].join();
+    }
+}
+
+// Squared distance transform of one line in place: f[q] = min_p (w * (q - p)^2 + f[p]).
+// Lower envelope of parabolas, Felzenszwalb and Huttenlocher, Distance Transforms of Sampled Functions.
+// v, z and copy are scratch arrays of n, n + 1 and n entries
+void TransformLine(double *f, int n, double w, int *v, double *z, double *copy)
+{
+    const double inf = std::numeric_limits<double>::infinity();
+    int k = -1;
+    for(int q = 0; q < n; ++q)
+    {
+        copy[q] = f[q];
+        if(copy[q] == inf)
+        {
+            continue;
+        }
+        double s = -inf;
+        while(k >= 0)
+        {
+            int p = v[k];
+            s = ((copy[q] + w * q * q) - (copy[p] + w * p * p)) / (2 * w * (q - p));
+            if(s > z[k])
+            {
+                break;
+            }
+            --k;
+        }
+        ++k;
+        v[k] = q;
+        z[k] = k == 0 ? -inf : s;
+        z[k + 1] = inf;
+    }
+    if(k < 0)
+    {
+        // no finite value on this line
+        return;
+    }
+    int j = 0;
+    for(int q = 0; q < n; ++q)
+    {
+        while(z[j + 1] < q)
+        {
+            ++j;
+        }
+        double d = q - v[j];
+        f[q] = w * d * d + copy[v[j]];
+    }
+}
+
+// Squared distance of every voxel to the nearest voxel on the other side of the mask, in place in dist.
+// A voxel is a site of the transform of the other side, where its value stays 0, so one volume holds
+// both transforms: each voxel keeps the value of its own side. Lines go through buffers of doubles per thread.
+// Return false if cancelled before all passes are done
+bool SquaredDistances(const unsigned char *inside, const int *dims, const double *spacing,
+                      unsigned int numThreads, const std::atomic<bool> *cancel, float *dist)
+{
+    const size_t nx = static_cast<size_t>(dims[0]), ny = static_cast<size_t>(dims[1]), nz = static_cast<size_t>(dims[2]);
+    const size_t numVoxels = nx * ny * nz;
+    std::fill(dist, dist + numVoxels, std::numeric_limits<float>::infinity());
+
+    // one pass per axis over all lines along it
+    const size_t strides[3] = {1, nx, nx * ny};
+    for(int axis = 0; axis < 3; ++axis)
+    {
+        const int n = dims[axis];
+        const size_t stride = strides[axis];
+        const int a1 = (axis + 1) % 3, a2 = (axis + 2) % 3;
+        const size_t n1 = static_cast<size_t>(dims[a1]);
+        const size_t numLines = n1 * static_cast<size_t>(dims[a2]);
+        const double w = spacing[axis] * spacing[axis];
+        ParallelLines(numLines, numThreads, cancel, [&](size_t line)
+        {
+            thread_local std::vector<double> values, copy, z;
+            thread_local std::vector<int> v;
+            values.resize(static_cast<size_t>(n));
+            copy.resize(static_cast<size_t>(n));
+            z.resize(static_cast<size_t>(n) + 1);
+            v.resize(static_cast<size_t>(n));
+            const size_t start = (line % n1) * strides[a1] + (line / n1) * strides[a2];
+            for(int side = 0; side < 2; ++side)
+            {
+                const bool ownInside = side == 1;
+                for(int q = 0; q < n; ++q)
+                {
+                    const size_t voxel = start + static_cast<size_t>(q) * stride;
+                    values[static_cast<size_t>(q)] = (inside[voxel] != 0) == ownInside ? dist[voxel] : 0.0;
+                }
+                TransformLine(values.data(), n, w, v.data(), z.data(), copy.data());
+                for(int q = 0; q < n; ++q)
+                {
+                    const size_t voxel = start + static_cast<size_t>(q) * stride;
+                    if((inside[voxel] != 0) == ownInside)
+                    {
+                        dist[voxel] = static_cast<float>(values[static_cast<size_t>(q)]);
+                    }
+                }
+            }
+        });
+        if(cancel != nullptr && *cancel)
+        {
+            return false;
+        }
+    }
+    return true;
+}
+}
+
+vtkSignedDistanceTransform::vtkSignedDistanceTransform()
+    : mCancel(nullptr)
+{
+}
+
+bool vtkSignedDistanceTransform::Compute(const unsigned char *inside, const int *dims, const double *spacing, float *dist,
+                                         unsigned int numThreads, const std::atomic<bool> *cancel)
+{
+    numThreads = std::max(1u, numThreads);
+    const size_t numVoxels = static_cast<size_t>(dims[0]) * static_cast<size_t>(dims[1]) * static_cast<size_t>(dims[2]);
+
+    // without a voxel on both sides there is no surface to measure from
+    const size_t numInside = numVoxels - static_cast<size_t>(std::count(inside, inside + numVoxels, 0));
+    if(numInside == 0 || numInside == numVoxels)
+    {
+        std::cerr << "The mask of the signed distance transform is " << (numInside == 0 ? "empty." : "full.")
+                  << std::endl;
+        return false;
+    }
+
+    if(!SquaredDistances(inside, dims, spacing, numThreads, cancel, dist))
+    {
+        return false;
+    }
+
+    // the surface lies half a voxel from the centers of the boundary voxels
+    const double halfVoxel = 0.5 * std::min(spacing[0], std::min(spacing[1], spacing[2]));
+    for(size_t i = 0; i < numVoxels; ++i)
+    {
+        const float d = static_cast<float>(sqrt(static_cast<double>(dist[i])) - halfVoxel);
+        dist[i] = inside[i] != 0 ? -d : d;
+    }
+    return true;
+}
+
+bool vtkSignedDistanceTransform::Convert(vtkImageData *input, RealImage::Pointer output)
+{
+    if(input == nullptr || input->GetScalarType() != VTK_UNSIGNED_CHAR || input->GetNumberOfScalarComponents() != 1)
+    {
+        std::cerr << "The signed distance transform needs a single component unsigned char image." << std::endl;
+        return false;
+    }
+    int dims[3];
+    input->GetDimensions(dims);
+
+    RealImage::RegionType region;
+    RealImage::SizeType size;
+    RealImage::IndexType start;
+    RealImage::SpacingType spacing;
+    RealImage::PointType origin;
+    for(int i = 0; i < 3; ++i)
+    {
+        size[i] = static_cast<RealImage::SizeValueType>(dims[i]);
+        start[i] = 0;
+        spacing[i] = input->GetSpacing()[i];
+        origin[i] = input->GetOrigin()[i];
+    }
+    region.SetSize(size);
+    region.SetIndex(start);
+    output->SetRegions(region);
+    output->SetSpacing(spacing);
+    output->SetOrigin(origin);
+    output->Allocate();
+
+    const double imageSpacing[3] = {spacing[0], spacing[1], spacing[2]};
+    if(!Compute(static_cast<const unsigned char*>(input->GetScalarPointer()), dims, imageSpacing,
+                output->GetBufferPointer(), std::thread::hardware_concurrency(), mCancel))
+    {
+        return false;
+    }
+    return true;
+}
@@ -0,0 +1,62 @@
+/*==============================================================================
+
+  Program: 3D Slicer
+
+  Portions (c) Copyright Brigham and Women's Hospital (BWH) All Rights Reserved.
+
+  See COPYRIGHT.txt
+  or http://www.slicer.org/copyright/copyright.txt for details.
+
+  Unless required by applicable law or agreed to in writing, software
+  distributed under the License is distributed on an "AS IS" BASIS,
+  WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+  See the License for the specific language governing permissions and
+  limitations under the License.
+
+==============================================================================*/
+
+
+#ifndef VTKSIGNEDDISTANCETRANSFORM_H
+#define VTKSIGNEDDISTANCETRANSFORM_H
+
+#include "itkImage.h"
+
+#include <atomic>
+
+class vtkImageData;
+
+/**
+ * @brief The vtkSignedDistanceTransform class
+ * Exact Euclidean signed distance map of a binary image in linear time.
+ * The separable transform of Felzenszwalb and Huttenlocher runs one pass per axis,
+ * the lines of each pass are split over threads. The boundary is placed half a voxel
+ * between inside and outside voxels, the same level as the iso-contour of the approximate filter.
+ * Distances are in physical units and negative inside.
+ */
+class vtkSignedDistanceTransform
+{
+public:
+    typedef itk::Image<float, 3> RealImage;
+
+    vtkSignedDistanceTransform();
+
+    // Convert stops once *cancel is set, nullptr if it runs to the end
+    void SetCancelFlag(const std::atomic<bool> *cancel) { mCancel = cancel; }
+
+    // Input: single component unsigned char image, nonzero voxels are inside
+    // Output: the distance map, written straight into its buffer
+    // Return false if the image is not a mask or has no voxel inside or no voxel outside, or if cancelled
+    bool Convert(vtkImageData *input, RealImage::Pointer output);
+
+    // Input: inside is nonzero for voxels inside, x varies fastest
+    // Input: the threads stop between blocks of lines once *cancel is set, unless it is nullptr
+    // Output: dist has dims[0]*dims[1]*dims[2] values, the passes run in place in it
+    // Return false if no voxel is inside or no voxel is outside, or if cancelled with dist incomplete
+    static bool Compute(const unsigned char *inside, const int *dims, const double *spacing, float *dist,
+                        unsigned int numThreads, const std::atomic<bool> *cancel = nullptr);
+
+private:
+    const std::atomic<bool> *mCancel;
+};
+
+#endif // VTKSIGNEDDISTANCETRANSFORM_H
@@ -42,7 +42,6 @@
 #include <vtkImageData.h>
 #include <vtkParametricSpline.h>
 #include <vtksys/SystemTools.hxx>
-#include <vtkPolyDataReader.h>
 #include <vtkPolyDataWriter.h>
 #include <vtkCleanPolyData.h>
 #include <vtkAppendPolyData.h>
@@ -55,18 +54,163 @@
 #include <vtkProgrammableSource.h>
 #include <vtkContourFilter.h>
 #include <vtkReverseSense.h>
+#include <vtkCellArray.h>
 #include "vtkSlicerSkeletalRepresentationInterpolater.h"
 #include "vtkSrep.h"
 #include "vtkSpoke.h"
+#include "vtkSrepKernels.h"
+#include "vtkSrepKernelDispatch.h"
 #include "newuoa.h"
 #include "vtkPolyData2ImageData.h"
-#include "vtkApproximateSignedDistanceMap.h"
+#include "vtkLabelVolume2ImageData.h"
+#include "vtkSignedDistanceTransform.h"
 #include "vtkGradientDistanceFilter.h"
+#include "vtkDistanceMapCache.h"
+#include "vtkBrickedLayout.h"
+#include "vtkSparseDistanceMap.h"
+#include "vtkSrepFile.h"
+#include "vtkSrepArchive.h"
+#include "vtkMeshDistanceOracle.h"
 
 // STD includes
+#include <algorithm>
 #include <cassert>
-const double voxelSpacing = 0.005;
+#include <atomic>
+#include <fstream>
+#include <sstream>
+#include <thread>
 const std::string newFilePrefix = "/refined_";
+
+namespace
+{
+// output file of refined spokes, the sides of a container go to <container name>_<side>.vtp
+std::string RefinedFileName(const std::string &outputPath, const std::string &spokeFileName)
+{
+    std::string containerFileName;
+    int side = 0;
+    if(vtkSrepFile::SplitSideFileName(spokeFileName, &containerFileName, &side))
+    {
+        return outputPath + newFilePrefix + vtksys::SystemTools::GetFilenameWithoutLastExtension(containerFileName)
+                + "_" + vtkSrepFile::GetSideName(side) + ".vtp";
+    }
+    return outputPath + newFilePrefix + vtksys::SystemTools::GetFilenameName(spokeFileName);
+}
+
+// the XML header of an s-rep with its spoke files
+void WriteHeaderFile(const std::string &headerFileName, int nRows, int nCols, double crestShift,
+                     const std::string &upFileName, const std::string &downFileName, const std::string &crestFileName)
+{
+    std::stringstream output;
+
+    output<<"<s-rep>"<<std::endl;
+    output<<"  <nRows>"<<nRows<<"</nRows>"<<std::endl;
+    output<<"  <nCols>"<<nCols<<"</nCols>"<<std::endl;
+    output<<"  <meshType>Quad</meshType>"<< std::endl;
+    output<<"  <color>"<<std::endl;
+    output<<"    <red>0</red>"<<std::endl;
+    output<<"    <green>0.5</green>"<<std::endl;
+    output<<"    <blue>0</blue>"<<std::endl;
+    output<<"  </color>"<<std::endl;
+    output<<"  <isMean>False</isMean>"<<std::endl;
+    output<<"  <meanStatPath/>"<<std::endl;
+    output<<"  <upSpoke>"<< upFileName<<"</upSpoke>"<<std::endl;
+    output<<"  <downSpoke>"<< downFileName << "</downSpoke>"<<std::endl;
+    output<<"  <crestSpoke>"<< crestFileName << "</crestSpoke>"<<std::endl;
+    if(crestShift != 0.0)
+    {
+        output<<"  <crestShift>"<< crestShift << "</crestShift>"<<std::endl;
+    }
+    output<<"</s-rep>"<<std::endl;
+
+    std::ofstream out_file;
+    out_file.open(headerFileName);
+    out_file << output.rdbuf();
+    out_file.close();
+}
+
+// the quads around a spoke in which its rSrad neighbors are interpolated
+enum NeighborQuad
+{
+    TopLeft = 0,
+    TopRight,
+    BotLeft,
+    BotRight
+};
+
+// Input: which quad around spoke (r, c), step is the distance of its neighbors
+// Output: qr, qc is the top-left spoke of that quad, swapDerivatives whether the right corners of the quad
+// trade their derivatives, positions the (u, v) of the neighbor in u and of the neighbor in v
+template<typename T>
+void GetNeighborQuad(int which, int r, int c, T step, int *qr, int *qc, bool *swapDerivatives, T *positions)
+{
+    switch(which)
+    {
+    case TopLeft:
+        *qr = r; *qc = c; *swapDerivatives = false;
+        positions[0] = step; positions[1] = 0; positions[2] = 0; positions[3] = step;
+        break;
+    case TopRight:
+        *qr = r; *qc = c - 1; *swapDerivatives = true;
+        positions[0] = step; positions[1] = 1; positions[2] = 0; positions[3] = 1 - step;
+        break;
+    case BotLeft:
+        *qr = r - 1; *qc = c; *swapDerivatives = true;
+        positions[0] = 1 - step; positions[1] = 0; positions[2] = 0; positions[3] = step;
+        break;
+    default:
+        *qr = r - 1; *qc = c - 1; *swapDerivatives = true;
+        positions[0] = 1 - step; positions[1] = 1; positions[2] = 1; positions[3] = 1 - step;
+        break;
+    }
+}
+
+// the entries of vtkSrepKernelTable instantiated for T
+template<typename T>
+struct KernelEntries;
+
+template<>
+struct KernelEntries<float>
+{
+    explicit KernelEntries(const vtkSrepKernelTable &table)
+        : interpolateOnTable(table.interpolateOnTableFloat), sampleImageMatch(table.sampleImageMatchFloat),
+          sampleImageMatchQuantized(table.sampleImageMatchQuantizedFloat), rSradPenalty(table.rSradPenaltyFloat)
+    {
+    }
+    decltype(vtkSrepKernelTable::interpolateOnTableFloat) interpolateOnTable;
+    decltype(vtkSrepKernelTable::sampleImageMatchFloat) sampleImageMatch;
+    decltype(vtkSrepKernelTable::sampleImageMatchQuantizedFloat) sampleImageMatchQuantized;
+    decltype(vtkSrepKernelTable::rSradPenaltyFloat) rSradPenalty;
+};
+
+template<>
+struct KernelEntries<double>
+{
+    explicit KernelEntries(const vtkSrepKernelTable &table)
+        : interpolateOnTable(table.interpolateOnTableDouble), sampleImageMatch(table.sampleImageMatchDouble),
+          sampleImageMatchQuantized(table.sampleImageMatchQuantizedDouble), rSradPenalty(table.rSradPenaltyDouble)
+    {
+    }
+    decltype(vtkSrepKernelTable::interpolateOnTableDouble) interpolateOnTable;
+    decltype(vtkSrepKernelTable::sampleImageMatchDouble) sampleImageMatch;
+    decltype(vtkSrepKernelTable::sampleImageMatchQuantizedDouble) sampleImageMatchQuantized;
+    decltype(vtkSrepKernelTable::rSradPenaltyDouble) rSradPenalty;
+};
+
+// skeletal points of all spokes of srep, 3 per spoke
+std::vector<double> GetSkeletalPoints(vtkSrep *srep)
+{
+    std::vector<double> skeletalPoints;
+    const std::vector<vtkSpoke *> &spokes = srep->GetAllSpokes();
+    for(size_t i = 0; i < spokes.size(); ++i)
+    {
+        double pt[3];
+        spokes[i]->GetSkeletalPoint(pt);
+        skeletalPoints.insert(skeletalPoints.end(), pt, pt + 3);
+    }
+    return skeletalPoints;
+}
+}
+
 //----------------------------------------------------------------------------
 vtkStandardNewMacro(vtkSlicerSkeletalRepresentationRefinerLogic);
 
@@ -78,6 +222,7 @@ vtkSlicerSkeletalRepresentationRefinerLogic::vtkSlicerSkeletalRepresentationRefi
 //----------------------------------------------------------------------------
 vtkSlicerSkeletalRepresentationRefinerLogic::~vtkSlicerSkeletalRepresentationRefinerLogic()
 {
+    CancelDistanceMap();
 }
 
 //----------------------------------------------------------------------------
@@ -88,14 +233,22 @@ void vtkSlicerSkeletalRepresentationRefinerLogic::PrintSelf(ostream& os, vtkInde
 
 void vtkSlicerSkeletalRepresentationRefinerLogic::SetImageFileName(const std::string &imageFilePath)
 {
+    CancelDistanceMap();
     mTargetMeshFilePath = imageFilePath;
+    // read the mesh once, the scene gets a copy and the distance map the kept one
+    vtkSmartPointer<vtkPolyData> surface;
+    if(!vtkLabelVolume2ImageData::IsLabelVolumeFile(imageFilePath))
+    {
+        surface = vtkSmartPointer<vtkPolyData>::New();
+        surface->DeepCopy(mMeshReader.Get(imageFilePath));
+    }
+    // the distance map is built while the mesh is shown and the s-rep is selected, refinement waits for it
+    StartDistanceMap();
     // visualize the input surface mesh
-    vtkSmartPointer<vtkPolyDataReader> reader = vtkSmartPointer<vtkPolyDataReader>::New();
-    reader->SetFileName(imageFilePath.c_str());
-    reader->Update();
-
-    vtkSmartPointer<vtkPolyData> surface = reader->GetOutput();
-    Visualize(surface, "Input surface mesh", 0, 0, 0);
+    if(surface)
+    {
+        Visualize(surface, "Input surface mesh", 0, 0, 0);
+    }
 }
 
 void vtkSlicerSkeletalRepresentationRefinerLogic::SetSrepFileName(const std::string &srepFilePath)
@@ -113,57 +266,20 @@ void vtkSlicerSkeletalRepresentationRefinerLogic::Refine(double stepSize, double
     mFirstCost = true;
     // 1. parse file
     const std::string headerFileName = mSrepFilePath;
-    int nRows = 0, nCols = 0;
-    double crestShift = 0.0;
     std::string up, down, crest;
-    ParseHeader(headerFileName, &nRows, &nCols, &crestShift, &up, &down, &crest);
-
-    if(nRows == 0 || nCols == 0)
+    if(!PrepareRefinement(interpolationLevel, &up, &down, &crest) || !ResolveFreeSpokes(mNumRows, mNumCols))
     {
-        std::cerr << "The s-rep model is empty." << std::endl;
         return;
     }
 
-    mNumCols = nCols;
-    mNumRows = nRows;
-
-    // Prepare signed distance image
-    AntiAliasSignedDistanceMap(mTargetMeshFilePath);
-
-    // Compute transformation matrix from srep to image coordinate system, namely, unit cube cs.
-    TransformSrep(headerFileName);
-
-    // make tuples of interpolation positions (u,v)
-    mInterpolatePositions.clear();
-    double tol = 1e-6;
-    int shares = static_cast<int>(pow(2, interpolationLevel));
-    double interval = double(1.0 / shares);
-    for(int i = 0; i <= shares; ++i)
-    {
-        for(int j = 0; j <= shares; ++j)
-        {
-            double u = i * interval;
-            double v = j * interval;
-            // no interpolation at corners
-            if((abs(u) < tol && abs(v) < tol) || (abs(u) < tol && abs(v-1) < tol)
-                    || (abs(u-1) < tol && abs(v) < tol) || (abs(u-1) < tol && abs(v-1) < tol))
-                continue;
-            std::pair<double, double> uv = make_pair(u, v);
-            mInterpolatePositions.push_back(uv);
-        }
-    }
-    if(interpolationLevel == 0)
-    {
-        mInterpolatePositions.push_back(std::pair<double, double>(0, 0));
-    }
     // Hide other nodes.
     HideNodesByClass("vtkMRMLModelNode");
 
     // Refine up spokes
-    RefinePartOfSpokes(up, stepSize, endCriterion, maxIter);
+    RefinePartOfSpokes(up, stepSize, endCriterion, maxIter, RefinedFileName(mOutputPath, up));
 
     // Refine down spokes
-    RefinePartOfSpokes(down, stepSize, endCriterion, maxIter);
+    RefinePartOfSpokes(down, stepSize, endCriterion, maxIter, RefinedFileName(mOutputPath, down));
 
     // Show crest spokes
     std::vector<double> radii, dirs, skeletalPoints;
@@ -188,6 +304,331 @@ void vtkSlicerSkeletalRepresentationRefinerLogic::Refine(double stepSize, double
     ShowImpliedBoundary(interpolationLevel, newHeaderFileName, "Refined ");
 }
 
+bool vtkSlicerSkeletalRepresentationRefinerLogic::PrepareRefinement(int interpolationLevel, std::string *upFileName,
+                                                                    std::string *downFileName, std::string *crestFileName)
+{
+    int nRows = 0, nCols = 0;
+    double crestShift = 0.0;
+    ParseHeader(mSrepFilePath, &nRows, &nCols, &crestShift, upFileName, downFileName, crestFileName);
+
+    if(nRows == 0 || nCols == 0)
+    {
+        std::cerr << "The s-rep model is empty." << std::endl;
+        return false;
+    }
+
+    mNumCols = nCols;
+    mNumRows = nRows;
+
+    // Prepare signed distance image, unless it was computed for the same mesh before or is shared
+    WaitForDistanceMap();
+    if(mSharedDistanceMap)
+    {
+        UpdateDistanceSampler();
+    }
+    else if(!mDistanceMapFileName.empty())
+    {
+        if(mMappedDistanceMap.GetFileName() != mDistanceMapFileName)
+        {
+            if(!MapDistanceMap(mDistanceMapFileName))
+            {
+                return false;
+            }
+            mDistanceMapMeshPath.clear();
+        }
+    }
+    else if(mDistanceMapMeshPath != mTargetMeshFilePath)
+    {
+        AntiAliasSignedDistanceMap(mTargetMeshFilePath);
+    }
+
+    // Compute transformation matrix from srep to image coordinate system, namely, unit cube cs.
+    TransformSrep(mSrepFilePath);
+
+    ComputeInterpolatePositions(interpolationLevel);
+    mPreparedSrepFilePath = mSrepFilePath;
+    return true;
+}
+
+void vtkSlicerSkeletalRepresentationRefinerLogic::SweepWeights(const std::vector<double> &wtImageMatch,
+                                                               const std::vector<double> &wtNormal,
+                                                               const std::vector<double> &wtSrad,
+                                                               double stepSize, double endCriterion,
+                                                               int iterPerRound, int interpolationLevel)
+{
+    std::string up, down, crest;
+    if(!PrepareRefinement(interpolationLevel, &up, &down, &crest) || !ResolveFreeSpokes(mNumRows, mNumCols))
+    {
+        return;
+    }
+
+    // all settings share the parsed up and down spokes
+    std::vector<double> coeffUp, radiiUp, dirsUp, skeletalPointsUp;
+    Parse(up, coeffUp, radiiUp, dirsUp, skeletalPointsUp);
+    std::vector<double> coeffDown, radiiDown, dirsDown, skeletalPointsDown;
+    Parse(down, coeffDown, radiiDown, dirsDown, skeletalPointsDown);
+    vtkSrep upSrep(mNumRows, mNumCols, radiiUp, dirsUp, skeletalPointsUp);
+    vtkSrep downSrep(mNumRows, mNumCols, radiiDown, dirsDown, skeletalPointsDown);
+    if(upSrep.IsEmpty() || downSrep.IsEmpty())
+    {
+        std::cerr << "The s-rep model is empty." << std::endl;
+        return;
+    }
+    // the threads below only read the interpolation tables
+    UpdateInterpolationTable(&upSrep);
+    UpdateInterpolationTable(&downSrep);
+
+    struct WeightSetting
+    {
+        double weights[3];
+        std::vector<double> freeCoeffUp;
+        std::vector<double> freeCoeffDown;
+        // unweighted image match, normal match and rSrad penalty of up + down spokes
+        double terms[3];
+        int rounds;
+    };
+
+    // coefficients of free spokes, which are the only input of the optimizer
+    std::vector<double> initialUp, initialDown;
+    for(size_t k = 0; k < (mFreeIndices.empty() ? coeffUp.size() / 4 : mFreeIndices.size()); ++k)
+    {
+        size_t idx = mFreeIndices.empty() ? k * 4 : static_cast<size_t>(mFreeIndices[k]) * 4;
+        initialUp.insert(initialUp.end(), coeffUp.begin() + static_cast<long>(idx), coeffUp.begin() + static_cast<long>(idx + 4));
+        initialDown.insert(initialDown.end(), coeffDown.begin() + static_cast<long>(idx), coeffDown.begin() + static_cast<long>(idx + 4));
+    }
+
+    std::vector<WeightSetting> settings;
+    for(size_t i = 0; i < wtImageMatch.size(); ++i)
+    {
+        for(size_t j = 0; j < wtNormal.size(); ++j)
+        {
+            for(size_t k = 0; k < wtSrad.size(); ++k)
+            {
+                WeightSetting setting;
+                setting.weights[0] = wtImageMatch[i];
+                setting.weights[1] = wtNormal[j];
+                setting.weights[2] = wtSrad[k];
+                setting.freeCoeffUp = initialUp;
+                setting.freeCoeffDown = initialDown;
+                setting.rounds = 0;
+                settings.push_back(setting);
+            }
+        }
+    }
+    if(settings.empty())
+    {
+        std::cerr << "No weights to sweep." << std::endl;
+        return;
+    }
+
+    // evaluate the initial s-rep for reference
+    double initialTerms[3] = {0.0, 0.0, 0.0};
+    {
+        double imageDist = 0.0, normal = 0.0, srad = 0.0;
+        ComputeObjectiveTerms(&upSrep, coeffUp.data(), &imageDist, &normal, &srad);
+        initialTerms[0] += imageDist; initialTerms[1] += normal; initialTerms[2] += srad;
+        ComputeObjectiveTerms(&downSrep, coeffDown.data(), &imageDist, &normal, &srad);
+        initialTerms[0] += imageDist; initialTerms[1] += normal; initialTerms[2] += srad;
+    }
+
+    // optimize one side of the s-rep with weights of this setting for iterPerRound iterations
+    auto optimize = [&](vtkSrep *srep, const std::vector<double> &allCoeff,
+                        const double *weights, std::vector<double> &freeCoeff, double step, double *terms)
+    {
+        std::vector<double> fullCoeff;
+        auto objective = [&](double *coeff) -> double
+        {
+            double imageDist = 0.0, normal = 0.0, srad = 0.0;
+            ExpandCoefficients(allCoeff, coeff, fullCoeff);
+            ComputeObjectiveTerms(srep, fullCoeff.data(), &imageDist, &normal, &srad);
+            return weights[0] * imageDist + weights[1] * normal + weights[2] * srad;
+        };
+        min_newuoa(static_cast<int>(freeCoeff.size()), freeCoeff.data(), objective, step, endCriterion, iterPerRound);
+
+        double imageDist = 0.0, normal = 0.0, srad = 0.0;
+        ExpandCoefficients(allCoeff, freeCoeff.data(), fullCoeff);
+        ComputeObjectiveTerms(srep, fullCoeff.data(), &imageDist, &normal, &srad);
+        terms[0] += imageDist;
+        terms[1] += normal;
+        terms[2] += srad;
+    };
+
+    std::vector<size_t> alive;
+    for(size_t i = 0; i < settings.size(); ++i)
+    {
+        alive.push_back(i);
+    }
+    unsigned int numThreads = std::max(1u, std::thread::hardware_concurrency());
+    double roundStep = stepSize;
+    for(int round = 0; ; ++round)
+    {
+        std::cout << "Weight sweep round " << round << ": " << alive.size() << " settings." << std::endl;
+        std::atomic<size_t> next(0);
+        auto worker = [&]()
+        {
+            for(size_t k = next++; k < alive.size(); k = next++)
+            {
+                WeightSetting &setting = settings[alive[k]];
+                setting.terms[0] = setting.terms[1] = setting.terms[2] = 0.0;
+                optimize(&upSrep, coeffUp, setting.weights, setting.freeCoeffUp, roundStep, setting.terms);
+                optimize(&downSrep, coeffDown, setting.weights, setting.freeCoeffDown, roundStep, setting.terms);
+                setting.rounds = round + 1;
+            }
+        };
+        std::vector<std::thread> threads;
+        for(unsigned int t = 0; t < std::min<size_t>(numThreads, alive.size()); ++t)
+        {
+            threads.push_back(std::thread(worker));
+        }
+        for(size_t t = 0; t < threads.size(); ++t)
+        {
+            threads[t].join();
+        }
+
+        // legal s-reps first, then better image match
+        std::sort(alive.begin(), alive.end(), [&](size_t a, size_t b)
+        {
+            bool legalA = settings[a].terms[2] <= initialTerms[2];
+            bool legalB = settings[b].terms[2] <= initialTerms[2];
+            if(legalA != legalB)
+            {
+                return legalA;
+            }
+            return settings[a].terms[0] < settings[b].terms[0];
+        });
+        if(alive.size() <= 1)
+        {
+            break;
+        }
+        alive.resize((alive.size() + 1) / 2);
+        // continue from the current coefficients with a smaller trust region
+        roundStep *= 0.5;
+    }
+
+    // rank all settings: survivors of later rounds first
+    std::vector<size_t> ranked;
+    for(size_t i = 0; i < settings.size(); ++i)
+    {
+        ranked.push_back(i);
+    }
+    std::stable_sort(ranked.begin(), ranked.end(), [&](size_t a, size_t b)
+    {
+        if(settings[a].rounds != settings[b].rounds)
+        {
+            return settings[a].rounds > settings[b].rounds;
+        }
+        bool legalA = settings[a].terms[2] <= initialTerms[2];
+        bool legalB = settings[b].terms[2] <= initialTerms[2];
+        if(legalA != legalB)
+        {
+            return legalA;
+        }
+        return settings[a].terms[0] < settings[b].terms[0];
+    });
+
+    std::stringstream table;
+    table << "rank,wtImageMatch,wtNormal,wtSrad,rounds,imageMatch,normal,srad" << std::endl;
+    table << "0,,,,0," << initialTerms[0] << "," << initialTerms[1] << "," << initialTerms[2] << std::endl;
+    for(size_t i = 0; i < ranked.size(); ++i)
+    {
+        const WeightSetting &setting = settings[ranked[i]];
+        table << i + 1 << "," << setting.weights[0] << "," << setting.weights[1] << "," << setting.weights[2] << ","
+              << setting.rounds << "," << setting.terms[0] << "," << setting.terms[1] << "," << setting.terms[2] << std::endl;
+    }
+    std::cout << "Weight sweep result (rank 0 is the initial s-rep):" << std::endl << table.str();
+
+    if(!mOutputPath.empty())
+    {
+        std::ofstream out_file;
+        out_file.open(mOutputPath + "/weightSweep.csv");
+        out_file << table.str();
+        out_file.close();
+    }
+}
+
+void vtkSlicerSkeletalRepresentationRefinerLogic::RefineSpokeNeighborhood(const std::string &spokeFileName, int r, int c,
+                                                                          double stepSize, double endCriterion, int maxIter)
+{
+    WaitForDistanceMap();
+    if(mDistanceSampler == nullptr || !mHasTransformation || mInterpolatePositions.empty())
+    {
+        std::cerr << "Local refinement requires a previous refinement of this s-rep." << std::endl;
+        return;
+    }
+    if(r < 0 || r >= mNumRows || c < 0 || c >= mNumCols)
+    {
+        std::cerr << "The spoke (" << r << ", " << c << ") is out of the s-rep grid." << std::endl;
+        return;
+    }
+
+    // the spokes must belong to the s-rep whose transformation and interpolation positions are reused
+    int nRows = 0, nCols = 0;
+    double crestShift = 0.0;
+    std::string up, down, crest;
+    ParseHeader(mPreparedSrepFilePath, &nRows, &nCols, &crestShift, &up, &down, &crest);
+    std::string sideFileName;
+    if(spokeFileName == up || spokeFileName == RefinedFileName(mOutputPath, up))
+    {
+        sideFileName = up;
+    }
+    else if(spokeFileName == down || spokeFileName == RefinedFileName(mOutputPath, down))
+    {
+        sideFileName = down;
+    }
+    else
+    {
+        std::cerr << spokeFileName << " is not an up or down spoke file of " << mPreparedSrepFilePath << std::endl;
+        return;
+    }
+
+    // the edit may have been saved within the stamp of the parsed file
+    mSrepModels.Invalidate(spokeFileName);
+    std::vector<double> coeff, radii, dirs, skeletalPoints;
+    Parse(spokeFileName, coeff, radii, dirs, skeletalPoints);
+    const size_t edited = static_cast<size_t>(r * mNumCols + c);
+    if(radii.size() != static_cast<size_t>(mNumRows * mNumCols))
+    {
+        std::cerr << spokeFileName << " doesn't have the spokes of the " << mNumRows << "x" << mNumCols
+                  << " grid." << std::endl;
+        return;
+    }
+
+    // the one-ring is merged into the refined spokes, the edited spoke is the only one taken from an unrefined file
+    const std::string refinedFileName = RefinedFileName(mOutputPath, sideFileName);
+    if(spokeFileName != refinedFileName && vtksys::SystemTools::FileExists(refinedFileName, true))
+    {
+        std::vector<double> refinedCoeff, refinedRadii, refinedDirs, refinedPoints;
+        Parse(refinedFileName, refinedCoeff, refinedRadii, refinedDirs, refinedPoints);
+        if(refinedRadii.size() == radii.size())
+        {
+            refinedRadii[edited] = radii[edited];
+            for(size_t k = 3 * edited; k < 3 * edited + 3; ++k)
+            {
+                refinedDirs[k] = dirs[k];
+                refinedPoints[k] = skeletalPoints[k];
+            }
+            radii.swap(refinedRadii);
+            dirs.swap(refinedDirs);
+            skeletalPoints.swap(refinedPoints);
+        }
+    }
+
+    // keep the region of interest selected by users
+    std::vector<int> savedIds(mFreeSpokeIds);
+    int savedRange[4] = {mFreeSpokeRange[0], mFreeSpokeRange[1], mFreeSpokeRange[2], mFreeSpokeRange[3]};
+
+    // -1 means no range, so the one-ring is clipped to the grid here
+    SetFreeSpokeRange(std::max(r - 1, 0), r + 1, std::max(c - 1, 0), c + 1);
+    RefineSpokes(radii, dirs, skeletalPoints, stepSize, endCriterion, maxIter, refinedFileName, true);
+
+    ClearFreeSpokes();
+    mFreeSpokeIds = savedIds;
+    for(int i = 0; i < 4; ++i)
+    {
+        mFreeSpokeRange[i] = savedRange[i];
+    }
+}
+
 void vtkSlicerSkeletalRepresentationRefinerLogic::InterpolateSrep(int interpolationLevel, std::string& srepFileName)
 {
     // Hide other nodes.
@@ -216,6 +657,21 @@ void vtkSlicerSkeletalRepresentationRefinerLogic::InterpolateSrep(int interpolat
         srep = nullptr;
         return;
     }
+    vtkSmartPointer<vtkPolyData> primarySpokes = vtkSmartPointer<vtkPolyData>::New();
+    ConvertSpokes2PolyData(srep->GetAllSpokes(), primarySpokes);
+
+    // the interpolation of the same s-rep at the same level is kept
+    vtkPolyData *cachedSpokes = mSrepModels.FindInterpolatedSpokes(srepFileName, interpolationLevel);
+    if(cachedSpokes != nullptr)
+    {
+        vtkSmartPointer<vtkPolyData> upSpokes_polyData = vtkSmartPointer<vtkPolyData>::New();
+        upSpokes_polyData->DeepCopy(cachedSpokes);
+        Visualize(upSpokes_polyData, "Interpolated", 1, 1, 1);
+        Visualize(primarySpokes, "Primary", 1, 0, 0);
+        delete srep;
+        return;
+    }
+
     // 1.1 interpolate and visualize for verification
     // collect neighboring spokes around corners
     vtkSlicerSkeletalRepresentationInterpolater interpolater;
@@ -276,160 +732,1264 @@ void vtkSlicerSkeletalRepresentationRefinerLogic::InterpolateSrep(int interpolat
 
     vtkSmartPointer<vtkPolyData> upSpokes_polyData = vtkSmartPointer<vtkPolyData>::New();
     ConvertSpokes2PolyData(interpolatedSpokes, upSpokes_polyData);
+    vtkSmartPointer<vtkPolyData> keptSpokes = vtkSmartPointer<vtkPolyData>::New();
+    keptSpokes->DeepCopy(upSpokes_polyData);
+    mSrepModels.StoreInterpolatedSpokes(srepFileName, interpolationLevel, keptSpokes);
     Visualize(upSpokes_polyData, "Interpolated", 1, 1, 1);
 
-    vtkSmartPointer<vtkPolyData> primarySpokes = vtkSmartPointer<vtkPolyData>::New();
-    ConvertSpokes2PolyData(srep->GetAllSpokes(), primarySpokes);
     Visualize(primarySpokes, "Primary", 1, 0, 0);
 
     // delete pointers
+    for(size_t i = 0; i < interpolatedSpokes.size(); ++i)
+    {
+        delete interpolatedSpokes[i];
+    }
     delete srep;
 }
 
-void vtkSlicerSkeletalRepresentationRefinerLogic::SetWeights(double wtImageMatch, double wtNormal, double wtSrad)
+bool vtkSlicerSkeletalRepresentationRefinerLogic::ExportSrepContainer(const std::string &headerFileName,
+                                                                      const std::string &srepFileName)
 {
-    mWtImageMatch = wtImageMatch;
-    mWtNormalMatch = wtNormal;
-    mWtSrad = wtSrad;
+    int nRows = 0, nCols = 0;
+    double crestShift = 0.0;
+    std::string spokeFileNames[3];
+    ParseHeader(headerFileName, &nRows, &nCols, &crestShift, &spokeFileNames[vtkSrepFile::Up],
+                &spokeFileNames[vtkSrepFile::Down], &spokeFileNames[vtkSrepFile::Crest]);
+    if(nRows == 0 || nCols == 0)
+    {
+        std::cerr << "The s-rep model is empty." << std::endl;
+        return false;
+    }
+
+    vtkSrepFile::Spokes sides[3];
+    for(int side = 0; side < 3; ++side)
+    {
+        std::vector<double> coeff;
+        Parse(spokeFileNames[side], coeff, sides[side].Radii, sides[side].Directions, sides[side].SkeletalPoints);
+        if(sides[side].Radii.empty())
+        {
+            std::cerr << "No " << vtkSrepFile::GetSideName(side) << " spokes in " << spokeFileNames[side] << std::endl;
+            return false;
+        }
+    }
+    mSrepModels.Invalidate(srepFileName);
+    return vtkSrepFile::Write(srepFileName, nRows, nCols, crestShift, sides);
 }
 
-double vtkSlicerSkeletalRepresentationRefinerLogic::operator ()(double *coeff)
+bool vtkSlicerSkeletalRepresentationRefinerLogic::ImportSrepContainer(const std::string &srepFileName,
+                                                                      const std::string &outputPath)
 {
-    double cost = 0.0;
-    cost = EvaluateObjectiveFunction(coeff);
-    return cost;
+    vtkSrepFile srepFile;
+    if(!srepFile.Open(srepFileName))
+    {
+        return false;
+    }
+    std::string spokeFileNames[3];
+    for(int side = 0; side < 3; ++side)
+    {
+        const size_t numSpokes = srepFile.GetNumberOfSpokes(side);
+        const double *radii = srepFile.GetSection(side, vtkSrepFile::Radii);
+        const double *dirs = srepFile.GetSection(side, vtkSrepFile::Directions);
+        const double *points = srepFile.GetSection(side, vtkSrepFile::SkeletalPoints);
+        std::vector<vtkSpoke*> spokes;
+        for(size_t i = 0; i < numSpokes; ++i)
+        {
+            spokes.push_back(new vtkSpoke(radii[i], points[3 * i], points[3 * i + 1], points[3 * i + 2],
+                                          dirs[3 * i], dirs[3 * i + 1], dirs[3 * i + 2]));
+        }
+        spokeFileNames[side] = outputPath + "/" + vtkSrepFile::GetSideName(side) + ".vtp";
+        SaveSpokes2Vtp(spokes, spokeFileNames[side]);
+        for(size_t i = 0; i < spokes.size(); ++i)
+        {
+            delete spokes[i];
+        }
+    }
+    WriteHeaderFile(outputPath + "/header.xml", srepFile.GetNumberOfRows(), srepFile.GetNumberOfColumns(),
+                    srepFile.GetCrestShift(), spokeFileNames[vtkSrepFile::Up], spokeFileNames[vtkSrepFile::Down],
+                    spokeFileNames[vtkSrepFile::Crest]);
+    mSrepModels.Invalidate(outputPath + "/header.xml");
+    return true;
 }
-double vtkSlicerSkeletalRepresentationRefinerLogic::EvaluateObjectiveFunction(double *coeff)
+
+bool vtkSlicerSkeletalRepresentationRefinerLogic::ExportSrepArchive(const std::vector<std::string> &headerFileNames,
+                                                                    const std::string &archiveFileName,
+                                                                    double pointStep, double radiusStep, int directionBits)
 {
-    // TODO: SHOULD add progress bar here.
-    //std::cout << "Current iteration: " << iterNum++ << std::endl;
+    vtkSrepArchiveWriter writer;
+    int archiveRows = 0, archiveCols = 0;
+    for(size_t i = 0; i < headerFileNames.size(); ++i)
+    {
+        int nRows = 0, nCols = 0;
+        double crestShift = 0.0;
+        std::string spokeFileNames[3];
+        ParseHeader(headerFileNames[i], &nRows, &nCols, &crestShift, &spokeFileNames[vtkSrepFile::Up],
+                    &spokeFileNames[vtkSrepFile::Down], &spokeFileNames[vtkSrepFile::Crest]);
+        if(nRows == 0 || nCols == 0)
+        {
+            std::cerr << "The s-rep model of " << headerFileNames[i] << " is empty." << std::endl;
+            return false;
+        }
+        if(i == 0)
+        {
+            if(!writer.Create(archiveFileName, nRows, nCols, pointStep, radiusStep, directionBits))
+            {
+                return false;
+            }
+            archiveRows = nRows;
+            archiveCols = nCols;
+        }
+        else if(nRows != archiveRows || nCols != archiveCols)
+        {
+            // the same spoke counts on another grid would decode with the wrong neighbors
+            std::cerr << "The s-rep of " << headerFileNames[i] << " has a grid of " << nRows << "x" << nCols
+                      << ", the archive has " << archiveRows << "x" << archiveCols << "." << std::endl;
+            return false;
+        }
+
+        // Parse keeps the spokes in the model cache, they are copied for the archive only
+        vtkSrepFile::Spokes sides[3];
+        for(int side = 0; side < 3; ++side)
+        {
+            std::vector<double> coeff;
+            Parse(spokeFileNames[side], coeff, sides[side].Radii, sides[side].Directions, sides[side].SkeletalPoints);
+            if(sides[side].Radii.empty())
+            {
+                std::cerr << "No " << vtkSrepFile::GetSideName(side) << " spokes in " << spokeFileNames[side] << std::endl;
+                return false;
+            }
+        }
+        if(!writer.AddSubject(headerFileNames[i], crestShift, sides))
+        {
+            return false;
+        }
+    }
+    if(headerFileNames.empty())
+    {
+        std::cerr << "No s-reps to archive." << std::endl;
+        return false;
+    }
+    return writer.Commit();
+}
+
+bool vtkSlicerSkeletalRepresentationRefinerLogic::ImportSrepArchive(const std::string &archiveFileName,
+                                                                    const std::string &subjectName,
+                                                                    const std::string &srepFileName)
+{
+    vtkSrepArchive archive;
+    if(!archive.Open(archiveFileName))
+    {
+        return false;
+    }
+    const long long subject = archive.FindSubject(subjectName);
+    if(subject < 0)
+    {
+        std::cerr << "There is no subject " << subjectName << " in " << archiveFileName << std::endl;
+        return false;
+    }
+    vtkSrepFile::Spokes sides[3];
+    if(!archive.ReadSubject(static_cast<size_t>(subject), sides))
+    {
+        return false;
+    }
+    mSrepModels.Invalidate(srepFileName);
+    return vtkSrepFile::Write(srepFileName, archive.GetNumberOfRows(), archive.GetNumberOfColumns(),
+                              archive.GetCrestShift(static_cast<size_t>(subject)), sides);
+}
+
+vtkSrep *vtkSlicerSkeletalRepresentationRefinerLogic::ReadSrepFromArchive(const std::string &archiveFileName,
+                                                                         const std::string &subjectName)
+{
+    vtkSrepArchive archive;
+    if(!archive.Open(archiveFileName))
+    {
+        return nullptr;
+    }
+    const long long subject = archive.FindSubject(subjectName);
+    if(subject < 0)
+    {
+        std::cerr << "There is no subject " << subjectName << " in " << archiveFileName << std::endl;
+        return nullptr;
+    }
+    return archive.ReadSrep(static_cast<size_t>(subject));
+}
+
+void vtkSlicerSkeletalRepresentationRefinerLogic::SetWeights(double wtImageMatch, double wtNormal, double wtSrad)
+{
+    mWtImageMatch = wtImageMatch;
+    mWtNormalMatch = wtNormal;
+    mWtSrad = wtSrad;
+}
+
+void vtkSlicerSkeletalRepresentationRefinerLogic::SetFreeSpokes(const std::vector<int> &ids)
+{
+    ClearFreeSpokes();
+    mFreeSpokeIds = ids;
+}
+
+void vtkSlicerSkeletalRepresentationRefinerLogic::SetFreeSpokeRange(int rowBegin, int rowEnd, int colBegin, int colEnd)
+{
+    ClearFreeSpokes();
+    mFreeSpokeRange[0] = rowBegin;
+    mFreeSpokeRange[1] = rowEnd;
+    mFreeSpokeRange[2] = colBegin;
+    mFreeSpokeRange[3] = colEnd;
+}
+
+void vtkSlicerSkeletalRepresentationRefinerLogic::ClearFreeSpokes()
+{
+    mFreeSpokeIds.clear();
+    mFreeSpokeRange[0] = -1;
+    mFreeSpokeRange[1] = -1;
+    mFreeSpokeRange[2] = -1;
+    mFreeSpokeRange[3] = -1;
+    mFreeIndices.clear();
+    mIsFreeSpoke.clear();
+    mIsActiveSpoke.clear();
+}
+
+void vtkSlicerSkeletalRepresentationRefinerLogic::SetSinglePrecision(bool singlePrecision)
+{
+    mSinglePrecision = singlePrecision;
+}
+
+void vtkSlicerSkeletalRepresentationRefinerLogic::SetPrecisionValidation(bool validate)
+{
+    mValidatePrecision = validate;
+}
+
+double vtkSlicerSkeletalRepresentationRefinerLogic::operator ()(double *coeff)
+{
+    double cost = 0.0;
+    if(mFreeIndices.empty())
+    {
+        cost = EvaluateObjectiveFunction(coeff);
+        return cost;
+    }
+
+    // only coefficients of free spokes are optimized, others keep initial values
+    std::vector<double> fullCoeff;
+    ExpandCoefficients(mCoeffArray, coeff, fullCoeff);
+    cost = EvaluateObjectiveFunction(fullCoeff.data());
+    return cost;
+}
+
+void vtkSlicerSkeletalRepresentationRefinerLogic::ExpandCoefficients(const std::vector<double> &allCoeff, const double *freeCoeff,
+                                                                     std::vector<double> &output) const
+{
+    if(mFreeIndices.empty())
+    {
+        output.assign(freeCoeff, freeCoeff + allCoeff.size());
+        return;
+    }
+    output = allCoeff;
+    for(size_t i = 0; i < mFreeIndices.size(); ++i)
+    {
+        size_t idxFull = static_cast<size_t>(mFreeIndices[i]) * 4;
+        size_t idxFree = i * 4;
+        output[idxFull] = freeCoeff[idxFree];
+        output[idxFull+1] = freeCoeff[idxFree+1];
+        output[idxFull+2] = freeCoeff[idxFree+2];
+        output[idxFull+3] = freeCoeff[idxFree+3];
+    }
+}
+
+double vtkSlicerSkeletalRepresentationRefinerLogic::EvaluateObjectiveFunction(double *coeff)
+{
+    // TODO: SHOULD add progress bar here.
+    //std::cout << "Current iteration: " << iterNum++ << std::endl;
 
     if(mSrep == nullptr)
     {
-        std::cerr << "The srep pointer in the refinement is nullptr." << std::endl;
-        return -100000.0;
+        std::cerr << "The srep pointer in the refinement is nullptr." << std::endl;
+        return -100000.0;
+    }
+
+    double imageDist = 0.0, normal = 0.0, srad = 0.0;
+    if(mSinglePrecision)
+    {
+        ComputeObjectiveTermsSingle(mSrep, coeff, &imageDist, &normal, &srad);
+    }
+    else
+    {
+        ComputeObjectiveTerms(mSrep, coeff, &imageDist, &normal, &srad);
+    }
+
+    if(mFirstCost)
+    {
+        // this log helps to adjust the weights of three terms
+        std::cout << "ImageMatch:" << imageDist << ", normal:" << normal << ", srad:" << srad << std::endl;
+        mFirstCost = false;
+    }
+
+    double cost = mWtImageMatch * imageDist + mWtNormalMatch * normal + mWtSrad * srad;
+    if(mSinglePrecision && mValidatePrecision)
+    {
+        double refImageDist = 0.0, refNormal = 0.0, refSrad = 0.0;
+        ComputeObjectiveTerms(mSrep, coeff, &refImageDist, &refNormal, &refSrad);
+        double reference = mWtImageMatch * refImageDist + mWtNormalMatch * refNormal + mWtSrad * refSrad;
+        double deviation = std::abs(cost - reference) / std::max(std::abs(reference), 1e-12);
+        mMaxDeviation = std::max(mMaxDeviation, deviation);
+        mSumDeviation += deviation;
+        ++mNumValidations;
+    }
+    return cost;
+}
+
+void vtkSlicerSkeletalRepresentationRefinerLogic::ComputeObjectiveTerms(vtkSrep *srep, const double *coeff,
+                                                                        double *outImageDist, double *outNormal, double *outSrad)
+{
+    ComputeKernelObjectiveTerms<double>(srep, coeff, outImageDist, outNormal, outSrad);
+}
+
+void vtkSlicerSkeletalRepresentationRefinerLogic::ComputeObjectiveTermsSingle(vtkSrep *srep, const double *coeff,
+                                                                              double *outImageDist, double *outNormal, double *outSrad)
+{
+    ComputeKernelObjectiveTerms<float>(srep, coeff, outImageDist, outNormal, outSrad);
+}
+
+template<typename T>
+void vtkSlicerSkeletalRepresentationRefinerLogic::ComputeKernelObjectiveTerms(vtkSrep *srep, const double *coeff,
+                                                                              double *outImageDist, double *outNormal, double *outSrad)
+{
+    typedef vtkSrepKernels<T> Kernels;
+    typedef typename Kernels::Spoke Spoke;
+    const KernelEntries<T> kernels(vtkSrepKernelDispatch::GetTable());
+    *outImageDist = 0.0;
+    *outNormal = 0.0;
+    *outSrad = 0.0;
+    if(mDistanceSampler == nullptr)
+    {
+        std::cerr << "The image in this RefinerLogic instance is empty." << std::endl;
+        return;
+    }
+    const int nRows = mNumRows;
+    const int nCols = mNumCols;
+    const size_t spokeNum = static_cast<size_t>(nRows * nCols);
+
+    // 1. deformed spokes, once per evaluation
+    std::vector<Spoke> spokes(spokeNum);
+    std::vector<double> skeletalPts(3 * spokeNum);
+    for(size_t i = 0; i < spokeNum; ++i)
+    {
+        vtkSpoke *thisSpoke = srep->GetAllSpokes()[i];
+        double pt[3], dir[3] = {coeff[4 * i], coeff[4 * i + 1], coeff[4 * i + 2]};
+        thisSpoke->GetSkeletalPoint(pt);
+        vtkMath::Normalize(dir);
+        spokes[i].radius = static_cast<T>(exp(coeff[4 * i + 3]) * thisSpoke->GetRadius());
+        for(int k = 0; k < 3; ++k)
+        {
+            spokes[i].point[k] = static_cast<T>(pt[k]);
+            spokes[i].dir[k] = static_cast<T>(dir[k]);
+            skeletalPts[3 * i + k] = pt[k];
+        }
+    }
+    // skeletal points of interpolated spokes don't change with the coefficients
+    const InterpolationTable *interpolationTable = FindInterpolationTable(skeletalPts);
+    if(interpolationTable == nullptr)
+    {
+        std::cerr << "The interpolation table of this s-rep has not been built." << std::endl;
+        return;
+    }
+    const InterpolationPoints<T> &table = interpolationTable->GetPoints(T());
+
+    // quad whose top-left spoke is (qr, qc), the table has the rest of the Hermite interpolation
+    auto makeQuad = [&](int qr, int qc, typename Kernels::Quad *quad)
+    {
+        quad->corners[0] = &spokes[static_cast<size_t>(qr * nCols + qc)];
+        quad->corners[1] = &spokes[static_cast<size_t>((qr + 1) * nCols + qc)];
+        quad->corners[2] = &spokes[static_cast<size_t>((qr + 1) * nCols + qc + 1)];
+        quad->corners[3] = &spokes[static_cast<size_t>(qr * nCols + qc + 1)];
+    };
+
+    // 2. image match of primary spokes and interpolated spokes
+    std::vector<T> points, dirs, weights;
+    auto addSample = [&](const Spoke &spoke, T weight)
+    {
+        T pt[3];
+        Kernels::GetBoundaryPoint(spoke, pt);
+        points.insert(points.end(), pt, pt + 3);
+        dirs.insert(dirs.end(), spoke.dir, spoke.dir + 3);
+        weights.push_back(weight);
+    };
+    for(size_t i = 0; i < spokeNum; ++i)
+    {
+        int id = static_cast<int>(i);
+        if(IsActiveSpoke(id) && (mIsFreeSpoke.empty() || mIsFreeSpoke[i]))
+        {
+            addSample(spokes[i], T(1));
+        }
+    }
+    // the image match counts every quad once per active corner spoke
+    const size_t numPositions = mInterpolatePositions.size();
+    std::vector<Spoke> interpolatedSpokes(numPositions, spokes[0]);
+    for(int qr = 0; qr + 1 < nRows; ++qr)
+    {
+        for(int qc = 0; qc + 1 < nCols; ++qc)
+        {
+            int multiplicity = IsActiveSpoke(qr * nCols + qc) + IsActiveSpoke((qr + 1) * nCols + qc)
+                             + IsActiveSpoke((qr + 1) * nCols + qc + 1) + IsActiveSpoke(qr * nCols + qc + 1);
+            if(multiplicity == 0)
+            {
+                continue;
+            }
+            typename Kernels::Quad quad;
+            makeQuad(qr, qc, &quad);
+            kernels.interpolateOnTable(quad, table.Positions.data(), table.GetQuadPoints(qr, qc, nCols),
+                                       numPositions, interpolatedSpokes.data());
+            for(size_t i = 0; i < interpolatedSpokes.size(); ++i)
+            {
+                addSample(interpolatedSpokes[i], static_cast<T>(multiplicity));
+            }
+        }
+    }
+
+    const T scale[3] = {static_cast<T>(mTransformationMat[0][0]),
+                        static_cast<T>(mTransformationMat[1][1]),
+                        static_cast<T>(mTransformationMat[2][2])};
+    const T shift[3] = {static_cast<T>(mTransformationMat[3][0]),
+                        static_cast<T>(mTransformationMat[3][1]),
+                        static_cast<T>(mTransformationMat[3][2])};
+    double imageDist = 0.0, normal = 0.0;
+    if(mDistanceSampler == &mImageSampler && mImageSampler.IsBricked())
+    {
+        // samples of one brick read neighboring voxels one after another
+        mImageSampler.SortSamples(points.data(), dirs.data(), weights.data(), weights.size(), scale, shift);
+    }
+    // the B-spline takes its normals from the distances, the other reads need the stored gradient
+    const int interpolation = mImageSampler.GetInterpolation();
+    if(mDistanceSampler == &mImageSampler && (mImageSampler.GetNormalMode() == vtkImageDistanceSampler::StoredGradient
+                                              || interpolation == vtkImageDistanceSampler::TricubicBSpline))
+    {
+        // the kernels index from the origin of the grid, voxel (i, j, k) at (i, j, k) * spacing
+        const double *origin = mImageSampler.GetOrigin();
+        const T gridShift[3] = {static_cast<T>(mTransformationMat[3][0] - origin[0]),
+                                static_cast<T>(mTransformationMat[3][1] - origin[1]),
+                                static_cast<T>(mTransformationMat[3][2] - origin[2])};
+        const int *dims = mImageSampler.GetDimensions();
+        const int maxIndex = std::max(dims[0], std::max(dims[1], dims[2])) - 1;
+        const T spacing = static_cast<T>(mImageSampler.GetSpacing());
+        if(mImageSampler.GetQuantizedDistance() != nullptr)
+        {
+            kernels.sampleImageMatchQuantized(points.data(), dirs.data(), weights.data(), weights.size(),
+                                              scale, gridShift, spacing, dims, maxIndex,
+                                              mImageSampler.IsBricked(), interpolation,
+                                              mImageSampler.GetQuantizedDistance(),
+                                              static_cast<T>(mImageSampler.GetDistanceScale()),
+                                              static_cast<T>(mImageSampler.GetDistanceOffset()),
+                                              mImageSampler.GetGradient(), &imageDist, &normal);
+        }
+        else
+        {
+            kernels.sampleImageMatch(points.data(), dirs.data(), weights.data(), weights.size(),
+                                     scale, gridShift, spacing, dims, maxIndex, mImageSampler.IsBricked(),
+                                     interpolation, mImageSampler.GetDistance(), mImageSampler.GetGradient(),
+                                     &imageDist, &normal);
+        }
+    }
+    else
+    {
+        mDistanceSampler->SampleImageMatch(points.data(), dirs.data(), weights.data(), weights.size(),
+                                           scale, shift, &imageDist, &normal);
+    }
+
+    // 3. rSrad penalty from the neighbors of every spoke in u and v
+    const T step = static_cast<T>(mInterpolatePositions[0].second);
+    // u and v neighbors from the 4 quads around every spoke
+    std::vector<Spoke> neighbors(spokeNum * 8, spokes[0]);
+    std::vector<typename Kernels::RSradInput> rSradInputs;
+    for(int r = 0; r < nRows; ++r)
+    {
+        for(int c = 0; c < nCols; ++c)
+        {
+            const int id = r * nCols + c;
+            if(!IsActiveSpoke(id))
+            {
+                continue;
+            }
+            Spoke *spokeNeighbors = &neighbors[static_cast<size_t>(id) * 8];
+            auto findNeighbors = [&](int which)
+            {
+                int qr, qc;
+                bool swapDerivatives;
+                T positions[4];
+                GetNeighborQuad(which, r, c, step, &qr, &qc, &swapDerivatives, positions);
+                typename Kernels::Quad quad;
+                makeQuad(qr, qc, &quad);
+                kernels.interpolateOnTable(quad, positions, table.GetNeighborPoints(id, which), 2,
+                                           spokeNeighbors + 2 * which);
+            };
+
+            // first and second neighbor in u and v, spokes on the border have one of them only
+            int first, second;
+            typename Kernels::RSradInput input;
+            input.spoke = &spokes[static_cast<size_t>(id)];
+            input.numU = 2;
+            input.numV = 2;
+            input.isForwardU = false;
+            input.isForwardV = false;
+            if(r == 0 && c == 0)
+            {
+                first = second = TopLeft; input.numU = input.numV = 1; input.isForwardU = input.isForwardV = true;
+            }
+            else if(r == 0 && c == nCols - 1)
+            {
+                first = second = TopRight; input.numU = input.numV = 1; input.isForwardU = true;
+            }
+            else if(r == 0)
+            {
+                first = TopRight; second = TopLeft; input.numU = 1; input.isForwardU = true;
+            }
+            else if(r == nRows - 1 && c == 0)
+            {
+                first = second = BotLeft; input.numU = input.numV = 1; input.isForwardV = true;
+            }
+            else if(r == nRows - 1 && c == nCols - 1)
+            {
+                first = second = BotRight; input.numU = input.numV = 1;
+            }
+            else if(r == nRows - 1)
+            {
+                first = BotRight; second = BotLeft; input.numU = 1;
+            }
+            else if(c == 0)
+            {
+                first = BotLeft; second = TopLeft; input.numV = 1; input.isForwardV = true;
+            }
+            else if(c == nCols - 1)
+            {
+                first = BotRight; second = TopRight; input.numV = 1;
+            }
+            else
+            {
+                first = BotRight; second = TopLeft;
+            }
+            findNeighbors(first);
+            if(second != first)
+            {
+                findNeighbors(second);
+            }
+            input.neighborsU[0] = spokeNeighbors + 2 * first;
+            input.neighborsU[1] = spokeNeighbors + 2 * second;
+            input.neighborsV[0] = spokeNeighbors + 2 * first + 1;
+            input.neighborsV[1] = spokeNeighbors + 2 * second + 1;
+            rSradInputs.push_back(input);
+        }
+    }
+    double srad = kernels.rSradPenalty(rSradInputs.data(), rSradInputs.size(), step);
+
+    *outImageDist = imageDist;
+    *outNormal = normal;
+    *outSrad = srad;
+}
+
+void vtkSlicerSkeletalRepresentationRefinerLogic::UpdateInterpolationTable(vtkSrep *srep)
+{
+    std::vector<double> skeletalPoints = GetSkeletalPoints(srep);
+    if(FindInterpolationTable(skeletalPoints) != nullptr)
+    {
+        return;
+    }
+    // the up and down spokes of the s-rep in refinement, older tables are not used again
+    const size_t maxTables = 2;
+    if(mInterpolationTables.size() >= maxTables)
+    {
+        mInterpolationTables.erase(mInterpolationTables.begin());
+    }
+    InterpolationTable table;
+    table.SkeletalPoints = skeletalPoints;
+    table.NumCols = mNumCols;
+    ComputeInterpolationPoints(table, &table.Float);
+    ComputeInterpolationPoints(table, &table.Double);
+    mInterpolationTables.push_back(table);
+}
+
+const vtkSlicerSkeletalRepresentationRefinerLogic::InterpolationTable *
+vtkSlicerSkeletalRepresentationRefinerLogic::FindInterpolationTable(const std::vector<double> &skeletalPoints) const
+{
+    for(size_t i = 0; i < mInterpolationTables.size(); ++i)
+    {
+        const InterpolationTable &table = mInterpolationTables[i];
+        if(table.Double.Positions.size() == 2 * mInterpolatePositions.size() && table.NumCols == mNumCols
+           && table.SkeletalPoints == skeletalPoints)
+        {
+            return &table;
+        }
+    }
+    return nullptr;
+}
+
+template<typename T>
+void vtkSlicerSkeletalRepresentationRefinerLogic::ComputeInterpolationPoints(const InterpolationTable &table,
+                                                                             InterpolationPoints<T> *output)
+{
+    typedef vtkSrepKernels<T> Kernels;
+    const std::vector<double> &skeletalPoints = table.SkeletalPoints;
+    const size_t numPositions = mInterpolatePositions.size();
+    const int nRows = mNumRows;
+    const int nCols = table.NumCols;
+    const size_t spokeNum = static_cast<size_t>(nRows * nCols);
+    output->Positions.clear();
+    for(auto it = mInterpolatePositions.begin(); it != mInterpolatePositions.end(); ++it)
+    {
+        output->Positions.push_back(static_cast<T>((*it).first));
+        output->Positions.push_back(static_cast<T>((*it).second));
+    }
+
+    // the Hermite interpolation reads the skeletal points and derivatives of the corners only
+    std::vector<typename Kernels::Spoke> corners(spokeNum);
+    std::vector<T> dxdu(3 * spokeNum), dxdv(3 * spokeNum);
+    for(int r = 0; r < nRows; ++r)
+    {
+        for(int c = 0; c < nCols; ++c)
+        {
+            double du[3], dv[3];
+            ComputeDerivative(skeletalPoints, r, c, nRows, nCols, du, dv);
+            size_t id = static_cast<size_t>(r * nCols + c);
+            for(int k = 0; k < 3; ++k)
+            {
+                corners[id].point[k] = static_cast<T>(skeletalPoints[3 * id + k]);
+                dxdu[3 * id + k] = static_cast<T>(du[k]);
+                dxdv[3 * id + k] = static_cast<T>(dv[k]);
+            }
+        }
+    }
+    // swapDerivatives gives the two right corners each other's derivatives, as the rSrad neighbors
+    // outside the top-left quad have always been interpolated
+    auto makeQuad = [&](int qr, int qc, bool swapDerivatives, typename Kernels::Quad *quad)
+    {
+        const int ids[4] = {qr * nCols + qc, (qr + 1) * nCols + qc, (qr + 1) * nCols + qc + 1, qr * nCols + qc + 1};
+        for(int k = 0; k < 4; ++k)
+        {
+            quad->corners[k] = &corners[static_cast<size_t>(ids[k])];
+            size_t d = static_cast<size_t>((swapDerivatives && k >= 2) ? ids[5 - k] : ids[k]);
+            for(int j = 0; j < 3; ++j)
+            {
+                quad->dxdu[k][j] = dxdu[3 * d + j];
+                quad->dxdv[k][j] = dxdv[3 * d + j];
+            }
+        }
+    };
+
+    output->QuadPoints.assign(3 * numPositions * spokeNum, T(0));
+    for(int qr = 0; qr + 1 < nRows; ++qr)
+    {
+        for(int qc = 0; qc + 1 < nCols; ++qc)
+        {
+            typename Kernels::Quad quad;
+            makeQuad(qr, qc, false, &quad);
+            T *points = &output->QuadPoints[3 * numPositions * static_cast<size_t>(qr * nCols + qc)];
+            for(size_t i = 0; i < numPositions; ++i)
+            {
+                Kernels::InterpolateSkeletalPoint(quad, output->Positions[2 * i], output->Positions[2 * i + 1],
+                                                  points + 3 * i);
+            }
+        }
+    }
+
+    const T step = static_cast<T>(mInterpolatePositions[0].second);
+    output->NeighborPoints.assign(24 * spokeNum, T(0));
+    for(int r = 0; r < nRows; ++r)
+    {
+        for(int c = 0; c < nCols; ++c)
+        {
+            for(int which = TopLeft; which <= BotRight; ++which)
+            {
+                int qr, qc;
+                bool swapDerivatives;
+                T positions[4];
+                GetNeighborQuad(which, r, c, step, &qr, &qc, &swapDerivatives, positions);
+                if(qr < 0 || qc < 0 || qr + 1 >= nRows || qc + 1 >= nCols)
+                {
+                    continue;
+                }
+                typename Kernels::Quad quad;
+                makeQuad(qr, qc, swapDerivatives, &quad);
+                T *points = &output->NeighborPoints[6 * (4 * static_cast<size_t>(r * nCols + c) + which)];
+                Kernels::InterpolateSkeletalPoint(quad, positions[0], positions[1], points);
+                Kernels::InterpolateSkeletalPoint(quad, positions[2], positions[3], points + 3);
+            }
+        }
+    }
+}
+
+void vtkSlicerSkeletalRepresentationRefinerLogic::AntiAliasSignedDistanceMap(const std::string &meshFileName)
+{
+    // the map of the selected mesh may have been built in the background already
+    WaitForDistanceMap();
+    if(meshFileName == mDistanceMapMeshPath && mDistanceSampler != nullptr)
+    {
+        return;
+    }
+    BuildDistanceMap(meshFileName);
+}
+
+void vtkSlicerSkeletalRepresentationRefinerLogic::StartDistanceMap()
+{
+    // nothing to build if the distances come from elsewhere or are there already
+    if(mSharedDistanceMap || !mDistanceMapFileName.empty() || mTargetMeshFilePath.empty()
+       || mTargetMeshFilePath == mDistanceMapMeshPath)
+    {
+        return;
+    }
+    mCancelDistanceMap = false;
+    const std::string meshFileName = mTargetMeshFilePath;
+    mDistanceMapJob = std::async(std::launch::async, [this, meshFileName]()
+    {
+        BuildDistanceMap(meshFileName);
+    });
+}
+
+void vtkSlicerSkeletalRepresentationRefinerLogic::WaitForDistanceMap()
+{
+    if(!mDistanceMapJob.valid())
+    {
+        return;
+    }
+    try
+    {
+        mDistanceMapJob.get();
+    }
+    catch(std::exception &excep)
+    {
+        std::cerr << "Building the distance map failed:" << std::endl;
+        std::cerr << excep.what() << std::endl;
+        mDistanceMapMeshPath.clear();
+    }
+}
+
+void vtkSlicerSkeletalRepresentationRefinerLogic::CancelDistanceMap()
+{
+    mCancelDistanceMap = true;
+    WaitForDistanceMap();
+    mCancelDistanceMap = false;
+}
+
+bool vtkSlicerSkeletalRepresentationRefinerLogic::DistanceMapCancelled(const std::string &meshFileName)
+{
+    if(!mCancelDistanceMap)
+    {
+        return false;
+    }
+    mAntiAliasedImage = RealImage::New();
+    mGradDistImage = VectorImage::New();
+    UpdateDistanceSampler();
+    vtkDebugMacro(<< "Stopped the distance map of " << meshFileName);
+    return true;
+}
+
+void vtkSlicerSkeletalRepresentationRefinerLogic::BuildDistanceMap(const std::string &meshFileName)
+{
+    mMappedDistanceMap.Close();
+    // free the volumes of the previous mesh before the new ones are allocated
+    mAntiAliasedImage = RealImage::New();
+    mGradDistImage = VectorImage::New();
+    mDistanceMapBricked = false;
+    mOctahedralNormals.clear();
+    mQuantizedDistance.clear();
+    mSparseDistanceMap = vtkSparseDistanceMap();
+    mMeshDistance.Clear();
+    UpdateDistanceSampler();
+    // label volumes have no triangles, their narrow band is cut from the dense map
+    const bool labelVolume = vtkLabelVolume2ImageData::IsLabelVolumeFile(meshFileName);
+    if(mExactMeshDistance && labelVolume)
+    {
+        std::cerr << "The exact distance needs a mesh, using the distance map of " << meshFileName << std::endl;
+    }
+    else if(mExactMeshDistance)
+    {
+        BuildMeshDistance(meshFileName);
+        return;
+    }
+    else if(mNarrowBand > 0 && !labelVolume)
+    {
+        BuildNarrowBandDistanceMap(meshFileName);
+        return;
+    }
+    const bool narrowBand = mNarrowBand > 0 && !mExactMeshDistance;
+
+    std::string cacheKey;
+    if(!mDistanceMapCacheDirectory.empty() && !narrowBand)
+    {
+        vtkDistanceMapCache cache(mDistanceMapCacheDirectory, mDistanceMapCacheSize);
+        cacheKey = cache.ComputeKey(meshFileName, mVoxelSpacing, mGridMargin, mBrickDistanceMaps, mNormalMode);
+        vtkDistanceMapFileHeader header;
+        if(mMapDistanceMaps && vtkDistanceMapCache::ReadHeader(cache.GetFileName(cacheKey), &header)
+           && MapDistanceMap(cache.GetFileName(cacheKey)))
+        {
+            cache.MarkUsed(cacheKey);
+            mDistanceMapMeshPath = meshFileName;
+            return;
+        }
+        if(!mMapDistanceMaps && cache.Load(cacheKey, mAntiAliasedImage, mGradDistImage, &mOctahedralNormals,
+                                           &mDistanceMapBricked))
+        {
+            mDistanceMapMeshPath = meshFileName;
+            UpdateDistanceSampler();
+            return;
+        }
+    }
+
+    // 1. convert poly data to image data
+    vtkSmartPointer<vtkImageData> img = vtkSmartPointer<vtkImageData>::New();
+    if(labelVolume)
+    {
+        vtkLabelVolume2ImageData labelConverter;
+        labelConverter.SetVoxelSpacing(mVoxelSpacing);
+        labelConverter.SetMargin(mGridMargin);
+        if(!labelConverter.Convert(meshFileName, img))
+        {
+            return;
+        }
+    }
+    else
+    {
+        vtkPolyData2ImageData polyDataConverter;
+        polyDataConverter.SetVoxelSpacing(mVoxelSpacing);
+        polyDataConverter.SetMargin(mGridMargin);
+        polyDataConverter.SetCancelFlag(&mCancelDistanceMap);
+        // this conversion already put the image into the unit-cube
+        polyDataConverter.Convert(mMeshReader.Get(meshFileName), img, nullptr);
+    }
+    if(DistanceMapCancelled(meshFileName))
+    {
+        return;
+    }
+
+    // 2. exact signed distance, written straight into the ITK buffer
+    vtkSignedDistanceTransform ssdGenerator;
+    ssdGenerator.SetCancelFlag(&mCancelDistanceMap);
+    if(!ssdGenerator.Convert(img, mAntiAliasedImage))
+    {
+        // not a mask, or stopped half way by CancelDistanceMap
+        mAntiAliasedImage = RealImage::New();
+        DistanceMapCancelled(meshFileName);
+        return;
+    }
+    // the mask is not needed any more, release it before the gradient volume is allocated
+    img = nullptr;
+    if(DistanceMapCancelled(meshFileName))
+    {
+        return;
+    }
+
+    if(narrowBand)
+    {
+        RealImage::SizeType size = mAntiAliasedImage->GetBufferedRegion().GetSize();
+        const int dims[3] = {static_cast<int>(size[0]), static_cast<int>(size[1]), static_cast<int>(size[2])};
+        const double origin[3] = {mAntiAliasedImage->GetOrigin()[0], mAntiAliasedImage->GetOrigin()[1],
+                                  mAntiAliasedImage->GetOrigin()[2]};
+        mSparseDistanceMap.BuildFromDense(mAntiAliasedImage->GetBufferPointer(), dims, origin, mVoxelSpacing,
+                                          mNarrowBand);
+        mAntiAliasedImage = RealImage::New();
+        UpdateDistanceSampler();
+        mDistanceMapMeshPath = meshFileName;
+        vtkDebugMacro(<< "Narrow band distance map: " << mSparseDistanceMap.GetNumberOfBricks() << " bricks, "
+                      << mSparseDistanceMap.GetMemorySize() / (1024 * 1024) << " MB.");
+        return;
+    }
+
+    // 4. compute normals of the image everywhere, the other modes work from the distances
+    if(mNormalMode == vtkImageDistanceSampler::StoredGradient)
+    {
+        vtkGradientDistanceFilter gradDistFilter;
+        gradDistFilter.Filter(mAntiAliasedImage, mGradDistImage);
+    }
+    if(DistanceMapCancelled(meshFileName))
+    {
+        return;
+    }
+    mDistanceMapMeshPath = meshFileName;
+
+    // the ITK images are only read through their buffers from here on
+    RealImage::SizeType size = mAntiAliasedImage->GetBufferedRegion().GetSize();
+    const int dims[3] = {static_cast<int>(size[0]), static_cast<int>(size[1]), static_cast<int>(size[2])};
+    if(mBrickDistanceMaps && vtkBrickedLayout::Fits(dims))
+    {
+        vtkBrickedLayout::Reorder(mAntiAliasedImage->GetBufferPointer(), dims, 1);
+        if(mGradDistImage->GetBufferPointer() != nullptr)
+        {
+            vtkBrickedLayout::Reorder(reinterpret_cast<float*>(mGradDistImage->GetBufferPointer()), dims, 3);
+        }
+        mDistanceMapBricked = true;
+    }
+
+    if(!cacheKey.empty())
+    {
+        // the octahedral codes are cached in place of the gradient, in the final layout
+        if(mNormalMode == vtkImageDistanceSampler::OctahedralNormals)
+        {
+            mOctahedralNormals.resize(static_cast<size_t>(dims[0]) * static_cast<size_t>(dims[1])
+                                      * static_cast<size_t>(dims[2]));
+            vtkImageDistanceSampler::ComputeOctahedralNormals(mAntiAliasedImage->GetBufferPointer(), dims,
+                                                              mVoxelSpacing, mDistanceMapBricked,
+                                                              mOctahedralNormals.data());
+        }
+        vtkDistanceMapCache cache(mDistanceMapCacheDirectory, mDistanceMapCacheSize);
+        // continue on the shared pages of the new entry and drop the private copy
+        if(cache.Store(cacheKey, mAntiAliasedImage, mGradDistImage, mOctahedralNormals, mDistanceMapBricked)
+           && mMapDistanceMaps && MapDistanceMap(cache.GetFileName(cacheKey)))
+        {
+            return;
+        }
+    }
+    UpdateDistanceSampler();
+}
+
+void vtkSlicerSkeletalRepresentationRefinerLogic::BuildNarrowBandDistanceMap(const std::string &meshFileName)
+{
+    // the inside mask comes from the same voxelization as the dense map, distances are exact within the band
+    vtkPolyData2ImageData polyDataConverter;
+    polyDataConverter.SetVoxelSpacing(mVoxelSpacing);
+    polyDataConverter.SetMargin(mGridMargin);
+    vtkSmartPointer<vtkImageData> img = vtkSmartPointer<vtkImageData>::New();
+    vtkSmartPointer<vtkPolyData> unitCubeMesh = vtkSmartPointer<vtkPolyData>::New();
+    polyDataConverter.Convert(mMeshReader.Get(meshFileName), img, unitCubeMesh);
+    std::vector<float> points;
+    std::vector<int> ids;
+    vtkPolyData2ImageData::ExtractTriangles(unitCubeMesh, points, ids);
+
+    int dims[3];
+    img->GetDimensions(dims);
+    mSparseDistanceMap.Build(points.data(), ids.data(), ids.size() / 3,
+                             static_cast<const unsigned char*>(img->GetScalarPointer()), dims,
+                             img->GetOrigin(), mVoxelSpacing, mNarrowBand);
+
+    // the dense volumes are not sampled any more
+    mAntiAliasedImage = RealImage::New();
+    mGradDistImage = VectorImage::New();
+    UpdateDistanceSampler();
+    mDistanceMapMeshPath = meshFileName;
+    vtkDebugMacro(<< "Narrow band distance map: " << mSparseDistanceMap.GetNumberOfBricks() << " bricks, "
+                  << mSparseDistanceMap.GetMemorySize() / (1024 * 1024) << " MB.");
+}
+
+void vtkSlicerSkeletalRepresentationRefinerLogic::BuildMeshDistance(const std::string &meshFileName)
+{
+    // same mapping into the unit cube as the distance maps, so the transformation of the s-rep applies
+    vtkPolyData2ImageData polyDataConverter;
+    vtkSmartPointer<vtkPolyData> unitCubeMesh = vtkSmartPointer<vtkPolyData>::New();
+    polyDataConverter.TransformToUnitCube(mMeshReader.Get(meshFileName), unitCubeMesh);
+    std::vector<float> points;
+    std::vector<int> ids;
+    vtkPolyData2ImageData::ExtractTriangles(unitCubeMesh, points, ids);
+    mMeshDistance.Build(points.data(), points.size() / 3, ids.data(), ids.size() / 3);
+
+    mAntiAliasedImage = RealImage::New();
+    mGradDistImage = VectorImage::New();
+    UpdateDistanceSampler();
+    mDistanceMapMeshPath = meshFileName;
+    vtkDebugMacro(<< "Exact distance to " << mMeshDistance.GetNumberOfTriangles() << " triangles.");
+}
+
+void vtkSlicerSkeletalRepresentationRefinerLogic::SetExactMeshDistance(bool exact)
+{
+    if(exact != mExactMeshDistance)
+    {
+        CancelDistanceMap();
+        mDistanceMapMeshPath.clear();
+        mExactMeshDistance = exact;
+    }
+}
+
+void vtkSlicerSkeletalRepresentationRefinerLogic::SetSharedDistanceMap(
+        std::shared_ptr<const vtkMultiLabelDistanceMap> distanceMap, int object)
+{
+    if(distanceMap && distanceMap->GetSampler(object) == nullptr)
+    {
+        std::cerr << "The shared distance map has no object " << object << "." << std::endl;
+        return;
+    }
+    if(distanceMap && !mTargetMeshFilePath.empty() && distanceMap->GetFileName(object) != mTargetMeshFilePath)
+    {
+        std::cerr << "Object " << object << " of the shared distance map is " << distanceMap->GetFileName(object)
+                  << ", not the image file " << mTargetMeshFilePath << "." << std::endl;
+    }
+    CancelDistanceMap();
+    mSharedDistanceMap = distanceMap;
+    mSharedObject = object;
+    // the own maps aren't sampled while the shared one is set, rebuild them at the next refinement without it
+    mMappedDistanceMap.Close();
+    mAntiAliasedImage = RealImage::New();
+    mGradDistImage = VectorImage::New();
+    mDistanceMapBricked = false;
+    mOctahedralNormals.clear();
+    mQuantizedDistance.clear();
+    mSparseDistanceMap = vtkSparseDistanceMap();
+    mMeshDistance.Clear();
+    mDistanceMapMeshPath.clear();
+    UpdateDistanceSampler();
+}
+
+void vtkSlicerSkeletalRepresentationRefinerLogic::SetNormalMode(int mode)
+{
+    if(mode < vtkImageDistanceSampler::StoredGradient || mode > vtkImageDistanceSampler::OctahedralNormals)
+    {
+        std::cerr << "Unknown normal mode " << mode << ", keeping the gradient volume." << std::endl;
+        mode = vtkImageDistanceSampler::StoredGradient;
+    }
+    if(mode != mNormalMode)
+    {
+        // the gradient volume may have been dropped, rebuild at the next refinement
+        CancelDistanceMap();
+        mDistanceMapMeshPath.clear();
+        mNormalMode = static_cast<vtkImageDistanceSampler::NormalMode>(mode);
+    }
+}
+
+void vtkSlicerSkeletalRepresentationRefinerLogic::SetQuantizedDistanceMap(bool quantize)
+{
+    if(quantize != mQuantizeDistance)
+    {
+        // the float volume may have been dropped, rebuild at the next refinement
+        CancelDistanceMap();
+        mDistanceMapMeshPath.clear();
+        mQuantizeDistance = quantize;
+    }
+}
+
+void vtkSlicerSkeletalRepresentationRefinerLogic::SetBrickedDistanceMaps(bool bricked)
+{
+    if(bricked != mBrickDistanceMaps)
+    {
+        CancelDistanceMap();
+        mDistanceMapMeshPath.clear();
+        mBrickDistanceMaps = bricked;
+    }
+}
+
+void vtkSlicerSkeletalRepresentationRefinerLogic::SetDistanceInterpolation(int interpolation)
+{
+    if(interpolation < vtkImageDistanceSampler::Nearest || interpolation > vtkImageDistanceSampler::TricubicBSpline)
+    {
+        std::cerr << "Unknown interpolation " << interpolation << ", sampling the nearest voxel." << std::endl;
+        interpolation = vtkImageDistanceSampler::Nearest;
+    }
+    // the volumes stay the same
+    WaitForDistanceMap();
+    mImageSampler.SetInterpolation(static_cast<vtkImageDistanceSampler::Interpolation>(interpolation));
+    mSparseDistanceMap.SetInterpolation(mImageSampler.GetInterpolation());
+}
+
+void vtkSlicerSkeletalRepresentationRefinerLogic::SetVoxelSpacing(double spacing)
+{
+    if(spacing <= 0)
+    {
+        std::cerr << "The voxel spacing must be positive." << std::endl;
+        return;
+    }
+    if(spacing != mVoxelSpacing)
+    {
+        CancelDistanceMap();
+        mDistanceMapMeshPath.clear();
+        mVoxelSpacing = spacing;
+    }
+}
+
+void vtkSlicerSkeletalRepresentationRefinerLogic::SetGridMargin(double margin)
+{
+    if(margin < 0)
+    {
+        std::cerr << "The grid margin can't be negative." << std::endl;
+        return;
+    }
+    if(margin != mGridMargin)
+    {
+        CancelDistanceMap();
+        mDistanceMapMeshPath.clear();
+        mGridMargin = margin;
     }
+}
 
-    // this temporary srep is constructed to compute the cost function value
-    // The original srep should not be changed by each iteration
-    vtkSrep *tempSrep = new vtkSrep();
-    tempSrep->DeepCopy(*mSrep);
-    tempSrep->Refine(coeff);
-    double imageDist = 0.0, normal = 0.0, srad = 0.0;
-    int paramDim = static_cast<int>(mCoeffArray.size());
-    int spokeNum = paramDim / 4;
-    // 1. Compute image match from all spokes and those spokes affected by them
-    for(int i = 0; i < spokeNum; ++i)
+void vtkSlicerSkeletalRepresentationRefinerLogic::SetNarrowBand(double band)
+{
+    if(band != mNarrowBand)
     {
-        int r = i / mNumCols;
-        int c = i % mNumCols;
-        vtkSpoke *thisSpoke = tempSrep->GetSpoke(r, c);
+        // rebuild the distance map at the next refinement
+        CancelDistanceMap();
+        mDistanceMapMeshPath.clear();
+        mNarrowBand = band;
+    }
+}
 
-        // compute distance for this spoke
-        imageDist += ComputeDistance(thisSpoke, &normal);
+bool vtkSlicerSkeletalRepresentationRefinerLogic::MapDistanceMap(const std::string &fileName)
+{
+    if(!mMappedDistanceMap.Open(fileName))
+    {
+        return false;
+    }
+    if(fabs(mMappedDistanceMap.GetSpacing() - mVoxelSpacing) > 1e-9 * mVoxelSpacing)
+    {
+        std::cerr << "The distance map " << fileName << " has voxels of " << mMappedDistanceMap.GetSpacing()
+                  << ", not of the spacing " << mVoxelSpacing << " used in refinement." << std::endl;
+        mMappedDistanceMap.Close();
+        return false;
+    }
+    if(mNormalMode == vtkImageDistanceSampler::StoredGradient && mMappedDistanceMap.GetGradient() == nullptr)
+    {
+        std::cerr << "The distance map " << fileName << " has no gradient volume for the stored gradient normals."
+                  << std::endl;
+        mMappedDistanceMap.Close();
+        return false;
+    }
+    mAntiAliasedImage = RealImage::New();
+    mGradDistImage = VectorImage::New();
+    mDistanceMapBricked = false;
+    mOctahedralNormals.clear();
+    mQuantizedDistance.clear();
+    mSparseDistanceMap = vtkSparseDistanceMap();
+    mMeshDistance.Clear();
+    UpdateDistanceSampler();
+    return true;
+}
 
-        for(auto it = mInterpolatePositions.begin(); it != mInterpolatePositions.end(); ++it)
+void vtkSlicerSkeletalRepresentationRefinerLogic::UpdateDistanceSampler()
+{
+    mDistanceSampler = nullptr;
+    mImageSampler.Clear();
+    if(mSharedDistanceMap)
+    {
+        mDistanceSampler = mSharedDistanceMap->GetSampler(mSharedObject);
+    }
+    else if(!mMeshDistance.IsEmpty())
+    {
+        mDistanceSampler = &mMeshDistance;
+    }
+    else if(!mSparseDistanceMap.IsEmpty())
+    {
+        mSparseDistanceMap.SetInterpolation(mImageSampler.GetInterpolation());
+        mDistanceSampler = &mSparseDistanceMap;
+    }
+    else if(mMappedDistanceMap.IsOpen())
+    {
+        SetImageVolumes(mMappedDistanceMap.GetDistance(), mMappedDistanceMap.GetGradient(),
+                        mMappedDistanceMap.GetOctahedralNormals(), mMappedDistanceMap.GetDimensions(),
+                        mMappedDistanceMap.GetOrigin(), mMappedDistanceMap.IsBricked());
+    }
+    else if(mAntiAliasedImage->GetBufferPointer() != nullptr)
+    {
+        RealImage::SizeType size = mAntiAliasedImage->GetBufferedRegion().GetSize();
+        const int dims[3] = {static_cast<int>(size[0]), static_cast<int>(size[1]), static_cast<int>(size[2])};
+        const double origin[3] = {mAntiAliasedImage->GetOrigin()[0], mAntiAliasedImage->GetOrigin()[1],
+                                  mAntiAliasedImage->GetOrigin()[2]};
+        SetImageVolumes(mAntiAliasedImage->GetBufferPointer(),
+                        reinterpret_cast<const float*>(mGradDistImage->GetBufferPointer()), nullptr, dims, origin,
+                        mDistanceMapBricked);
+        if(!mQuantizedDistance.empty())
         {
-            double u = (*it).first;
-            double v = (*it).second;
+            // the fixed point copy replaces the float volume
+            mAntiAliasedImage = RealImage::New();
+        }
+    }
+    else if(!mQuantizedDistance.empty())
+    {
+        SetImageVolumes(nullptr, reinterpret_cast<const float*>(mGradDistImage->GetBufferPointer()), nullptr,
+                        mQuantizedDims, mQuantizedOrigin, mDistanceMapBricked);
+    }
+}
 
-            // For each spoke at the corner of the srep,
-            // its neighbors are all spokes in one quad
-            if(r == 0 && c == 0)
-            {
-                // left-top corner
-                imageDist += TotalDistOfLeftTopSpoke(tempSrep, u, v, r, c, &normal);
-            }
-            else if(r == 0 && c == mNumCols - 1)
-            {
-                // right-top corner
-                imageDist += TotalDistOfRightTopSpoke(tempSrep, u, v, r,c, &normal);
-            }
-            else if(r == mNumRows - 1 && c == 0)
-            {
-                // left-bot corner
-                imageDist += TotalDistOfLeftBotSpoke(tempSrep, u, v, r,c, &normal);
-            }
-            else if(r == mNumRows - 1 && c == mNumCols - 1)
-            {
-                // right-bot corner
-                imageDist += TotalDistOfRightBotSpoke(tempSrep, u, v, r, c, &normal);
-            }
-            // For each spoke on the edge of the srep,
-            // its neighbors are all spokes in two quads
-            else if(r == 0)
-            {
-                // top edge in middle
-                imageDist += TotalDistOfRightTopSpoke(tempSrep, u, v, r, c, &normal);
-                imageDist += TotalDistOfLeftTopSpoke(tempSrep, u, v, r, c, &normal);
-            }
-            else if(r == mNumRows - 1)
-            {
-                // bot edge in middle
-                imageDist += TotalDistOfRightBotSpoke(tempSrep, u, v, r, c, &normal);
-                imageDist += TotalDistOfLeftBotSpoke(tempSrep, u, v, r, c, &normal);
-            }
-            else if(c == 0)
+void vtkSlicerSkeletalRepresentationRefinerLogic::SetImageVolumes(const float *dist, const float *grad,
+                                                                  const unsigned int *octahedralNormals,
+                                                                  const int *dims, const double *origin,
+                                                                  bool bricked)
+{
+    const size_t numVoxels = static_cast<size_t>(dims[0]) * static_cast<size_t>(dims[1])
+                           * static_cast<size_t>(dims[2]);
+    switch(mNormalMode)
+    {
+    case vtkImageDistanceSampler::OnDemandGradient:
+        mImageSampler.SetDistanceVolume(dist, dims, origin, mVoxelSpacing);
+        break;
+    case vtkImageDistanceSampler::OctahedralNormals:
+    {
+        if(octahedralNormals == nullptr)
+        {
+            if(mOctahedralNormals.size() != numVoxels)
             {
-                // left edge in middle
-                imageDist += TotalDistOfLeftBotSpoke(tempSrep, u, v, r, c, &normal);
-                imageDist += TotalDistOfLeftTopSpoke(tempSrep, u, v, r, c, &normal);
+                if(dist == nullptr)
+                {
+                    return;
+                }
+                mOctahedralNormals.resize(numVoxels);
+                vtkImageDistanceSampler::ComputeOctahedralNormals(dist, dims, mVoxelSpacing, bricked,
+                                                                  mOctahedralNormals.data());
             }
-            else if(c == mNumCols - 1)
+            octahedralNormals = mOctahedralNormals.data();
+        }
+        mImageSampler.SetOctahedralVolumes(dist, octahedralNormals, dims, origin, mVoxelSpacing);
+        break;
+    }
+    default:
+        if(grad == nullptr)
+        {
+            std::cerr << "The distance map has no gradient volume, it needs another normal mode." << std::endl;
+            return;
+        }
+        mImageSampler.SetVolumes(dist, grad, dims, origin, mVoxelSpacing);
+        break;
+    }
+
+    // a private fixed point copy of a mapped map would cost more memory than the shared pages it replaces
+    if(mQuantizeDistance && !mMappedDistanceMap.IsOpen())
+    {
+        if(mQuantizedDistance.size() != numVoxels)
+        {
+            if(dist == nullptr)
             {
-                // right edge in middle
-                imageDist += TotalDistOfRightBotSpoke(tempSrep, u, v, r, c, &normal);
-                imageDist += TotalDistOfRightTopSpoke(tempSrep, u, v, r, c, &normal);
+                mImageSampler.Clear();
+                return;
             }
-            // for each spoke in the middle of the srep,
-            // obtain image distance and normal from all interpolated spoke in 4 quads around it
-            else
+            // nothing in the unit cube is farther than its diagonal
+            double maxError = 0.0, rmsError = 0.0;
+            mQuantizedDistance.resize(numVoxels);
+            vtkImageDistanceSampler::QuantizeDistance(dist, numVoxels, sqrt(3.0), mQuantizedDistance.data(),
+                                                      &mDistanceScale, &mDistanceOffset, &maxError, &rmsError);
+            for(int i = 0; i < 3; ++i)
             {
-                imageDist += TotalDistOfRightBotSpoke(tempSrep, u, v, r, c, &normal);
-                imageDist += TotalDistOfRightTopSpoke(tempSrep, u, v, r, c, &normal);
-
-                imageDist += TotalDistOfLeftBotSpoke(tempSrep, u, v, r, c, &normal);
-                imageDist += TotalDistOfLeftTopSpoke(tempSrep, u, v, r, c, &normal);
+                mQuantizedDims[i] = dims[i];
+                mQuantizedOrigin[i] = origin[i];
             }
+            vtkDebugMacro(<< "Quantized distance map: step " << mDistanceScale << ", max error " << maxError
+                          << ", rms error " << rmsError << ".");
         }
-
-    }
-
-    // 2. compute srad penalty
-    srad = ComputeRSradPenalty(tempSrep);
-
-    if(mFirstCost)
-    {
-        // this log helps to adjust the weights of three terms
-        std::cout << "ImageMatch:" << imageDist << ", normal:" << normal << ", srad:" << srad << std::endl;
-        mFirstCost = false;
+        mImageSampler.SetQuantizedDistance(mQuantizedDistance.data(), mDistanceScale, mDistanceOffset);
     }
-
-    delete tempSrep;
-    return mWtImageMatch * imageDist + mWtNormalMatch * normal + mWtSrad * srad;
+    mImageSampler.SetBrickedLayout(bricked);
+    mDistanceSampler = &mImageSampler;
 }
 
-void vtkSlicerSkeletalRepresentationRefinerLogic::AntiAliasSignedDistanceMap(const std::string &meshFileName)
+void vtkSlicerSkeletalRepresentationRefinerLogic::SetMemoryMappedDistanceMaps(bool mapDistanceMaps)
 {
-    // 1. convert poly data to image data
-    vtkPolyData2ImageData polyDataConverter;
-    vtkSmartPointer<vtkImageData> img = vtkSmartPointer<vtkImageData>::New();
-
-    // this conversion already put the image into the unit-cube
-    polyDataConverter.Convert(meshFileName, img);
+    WaitForDistanceMap();
+    mMapDistanceMaps = mapDistanceMaps;
+}
 
-    vtkSmartPointer<vtkImageData> antiAliasedImage = vtkSmartPointer<vtkImageData>::New();
+void vtkSlicerSkeletalRepresentationRefinerLogic::SetDistanceMapFileName(const std::string &fileName)
+{
+    // the map from the file replaces the one being built
+    CancelDistanceMap();
+    mDistanceMapFileName = fileName;
+}
 
-    vtkApproximateSignedDistanceMap ssdGenerator;
-    ssdGenerator.Convert(img, mAntiAliasedImage);
+void vtkSlicerSkeletalRepresentationRefinerLogic::SetDistanceMapCacheDirectory(const std::string &cacheDirectory)
+{
+    WaitForDistanceMap();
+    mDistanceMapCacheDirectory = cacheDirectory;
+}
 
-    // 4. compute normals of the image everywhere
-    vtkGradientDistanceFilter gradDistFilter;
-    gradDistFilter.Filter(mAntiAliasedImage, mGradDistImage);
+void vtkSlicerSkeletalRepresentationRefinerLogic::SetDistanceMapCacheSize(unsigned long long maximumSize)
+{
+    WaitForDistanceMap();
+    mDistanceMapCacheSize = maximumSize;
 }
 
 void vtkSlicerSkeletalRepresentationRefinerLogic::TransformSrep(const std::string &headerFile)
 {
+    // the transformation only depends on the s-rep
+    if(mSrepModels.FindTransform(headerFile, mTransformationMat))
+    {
+        mHasTransformation = true;
+        return;
+    }
 
     int nRows = 0, nCols = 0;
     std::string up, down, crest;
@@ -463,6 +2023,8 @@ void vtkSlicerSkeletalRepresentationRefinerLogic::TransformSrep(const std::strin
     srep->AddSpokes(radiiCrest, dirsCrest, skeletalPointsCrest);
 
     TransformSrep2ImageCS(srep, mTransformationMat);
+    mHasTransformation = true;
+    mSrepModels.StoreTransform(headerFile, mTransformationMat);
 
 //    vtkSmartPointer<vtkPolyData> primarySpokes = vtkSmartPointer<vtkPolyData>::New();
 //    ConvertSpokes2PolyData(srep->GetAllSpokes(), primarySpokes);
@@ -677,6 +2239,7 @@ void vtkSlicerSkeletalRepresentationRefinerLogic::SaveSpokes2Vtp(std::vector<vtk
     writer->SetFileName(path.c_str());
     writer->SetInputData(output);
     writer->Update();
+    mSrepModels.Invalidate(path);
 }
 
 void vtkSlicerSkeletalRepresentationRefinerLogic::TransSpokes2PolyData(std::vector<vtkSpoke *>input, vtkPolyData *output)
@@ -778,6 +2341,57 @@ void vtkSlicerSkeletalRepresentationRefinerLogic
 void vtkSlicerSkeletalRepresentationRefinerLogic::Parse(const std::string &modelFileName, std::vector<double> &coeffArray,
                                                         std::vector<double> &radii, std::vector<double> &dirs, std::vector<double> &skeletalPoints)
 {
+    // every spoke file is read once until it changes
+    const vtkSrepFile::Spokes *spokes = mSrepModels.FindSpokes(modelFileName);
+    if(spokes == nullptr)
+    {
+        vtkSrepFile::Spokes parsed;
+        std::vector<double> coeff;
+        ReadSpokeFile(modelFileName, coeff, parsed.Radii, parsed.Directions, parsed.SkeletalPoints);
+        spokes = mSrepModels.StoreSpokes(modelFileName, parsed);
+    }
+
+    // the coefficient for radii is the exponential value, initially 0
+    const size_t numOfSpokes = spokes->Radii.size();
+    for(size_t i = 0; i < numOfSpokes; ++i)
+    {
+        coeffArray.insert(coeffArray.end(), spokes->Directions.begin() + 3 * i, spokes->Directions.begin() + 3 * i + 3);
+        coeffArray.push_back(0);
+    }
+    radii.insert(radii.end(), spokes->Radii.begin(), spokes->Radii.end());
+    dirs.insert(dirs.end(), spokes->Directions.begin(), spokes->Directions.end());
+    skeletalPoints.insert(skeletalPoints.end(), spokes->SkeletalPoints.begin(), spokes->SkeletalPoints.end());
+}
+
+void vtkSlicerSkeletalRepresentationRefinerLogic::ReadSpokeFile(const std::string &modelFileName,
+                                                                std::vector<double> &coeffArray,
+                                                                std::vector<double> &radii, std::vector<double> &dirs,
+                                                                std::vector<double> &skeletalPoints)
+{
+    // one side of a container, only its sections are read
+    std::string containerFileName;
+    int side = 0;
+    if(vtkSrepFile::SplitSideFileName(modelFileName, &containerFileName, &side))
+    {
+        vtkSrepFile srepFile;
+        if(!srepFile.Open(containerFileName))
+        {
+            return;
+        }
+        const size_t numOfSpokes = srepFile.GetNumberOfSpokes(side);
+        const double *spokeRadii = srepFile.GetSection(side, vtkSrepFile::Radii);
+        const double *spokeDirs = srepFile.GetSection(side, vtkSrepFile::Directions);
+        const double *spokePoints = srepFile.GetSection(side, vtkSrepFile::SkeletalPoints);
+        for(size_t i = 0; i < numOfSpokes; ++i)
+        {
+            coeffArray.insert(coeffArray.end(), spokeDirs + 3 * i, spokeDirs + 3 * i + 3);
+            coeffArray.push_back(0);
+        }
+        radii.insert(radii.end(), spokeRadii, spokeRadii + numOfSpokes);
+        dirs.insert(dirs.end(), spokeDirs, spokeDirs + 3 * numOfSpokes);
+        skeletalPoints.insert(skeletalPoints.end(), spokePoints, spokePoints + 3 * numOfSpokes);
+        return;
+    }
 
     vtkSmartPointer<vtkXMLPolyDataReader> reader = vtkSmartPointer<vtkXMLPolyDataReader>::New();
     reader->SetFileName(modelFileName.c_str());
@@ -828,6 +2442,43 @@ void vtkSlicerSkeletalRepresentationRefinerLogic::ParseHeader(const std::string
                                                                double *shift, std::string* upFileName,
                                                               std::string* downFileName, std::string* crestFileName)
 {
+    // every header is read once until it changes
+    const vtkSrepModelCache::Header *header = mSrepModels.FindHeader(headerFileName);
+    if(header == nullptr)
+    {
+        vtkSrepModelCache::Header parsed;
+        ReadHeaderFile(headerFileName, &parsed.NumRows, &parsed.NumCols, &parsed.CrestShift, &parsed.UpFileName,
+                       &parsed.DownFileName, &parsed.CrestFileName);
+        header = mSrepModels.StoreHeader(headerFileName, parsed);
+    }
+    *nRows = header->NumRows;
+    *nCols = header->NumCols;
+    *shift = header->CrestShift;
+    *upFileName = header->UpFileName;
+    *downFileName = header->DownFileName;
+    *crestFileName = header->CrestFileName;
+}
+
+void vtkSlicerSkeletalRepresentationRefinerLogic::ReadHeaderFile(const std::string &headerFileName, int *nRows,
+                                                                 int *nCols, double *shift, std::string* upFileName,
+                                                                 std::string* downFileName, std::string* crestFileName)
+{
+    // only the fixed header of a container is read here, Parse reads the spokes of each side
+    if(vtkSrepFile::IsSrepFile(headerFileName))
+    {
+        vtkSrepFile srepFile;
+        if(srepFile.Open(headerFileName))
+        {
+            *nRows = srepFile.GetNumberOfRows();
+            *nCols = srepFile.GetNumberOfColumns();
+            *shift = srepFile.GetCrestShift();
+            *upFileName = vtkSrepFile::GetSideFileName(headerFileName, vtkSrepFile::Up);
+            *downFileName = vtkSrepFile::GetSideFileName(headerFileName, vtkSrepFile::Down);
+            *crestFileName = vtkSrepFile::GetSideFileName(headerFileName, vtkSrepFile::Crest);
+        }
+        return;
+    }
+
     vtkSmartPointer<vtkXMLDataParser> parser = vtkSmartPointer<vtkXMLDataParser>::New();
 
     parser->SetFileName(headerFileName.c_str());
@@ -902,6 +2553,23 @@ void vtkSlicerSkeletalRepresentationRefinerLogic::UpdateHeader(const string &hea
                                                                const string &outputFilePath,
                                                                std::string *newHeaderFileName)
 {
+    // the refined up and down spokes of a container are .vtp files next to the new XML header,
+    // its crest spokes stay in the container
+    if(vtkSrepFile::IsSrepFile(headerFileName))
+    {
+        int nRows = 0, nCols = 0;
+        double crestShift = 0.0;
+        std::string up, down, crest;
+        const std::string fullHeaderFileName = vtksys::SystemTools::CollapseFullPath(headerFileName);
+        ParseHeader(fullHeaderFileName, &nRows, &nCols, &crestShift, &up, &down, &crest);
+        *newHeaderFileName = outputFilePath + newFilePrefix
+                + vtksys::SystemTools::GetFilenameWithoutLastExtension(headerFileName) + ".xml";
+        WriteHeaderFile(*newHeaderFileName, nRows, nCols, crestShift, RefinedFileName(outputFilePath, up),
+                        RefinedFileName(outputFilePath, down), crest);
+        mSrepModels.Invalidate(*newHeaderFileName);
+        return;
+    }
+
     vtkSmartPointer<vtkXMLDataParser> parser = vtkSmartPointer<vtkXMLDataParser>::New();
 
     parser->SetFileName(headerFileName.c_str());
@@ -959,31 +2627,11 @@ void vtkSlicerSkeletalRepresentationRefinerLogic::UpdateHeader(const string &hea
             }
 
         }
-        std::stringstream output;
-
-        output<<"<s-rep>"<<std::endl;
-        output<<"  <nRows>"<<nRows<<"</nRows>"<<std::endl;
-        output<<"  <nCols>"<<nCols<<"</nCols>"<<std::endl;
-        output<<"  <meshType>Quad</meshType>"<< std::endl;
-        output<<"  <color>"<<std::endl;
-        output<<"    <red>0</red>"<<std::endl;
-        output<<"    <green>0.5</green>"<<std::endl;
-        output<<"    <blue>0</blue>"<<std::endl;
-        output<<"  </color>"<<std::endl;
-        output<<"  <isMean>False</isMean>"<<std::endl;
-        output<<"  <meanStatPath/>"<<std::endl;
-        output<<"  <upSpoke>"<< newUpFileName<<"</upSpoke>"<<std::endl;
-        output<<"  <downSpoke>"<< newDownFileName << "</downSpoke>"<<std::endl;
-        output<<"  <crestSpoke>"<< newCrestFileName << "</crestSpoke>"<<std::endl;
-        output<<"</s-rep>"<<std::endl;
-
         std::string oldHeader = vtksys::SystemTools::GetFilenameName(headerFileName);
         oldHeader = outputFilePath + newFilePrefix + oldHeader;
         std::string header_file(oldHeader);
-        std::ofstream out_file;
-        out_file.open(header_file);
-        out_file << output.rdbuf();
-        out_file.close();
+        WriteHeaderFile(header_file, nRows, nCols, 0.0, newUpFileName, newDownFileName, newCrestFileName);
+        mSrepModels.Invalidate(header_file);
         *newHeaderFileName = header_file;
     }
 }
@@ -995,73 +2643,6 @@ void vtkSlicerSkeletalRepresentationRefinerLogic::ComputeDiff(double *head, doub
     output[2] = factor * (head[2] - tail[2]);
 }
 
-double vtkSlicerSkeletalRepresentationRefinerLogic::ComputeDistance(vtkSpoke *theSpoke, double *normalMatch)
-{
-    // 1. Transform the boundary point to image cs. by applying [x, y, z, 1] * mTransformationMat
-    double pt[3];
-    theSpoke->GetBoundaryPoint(pt);
-
-    pt[0] = pt[0] * mTransformationMat[0][0] + mTransformationMat[3][0];
-    pt[1] = pt[1] * mTransformationMat[1][1] + mTransformationMat[3][1];
-    pt[2] = pt[2] * mTransformationMat[2][2] + mTransformationMat[3][2];
-
-    pt[0] /= voxelSpacing;
-    pt[1] /= voxelSpacing;
-    pt[2] /= voxelSpacing;
-
-    int x = static_cast<int>(pt[0]+0.5);
-    int y = static_cast<int>(pt[1]+0.5);
-    int z = static_cast<int>(pt[2]+0.5);
-
-    int maxX = static_cast<int>(1 / voxelSpacing - 1);
-    int maxY = static_cast<int>(1 / voxelSpacing - 1);
-    int maxZ = static_cast<int>(1 / voxelSpacing - 1);
-
-    if(x > maxX) x = maxX;
-    if(y > maxY) y = maxY;
-    if(z > maxZ) z = maxZ;
-
-    if(x < 0) x = 0;
-    if(y < 0) y = 0;
-    if(z < 0) z = 0;
-
-    if(mAntiAliasedImage == nullptr)
-    {
-        std::cerr << "The image in this RefinerLogic instance is empty." << std::endl;
-        return -10000.0;
-    }
-    RealImage::IndexType pixelIndex = {{x,y,z}};
-    float dist = mAntiAliasedImage->GetPixel(pixelIndex);
-
-    if(mGradDistImage == nullptr)
-    {
-        return -10000.0;
-    }
-
-    VectorImage::IndexType indexGrad;
-    indexGrad[0] = x;
-    indexGrad[1] = y;
-    indexGrad[2] = z;
-
-    VectorImage::PixelType grad = mGradDistImage->GetPixel(indexGrad);
-    double normalVector[3];
-    normalVector[0] = static_cast<double>(grad[0]);
-    normalVector[1] = static_cast<double>(grad[1]);
-    normalVector[2] = static_cast<double>(grad[2]);
-    // normalize the normal vector
-    vtkMath::Normalize(normalVector);
-
-    double spokeDir[3];
-    theSpoke->GetDirection(spokeDir);
-    double dotProduct = vtkMath::Dot(normalVector, spokeDir);
-    double distSqr = static_cast<double>(dist * dist);
-
-    // The normal match (between [0,1]) is scaled by the distance so that the overall term is comparable
-    *normalMatch = *normalMatch + distSqr * (1 - dotProduct);
-    // return square of distance
-    return distSqr;
-}
-
 void vtkSlicerSkeletalRepresentationRefinerLogic::Visualize(vtkPolyData *model, const std::string &modelName,
                                                             double r, double g, double b, bool isVisible)
 {
@@ -1528,11 +3109,27 @@ void vtkSlicerSkeletalRepresentationRefinerLogic::ConnectFoldCurve(const std::ve
     }
 }
 
-void vtkSlicerSkeletalRepresentationRefinerLogic::RefinePartOfSpokes(const string &srepFileName, double stepSize, double endCriterion, int maxIter)
+void vtkSlicerSkeletalRepresentationRefinerLogic::RefinePartOfSpokes(const string &srepFileName, double stepSize, double endCriterion,
+                                                                     int maxIter, const std::string &refinedFileName, bool isLocal)
 {
+    std::vector<double> coeff, radii, dirs, skeletalPoints;
+    Parse(srepFileName, coeff, radii, dirs, skeletalPoints);
+    RefineSpokes(radii, dirs, skeletalPoints, stepSize, endCriterion, maxIter, refinedFileName, isLocal);
+}
+
+void vtkSlicerSkeletalRepresentationRefinerLogic::RefineSpokes(std::vector<double> &radii, std::vector<double> &dirs,
+                                                               std::vector<double> &skeletalPoints, double stepSize,
+                                                               double endCriterion, int maxIter,
+                                                               const std::string &refinedFileName, bool isLocal)
+{
+    // the coefficient for radii is the exponential value, initially 0
     mCoeffArray.clear();
-    std::vector<double> radii, dirs, skeletalPoints;
-    Parse(srepFileName, mCoeffArray, radii, dirs, skeletalPoints);
+    for(size_t i = 0; i < radii.size(); ++i)
+    {
+        mCoeffArray.insert(mCoeffArray.end(), dirs.begin() + static_cast<long>(3 * i),
+                           dirs.begin() + static_cast<long>(3 * i + 3));
+        mCoeffArray.push_back(0);
+    }
 
     vtkSrep *srep = new vtkSrep(mNumRows, mNumCols, radii, dirs, skeletalPoints);
     if(srep->IsEmpty())
@@ -1544,38 +3141,85 @@ void vtkSlicerSkeletalRepresentationRefinerLogic::RefinePartOfSpokes(const strin
     }
 
     // total number of parameters that need to optimize
-    size_t paramDim = mCoeffArray.size();
+    if(!ResolveFreeSpokes(mNumRows, mNumCols))
+    {
+        delete srep;
+        return;
+    }
+    size_t paramDim = mFreeIndices.empty() ? mCoeffArray.size() : mFreeIndices.size() * 4;
     double coeff[paramDim];
-    for(size_t i = 0; i < paramDim; ++i)
+    if(mFreeIndices.empty())
+    {
+        for(size_t i = 0; i < paramDim; ++i)
+        {
+            coeff[i] = mCoeffArray[i];
+        }
+    }
+    else
     {
-        coeff[i] = mCoeffArray[i];
+        for(size_t i = 0; i < mFreeIndices.size(); ++i)
+        {
+            size_t idxFull = static_cast<size_t>(mFreeIndices[i]) * 4;
+            coeff[i * 4] = mCoeffArray[idxFull];
+            coeff[i * 4 + 1] = mCoeffArray[idxFull + 1];
+            coeff[i * 4 + 2] = mCoeffArray[idxFull + 2];
+            coeff[i * 4 + 3] = mCoeffArray[idxFull + 3];
+        }
     }
 
     mSrep = srep;
-    vtkSmartPointer<vtkPolyData> origSrep = vtkSmartPointer<vtkPolyData>::New();
-    ConvertSpokes2PolyData(srep->GetAllSpokes(), origSrep);
+    UpdateInterpolationTable(srep);
+    if(!isLocal)
+    {
+        vtkSmartPointer<vtkPolyData> origSrep = vtkSmartPointer<vtkPolyData>::New();
+        ConvertSpokes2PolyData(srep->GetAllSpokes(), origSrep);
 
-    Visualize(origSrep, "Before refinement", 1, 0, 0);
+        Visualize(origSrep, "Before refinement", 1, 0, 0);
+    }
 
     mFirstCost = true;
+    mMaxDeviation = 0.0;
+    mSumDeviation = 0.0;
+    mNumValidations = 0;
+    if(mSinglePrecision)
+    {
+        std::cout << "Single precision kernels: " << vtkSrepKernelDispatch::GetName() << std::endl;
+    }
     // 2. Invoke newuoa to optimize
     min_newuoa(static_cast<int>(paramDim), coeff, *this, stepSize, endCriterion, maxIter);
 
+    if(mSinglePrecision)
+    {
+        if(mValidatePrecision && mNumValidations > 0)
+        {
+            std::cout << "Single precision objective: max relative deviation " << mMaxDeviation
+                      << ", mean " << mSumDeviation / mNumValidations
+                      << " over " << mNumValidations << " evaluations." << std::endl;
+        }
+        // polish the single precision optimum in double precision
+        mSinglePrecision = false;
+        double polishStep = std::max(0.1 * stepSize, endCriterion);
+        int polishIter = std::min(maxIter, std::max(maxIter / 10, static_cast<int>(2 * paramDim + 2)));
+        min_newuoa(static_cast<int>(paramDim), coeff, *this, polishStep, endCriterion, polishIter);
+        mSinglePrecision = true;
+    }
+
+    // scatter the coefficients of free spokes back to the whole array
+    std::vector<double> fullCoeff;
+    ExpandCoefficients(mCoeffArray, coeff, fullCoeff);
+
     // Re-evaluate the cost
     mFirstCost = true;
-    EvaluateObjectiveFunction(coeff);
+    EvaluateObjectiveFunction(fullCoeff.data());
 
     // 3. Visualize the refined srep
-    srep->Refine(coeff);
+    srep->Refine(fullCoeff.data());
     vtkSmartPointer<vtkPolyData> refinedSrep = vtkSmartPointer<vtkPolyData>::New();
     ConvertSpokes2PolyData(srep->GetAllSpokes(), refinedSrep);
-    Visualize(refinedSrep, "Refined", 0, 1, 1);
+    Visualize(refinedSrep, isLocal ? "Locally refined" : "Refined", 0, 1, 1);
 
     // write to vtp file
-    std::string outputFile(mOutputPath);
-    std::string fileName = vtksys::SystemTools::GetFilenameName(srepFileName);
-    outputFile = outputFile + newFilePrefix + fileName;
-    SaveSpokes2Vtp(srep->GetAllSpokes(), outputFile);
+    SaveSpokes2Vtp(srep->GetAllSpokes(), refinedFileName);
     if(mSrep != nullptr)
     {
         delete mSrep;
@@ -1583,440 +3227,112 @@ void vtkSlicerSkeletalRepresentationRefinerLogic::RefinePartOfSpokes(const strin
     }
 }
 
-double vtkSlicerSkeletalRepresentationRefinerLogic::TotalDistOfLeftTopSpoke(vtkSrep *tempSrep,
-                                                                            double u, double v,
-                                                                            int r, int c,
-                                                                            double *normalMatch)
-{
-    vtkSlicerSkeletalRepresentationInterpolater interpolater;
-    vtkSpoke *cornerSpokes[4];
-    double imageDist = 0.0;
-    cornerSpokes[0] = tempSrep->GetSpoke(r, c);
-    cornerSpokes[1] = tempSrep->GetSpoke(r+1, c);
-    cornerSpokes[2] = tempSrep->GetSpoke(r+1, c+1);
-    cornerSpokes[3] = tempSrep->GetSpoke(r, c+1);
-    double  dXdu11[3], dXdv11[3],
-            dXdu12[3], dXdv12[3],
-            dXdu21[3], dXdv21[3],
-            dXdu22[3], dXdv22[3];
-    std::vector<double> skeletalPts = tempSrep->GetAllSkeletalPoints();
-    int nRows = tempSrep->GetNumRows();
-    int nCols = tempSrep->GetNumCols();
-    ComputeDerivative(skeletalPts, r, c, nRows, nCols, dXdu11, dXdv11);
-    ComputeDerivative(skeletalPts, r+1, c, nRows, nCols, dXdu21, dXdv21);
-    ComputeDerivative(skeletalPts, r+1, c+1, nRows, nCols, dXdu22, dXdv22);
-    ComputeDerivative(skeletalPts, r, c+1, nRows, nCols, dXdu12, dXdv12);
-
-    interpolater.SetCornerDxdu(dXdu11,
-                               dXdu21,
-                               dXdu22,
-                               dXdu12);
-    interpolater.SetCornerDxdv(dXdv11,
-                               dXdv21,
-                               dXdv22,
-                               dXdv12);
-    vtkSpoke interpolatedSpoke;
-    interpolater.Interpolate(u, v, cornerSpokes, &interpolatedSpoke);
-
-    // compute the ssd for this interpolated spoke
-    imageDist += ComputeDistance(&interpolatedSpoke, normalMatch);
-
-    return imageDist;
-}
-
-double vtkSlicerSkeletalRepresentationRefinerLogic::TotalDistOfRightTopSpoke(vtkSrep *tempSrep,
-                                                                             double u, double v,
-                                                                             int r, int c,
-                                                                             double *normalMatch)
-{
-    vtkSlicerSkeletalRepresentationInterpolater interpolater;
-    vtkSpoke *cornerSpokes[4];
-    double imageDist = 0.0;
-    cornerSpokes[0] = tempSrep->GetSpoke(r, c-1);
-    cornerSpokes[1] = tempSrep->GetSpoke(r+1, c-1);
-    cornerSpokes[2] = tempSrep->GetSpoke(r+1, c);
-    cornerSpokes[3] = tempSrep->GetSpoke(r, c);
-    double  dXdu11[3], dXdv11[3],
-            dXdu12[3], dXdv12[3],
-            dXdu21[3], dXdv21[3],
-            dXdu22[3], dXdv22[3];
-    std::vector<double> skeletalPts = tempSrep->GetAllSkeletalPoints();
-    int nRows = tempSrep->GetNumRows();
-    int nCols = tempSrep->GetNumCols();
-    ComputeDerivative(skeletalPts, r, c-1, nRows, nCols, dXdu11, dXdv11);
-    ComputeDerivative(skeletalPts, r+1, c-1, nRows, nCols, dXdu21, dXdv21);
-    ComputeDerivative(skeletalPts, r+1, c, nRows, nCols, dXdu22, dXdv22);
-    ComputeDerivative(skeletalPts, r, c, nRows, nCols, dXdu12, dXdv12);
-
-    interpolater.SetCornerDxdu(dXdu11,
-                               dXdu21,
-                               dXdu22,
-                               dXdu12);
-    interpolater.SetCornerDxdv(dXdv11,
-                               dXdv21,
-                               dXdv22,
-                               dXdv12);
-    vtkSpoke interpolatedSpoke;
-    interpolater.Interpolate(u, v, cornerSpokes, &interpolatedSpoke);
-
-    // compute the ssd & normal match for this interpolated spoke
-    imageDist += ComputeDistance(&interpolatedSpoke, normalMatch);
-    return imageDist;
-}
-
-double vtkSlicerSkeletalRepresentationRefinerLogic::TotalDistOfLeftBotSpoke(vtkSrep *tempSrep,
-                                                                            double u, double v,
-                                                                            int r, int c,
-                                                                            double *normalMatch)
+void vtkSlicerSkeletalRepresentationRefinerLogic::ComputeInterpolatePositions(int interpolationLevel)
 {
-    vtkSlicerSkeletalRepresentationInterpolater interpolater;
-    vtkSpoke *cornerSpokes[4];
-    double imageDist = 0.0;
-    cornerSpokes[0] = tempSrep->GetSpoke(r-1, c);
-    cornerSpokes[1] = tempSrep->GetSpoke(r, c);
-    cornerSpokes[2] = tempSrep->GetSpoke(r, c+1);
-    cornerSpokes[3] = tempSrep->GetSpoke(r-1, c+1);
-    double  dXdu11[3], dXdv11[3],
-            dXdu12[3], dXdv12[3],
-            dXdu21[3], dXdv21[3],
-            dXdu22[3], dXdv22[3];
-    std::vector<double> skeletalPts = tempSrep->GetAllSkeletalPoints();
-    int nRows = tempSrep->GetNumRows();
-    int nCols = tempSrep->GetNumCols();
-    ComputeDerivative(skeletalPts, r-1, c, nRows, nCols, dXdu11, dXdv11);
-    ComputeDerivative(skeletalPts, r, c, nRows, nCols, dXdu21, dXdv21);
-    ComputeDerivative(skeletalPts, r, c+1, nRows, nCols, dXdu22, dXdv22);
-    ComputeDerivative(skeletalPts, r-1, c+1, nRows, nCols, dXdu12, dXdv12);
-
-    interpolater.SetCornerDxdu(dXdu11,
-                               dXdu21,
-                               dXdu22,
-                               dXdu12);
-    interpolater.SetCornerDxdv(dXdv11,
-                               dXdv21,
-                               dXdv22,
-                               dXdv12);
-    vtkSpoke interpolatedSpoke;
-    interpolater.Interpolate(u, v, cornerSpokes, &interpolatedSpoke);
-
-    // compute the ssd for this interpolated spoke
-    imageDist += ComputeDistance(&interpolatedSpoke, normalMatch);
-    return imageDist;
-}
-
-double vtkSlicerSkeletalRepresentationRefinerLogic::TotalDistOfRightBotSpoke(vtkSrep *tempSrep,
-                                                                             double u, double v,
-                                                                             int r, int c,
-                                                                             double *normalMatch)
+    mInterpolatePositions.clear();
+    mInterpolationTables.clear();
+    double tol = 1e-6;
+    int shares = static_cast<int>(pow(2, interpolationLevel));
+    double interval = double(1.0 / shares);
+    for(int i = 0; i <= shares; ++i)
+    {
+        for(int j = 0; j <= shares; ++j)
+        {
+            double u = i * interval;
+            double v = j * interval;
+            // no interpolation at corners
+            if((abs(u) < tol && abs(v) < tol) || (abs(u) < tol && abs(v-1) < tol)
+                    || (abs(u-1) < tol && abs(v) < tol) || (abs(u-1) < tol && abs(v-1) < tol))
+                continue;
+            std::pair<double, double> uv = make_pair(u, v);
+            mInterpolatePositions.push_back(uv);
+        }
+    }
+    if(interpolationLevel == 0)
+    {
+        mInterpolatePositions.push_back(std::pair<double, double>(0, 0));
+    }
+}
+
+bool vtkSlicerSkeletalRepresentationRefinerLogic::ResolveFreeSpokes(int nRows, int nCols)
 {
-    vtkSlicerSkeletalRepresentationInterpolater interpolater;
-    vtkSpoke *cornerSpokes[4];
-    double imageDist = 0.0;
-    cornerSpokes[0] = tempSrep->GetSpoke(r-1, c-1);
-    cornerSpokes[1] = tempSrep->GetSpoke(r, c-1);
-    cornerSpokes[2] = tempSrep->GetSpoke(r, c);
-    cornerSpokes[3] = tempSrep->GetSpoke(r-1, c);
-    double  dXdu11[3], dXdv11[3],
-            dXdu12[3], dXdv12[3],
-            dXdu21[3], dXdv21[3],
-            dXdu22[3], dXdv22[3];
-    std::vector<double> skeletalPts = tempSrep->GetAllSkeletalPoints();
-    int nRows = tempSrep->GetNumRows();
-    int nCols = tempSrep->GetNumCols();
-    ComputeDerivative(skeletalPts, r-1, c-1, nRows, nCols, dXdu11, dXdv11);
-    ComputeDerivative(skeletalPts, r, c-1, nRows, nCols, dXdu21, dXdv21);
-    ComputeDerivative(skeletalPts, r, c, nRows, nCols, dXdu22, dXdv22);
-    ComputeDerivative(skeletalPts, r-1, c, nRows, nCols, dXdu12, dXdv12);
-
-    interpolater.SetCornerDxdu(dXdu11,
-                               dXdu21,
-                               dXdu22,
-                               dXdu12);
-    interpolater.SetCornerDxdv(dXdv11,
-                               dXdv21,
-                               dXdv22,
-                               dXdv12);
-    vtkSpoke interpolatedSpoke;
-    interpolater.Interpolate(u, v, cornerSpokes, &interpolatedSpoke);
-
-    // compute the ssd for this interpolated spoke
-    imageDist += ComputeDistance(&interpolatedSpoke, normalMatch);
-    return imageDist;
-}
-
-double vtkSlicerSkeletalRepresentationRefinerLogic::ComputeRSradPenalty(vtkSrep *input)
-{
-    double penalty = 0.0;
-    // Interpolate
-    if(input->IsEmpty())
+    mFreeIndices.clear();
+    mIsFreeSpoke.clear();
+    mIsActiveSpoke.clear();
+    if(nRows <= 0 || nCols <= 0)
     {
-        std::cerr << "The s-rep model is empty in computing rSrad." << std::endl;
-        return 0.0;
+        return false;
     }
-    // 1.1 interpolate and visualize for verification
-    // collect neighboring spokes around corners
-    vtkSlicerSkeletalRepresentationInterpolater interpolater;
-    int nRows = input->GetNumRows();
-    int nCols = input->GetNumCols();
 
-    std::vector<vtkSpoke*> interpolatedSpokes;
-    std::vector<vtkSpoke*> primarySpokes;
-    for(int r = 0; r < nRows; ++r)
+    size_t numSpokes = static_cast<size_t>(nRows * nCols);
+    std::vector<bool> isFree(numSpokes, false);
+    bool hasSelection = false;
+    for(size_t i = 0; i < mFreeSpokeIds.size(); ++i)
     {
-        for(int c = 0; c < nCols; ++c)
+        int id = mFreeSpokeIds[i];
+        if(id < 0 || id >= nRows * nCols)
         {
-            vtkSpoke* thisSpoke = input->GetSpoke(r, c);
-
-            std::vector<vtkSpoke*> neighborU, neighborV;
-            if(r == 0 && c == 0)
-            {
-                // top left corner
-                FindTopLeftNeigbors(r, c, input, neighborU, neighborV);
-                thisSpoke->SetNeighborU(neighborU, true);
-                thisSpoke->SetNeighborV(neighborV, true);
-            }
-            else if(r == 0 && c == nCols - 1)
-            {
-                // top right corner
-                FindTopRightNeigbors(r, c, input, neighborU, neighborV);
-                thisSpoke->SetNeighborU(neighborU, true);
-                thisSpoke->SetNeighborV(neighborV, false);
-            }
-            else if(r == 0)
-            {
-                // top edge
-                FindTopRightNeigbors(r, c, input, neighborU, neighborV);
-                FindTopLeftNeigbors(r, c, input, neighborU, neighborV);
-                neighborU.pop_back();
-                thisSpoke->SetNeighborU(neighborU, true);
-                thisSpoke->SetNeighborV(neighborV, false);
-            }
-            else if(r == nRows - 1 && c == 0)
-            {
-                // left bot corner
-                FindBotLeftNeigbors(r, c, input, neighborU, neighborV);
-                thisSpoke->SetNeighborU(neighborU, false);
-                thisSpoke->SetNeighborV(neighborV, true);
-            }
-            else if(r == nRows - 1 && c == nCols -1)
-            {
-                // right bot corner
-                FindBotRightNeigbors(r, c, input, neighborU, neighborV);
-                thisSpoke->SetNeighborU(neighborU, false);
-                thisSpoke->SetNeighborV(neighborV, false);
-            }
-            else if(r == nRows - 1)
+            std::cerr << "Free spoke " << id << " is out of the s-rep grid." << std::endl;
+            continue;
+        }
+        isFree[static_cast<size_t>(id)] = true;
+        hasSelection = true;
+    }
+    if(mFreeSpokeRange[0] >= 0)
+    {
+        int rowEnd = std::min(mFreeSpokeRange[1], nRows - 1);
+        int colEnd = std::min(mFreeSpokeRange[3], nCols - 1);
+        for(int r = std::max(mFreeSpokeRange[0], 0); r <= rowEnd; ++r)
+        {
+            for(int c = std::max(mFreeSpokeRange[2], 0); c <= colEnd; ++c)
             {
-                // bot edge
-                FindBotRightNeigbors(r, c, input, neighborU, neighborV);
-                FindBotLeftNeigbors(r, c, input, neighborU, neighborV);
-                neighborU.pop_back();
-                thisSpoke->SetNeighborU(neighborU, false);
-                thisSpoke->SetNeighborV(neighborV, false);
+                isFree[static_cast<size_t>(r * nCols + c)] = true;
+                hasSelection = true;
             }
-            else if(c == 0)
+        }
+    }
+    if(!hasSelection)
+    {
+        if(!mFreeSpokeIds.empty() || mFreeSpokeRange[0] >= 0)
+        {
+            std::cerr << "None of the selected free spokes is in the s-rep grid." << std::endl;
+            return false;
+        }
+        // refine all spokes
+        return true;
+    }
+
+    // a free spoke changes the interpolated spokes in 4 quads around it,
+    // which are sampled by (and are rSrad neighbors of) the spokes in its one-ring
+    std::vector<bool> isActive(numSpokes, false);
+    for(int r = 0; r < nRows; ++r)
+    {
+        for(int c = 0; c < nCols; ++c)
+        {
+            if(!isFree[static_cast<size_t>(r * nCols + c)])
             {
-                // left edge
-                FindBotLeftNeigbors(r, c, input, neighborU, neighborV);
-                FindTopLeftNeigbors(r, c, input, neighborU, neighborV);
-                neighborV.pop_back();
-                thisSpoke->SetNeighborU(neighborU, false);
-                thisSpoke->SetNeighborV(neighborV, true);
+                continue;
             }
-            else if(c == nCols - 1)
+            mFreeIndices.push_back(r * nCols + c);
+            for(int nr = std::max(r - 1, 0); nr <= std::min(r + 1, nRows - 1); ++nr)
             {
-                // right edge
-                FindBotRightNeigbors(r, c, input, neighborU, neighborV);
-                FindTopRightNeigbors(r, c, input, neighborU, neighborV);
-                neighborV.pop_back();
-                thisSpoke->SetNeighborU(neighborU, false);
-                thisSpoke->SetNeighborV(neighborV, false);
-            }
-            else {
-                // interior
-                FindBotRightNeigbors(r, c, input, neighborU, neighborV);
-                FindTopLeftNeigbors(r, c, input, neighborU, neighborV);
-                thisSpoke->SetNeighborU(neighborU, false);
-                thisSpoke->SetNeighborV(neighborV, false);
+                for(int nc = std::max(c - 1, 0); nc <= std::min(c + 1, nCols - 1); ++nc)
+                {
+                    isActive[static_cast<size_t>(nr * nCols + nc)] = true;
+                }
             }
-
-            primarySpokes.push_back(thisSpoke);
         }
-
     }
-
-    //compute the penalty
-    double step = mInterpolatePositions[0].second;
-    for(size_t i = 0; i < primarySpokes.size(); ++i)
-    {
-        double thisPenalty = primarySpokes[i]->GetRSradPenalty(step);
-        penalty += thisPenalty;
-    }
-    return penalty;
+    mIsFreeSpoke = isFree;
+    mIsActiveSpoke = isActive;
+    return true;
 }
 
-void vtkSlicerSkeletalRepresentationRefinerLogic::FindTopLeftNeigbors(int r, int c,
-                                                               vtkSrep* input,
-                                                               std::vector<vtkSpoke *> &neighborU,
-                                                               std::vector<vtkSpoke *> &neighborV)
-{
-    vtkSlicerSkeletalRepresentationInterpolater interpolater;
-    int nRows = input->GetNumRows();
-    int nCols = input->GetNumCols();
-    vtkSpoke *cornerSpokes[4];
-
-    double  dXdu11[3], dXdv11[3],
-            dXdu12[3], dXdv12[3],
-            dXdu21[3], dXdv21[3],
-            dXdu22[3], dXdv22[3];
-    cornerSpokes[0] = input->GetSpoke(r, c);
-    cornerSpokes[1] = input->GetSpoke(r+1, c);
-    cornerSpokes[2] = input->GetSpoke(r+1, c+1);
-    cornerSpokes[3] = input->GetSpoke(r, c+ 1);
-    std::vector<double> skeletalPts = input->GetAllSkeletalPoints();
-    ComputeDerivative(skeletalPts, r, c, nRows, nCols, dXdu11, dXdv11);
-    ComputeDerivative(skeletalPts, r+1, c, nRows, nCols, dXdu21, dXdv21);
-    ComputeDerivative(skeletalPts, r, c+1, nRows, nCols, dXdu12, dXdv12);
-    ComputeDerivative(skeletalPts, r+1, c+1, nRows, nCols, dXdu22, dXdv22);
-
-    interpolater.SetCornerDxdu(dXdu11,
-                               dXdu21,
-                               dXdu22,
-                               dXdu12);
-    interpolater.SetCornerDxdv(dXdv11,
-                               dXdv21,
-                               dXdv22,
-                               dXdv12);
-
-    vtkSpoke* in1 = new vtkSpoke;
-    vtkSpoke* in2 = new vtkSpoke;
-    double stepV = mInterpolatePositions[0].second;
-    double stepU = stepV;
-    interpolater.Interpolate(stepU, 0, cornerSpokes, in1);
-    neighborU.push_back(in1);
-    interpolater.Interpolate(0, stepV, cornerSpokes, in2);
-    neighborV.push_back(in2);
-}
-
-void vtkSlicerSkeletalRepresentationRefinerLogic::FindTopRightNeigbors(int r, int c, vtkSrep *input, std::vector<vtkSpoke *> &neighborU, std::vector<vtkSpoke *> &neighborV)
-{
-    vtkSlicerSkeletalRepresentationInterpolater interpolater;
-    int nRows = input->GetNumRows();
-    int nCols = input->GetNumCols();
-    vtkSpoke *cornerSpokes[4];
-    std::vector<double> skeletalPts = input->GetAllSkeletalPoints();
-    double  dXdu11[3], dXdv11[3],
-            dXdu12[3], dXdv12[3],
-            dXdu21[3], dXdv21[3],
-            dXdu22[3], dXdv22[3];
-    cornerSpokes[0] = input->GetSpoke(r, c- 1);
-    cornerSpokes[1] = input->GetSpoke(r+1, c-1);
-    cornerSpokes[2] = input->GetSpoke(r+1, c);
-    cornerSpokes[3] = input->GetSpoke(r, c);
-    ComputeDerivative(skeletalPts, r, c-1, nRows, nCols, dXdu11, dXdv11);
-    ComputeDerivative(skeletalPts, r+1, c-1, nRows, nCols, dXdu21, dXdv21);
-    ComputeDerivative(skeletalPts, r+1, c, nRows, nCols, dXdu12, dXdv12);
-    ComputeDerivative(skeletalPts, r, c, nRows, nCols, dXdu22, dXdv22);
-
-    interpolater.SetCornerDxdu(dXdu11,
-                               dXdu21,
-                               dXdu22,
-                               dXdu12);
-    interpolater.SetCornerDxdv(dXdv11,
-                               dXdv21,
-                               dXdv22,
-                               dXdv12);
-
-    vtkSpoke* in1 = new vtkSpoke;
-    vtkSpoke* in2 = new vtkSpoke;
-    double stepV = mInterpolatePositions[0].second;
-    double stepU = stepV;
-    interpolater.Interpolate(stepU, 1, cornerSpokes, in1);
-    neighborU.push_back(in1);
-    interpolater.Interpolate(0, 1-stepV, cornerSpokes, in2);
-    neighborV.push_back(in2);
-}
-
-void vtkSlicerSkeletalRepresentationRefinerLogic::FindBotLeftNeigbors(int r, int c,
-                                                                      vtkSrep *input,
-                                                                      std::vector<vtkSpoke *> &neighborU,
-                                                                      std::vector<vtkSpoke *> &neighborV)
-{
-    vtkSlicerSkeletalRepresentationInterpolater interpolater;
-    int nRows = input->GetNumRows();
-    int nCols = input->GetNumCols();
-    vtkSpoke *cornerSpokes[4];
-    std::vector<double> skeletalPts = input->GetAllSkeletalPoints();
-    double  dXdu11[3], dXdv11[3],
-            dXdu12[3], dXdv12[3],
-            dXdu21[3], dXdv21[3],
-            dXdu22[3], dXdv22[3];
-    cornerSpokes[0] = input->GetSpoke(r-1, c);
-    cornerSpokes[1] = input->GetSpoke(r, c);
-    cornerSpokes[2] = input->GetSpoke(r, c+1);
-    cornerSpokes[3] = input->GetSpoke(r-1, c+1);
-    ComputeDerivative(skeletalPts, r-1, c, nRows, nCols, dXdu11, dXdv11);
-    ComputeDerivative(skeletalPts, r, c, nRows, nCols, dXdu21, dXdv21);
-    ComputeDerivative(skeletalPts, r, c+1, nRows, nCols, dXdu12, dXdv12);
-    ComputeDerivative(skeletalPts, r-1, c+1, nRows, nCols, dXdu22, dXdv22);
-
-    interpolater.SetCornerDxdu(dXdu11,
-                               dXdu21,
-                               dXdu22,
-                               dXdu12);
-    interpolater.SetCornerDxdv(dXdv11,
-                               dXdv21,
-                               dXdv22,
-                               dXdv12);
-
-    vtkSpoke* in1 = new vtkSpoke;
-    vtkSpoke* in2 = new vtkSpoke;
-    double stepV = mInterpolatePositions[0].second;
-    double stepU = stepV;
-    interpolater.Interpolate(1-stepU, 0, cornerSpokes, in1);
-    neighborU.push_back(in1);
-    interpolater.Interpolate(0, stepV, cornerSpokes, in2);
-    neighborV.push_back(in2);
-}
-
-void vtkSlicerSkeletalRepresentationRefinerLogic::FindBotRightNeigbors(int r, int c,
-                                                                       vtkSrep *input,
-                                                                       std::vector<vtkSpoke *> &neighborU,
-                                                                       std::vector<vtkSpoke *> &neighborV)
+bool vtkSlicerSkeletalRepresentationRefinerLogic::IsActiveSpoke(int id) const
 {
-    vtkSlicerSkeletalRepresentationInterpolater interpolater;
-    int nRows = input->GetNumRows();
-    int nCols = input->GetNumCols();
-    vtkSpoke *cornerSpokes[4];
-    std::vector<double> skeletalPts = input->GetAllSkeletalPoints();
-    double  dXdu11[3], dXdv11[3],
-            dXdu12[3], dXdv12[3],
-            dXdu21[3], dXdv21[3],
-            dXdu22[3], dXdv22[3];
-    cornerSpokes[0] = input->GetSpoke(r-1, c-1);
-    cornerSpokes[1] = input->GetSpoke(r, c-1);
-    cornerSpokes[2] = input->GetSpoke(r, c);
-    cornerSpokes[3] = input->GetSpoke(r-1, c);
-    ComputeDerivative(skeletalPts, r-1, c-1, nRows, nCols, dXdu11, dXdv11);
-    ComputeDerivative(skeletalPts, r, c-1, nRows, nCols, dXdu21, dXdv21);
-    ComputeDerivative(skeletalPts, r, c, nRows, nCols, dXdu12, dXdv12);
-    ComputeDerivative(skeletalPts, r-1, c, nRows, nCols, dXdu22, dXdv22);
-
-    interpolater.SetCornerDxdu(dXdu11,
-                               dXdu21,
-                               dXdu22,
-                               dXdu12);
-    interpolater.SetCornerDxdv(dXdv11,
-                               dXdv21,
-                               dXdv22,
-                               dXdv12);
-
-    vtkSpoke* in1 = new vtkSpoke;
-    vtkSpoke* in2 = new vtkSpoke;
-    double stepV = mInterpolatePositions[0].second;
-    double stepU = stepV;
-    interpolater.Interpolate(1-stepU, 1, cornerSpokes, in1);
-    neighborU.push_back(in1);
-    interpolater.Interpolate(1, 1-stepV, cornerSpokes, in2);
-    neighborV.push_back(in2);
+    if(mIsActiveSpoke.empty())
+    {
+        return true;
+    }
+    return mIsActiveSpoke[static_cast<size_t>(id)];
 }
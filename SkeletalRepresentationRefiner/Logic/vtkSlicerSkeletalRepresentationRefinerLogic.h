@@ -30,12 +30,25 @@
 // MRML includes
 
 // STD includes
+#include <atomic>
 #include <cstdlib>
+#include <future>
+#include <memory>
 #include <set>
 #include <utility>
+#include <vector>
 
 #include "vtkSlicerSkeletalRepresentationRefinerModuleLogicExport.h"
 #include "vtkSlicerSkeletalRepresentationInterpolater.h"
+#include "vtkDistanceMapCache.h"
+#include "vtkMappedDistanceMap.h"
+#include "vtkPolyData2ImageData.h"
+#include "vtkSparseDistanceMap.h"
+#include "vtkMultiLabelDistanceMap.h"
+#include "vtkMeshDistanceOracle.h"
+#include "vtkSurfaceMeshReader.h"
+#include "vtkSrepFile.h"
+#include "vtkSrepModelCache.h"
 #include "vtkImageData.h"
 #include "vtkSmartPointer.h"
 #include "itkImage.h"
@@ -59,10 +72,12 @@ public:
   vtkTypeMacro(vtkSlicerSkeletalRepresentationRefinerLogic, vtkSlicerModuleLogic);
   void PrintSelf(ostream& os, vtkIndent indent) override;
 
-  // Select image file
+  // Select image file: a surface mesh, or a binary label volume (.nrrd, .mha) whose nonzero voxels
+  // are the object. The s-rep is then expected in the RAS space of the volume.
+  // Its distance map is built on a background thread right away, a new selection stops the old one.
   void SetImageFileName(const std::string &imageFilePath);
 
-  // Select srep file
+  // Select srep file: a header.xml naming up, down and crest .vtp files, or a single .srep container
   void SetSrepFileName(const std::string &srepFilePath);
 
   // Select output path
@@ -75,12 +90,72 @@ public:
   // Input: interpolationLevel is the density when computing image match term
   void Refine(double stepSize, double endCriterion, int maxIter, int interpolationLevel);
 
+  // Re-optimize one spoke and its one-ring of neighbors after it was edited manually.
+  // Reuses the distance map, the transformation and the interpolation table of the last Refine call.
+  // The one-ring is merged into the spokes Refine wrote to the output path, if there are any,
+  // with the edited spoke taken from spokeFileName. The result replaces that refined file.
+  // Input: spokeFileName is the up or down spoke file of that s-rep, or its refined copy, with the edited spoke
+  // Input: r, c are the row and col of the edited spoke
+  void RefineSpokeNeighborhood(const std::string &spokeFileName, int r, int c,
+                               double stepSize, double endCriterion, int maxIter);
+
   // Interpolate srep
   void InterpolateSrep(int interpolationLevel, std::string& srepFileName);
 
+  // Write the s-rep of an XML header, or of another container, into one .srep container
+  bool ExportSrepContainer(const std::string &headerFileName, const std::string &srepFileName);
+
+  // Write the s-rep of a container as header.xml, up.vtp, down.vtp and crest.vtp into outputPath
+  bool ImportSrepContainer(const std::string &srepFileName, const std::string &outputPath);
+
+  // Compress the s-reps of many XML headers or containers with the same grid into one .sreps archive.
+  // Fails if a subject has another grid than the first one.
+  // Subjects are named by their header file names. pointStep and radiusStep bound the error of skeletal
+  // points and radii to half a step, directionBits sets the angular resolution of directions
+  bool ExportSrepArchive(const std::vector<std::string> &headerFileNames, const std::string &archiveFileName,
+                         double pointStep = 1e-4, double radiusStep = 1e-4, int directionBits = 16);
+
+  // Write one subject of an archive as a .srep container, which can then be selected for refinement
+  bool ImportSrepArchive(const std::string &archiveFileName, const std::string &subjectName,
+                         const std::string &srepFileName);
+
+  // Decode one subject of an archive straight into an s-rep, without writing spoke files.
+  // nullptr if the archive or the subject can't be read. The caller deletes the s-rep
+  vtkSrep *ReadSrepFromArchive(const std::string &archiveFileName, const std::string &subjectName);
+
   // set weights for three items in the objective function
   void SetWeights(double wtImageMatch, double wtNormal, double wtSrad);
 
+  // Sweep the weights of the objective function to help tuning them for a new kind of object.
+  // Every combination of the given weights is refined concurrently against the same distance map
+  // and parsed s-rep. Successive halving: each round gives all surviving settings iterPerRound more
+  // NEWUOA iterations on up and down spokes, then drops the worse half.
+  // Settings are ranked by the unweighted image match; those that increase the rSrad penalty go last.
+  // Output: the ranked table is printed and written to weightSweep.csv in the output path
+  void SweepWeights(const std::vector<double> &wtImageMatch, const std::vector<double> &wtNormal,
+                    const std::vector<double> &wtSrad, double stepSize, double endCriterion,
+                    int iterPerRound, int interpolationLevel);
+
+  // Restrict refinement to a region of interest. Spokes outside the selection keep
+  // their direction and length, and only the quads around free spokes are sampled.
+  // Input: ids are 0-based indices (r * nCols + c) of spokes in the up/down grid
+  void SetFreeSpokes(const std::vector<int> &ids);
+
+  // Select free spokes by inclusive ranges of rows and cols
+  // A selection without any spoke in the grid is an error, nothing is refined then
+  void SetFreeSpokeRange(int rowBegin, int rowEnd, int colBegin, int colEnd);
+
+  // Refine all spokes again
+  void ClearFreeSpokes();
+
+  // Evaluate interpolation, image match and rSrad in single precision while optimizing.
+  // The final polish and evaluation of each refinement still run in double precision.
+  void SetSinglePrecision(bool singlePrecision);
+
+  // Also evaluate every single precision objective in double precision and report
+  // the relative deviation after each refinement. Slow, meant to validate the fast path.
+  void SetPrecisionValidation(bool validate);
+
   // Description: Override operator (). Required by min_newuoa.
   // Parameter: @coeff: the pointer to coefficients
   double operator () (double *coeff);
@@ -89,11 +164,69 @@ public:
   // given the current coeff array
   double EvaluateObjectiveFunction(double *coeff);
 
+  // Sample the distances of one object of a map built for several objects at once, e.g. shared by the
+  // refiners of neighboring objects, instead of computing a distance map of the image file.
+  // The image file should still be the mesh of that object, the s-rep is mapped into its unit cube.
+  // An empty map goes back to the distance map of the image file. The shared map keeps the
+  // interpolation it was given by vtkMultiLabelDistanceMap::SetInterpolation.
+  void SetSharedDistanceMap(std::shared_ptr<const vtkMultiLabelDistanceMap> distanceMap, int object);
+
   // Generate anti-aliased signed distance map from surface mesh
   // Input: vtk file that contains target surface mesh
   // Output: image file that can be used in refinement
+  // Waits for the background build of the selected mesh and reuses it
   void AntiAliasSignedDistanceMap(const std::string &meshFileName);
 
+  // Keep distance maps in this directory and reuse them for the same mesh content and grid.
+  // An empty directory (the default) disables the cache.
+  void SetDistanceMapCacheDirectory(const std::string &cacheDirectory);
+
+  // Bytes the cache directory may take, the least recently used maps are removed beyond it.
+  // vtkDistanceMapCache::DefaultMaximumSize by default
+  void SetDistanceMapCacheSize(unsigned long long maximumSize);
+
+  // Sample cached distance maps through a read-only memory mapping instead of loading them,
+  // so concurrent refinement processes against the same target share one copy. Needs the cache directory.
+  void SetMemoryMappedDistanceMaps(bool mapDistanceMaps);
+
+  // Refine against a precomputed distance map file (see vtkDistanceMapCache) mapped read-only,
+  // instead of computing it from the target mesh. Empty (the default) computes it again.
+  void SetDistanceMapFileName(const std::string &fileName);
+
+  // Voxel size of the distance maps in the unit cube the target mesh is mapped into
+  void SetVoxelSpacing(double spacing);
+
+  // The distance maps cover the bounds of the mapped mesh plus this margin instead of the whole unit cube.
+  // Boundary points of the s-rep beyond it read the border voxels of the map.
+  void SetGridMargin(double margin);
+
+  // Keep only a band of this half-width (in unit cube units) around the target surface in a sparse
+  // distance map. Distances outside the band read as +/- band. 0 (the default) keeps the dense volumes.
+  void SetNarrowBand(double band);
+
+  // Measure the image match by the exact signed distance to the target mesh through a triangle
+  // hierarchy instead of sampling a distance map. No volume is generated. Overrides the narrow band.
+  void SetExactMeshDistance(bool exact);
+
+  // Normals of the dense distance map: vtkImageDistanceSampler::StoredGradient (the default) keeps the
+  // gradient volume, OnDemandGradient differentiates the distance map at the sampled voxels only and
+  // OctahedralNormals keeps unit normals in 4 bytes per voxel. The gradient volume is dropped in the last two.
+  void SetNormalMode(int mode);
+
+  // Keep the dense distance map as 16 bit fixed point values with one scale and offset per volume
+  // instead of floats. The quantization error against the float map is in the debug output when it is built.
+  // Memory-mapped distance maps are sampled as floats from the file.
+  void SetQuantizedDistanceMap(bool quantize);
+
+  // Lay the dense volumes out in 8x8x8 bricks (vtkBrickedLayout) and sort the boundary samples by brick,
+  // so that the image match reads few pages and cache lines. Cached and mapped files keep the layout.
+  void SetBrickedDistanceMaps(bool bricked);
+
+  // How the dense and the narrow band distance maps are read between voxels: vtkImageDistanceSampler::Nearest
+  // (the default), Trilinear or TricubicBSpline. Both interpolations make the objective continuous in the spokes,
+  // so a grid of twice the voxel spacing fits at least as well as the nearest voxel.
+  void SetDistanceInterpolation(int interpolation);
+
   // Compute transformation matrix from srep to image coordinate system, namely, unit cube cs.
   void TransformSrep(const std::string &headerFile);
 
@@ -112,27 +245,102 @@ protected:
   void OnMRMLSceneNodeRemoved(vtkMRMLNode* node) override;
 
 private:
+  // Skeletal points of interpolated spokes. Refinement moves radii and directions only, so they are
+  // computed once per s-rep and interpolation level and reused by the evaluations and local refinement
+  template<typename T>
+  struct InterpolationPoints
+  {
+      // mInterpolatePositions, u and v interleaved
+      std::vector<T> Positions;
+      // 3 per position in every quad, by the id of the top-left spoke of the quad
+      std::vector<T> QuadPoints;
+      // neighbors in u and v of every spoke in the 4 quads around it, 6 per quad
+      std::vector<T> NeighborPoints;
+
+      const T *GetQuadPoints(int qr, int qc, int nCols) const
+      {
+          return &QuadPoints[3 * (Positions.size() / 2) * static_cast<size_t>(qr * nCols + qc)];
+      }
+      const T *GetNeighborPoints(int id, int which) const
+      {
+          return &NeighborPoints[6 * (4 * static_cast<size_t>(id) + static_cast<size_t>(which))];
+      }
+  };
+  struct InterpolationTable
+  {
+      // the skeletal points and columns of the grid the table was built from
+      std::vector<double> SkeletalPoints;
+      int NumCols = 0;
+      // the same points for the kernels of either precision
+      InterpolationPoints<float> Float;
+      InterpolationPoints<double> Double;
+
+      const InterpolationPoints<float> &GetPoints(float) const { return Float; }
+      const InterpolationPoints<double> &GetPoints(double) const { return Double; }
+  };
+
   // interpolate s-rep
   void Interpolate();
 
-  // parse the s-rep
+  // parse the header, prepare the distance map, transformation and interpolation positions
+  // return false if the s-rep model is empty
+  bool PrepareRefinement(int interpolationLevel, std::string *upFileName,
+                         std::string *downFileName, std::string *crestFileName);
+
+  // compute the unweighted terms of the objective function for srep deformed by coeff
+  // It reads the interpolation table of srep and doesn't change the state of this logic,
+  // thus can be called from several threads once UpdateInterpolationTable has been called for srep.
+  void ComputeObjectiveTerms(vtkSrep *srep, const double *coeff,
+                             double *imageDist, double *normal, double *srad);
+
+  // same terms as ComputeObjectiveTerms with the kernels instantiated in single precision
+  void ComputeObjectiveTermsSingle(vtkSrep *srep, const double *coeff,
+                                   double *imageDist, double *normal, double *srad);
+
+  // the two above, with the kernels of vtkSrepKernelDispatch instantiated for T
+  // Every quad is interpolated once and weighted by the number of active spokes sharing it.
+  template<typename T>
+  void ComputeKernelObjectiveTerms(vtkSrep *srep, const double *coeff,
+                                   double *imageDist, double *normal, double *srad);
+
+  // build the interpolation table of the skeletal points of srep unless there is one for them
+  // and the current interpolation positions. Not thread safe, the evaluations only read the tables
+  void UpdateInterpolationTable(vtkSrep *srep);
+
+  // nullptr if UpdateInterpolationTable was not called for these skeletal points
+  const InterpolationTable *FindInterpolationTable(const std::vector<double> &skeletalPoints) const;
+
+  // fill in output with the points of table for the kernels of precision T
+  template<typename T>
+  void ComputeInterpolationPoints(const InterpolationTable &table, InterpolationPoints<T> *output);
+
+  // fill in coefficients of free spokes into the coefficients of all spokes
+  void ExpandCoefficients(const std::vector<double> &allCoeff, const double *freeCoeff,
+                          std::vector<double> &output) const;
+
+  // parse the s-rep, from mSrepModels unless the file is new or has changed
   // put the spoke length and direction into coeffArray
   void Parse(const std::string &modelFileName, std::vector<double> &coeffArray,
              std::vector<double> &radii, std::vector<double> &dirs, std::vector<double> &skeletalPoints);
 
-  // parse the header of s-rep including the rows and cols in the s-rep
+  // read a spoke file, a .vtp file or one side of a container
+  void ReadSpokeFile(const std::string &modelFileName, std::vector<double> &coeffArray,
+                     std::vector<double> &radii, std::vector<double> &dirs, std::vector<double> &skeletalPoints);
+
+  // parse the header of s-rep including the rows and cols in the s-rep, from mSrepModels like Parse
   void ParseHeader(const std::string &headerFileName, int *nRows, int *nCols, double *shift,
                    std::string* upFileName, std::string* downFileName, std::string* crestFileName);
 
+  // read a header.xml or the header of a container
+  void ReadHeaderFile(const std::string &headerFileName, int *nRows, int *nCols, double *shift,
+                      std::string* upFileName, std::string* downFileName, std::string* crestFileName);
+
   // update header file after refinement
   void UpdateHeader(const std::string &headerFileName, const std::string &outputFileName, std::string *newHeaderFileName);
 
   // compute the difference between two vectors, factor can be used to compute center-difference
   void ComputeDiff(double *head, double *tail, double factor, double *output);
 
-  // compute distance from implied boundary in signed distance map
-  double ComputeDistance(vtkSpoke *theSpoke, double *normalMatch);
-
   // derivative of skeletal point
   void ComputeDerivative(std::vector<double> skeletalPoints, int r, int c, int nRows, int nCols, double *dXdu, double *dXdv);
 
@@ -170,45 +378,66 @@ private:
   void ConnectFoldCurve(const std::vector<vtkSpoke *>& edgeSpokes, vtkPoints *foldCurvePts, vtkCellArray *foldCurveCell);
 
   // e.g. Refine up spokes saved in upFileName
-  void RefinePartOfSpokes(const std::string& srepFileName, double stepSize, double endCriterion, int maxIter);
+  // Input: refinedFileName is where the refined spokes are written
+  // Input: isLocal is true if intermediate models should not be shown
+  void RefinePartOfSpokes(const std::string& srepFileName, double stepSize, double endCriterion, int maxIter,
+                          const std::string &refinedFileName, bool isLocal = false);
+
+  // same as RefinePartOfSpokes with the parsed spokes of one side
+  void RefineSpokes(std::vector<double> &radii, std::vector<double> &dirs, std::vector<double> &skeletalPoints,
+                    double stepSize, double endCriterion, int maxIter, const std::string &refinedFileName,
+                    bool isLocal);
+
+  // make tuples of interpolation positions (u,v)
+  void ComputeInterpolatePositions(int interpolationLevel);
 
-  // compute total distance of left top spoke to the quad
-  double TotalDistOfLeftTopSpoke(vtkSrep* input, double u, double v, int r, int c, double *normalMatch);
+  // resolve the selection of free spokes on a grid of nRows x nCols
+  // also mark spokes whose quads or rSrad neighbors are affected by the free spokes
+  // Return false if spokes were selected but none of them is in the grid
+  bool ResolveFreeSpokes(int nRows, int nCols);
 
-  // compute total distance of right top spoke to the quad
-  double TotalDistOfRightTopSpoke(vtkSrep* input, double u, double v, int r, int c, double *normalMatch);
+  // true if the objective terms owned by spoke id need to be evaluated
+  bool IsActiveSpoke(int id) const;
 
-  // compute total distance of left bottom spoke to the quad
-  double TotalDistOfLeftBotSpoke(vtkSrep* input, double u, double v, int r, int c, double *normalMatch);
+  // the distance map of meshFileName with the current settings, on the calling thread
+  void BuildDistanceMap(const std::string &meshFileName);
 
-  // compute total distance of Right bottom spoke to the quad
-  double TotalDistOfRightBotSpoke(vtkSrep* input, double u, double v, int r, int c, double *normalMatch);
+  // build the distance map of mTargetMeshFilePath on a background thread unless it is there already
+  void StartDistanceMap();
 
-  // compute rSrad penalty
-  double ComputeRSradPenalty(vtkSrep* input);
+  // block until the background build is done, return at once if there is none
+  void WaitForDistanceMap();
 
-  void FindTopLeftNeigbors(int r, int c,
-                           vtkSrep* input,
-                           std::vector<vtkSpoke *> &neighborU,
-                           std::vector<vtkSpoke *> &neighborV);
+  // stop the background build at its next step and wait for it
+  void CancelDistanceMap();
 
-  void FindTopRightNeigbors(int r, int c,
-                           vtkSrep* input,
-                           std::vector<vtkSpoke *> &neighborU,
-                           std::vector<vtkSpoke *> &neighborV);
+  // true if the build was cancelled, the partial volumes are released then
+  bool DistanceMapCancelled(const std::string &meshFileName);
 
-  void FindBotLeftNeigbors(int r, int c,
-                           vtkSrep* input,
-                           std::vector<vtkSpoke *> &neighborU,
-                           std::vector<vtkSpoke *> &neighborV);
+  // compute the narrow band distance map of the target mesh instead of the dense volumes
+  void BuildNarrowBandDistanceMap(const std::string &meshFileName);
+
+  // build the exact distance to the target mesh instead of a distance map
+  void BuildMeshDistance(const std::string &meshFileName);
+
+  // point mImageSampler to a dense distance map with the normals of mNormalMode. grad and
+  // octahedralNormals may be nullptr, the codes are then computed from dist. dist may be nullptr
+  // once it has been quantized. bricked tells the layout of the volumes
+  void SetImageVolumes(const float *dist, const float *grad, const unsigned int *octahedralNormals,
+                       const int *dims, const double *origin, bool bricked);
+
+  // map a distance map file and release the ITK volumes. Return false if it can't be used
+  bool MapDistanceMap(const std::string &fileName);
+
+  // point mDistanceSampler to the shared map, the exact mesh distance, the narrow band, the mapped file
+  // or the ITK volumes
+  void UpdateDistanceSampler();
 
-  void FindBotRightNeigbors(int r, int c,
-                           vtkSrep* input,
-                           std::vector<vtkSpoke *> &neighborU,
-                           std::vector<vtkSpoke *> &neighborV);
 private:
   std::string mTargetMeshFilePath;
   std::string mSrepFilePath;
+  // headers and spokes parsed so far, with their transformation and interpolated spokes
+  vtkSrepModelCache mSrepModels;
   std::string mOutputPath;
   // weights in optimization algorithm
   double mWtImageMatch;
@@ -218,14 +447,74 @@ private:
   // output the first terms in object func can help to set weights
   bool mFirstCost = true;
 
+  // single precision evaluation and its validation against double precision
+  bool mSinglePrecision = false;
+  bool mValidatePrecision = false;
+  double mMaxDeviation = 0.0;
+  double mSumDeviation = 0.0;
+  int mNumValidations = 0;
+
   // store the data at the beginning of refinement
   int mNumRows;
   int mNumCols;
   vtkSrep* mSrep;
   // when apply this transformation: [x, y, z, 1] * mTransformationMat
   double mTransformationMat[4][4]; // homogeneous matrix transfrom from srep to unit cube cs.
+  bool mHasTransformation = false;
+  // header of the s-rep the transformation and the interpolation positions were prepared for
+  std::string mPreparedSrepFilePath;
+  // grid of the distance maps
+  double mVoxelSpacing = vtkPolyData2ImageData::DefaultVoxelSpacing;
+  double mGridMargin = vtkPolyData2ImageData::DefaultMargin;
+  // the mesh that mAntiAliasedImage and mGradDistImage are computed from
+  std::string mDistanceMapMeshPath;
+  // the target meshes read so far, like the distance maps only touched by the build job while it runs
+  vtkSurfaceMeshReader mMeshReader;
+  std::string mDistanceMapCacheDirectory;
+  unsigned long long mDistanceMapCacheSize = vtkDistanceMapCache::DefaultMaximumSize;
+  std::string mDistanceMapFileName;
+  bool mMapDistanceMaps = false;
+  vtkMappedDistanceMap mMappedDistanceMap;
+  // the dense volumes sampled in refinement, owned by mMappedDistanceMap or the ITK images
+  vtkImageDistanceSampler mImageSampler;
+  vtkImageDistanceSampler::NormalMode mNormalMode = vtkImageDistanceSampler::StoredGradient;
+  // computed from the distance map in use, empty unless the normal mode is OctahedralNormals
+  std::vector<unsigned int> mOctahedralNormals;
+  // fixed point copy of the distance map in use, replaces the float volume if mQuantizeDistance
+  bool mQuantizeDistance = false;
+  std::vector<short> mQuantizedDistance;
+  int mQuantizedDims[3] = {0, 0, 0};
+  double mQuantizedOrigin[3] = {0.0, 0.0, 0.0};
+  double mDistanceScale = 1.0;
+  double mDistanceOffset = 0.0;
+  // mBrickDistanceMaps is the setting, mDistanceMapBricked the layout of mAntiAliasedImage and mGradDistImage
+  bool mBrickDistanceMaps = false;
+  bool mDistanceMapBricked = false;
+  // used instead of the dense volumes if they are not empty
+  double mNarrowBand = 0.0;
+  vtkSparseDistanceMap mSparseDistanceMap;
+  bool mExactMeshDistance = false;
+  vtkMeshDistanceOracle mMeshDistance;
+  // the build started by SetImageFileName. Only its thread touches the distance maps until it is waited for
+  std::future<void> mDistanceMapJob;
+  std::atomic<bool> mCancelDistanceMap{false};
+  // used instead of all of the above if set
+  std::shared_ptr<const vtkMultiLabelDistanceMap> mSharedDistanceMap;
+  int mSharedObject = -1;
+  // the source of distances in refinement, nullptr until one is prepared
+  const vtkDistanceSampler *mDistanceSampler = nullptr;
   std::vector<double> mCoeffArray;
   std::vector<std::pair<double, double> > mInterpolatePositions;
+  // one table per skeletal sheet, the up and down spokes of an s-rep may have their own
+  std::vector<InterpolationTable> mInterpolationTables;
+
+  // region of interest: selection from users
+  std::vector<int> mFreeSpokeIds;
+  int mFreeSpokeRange[4] = {-1, -1, -1, -1}; // rowBegin, rowEnd, colBegin, colEnd
+  // resolved at the beginning of refinement. Empty if all spokes are free
+  std::vector<int> mFreeIndices;
+  std::vector<bool> mIsFreeSpoke;
+  std::vector<bool> mIsActiveSpoke;
   //vtkSmartPointer<vtkImageData> mAntiAliasedImage = vtkSmartPointer<vtkImageData>::New();
   RealImage::Pointer mAntiAliasedImage = RealImage::New();
   VectorImage::Pointer mGradDistImage = VectorImage::New();
@@ -0,0 +1,371 @@
+/*==============================================================================
+
+  Program: 3D Slicer
+
+  Portions (c) Copyright Brigham and Women's Hospital (BWH) All Rights Reserved.
+
+  See COPYRIGHT.txt
+  or http://www.slicer.org/copyright/copyright.txt for details.
+
+  Unless required by applicable law or agreed to in writing, software
+  distributed under the License is distributed on an "AS IS" BASIS,
+  WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+  See the License for the specific language governing permissions and
+  limitations under the License.
+
+==============================================================================*/
+
+
+#include "vtkSparseDistanceMap.h"
+#include "vtkMeshDistanceOracle.h"
+
+#include <algorithm>
+#include <math.h>
+
+vtkSparseDistanceMap::vtkSparseDistanceMap()
+    : mSpacing(1.0), mBand(0.0), mInterpolation(vtkImageDistanceSampler::Nearest)
+{
+    for(int i = 0; i < 3; ++i)
+    {
+        mDims[i] = 0;
+        mBrickDims[i] = 0;
+        mOrigin[i] = 0.0;
+    }
+}
+
+void vtkSparseDistanceMap::Reset(const int *dims, const double *origin, double spacing, double band)
+{
+    size_t numBricks = 1;
+    for(int i = 0; i < 3; ++i)
+    {
+        mDims[i] = dims[i];
+        mOrigin[i] = origin[i];
+        mBrickDims[i] = (dims[i] + BrickSize - 1) / BrickSize;
+        numBricks *= static_cast<size_t>(mBrickDims[i]);
+    }
+    mSpacing = spacing;
+    mBand = band;
+    mBrickIndex.assign(numBricks, OutsideBrick);
+    mValues.clear();
+}
+
+size_t vtkSparseDistanceMap::BrickOf(int x, int y, int z) const
+{
+    return (static_cast<size_t>(z / BrickSize) * static_cast<size_t>(mBrickDims[1])
+            + static_cast<size_t>(y / BrickSize)) * static_cast<size_t>(mBrickDims[0])
+            + static_cast<size_t>(x / BrickSize);
+}
+
+size_t vtkSparseDistanceMap::VoxelInBrick(int x, int y, int z) const
+{
+    return static_cast<size_t>(((z % BrickSize) * BrickSize + (y % BrickSize)) * BrickSize + (x % BrickSize));
+}
+
+void vtkSparseDistanceMap::AllocateBricks(const std::vector<unsigned char> &marked, float value)
+{
+    const size_t brickVolume = BrickSize * BrickSize * BrickSize;
+    int32_t numStored = 0;
+    for(size_t b = 0; b < marked.size(); ++b)
+    {
+        if(marked[b])
+        {
+            mBrickIndex[b] = numStored++;
+        }
+    }
+    mValues.assign(static_cast<size_t>(numStored) * brickVolume, value);
+}
+
+void vtkSparseDistanceMap::Build(const float *points, const int *triangles, size_t numTriangles,
+                                 const unsigned char *inside, const int *dims, const double *origin,
+                                 double spacing, double band)
+{
+    Reset(dims, origin, spacing, band);
+    const double bandVoxels = band / spacing;
+
+    // voxel box of a triangle grown by the band
+    auto triangleBox = [&](size_t t, int *lo, int *hi)
+    {
+        for(int i = 0; i < 3; ++i)
+        {
+            double minCoord = points[3 * triangles[3 * t] + i], maxCoord = minCoord;
+            for(int k = 1; k < 3; ++k)
+            {
+                double coord = points[3 * triangles[3 * t + k] + i];
+                minCoord = std::min(minCoord, coord);
+                maxCoord = std::max(maxCoord, coord);
+            }
+            lo[i] = std::max(0, static_cast<int>(floor((minCoord - origin[i]) / spacing - bandVoxels)));
+            hi[i] = std::min(mDims[i] - 1, static_cast<int>(ceil((maxCoord - origin[i]) / spacing + bandVoxels)));
+        }
+        return lo[0] <= hi[0] && lo[1] <= hi[1] && lo[2] <= hi[2];
+    };
+
+    // 1. bricks touched by the band of any triangle
+    std::vector<unsigned char> marked(mBrickIndex.size(), 0);
+    for(size_t t = 0; t < numTriangles; ++t)
+    {
+        int lo[3], hi[3];
+        if(!triangleBox(t, lo, hi))
+        {
+            continue;
+        }
+        for(int bz = lo[2] / BrickSize; bz <= hi[2] / BrickSize; ++bz)
+        {
+            for(int by = lo[1] / BrickSize; by <= hi[1] / BrickSize; ++by)
+            {
+                for(int bx = lo[0] / BrickSize; bx <= hi[0] / BrickSize; ++bx)
+                {
+                    marked[BrickOf(bx * BrickSize, by * BrickSize, bz * BrickSize)] = 1;
+                }
+            }
+        }
+    }
+    AllocateBricks(marked, static_cast<float>(band));
+
+    // 2. unsigned distance to the nearest triangle, clamped to the band
+    for(size_t t = 0; t < numTriangles; ++t)
+    {
+        int lo[3], hi[3];
+        if(!triangleBox(t, lo, hi))
+        {
+            continue;
+        }
+        double a[3], b[3], c[3];
+        for(int i = 0; i < 3; ++i)
+        {
+            a[i] = points[3 * triangles[3 * t] + i];
+            b[i] = points[3 * triangles[3 * t + 1] + i];
+            c[i] = points[3 * triangles[3 * t + 2] + i];
+        }
+        for(int z = lo[2]; z <= hi[2]; ++z)
+        {
+            for(int y = lo[1]; y <= hi[1]; ++y)
+            {
+                for(int x = lo[0]; x <= hi[0]; ++x)
+                {
+                    double p[3] = {origin[0] + x * spacing, origin[1] + y * spacing, origin[2] + z * spacing};
+                    double closest[3];
+                    vtkMeshDistanceOracle::ClosestPointOnTriangle(p, a, b, c, closest);
+                    float d = static_cast<float>(sqrt((p[0] - closest[0]) * (p[0] - closest[0])
+                                                      + (p[1] - closest[1]) * (p[1] - closest[1])
+                                                      + (p[2] - closest[2]) * (p[2] - closest[2])));
+                    float &value = mValues[static_cast<size_t>(mBrickIndex[BrickOf(x, y, z)]) * BrickSize * BrickSize * BrickSize
+                                           + VoxelInBrick(x, y, z)];
+                    if(d < value)
+                    {
+                        value = d;
+                    }
+                }
+            }
+        }
+    }
+
+    // 3. signs from the inside mask. No surface crosses a brick without storage, so one voxel decides it
+    const size_t sliceSize = static_cast<size_t>(mDims[0]) * static_cast<size_t>(mDims[1]);
+    auto isInside = [&](int x, int y, int z)
+    {
+        return inside[static_cast<size_t>(z) * sliceSize + static_cast<size_t>(y) * static_cast<size_t>(mDims[0])
+                      + static_cast<size_t>(x)] != 0;
+    };
+    for(int z = 0; z < mDims[2]; ++z)
+    {
+        for(int y = 0; y < mDims[1]; ++y)
+        {
+            for(int x = 0; x < mDims[0]; ++x)
+            {
+                int32_t &brick = mBrickIndex[BrickOf(x, y, z)];
+                if(brick >= 0)
+                {
+                    if(isInside(x, y, z))
+                    {
+                        float &value = mValues[static_cast<size_t>(brick) * BrickSize * BrickSize * BrickSize
+                                               + VoxelInBrick(x, y, z)];
+                        value = -value;
+                    }
+                }
+                else if(x % BrickSize == 0 && y % BrickSize == 0 && z % BrickSize == 0)
+                {
+                    brick = isInside(x, y, z) ? InsideBrick : OutsideBrick;
+                }
+            }
+        }
+    }
+}
+
+void vtkSparseDistanceMap::BuildFromDense(const float *dist, const int *dims, const double *origin, double spacing,
+                                          double band)
+{
+    Reset(dims, origin, spacing, band);
+    const size_t sliceSize = static_cast<size_t>(mDims[0]) * static_cast<size_t>(mDims[1]);
+    auto denseValue = [&](int x, int y, int z)
+    {
+        return dist[static_cast<size_t>(z) * sliceSize + static_cast<size_t>(y) * static_cast<size_t>(mDims[0])
+                    + static_cast<size_t>(x)];
+    };
+
+    std::vector<unsigned char> marked(mBrickIndex.size(), 0);
+    for(int z = 0; z < mDims[2]; ++z)
+    {
+        for(int y = 0; y < mDims[1]; ++y)
+        {
+            for(int x = 0; x < mDims[0]; ++x)
+            {
+                if(fabs(denseValue(x, y, z)) <= band)
+                {
+                    marked[BrickOf(x, y, z)] = 1;
+                }
+            }
+        }
+    }
+    AllocateBricks(marked, static_cast<float>(band));
+
+    const float maxValue = static_cast<float>(band);
+    for(int z = 0; z < mDims[2]; ++z)
+    {
+        for(int y = 0; y < mDims[1]; ++y)
+        {
+            for(int x = 0; x < mDims[0]; ++x)
+            {
+                int32_t &brick = mBrickIndex[BrickOf(x, y, z)];
+                float d = denseValue(x, y, z);
+                if(brick >= 0)
+                {
+                    mValues[static_cast<size_t>(brick) * BrickSize * BrickSize * BrickSize + VoxelInBrick(x, y, z)] =
+                            std::max(-maxValue, std::min(maxValue, d));
+                }
+                else if(x % BrickSize == 0 && y % BrickSize == 0 && z % BrickSize == 0)
+                {
+                    brick = d < 0 ? InsideBrick : OutsideBrick;
+                }
+            }
+        }
+    }
+}
+
+size_t vtkSparseDistanceMap::GetMemorySize() const
+{
+    return mBrickIndex.size() * sizeof(int32_t) + mValues.size() * sizeof(float);
+}
+
+float vtkSparseDistanceMap::GetValue(int x, int y, int z) const
+{
+    x = std::max(0, std::min(mDims[0] - 1, x));
+    y = std::max(0, std::min(mDims[1] - 1, y));
+    z = std::max(0, std::min(mDims[2] - 1, z));
+    int32_t brick = mBrickIndex[BrickOf(x, y, z)];
+    if(brick == OutsideBrick)
+    {
+        return static_cast<float>(mBand);
+    }
+    if(brick == InsideBrick)
+    {
+        return static_cast<float>(-mBand);
+    }
+    return mValues[static_cast<size_t>(brick) * BrickSize * BrickSize * BrickSize + VoxelInBrick(x, y, z)];
+}
+
+void vtkSparseDistanceMap::GetGradient(int x, int y, int z, float *grad) const
+{
+    // same stencil as itk::GradientImageFilter, the border value is repeated outside the grid
+    const float factor = static_cast<float>(0.5 / mSpacing);
+    grad[0] = (GetValue(x + 1, y, z) - GetValue(x - 1, y, z)) * factor;
+    grad[1] = (GetValue(x, y + 1, z) - GetValue(x, y - 1, z)) * factor;
+    grad[2] = (GetValue(x, y, z + 1) - GetValue(x, y, z - 1)) * factor;
+}
+
+void vtkSparseDistanceMap::GridCoordinates(const double *point, double *coords) const
+{
+    for(int i = 0; i < 3; ++i)
+    {
+        coords[i] = (point[i] - mOrigin[i]) / mSpacing;
+        coords[i] = std::max(0.0, std::min(static_cast<double>(mDims[i] - 1), coords[i]));
+    }
+}
+
+double vtkSparseDistanceMap::Sample(const double *point, double *normal) const
+{
+    if(mInterpolation == vtkImageDistanceSampler::Trilinear)
+    {
+        return SampleTrilinear(point, normal);
+    }
+    if(mInterpolation == vtkImageDistanceSampler::TricubicBSpline)
+    {
+        return SampleTricubic(point, normal);
+    }
+    int index[3];
+    for(int i = 0; i < 3; ++i)
+    {
+        index[i] = std::max(0, std::min(mDims[i] - 1, static_cast<int>((point[i] - mOrigin[i]) / mSpacing + 0.5)));
+    }
+    float grad[3];
+    GetGradient(index[0], index[1], index[2], grad);
+    normal[0] = static_cast<double>(grad[0]);
+    normal[1] = static_cast<double>(grad[1]);
+    normal[2] = static_cast<double>(grad[2]);
+    Normalize(normal);
+    return static_cast<double>(GetValue(index[0], index[1], index[2]));
+}
+
+double vtkSparseDistanceMap::SampleTrilinear(const double *point, double *normal) const
+{
+    double coords[3];
+    GridCoordinates(point, coords);
+    int cell[3], next[3];
+    double f[3];
+    for(int i = 0; i < 3; ++i)
+    {
+        // the last cell starts one voxel before the border, a single voxel is its own neighbor
+        cell[i] = std::min(static_cast<int>(coords[i]), std::max(mDims[i] - 2, 0));
+        next[i] = cell[i] < mDims[i] - 1 ? 1 : 0;
+        f[i] = coords[i] - cell[i];
+    }
+    double d = 0.0;
+    normal[0] = normal[1] = normal[2] = 0.0;
+    for(int corner = 0; corner < 8; ++corner)
+    {
+        const int c[3] = {corner & 1, (corner >> 1) & 1, corner >> 2};
+        const double w[3] = {c[0] ? f[0] : 1 - f[0], c[1] ? f[1] : 1 - f[1], c[2] ? f[2] : 1 - f[2]};
+        const double cornerDist = static_cast<double>(GetValue(cell[0] + c[0] * next[0], cell[1] + c[1] * next[1],
+                                                               cell[2] + c[2] * next[2]));
+        d += w[0] * w[1] * w[2] * cornerDist;
+        // gradient of the blend itself
+        normal[0] += (c[0] ? 1 : -1) * next[0] * w[1] * w[2] * cornerDist;
+        normal[1] += (c[1] ? 1 : -1) * next[1] * w[0] * w[2] * cornerDist;
+        normal[2] += (c[2] ? 1 : -1) * next[2] * w[0] * w[1] * cornerDist;
+    }
+    Normalize(normal);
+    return d;
+}
+
+double vtkSparseDistanceMap::SampleTricubic(const double *point, double *normal) const
+{
+    double coords[3];
+    GridCoordinates(point, coords);
+    int cell[3];
+    double w[3][4], dw[3][4];
+    for(int i = 0; i < 3; ++i)
+    {
+        cell[i] = std::min(static_cast<int>(coords[i]), std::max(mDims[i] - 2, 0));
+        BSplineWeights(coords[i] - cell[i], w[i], dw[i]);
+    }
+    double d = 0.0;
+    normal[0] = normal[1] = normal[2] = 0.0;
+    for(int k = 0; k < 4; ++k)
+    {
+        for(int j = 0; j < 4; ++j)
+        {
+            for(int i = 0; i < 4; ++i)
+            {
+                // GetValue repeats the border voxels beyond the grid
+                const double voxelDist = static_cast<double>(GetValue(cell[0] + i - 1, cell[1] + j - 1,
+                                                                      cell[2] + k - 1));
+                d += w[0][i] * w[1][j] * w[2][k] * voxelDist;
+                normal[0] += dw[0][i] * w[1][j] * w[2][k] * voxelDist;
+                normal[1] += w[0][i] * dw[1][j] * w[2][k] * voxelDist;
+                normal[2] += w[0][i] * w[1][j] * dw[2][k] * voxelDist;
+            }
+        }
+    }
+    Normalize(normal);
+    return d;
+}
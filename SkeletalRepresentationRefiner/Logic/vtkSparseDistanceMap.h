@@ -0,0 +1,109 @@
+/*==============================================================================
+
+  Program: 3D Slicer
+
+  Portions (c) Copyright Brigham and Women's Hospital (BWH) All Rights Reserved.
+
+  See COPYRIGHT.txt
+  or http://www.slicer.org/copyright/copyright.txt for details.
+
+  Unless required by applicable law or agreed to in writing, software
+  distributed under the License is distributed on an "AS IS" BASIS,
+  WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+  See the License for the specific language governing permissions and
+  limitations under the License.
+
+==============================================================================*/
+
+
+#ifndef VTKSPARSEDISTANCEMAP_H
+#define VTKSPARSEDISTANCEMAP_H
+
+#include "vtkDistanceSampler.h"
+
+#include <stddef.h>
+#include <stdint.h>
+#include <vector>
+
+/**
+ * @brief The vtkSparseDistanceMap class
+ * Narrow-band signed distance map on the voxel grid of the dense distance map.
+ * The grid is split into bricks of 8x8x8 voxels. Only bricks within the band around the surface
+ * store distances, the others only remember whether they are inside or outside and read as
+ * -band or +band. The refinement samples the distance near the target surface only,
+ * so this keeps its accuracy there with a fraction of the memory of the dense volumes.
+ * Voxel (i, j, k) is centered at origin + (i, j, k) * spacing, the same as the dense distance map.
+ * Distances are negative inside. Samples read the nearest voxel, the 8 voxels around the point or the
+ * cubic B-spline through the 4x4x4 voxels around it like vtkImageDistanceSampler, across brick borders.
+ * The normal is the normalized gradient of the distances, central differences at the nearest voxel
+ * or the gradient of the blend.
+ */
+class vtkSparseDistanceMap : public vtkDistanceSampler
+{
+public:
+    enum { BrickSize = 8 };
+
+    vtkSparseDistanceMap();
+
+    // Exact distances to the triangles within the band, signs from the inside mask.
+    // Input: points are xyz in the unit cube, triangles are 3 point ids each
+    // Input: inside is nonzero for voxels inside the mesh, on a grid of dims voxels starting at origin
+    // Input: band is the half-width of the band in the units of spacing
+    void Build(const float *points, const int *triangles, size_t numTriangles,
+               const unsigned char *inside, const int *dims, const double *origin, double spacing, double band);
+
+    // Keep the band of a dense distance map, x varies fastest
+    void BuildFromDense(const float *dist, const int *dims, const double *origin, double spacing, double band);
+
+    bool IsEmpty() const { return mBrickIndex.empty(); }
+
+    const int *GetDimensions() const { return mDims; }
+
+    double GetBand() const { return mBand; }
+
+    size_t GetNumberOfBricks() const { return mValues.size() / (BrickSize * BrickSize * BrickSize); }
+
+    // bytes held by the map
+    size_t GetMemorySize() const;
+
+    // distance at a voxel, indices are clamped to the grid
+    float GetValue(int x, int y, int z) const;
+
+    // central differences of the distance at a voxel, one-sided on the border of the grid.
+    // Zero outside the band where the distance is constant.
+    void GetGradient(int x, int y, int z, float *grad) const;
+
+    // Kept when the map is built again
+    void SetInterpolation(vtkImageDistanceSampler::Interpolation interpolation) { mInterpolation = interpolation; }
+    vtkImageDistanceSampler::Interpolation GetInterpolation() const { return mInterpolation; }
+
+    double Sample(const double *point, double *normal) const override;
+
+    bool HasUnitNormals() const override { return true; }
+
+private:
+    // entries of mBrickIndex for bricks without storage
+    enum { OutsideBrick = -1, InsideBrick = -2 };
+
+    int mDims[3];
+    int mBrickDims[3];
+    double mOrigin[3];
+    double mSpacing;
+    double mBand;
+    vtkImageDistanceSampler::Interpolation mInterpolation;
+    // per brick: offset of its values in mValues / BrickSize^3, or OutsideBrick / InsideBrick
+    std::vector<int32_t> mBrickIndex;
+    std::vector<float> mValues;
+
+    void Reset(const int *dims, const double *origin, double spacing, double band);
+    size_t BrickOf(int x, int y, int z) const;
+    size_t VoxelInBrick(int x, int y, int z) const;
+    // continuous voxel coordinates of point, clamped to the grid
+    void GridCoordinates(const double *point, double *coords) const;
+    double SampleTrilinear(const double *point, double *normal) const;
+    double SampleTricubic(const double *point, double *normal) const;
+    // give storage to the marked bricks and fill them with value
+    void AllocateBricks(const std::vector<unsigned char> &marked, float value);
+};
+
+#endif // VTKSPARSEDISTANCEMAP_H
@@ -0,0 +1,869 @@
+/*==============================================================================
+
+  Program: 3D Slicer
+
+  Portions (c) Copyright Brigham and Women's Hospital (BWH) All Rights Reserved.
+
+  See COPYRIGHT.txt
+  or http://www.slicer.org/copyright/copyright.txt for details.
+
+  Unless required by applicable law or agreed to in writing, software
+  distributed under the License is distributed on an "AS IS" BASIS,
+  WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+  See the License for the specific language governing permissions and
+  limitations under the License.
+
+==============================================================================*/
+
+
+#include "vtkSrepArchive.h"
+#include "vtkSrep.h"
+
+#include <vtksys/SystemTools.hxx>
+
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <cstdio>
+#include <cstring>
+#include <iostream>
+#include <sstream>
+#include <thread>
+
+namespace
+{
+const char archiveMagic[8] = {'S', 'R', 'E', 'P', 'A', 'R', 'C', '\0'};
+const uint32_t archiveVersion = 1;
+// the version as a host of the other byte order reads it
+const uint32_t archiveVersionSwapped = ((archiveVersion & 0xFFu) << 24) | ((archiveVersion & 0xFF00u) << 8)
+                                       | ((archiveVersion >> 8) & 0xFF00u) | (archiveVersion >> 24);
+static_assert(sizeof(vtkSrepArchiveHeader) == 128, "the header of s-rep archives must be 128 bytes");
+static_assert(sizeof(vtkSrepArchiveEntry) == 32, "the index entries of s-rep archives must be 32 bytes");
+
+// quantized values stay below 2^52, where doubles are still exact integers
+const double quantizedLimit = 4503599627370496.0;
+
+// Adaptive binary range coder as in LZMA, probabilities of a zero bit have 11 bits
+const int probBits = 11;
+const uint16_t probInit = 1 << (probBits - 1);
+const int probMoveBits = 5;
+const uint32_t rangeTop = 1u << 24;
+
+class RangeEncoder
+{
+public:
+    explicit RangeEncoder(std::vector<unsigned char> *output)
+        : mOutput(output), mLow(0), mRange(0xFFFFFFFFu), mCache(0), mCacheSize(1)
+    {
+    }
+
+    void EncodeBit(uint16_t &prob, int bit)
+    {
+        const uint32_t bound = (mRange >> probBits) * prob;
+        if(bit == 0)
+        {
+            mRange = bound;
+            prob += ((1u << probBits) - prob) >> probMoveBits;
+        }
+        else
+        {
+            mLow += bound;
+            mRange -= bound;
+            prob -= prob >> probMoveBits;
+        }
+        Normalize();
+    }
+
+    // the low numBits bits of value with probability 1/2, highest first
+    void EncodeDirect(uint64_t value, int numBits)
+    {
+        for(int i = numBits - 1; i >= 0; --i)
+        {
+            mRange >>= 1;
+            if((value >> i) & 1)
+            {
+                mLow += mRange;
+            }
+            Normalize();
+        }
+    }
+
+    void Flush()
+    {
+        for(int i = 0; i < 5; ++i)
+        {
+            ShiftLow();
+        }
+    }
+
+private:
+    void Normalize()
+    {
+        while(mRange < rangeTop)
+        {
+            mRange <<= 8;
+            ShiftLow();
+        }
+    }
+
+    // a byte is held back while a carry may still propagate into it
+    void ShiftLow()
+    {
+        if(static_cast<uint32_t>(mLow) < 0xFF000000u || (mLow >> 32) != 0)
+        {
+            const unsigned char carry = static_cast<unsigned char>(mLow >> 32);
+            unsigned char byte = mCache;
+            do
+            {
+                mOutput->push_back(static_cast<unsigned char>(byte + carry));
+                byte = 0xFF;
+            } while(--mCacheSize != 0);
+            mCache = static_cast<unsigned char>(mLow >> 24);
+        }
+        ++mCacheSize;
+        mLow = (mLow & 0x00FFFFFFu) << 8;
+    }
+
+    std::vector<unsigned char> *mOutput;
+    uint64_t mLow;
+    uint32_t mRange;
+    unsigned char mCache;
+    uint64_t mCacheSize;
+};
+
+class RangeDecoder
+{
+public:
+    RangeDecoder(const unsigned char *data, size_t size)
+        : mData(data), mEnd(data + size), mCode(0), mRange(0xFFFFFFFFu), mCorrupt(false)
+    {
+        for(int i = 0; i < 5; ++i)
+        {
+            mCode = (mCode << 8) | NextByte();
+        }
+    }
+
+    int DecodeBit(uint16_t &prob)
+    {
+        const uint32_t bound = (mRange >> probBits) * prob;
+        int bit = 0;
+        if(mCode < bound)
+        {
+            mRange = bound;
+            prob += ((1u << probBits) - prob) >> probMoveBits;
+        }
+        else
+        {
+            mCode -= bound;
+            mRange -= bound;
+            prob -= prob >> probMoveBits;
+            bit = 1;
+        }
+        Normalize();
+        return bit;
+    }
+
+    uint64_t DecodeDirect(int numBits)
+    {
+        uint64_t value = 0;
+        for(int i = 0; i < numBits; ++i)
+        {
+            mRange >>= 1;
+            int bit = 0;
+            if(mCode >= mRange)
+            {
+                mCode -= mRange;
+                bit = 1;
+            }
+            value = (value << 1) | static_cast<uint64_t>(bit);
+            Normalize();
+        }
+        return value;
+    }
+
+    void SetCorrupt() { mCorrupt = true; }
+
+    // true if the stream ended early or held an impossible code
+    bool IsCorrupt() const { return mCorrupt; }
+
+private:
+    void Normalize()
+    {
+        if(mRange < rangeTop)
+        {
+            mRange <<= 8;
+            mCode = (mCode << 8) | NextByte();
+        }
+    }
+
+    uint32_t NextByte()
+    {
+        if(mData == mEnd)
+        {
+            mCorrupt = true;
+            return 0;
+        }
+        return *mData++;
+    }
+
+    const unsigned char *mData;
+    const unsigned char *mEnd;
+    uint32_t mCode;
+    uint32_t mRange;
+    bool mCorrupt;
+};
+
+// Adaptive model of signed integers. The bit length of the zigzag code goes through a bit tree,
+// the two bits after its leading one have contexts and the remaining low bits are sent directly
+struct IntegerModel
+{
+    uint16_t Lengths[128];
+    uint16_t Bits[65][3];
+
+    IntegerModel()
+    {
+        std::fill(&Lengths[0], &Lengths[0] + 128, probInit);
+        std::fill(&Bits[0][0], &Bits[0][0] + 65 * 3, probInit);
+    }
+};
+
+void EncodeInteger(RangeEncoder &encoder, IntegerModel &model, int64_t value)
+{
+    const uint64_t code = (static_cast<uint64_t>(value) << 1) ^ static_cast<uint64_t>(value >> 63);
+    int length = 0;
+    for(uint64_t rest = code; rest != 0; rest >>= 1)
+    {
+        ++length;
+    }
+    for(int i = 6, node = 1; i >= 0; --i)
+    {
+        const int bit = (length >> i) & 1;
+        encoder.EncodeBit(model.Lengths[node], bit);
+        node = (node << 1) | bit;
+    }
+    if(length < 2)
+    {
+        return;
+    }
+    int remaining = length - 1;
+    const int first = static_cast<int>((code >> (remaining - 1)) & 1);
+    encoder.EncodeBit(model.Bits[length][0], first);
+    --remaining;
+    if(remaining > 0)
+    {
+        encoder.EncodeBit(model.Bits[length][1 + first], static_cast<int>((code >> (remaining - 1)) & 1));
+        --remaining;
+    }
+    encoder.EncodeDirect(code, remaining);
+}
+
+int64_t DecodeInteger(RangeDecoder &decoder, IntegerModel &model)
+{
+    int node = 1;
+    for(int i = 0; i < 7; ++i)
+    {
+        node = (node << 1) | decoder.DecodeBit(model.Lengths[node]);
+    }
+    const int length = node - 128;
+    if(length > 64)
+    {
+        decoder.SetCorrupt();
+        return 0;
+    }
+    uint64_t code = length == 0 ? 0 : 1;
+    if(length > 1)
+    {
+        int remaining = length - 1;
+        const int first = decoder.DecodeBit(model.Bits[length][0]);
+        code = (code << 1) | static_cast<uint64_t>(first);
+        --remaining;
+        if(remaining > 0)
+        {
+            code = (code << 1) | static_cast<uint64_t>(decoder.DecodeBit(model.Bits[length][1 + first]));
+            --remaining;
+        }
+        code = (code << remaining) | decoder.DecodeDirect(remaining);
+    }
+    return static_cast<int64_t>((code >> 1) ^ (~(code & 1) + 1));
+}
+
+bool Quantize(const std::vector<double> &values, double step, std::vector<int64_t> *quantized)
+{
+    quantized->resize(values.size());
+    for(size_t i = 0; i < values.size(); ++i)
+    {
+        const double q = std::floor(values[i] / step + 0.5);
+        if(!(std::fabs(q) < quantizedLimit))
+        {
+            return false;
+        }
+        (*quantized)[i] = static_cast<int64_t>(q);
+    }
+    return true;
+}
+
+// Octahedral coordinates of a direction, in [-scale, scale]. The lower hemisphere is folded over the diagonals
+void EncodeDirection(const double *dir, double scale, int64_t *coords)
+{
+    const double norm = std::fabs(dir[0]) + std::fabs(dir[1]) + std::fabs(dir[2]);
+    double u = 0.0, v = 0.0;
+    if(norm > 0.0)
+    {
+        u = dir[0] / norm;
+        v = dir[1] / norm;
+        if(dir[2] < 0.0)
+        {
+            const double foldedU = (1.0 - std::fabs(v)) * (u >= 0.0 ? 1.0 : -1.0);
+            const double foldedV = (1.0 - std::fabs(u)) * (v >= 0.0 ? 1.0 : -1.0);
+            u = foldedU;
+            v = foldedV;
+        }
+    }
+    coords[0] = static_cast<int64_t>(std::floor(u * scale + 0.5));
+    coords[1] = static_cast<int64_t>(std::floor(v * scale + 0.5));
+}
+
+void DecodeDirection(const int64_t *coords, double scale, double *dir)
+{
+    double u = static_cast<double>(coords[0]) / scale;
+    double v = static_cast<double>(coords[1]) / scale;
+    const double z = 1.0 - std::fabs(u) - std::fabs(v);
+    if(z < 0.0)
+    {
+        const double unfoldedU = (1.0 - std::fabs(v)) * (u >= 0.0 ? 1.0 : -1.0);
+        const double unfoldedV = (1.0 - std::fabs(u)) * (v >= 0.0 ? 1.0 : -1.0);
+        u = unfoldedU;
+        v = unfoldedV;
+    }
+    const double norm = std::sqrt(u * u + v * v + z * z);
+    dir[0] = u / norm;
+    dir[1] = v / norm;
+    dir[2] = z / norm;
+}
+
+// the largest octahedral coordinate for a number of bits
+double DirectionScale(uint32_t directionBits)
+{
+    return static_cast<double>((1u << (directionBits - 1)) - 1);
+}
+
+// Prediction of value k of spoke i from the spokes before it. Up and down spokes lie on the skeletal grid
+// and use the parallelogram of their left, upper and upper left neighbors, crest spokes use the previous one.
+// Unsigned arithmetic wraps, so corrupt residuals can't overflow.
+uint64_t Predict(const std::vector<int64_t> &values, size_t i, size_t k, size_t width, size_t nCols, bool grid)
+{
+    if(grid && nCols > 0 && i >= nCols)
+    {
+        const uint64_t above = static_cast<uint64_t>(values[(i - nCols) * width + k]);
+        if(i % nCols == 0)
+        {
+            return above;
+        }
+        return static_cast<uint64_t>(values[(i - 1) * width + k]) + above
+                - static_cast<uint64_t>(values[(i - nCols - 1) * width + k]);
+    }
+    return i > 0 ? static_cast<uint64_t>(values[(i - 1) * width + k]) : 0;
+}
+
+// What both coders need to predict a section: the grid, and for skeletal points of down and crest spokes
+// the quantized up points with the topology that matches them
+struct SectionLayout
+{
+    size_t Width;
+    size_t NumCols;
+    bool Grid;
+    const int32_t *References;
+    const std::vector<int64_t> *UpValues;
+};
+
+SectionLayout GetLayout(const vtkSrepArchiveHeader &header, const std::vector<int32_t> &topology,
+                        const std::vector<int64_t> &upPoints, int side, int section)
+{
+    SectionLayout layout;
+    layout.Width = section == vtkSrepFile::SkeletalPoints ? 3 : (section == vtkSrepFile::Directions ? 2 : 1);
+    layout.NumCols = static_cast<size_t>(header.nCols);
+    layout.Grid = side != vtkSrepFile::Crest
+            && header.numSpokes[side] == static_cast<uint64_t>(header.nRows) * static_cast<uint64_t>(header.nCols);
+    layout.References = nullptr;
+    layout.UpValues = nullptr;
+    if(section == vtkSrepFile::SkeletalPoints && side != vtkSrepFile::Up && !topology.empty())
+    {
+        layout.References = topology.data() + (side == vtkSrepFile::Down ? 0 : header.numSpokes[vtkSrepFile::Down]);
+        layout.UpValues = &upPoints;
+    }
+    return layout;
+}
+
+uint64_t PredictInLayout(const SectionLayout &layout, const std::vector<int64_t> &values, size_t i, size_t k)
+{
+    if(layout.References != nullptr && layout.References[i] >= 0)
+    {
+        return static_cast<uint64_t>((*layout.UpValues)[static_cast<size_t>(layout.References[i]) * 3 + k]);
+    }
+    return Predict(values, i, k, layout.Width, layout.NumCols, layout.Grid);
+}
+
+// quantized spokes of one side
+struct QuantizedSpokes
+{
+    std::vector<int64_t> Sections[3];
+};
+
+// models shared by the sides of a subject
+struct SubjectModels
+{
+    IntegerModel Sections[3];
+};
+
+void EncodeSubject(const vtkSrepArchiveHeader &header, const std::vector<int32_t> &topology,
+                   const QuantizedSpokes *sides, std::vector<unsigned char> *output)
+{
+    output->clear();
+    RangeEncoder encoder(output);
+    SubjectModels models;
+    for(int side = 0; side < 3; ++side)
+    {
+        for(int section = 0; section < 3; ++section)
+        {
+            const SectionLayout layout = GetLayout(header, topology, sides[vtkSrepFile::Up].Sections[vtkSrepFile::SkeletalPoints],
+                                                   side, section);
+            const std::vector<int64_t> &values = sides[side].Sections[section];
+            for(size_t i = 0; i < values.size() / layout.Width; ++i)
+            {
+                for(size_t k = 0; k < layout.Width; ++k)
+                {
+                    const uint64_t residual = static_cast<uint64_t>(values[i * layout.Width + k])
+                            - PredictInLayout(layout, values, i, k);
+                    EncodeInteger(encoder, models.Sections[section], static_cast<int64_t>(residual));
+                }
+            }
+        }
+    }
+    encoder.Flush();
+}
+
+// Decodes the sides of one subject in the order up, down, crest
+class SubjectDecoder
+{
+public:
+    SubjectDecoder(const vtkSrepArchiveHeader &header, const std::vector<int32_t> &topology,
+                   const unsigned char *data, size_t size)
+        : mHeader(header), mTopology(topology), mDecoder(data, size)
+    {
+    }
+
+    bool DecodeSide(int side, vtkSrepFile::Spokes *spokes)
+    {
+        const size_t numSpokes = static_cast<size_t>(mHeader.numSpokes[side]);
+        for(int section = 0; section < 3; ++section)
+        {
+            const SectionLayout layout = GetLayout(mHeader, mTopology, mUpPoints, side, section);
+            std::vector<int64_t> &values = section == vtkSrepFile::SkeletalPoints && side == vtkSrepFile::Up
+                    ? mUpPoints : mValues[section];
+            values.resize(numSpokes * layout.Width);
+            for(size_t i = 0; i < numSpokes; ++i)
+            {
+                for(size_t k = 0; k < layout.Width; ++k)
+                {
+                    const uint64_t residual = static_cast<uint64_t>(DecodeInteger(mDecoder, mModels.Sections[section]));
+                    values[i * layout.Width + k] = static_cast<int64_t>(PredictInLayout(layout, values, i, k) + residual);
+                }
+            }
+            if(mDecoder.IsCorrupt())
+            {
+                return false;
+            }
+        }
+
+        const std::vector<int64_t> &points = side == vtkSrepFile::Up ? mUpPoints : mValues[vtkSrepFile::SkeletalPoints];
+        spokes->SkeletalPoints.resize(3 * numSpokes);
+        for(size_t i = 0; i < points.size(); ++i)
+        {
+            spokes->SkeletalPoints[i] = static_cast<double>(points[i]) * mHeader.pointStep;
+        }
+        const double scale = DirectionScale(mHeader.directionBits);
+        spokes->Directions.resize(3 * numSpokes);
+        for(size_t i = 0; i < numSpokes; ++i)
+        {
+            DecodeDirection(&mValues[vtkSrepFile::Directions][2 * i], scale, &spokes->Directions[3 * i]);
+        }
+        spokes->Radii.resize(numSpokes);
+        for(size_t i = 0; i < numSpokes; ++i)
+        {
+            spokes->Radii[i] = static_cast<double>(mValues[vtkSrepFile::Radii][i]) * mHeader.radiusStep;
+        }
+        return true;
+    }
+
+private:
+    const vtkSrepArchiveHeader &mHeader;
+    const std::vector<int32_t> &mTopology;
+    RangeDecoder mDecoder;
+    SubjectModels mModels;
+    std::vector<int64_t> mUpPoints;
+    std::vector<int64_t> mValues[3];
+};
+
+// true if [offset, offset + length) lies within a file of this size
+inline bool InFile(uint64_t offset, uint64_t length, uint64_t size)
+{
+    return offset <= size && length <= size - offset;
+}
+}
+
+vtkSrepArchive::vtkSrepArchive()
+{
+    std::memset(&mHeader, 0, sizeof(mHeader));
+}
+
+vtkSrepArchive::~vtkSrepArchive()
+{
+    Close();
+}
+
+bool vtkSrepArchive::Open(const std::string &fileName)
+{
+    Close();
+    if(!mFile.Open(fileName))
+    {
+        std::cerr << "Cannot open the s-rep archive " << fileName << std::endl;
+        return false;
+    }
+    const uint64_t size = mFile.GetSize();
+    bool valid = size >= sizeof(vtkSrepArchiveHeader);
+    if(valid)
+    {
+        std::memcpy(&mHeader, mFile.GetData(), sizeof(mHeader));
+        valid = std::memcmp(mHeader.magic, archiveMagic, sizeof(archiveMagic)) == 0 && mHeader.version == archiveVersion
+                && mHeader.nRows >= 0 && mHeader.nCols >= 0 && mHeader.directionBits >= 8 && mHeader.directionBits <= 30
+                && mHeader.pointStep > 0.0 && std::isfinite(mHeader.pointStep)
+                && mHeader.radiusStep > 0.0 && std::isfinite(mHeader.radiusStep)
+                && mHeader.numSpokes[0] <= size && mHeader.numSpokes[1] <= size && mHeader.numSpokes[2] <= size
+                && mHeader.numSubjects <= size;
+    }
+    const uint64_t numReferences = valid ? mHeader.numSpokes[vtkSrepFile::Down] + mHeader.numSpokes[vtkSrepFile::Crest] : 0;
+    valid = valid && InFile(mHeader.topologyOffset, numReferences * sizeof(int32_t), size)
+            && InFile(mHeader.indexOffset, mHeader.numSubjects * sizeof(vtkSrepArchiveEntry), size)
+            && mHeader.namesOffset <= mHeader.indexOffset;
+    if(valid)
+    {
+        mTopology.resize(static_cast<size_t>(numReferences));
+        std::memcpy(mTopology.data(), mFile.GetData() + mHeader.topologyOffset, mTopology.size() * sizeof(int32_t));
+        for(size_t i = 0; i < mTopology.size() && valid; ++i)
+        {
+            valid = mTopology[i] >= -1 && static_cast<int64_t>(mTopology[i]) < static_cast<int64_t>(mHeader.numSpokes[vtkSrepFile::Up]);
+        }
+    }
+    if(valid)
+    {
+        mIndex.resize(static_cast<size_t>(mHeader.numSubjects));
+        std::memcpy(mIndex.data(), mFile.GetData() + mHeader.indexOffset, mIndex.size() * sizeof(vtkSrepArchiveEntry));
+        const uint64_t namesSize = mHeader.indexOffset - mHeader.namesOffset;
+        for(size_t i = 0; i < mIndex.size() && valid; ++i)
+        {
+            const vtkSrepArchiveEntry &entry = mIndex[i];
+            valid = entry.offset >= sizeof(vtkSrepArchiveHeader) && InFile(entry.offset, entry.size, size)
+                    && InFile(entry.nameOffset, entry.nameLength, namesSize);
+            if(valid)
+            {
+                mSubjects[GetSubjectName(i)] = i;
+            }
+        }
+    }
+    if(!valid && std::memcmp(mHeader.magic, archiveMagic, sizeof(archiveMagic)) == 0
+            && mHeader.version == archiveVersionSwapped)
+    {
+        std::cerr << fileName << " was written on a host of the other byte order." << std::endl;
+        Close();
+        return false;
+    }
+    if(!valid)
+    {
+        std::cerr << fileName << " is not a valid s-rep archive." << std::endl;
+        Close();
+        return false;
+    }
+    return true;
+}
+
+void vtkSrepArchive::Close()
+{
+    mFile.Close();
+    std::memset(&mHeader, 0, sizeof(mHeader));
+    mIndex.clear();
+    mTopology.clear();
+    mSubjects.clear();
+}
+
+std::string vtkSrepArchive::GetSubjectName(size_t subject) const
+{
+    const vtkSrepArchiveEntry &entry = mIndex[subject];
+    return std::string(mFile.GetData() + mHeader.namesOffset + entry.nameOffset, entry.nameLength);
+}
+
+double vtkSrepArchive::GetCrestShift(size_t subject) const
+{
+    return mIndex[subject].crestShift;
+}
+
+long long vtkSrepArchive::FindSubject(const std::string &name) const
+{
+    std::map<std::string, size_t>::const_iterator found = mSubjects.find(name);
+    return found == mSubjects.end() ? -1 : static_cast<long long>(found->second);
+}
+
+bool vtkSrepArchive::ReadSubject(size_t subject, vtkSrepFile::Spokes *sides) const
+{
+    if(subject >= mIndex.size())
+    {
+        return false;
+    }
+    const vtkSrepArchiveEntry &entry = mIndex[subject];
+    SubjectDecoder decoder(mHeader, mTopology, reinterpret_cast<const unsigned char*>(mFile.GetData() + entry.offset),
+                           static_cast<size_t>(entry.size));
+    for(int side = 0; side < 3; ++side)
+    {
+        if(!decoder.DecodeSide(side, &sides[side]))
+        {
+            std::cerr << "Subject " << GetSubjectName(subject) << " of the s-rep archive is corrupt." << std::endl;
+            return false;
+        }
+    }
+    return true;
+}
+
+vtkSrep *vtkSrepArchive::ReadSrep(size_t subject) const
+{
+    if(subject >= mIndex.size())
+    {
+        return nullptr;
+    }
+    if(GetNumberOfSpokes(vtkSrepFile::Up) != static_cast<size_t>(mHeader.nRows) * static_cast<size_t>(mHeader.nCols))
+    {
+        std::cerr << "The up spokes of the s-rep archive do not form its grid." << std::endl;
+        return nullptr;
+    }
+    const vtkSrepArchiveEntry &entry = mIndex[subject];
+    SubjectDecoder decoder(mHeader, mTopology, reinterpret_cast<const unsigned char*>(mFile.GetData() + entry.offset),
+                           static_cast<size_t>(entry.size));
+    vtkSrepFile::Spokes spokes;
+    vtkSrep *srep = nullptr;
+    for(int side = 0; side < 3; ++side)
+    {
+        if(!decoder.DecodeSide(side, &spokes))
+        {
+            std::cerr << "Subject " << GetSubjectName(subject) << " of the s-rep archive is corrupt." << std::endl;
+            delete srep;
+            return nullptr;
+        }
+        if(side == vtkSrepFile::Up)
+        {
+            srep = new vtkSrep(mHeader.nRows, mHeader.nCols, spokes.Radii, spokes.Directions, spokes.SkeletalPoints);
+        }
+        else
+        {
+            srep->AddSpokes(spokes.Radii, spokes.Directions, spokes.SkeletalPoints);
+        }
+    }
+    return srep;
+}
+
+bool vtkSrepArchive::IsSrepArchive(const std::string &fileName)
+{
+    return vtksys::SystemTools::LowerCase(vtksys::SystemTools::GetFilenameLastExtension(fileName)) == ".sreps";
+}
+
+vtkSrepArchiveWriter::vtkSrepArchiveWriter()
+{
+    std::memset(&mHeader, 0, sizeof(mHeader));
+}
+
+vtkSrepArchiveWriter::~vtkSrepArchiveWriter()
+{
+    Abort();
+}
+
+bool vtkSrepArchiveWriter::Create(const std::string &fileName, int nRows, int nCols,
+                                  double pointStep, double radiusStep, int directionBits)
+{
+    Abort();
+    if(nRows < 0 || nCols < 0 || !(pointStep > 0.0) || !(radiusStep > 0.0) || directionBits < 8 || directionBits > 30)
+    {
+        std::cerr << "Invalid parameters for the s-rep archive " << fileName << std::endl;
+        return false;
+    }
+    std::memset(&mHeader, 0, sizeof(mHeader));
+    std::memcpy(mHeader.magic, archiveMagic, sizeof(archiveMagic));
+    mHeader.version = archiveVersion;
+    mHeader.nRows = nRows;
+    mHeader.nCols = nCols;
+    mHeader.directionBits = static_cast<uint32_t>(directionBits);
+    mHeader.pointStep = pointStep;
+    mHeader.radiusStep = radiusStep;
+    mIndex.clear();
+    mTopology.clear();
+    mNames.clear();
+
+    // unique temporary name per process and thread
+    std::stringstream tempName;
+    tempName << fileName << ".tmp" << std::chrono::steady_clock::now().time_since_epoch().count()
+             << "_" << std::this_thread::get_id();
+    mFileName = fileName;
+    mTempFileName = tempName.str();
+    mStream.open(mTempFileName.c_str(), std::ios::binary);
+    // the header is written again by Commit
+    mStream.write(reinterpret_cast<const char*>(&mHeader), sizeof(mHeader));
+    if(!mStream)
+    {
+        std::cerr << "Failed to write the s-rep archive " << mTempFileName << std::endl;
+        Abort();
+        return false;
+    }
+    return true;
+}
+
+bool vtkSrepArchiveWriter::AddSubject(const std::string &name, double crestShift, const vtkSrepFile::Spokes *sides)
+{
+    if(!mStream.is_open())
+    {
+        return false;
+    }
+    for(int side = 0; side < 3; ++side)
+    {
+        const vtkSrepFile::Spokes &spokes = sides[side];
+        const uint64_t numSpokes = spokes.Radii.size();
+        if(spokes.SkeletalPoints.size() != 3 * numSpokes || spokes.Directions.size() != 3 * numSpokes
+                || (!mIndex.empty() && numSpokes != mHeader.numSpokes[side]))
+        {
+            std::cerr << "The " << vtkSrepFile::GetSideName(side) << " spokes of " << name
+                      << " do not match the s-rep archive." << std::endl;
+            return false;
+        }
+    }
+
+    QuantizedSpokes quantized[3];
+    const double scale = DirectionScale(mHeader.directionBits);
+    for(int side = 0; side < 3; ++side)
+    {
+        if(!Quantize(sides[side].SkeletalPoints, mHeader.pointStep, &quantized[side].Sections[vtkSrepFile::SkeletalPoints])
+                || !Quantize(sides[side].Radii, mHeader.radiusStep, &quantized[side].Sections[vtkSrepFile::Radii]))
+        {
+            std::cerr << "The " << vtkSrepFile::GetSideName(side) << " spokes of " << name
+                      << " are out of the range of the s-rep archive." << std::endl;
+            return false;
+        }
+        std::vector<int64_t> &directions = quantized[side].Sections[vtkSrepFile::Directions];
+        directions.resize(2 * sides[side].Radii.size());
+        for(size_t i = 0; i < sides[side].Radii.size(); ++i)
+        {
+            EncodeDirection(&sides[side].Directions[3 * i], scale, &directions[2 * i]);
+        }
+    }
+
+    if(mIndex.empty())
+    {
+        // The first subject fixes the spoke counts and the topology: each down and crest spoke refers to
+        // the up spoke nearest to its skeletal point, which predicts that point in every subject
+        for(int side = 0; side < 3; ++side)
+        {
+            mHeader.numSpokes[side] = sides[side].Radii.size();
+        }
+        const std::vector<double> &upPoints = sides[vtkSrepFile::Up].SkeletalPoints;
+        for(int side = vtkSrepFile::Down; side <= vtkSrepFile::Crest; ++side)
+        {
+            const std::vector<double> &points = sides[side].SkeletalPoints;
+            for(size_t i = 0; i < sides[side].Radii.size(); ++i)
+            {
+                int32_t nearest = -1;
+                double nearestDistance = 0.0;
+                for(size_t j = 0; j < upPoints.size() / 3; ++j)
+                {
+                    const double dx = points[3 * i] - upPoints[3 * j];
+                    const double dy = points[3 * i + 1] - upPoints[3 * j + 1];
+                    const double dz = points[3 * i + 2] - upPoints[3 * j + 2];
+                    const double distance = dx * dx + dy * dy + dz * dz;
+                    if(nearest < 0 || distance < nearestDistance)
+                    {
+                        nearest = static_cast<int32_t>(j);
+                        nearestDistance = distance;
+                    }
+                }
+                mTopology.push_back(nearest);
+            }
+        }
+    }
+    else if(mSubjectNames.count(name) != 0)
+    {
+        std::cerr << "The s-rep archive already has a subject " << name << std::endl;
+        return false;
+    }
+
+    EncodeSubject(mHeader, mTopology, quantized, &mBuffer);
+    vtkSrepArchiveEntry entry;
+    std::memset(&entry, 0, sizeof(entry));
+    entry.offset = mIndex.empty() ? sizeof(vtkSrepArchiveHeader) : mIndex.back().offset + mIndex.back().size;
+    entry.size = mBuffer.size();
+    entry.crestShift = crestShift;
+    entry.nameOffset = static_cast<uint32_t>(mNames.size());
+    entry.nameLength = static_cast<uint32_t>(name.size());
+    mStream.write(reinterpret_cast<const char*>(mBuffer.data()), static_cast<std::streamsize>(mBuffer.size()));
+    if(!mStream)
+    {
+        std::cerr << "Failed to write the s-rep archive " << mTempFileName << std::endl;
+        Abort();
+        return false;
+    }
+    mIndex.push_back(entry);
+    mNames += name;
+    mSubjectNames.insert(name);
+    return true;
+}
+
+bool vtkSrepArchiveWriter::Commit()
+{
+    if(!mStream.is_open())
+    {
+        return false;
+    }
+    const uint64_t topologyOffset = mIndex.empty() ? sizeof(vtkSrepArchiveHeader) : mIndex.back().offset + mIndex.back().size;
+    mHeader.numSubjects = mIndex.size();
+    mHeader.topologyOffset = topologyOffset;
+    mHeader.namesOffset = topologyOffset + mTopology.size() * sizeof(int32_t);
+    mHeader.indexOffset = mHeader.namesOffset + mNames.size();
+    mStream.write(reinterpret_cast<const char*>(mTopology.data()), static_cast<std::streamsize>(mTopology.size() * sizeof(int32_t)));
+    mStream.write(mNames.data(), static_cast<std::streamsize>(mNames.size()));
+    mStream.write(reinterpret_cast<const char*>(mIndex.data()),
+                  static_cast<std::streamsize>(mIndex.size() * sizeof(vtkSrepArchiveEntry)));
+    mStream.seekp(0);
+    mStream.write(reinterpret_cast<const char*>(&mHeader), sizeof(mHeader));
+    mStream.close();
+    if(!mStream)
+    {
+        std::cerr << "Failed to write the s-rep archive " << mTempFileName << std::endl;
+        Abort();
+        return false;
+    }
+    if(!vtkMappedFile::Replace(mTempFileName, mFileName))
+    {
+        std::cerr << "Failed to write the s-rep archive " << mFileName << std::endl;
+        Abort();
+        return false;
+    }
+    mTempFileName.clear();
+    return true;
+}
+
+void vtkSrepArchiveWriter::Abort()
+{
+    if(mStream.is_open())
+    {
+        mStream.close();
+    }
+    mStream.clear();
+    if(!mTempFileName.empty())
+    {
+        std::remove(mTempFileName.c_str());
+        mTempFileName.clear();
+    }
+    mSubjectNames.clear();
+}
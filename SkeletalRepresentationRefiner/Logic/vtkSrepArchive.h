@@ -0,0 +1,162 @@
+/*==============================================================================
+
+  Program: 3D Slicer
+
+  Portions (c) Copyright Brigham and Women's Hospital (BWH) All Rights Reserved.
+
+  See COPYRIGHT.txt
+  or http://www.slicer.org/copyright/copyright.txt for details.
+
+  Unless required by applicable law or agreed to in writing, software
+  distributed under the License is distributed on an "AS IS" BASIS,
+  WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+  See the License for the specific language governing permissions and
+  limitations under the License.
+
+==============================================================================*/
+
+
+#ifndef VTKSREPARCHIVE_H
+#define VTKSREPARCHIVE_H
+
+#include "vtkSlicerSkeletalRepresentationRefinerModuleLogicExport.h"
+#include "vtkMappedFile.h"
+#include "vtkSrepFile.h"
+
+#include <fstream>
+#include <map>
+#include <set>
+#include <stddef.h>
+#include <stdint.h>
+#include <string>
+#include <vector>
+
+class vtkSrep;
+
+// Fixed-size header of an s-rep archive. The header, the topology and the index are in the byte order of
+// the host that wrote the archive, all supported platforms are little-endian, and Open rejects the other order.
+// The range coded subjects are byte streams and don't depend on it.
+// The header is followed by the compressed subjects, then by the topology, the subject names and the index.
+struct vtkSrepArchiveHeader
+{
+    char magic[8];              // "SREPARC"
+    uint32_t version;
+    int32_t nRows;
+    int32_t nCols;
+    uint32_t directionBits;     // bits per octahedral coordinate of a direction
+    uint64_t numSubjects;
+    uint64_t numSpokes[3];      // up, down, crest, the same for all subjects
+    double pointStep;           // quantization step of skeletal points
+    double radiusStep;          // quantization step of radii
+    uint64_t topologyOffset;    // int32 per down and crest spoke: the nearest up spoke, or -1
+    uint64_t namesOffset;
+    uint64_t indexOffset;       // one vtkSrepArchiveEntry per subject
+    uint64_t reserved[4];
+};
+
+// Index entry of one subject in an s-rep archive
+struct vtkSrepArchiveEntry
+{
+    uint64_t offset;
+    uint64_t size;
+    double crestShift;
+    uint32_t nameOffset;        // from namesOffset
+    uint32_t nameLength;
+};
+
+/**
+ * @brief The vtkSrepArchive class
+ * Read-only access to an archive of many s-reps of the same grid, e.g. the refined s-reps of a shape study.
+ * The grid and the spoke counts are stored once. Per subject, skeletal points and radii are quantized
+ * with fixed steps and directions are quantized in octahedral coordinates, then each value is predicted
+ * from its neighbors on the grid and the residuals are range coded. Subjects are coded independently,
+ * so any one of them is decoded without touching the others. Reading is const and thread-safe.
+ */
+class VTK_SLICER_SKELETALREPRESENTATIONREFINER_MODULE_LOGIC_EXPORT vtkSrepArchive
+{
+public:
+    vtkSrepArchive();
+    ~vtkSrepArchive();
+
+    // Map the archive and read its index. Return false if it is not a valid archive
+    bool Open(const std::string &fileName);
+
+    // Unmap the archive
+    void Close();
+
+    bool IsOpen() const { return mFile.IsOpen(); }
+
+    int GetNumberOfRows() const { return mHeader.nRows; }
+    int GetNumberOfColumns() const { return mHeader.nCols; }
+    size_t GetNumberOfSpokes(int side) const { return static_cast<size_t>(mHeader.numSpokes[side]); }
+    size_t GetNumberOfSubjects() const { return static_cast<size_t>(mHeader.numSubjects); }
+
+    std::string GetSubjectName(size_t subject) const;
+    double GetCrestShift(size_t subject) const;
+
+    // Index of the subject with this name, -1 if there is none
+    long long FindSubject(const std::string &name) const;
+
+    // Decode the spokes of all sides of one subject, in the order of vtkSrepFile::Side
+    bool ReadSubject(size_t subject, vtkSrepFile::Spokes *sides) const;
+
+    // Decode one subject into an s-rep of up, down and crest spokes, like the refiner builds it from spoke files.
+    // Each side is added to the s-rep as soon as it is decoded. The caller deletes the s-rep
+    vtkSrep *ReadSrep(size_t subject) const;
+
+    // true if fileName has the extension of archives, .sreps
+    static bool IsSrepArchive(const std::string &fileName);
+
+private:
+    vtkMappedFile mFile;
+    vtkSrepArchiveHeader mHeader;
+    std::vector<vtkSrepArchiveEntry> mIndex;
+    std::vector<int32_t> mTopology;
+    std::map<std::string, size_t> mSubjects;
+
+    vtkSrepArchive(const vtkSrepArchive&); // Not implemented
+    void operator=(const vtkSrepArchive&); // Not implemented
+};
+
+/**
+ * @brief The vtkSrepArchiveWriter class
+ * Writes an s-rep archive one subject at a time. All subjects need the same grid and spoke counts.
+ * The archive is written under a temporary name and renamed by Commit, so readers never see a partial file.
+ */
+class VTK_SLICER_SKELETALREPRESENTATIONREFINER_MODULE_LOGIC_EXPORT vtkSrepArchiveWriter
+{
+public:
+    vtkSrepArchiveWriter();
+
+    // Removes the temporary file unless Commit succeeded
+    ~vtkSrepArchiveWriter();
+
+    // Start an archive. The steps bound the error of skeletal points and radii to half a step,
+    // directionBits (8 to 30) sets the angular resolution of directions
+    bool Create(const std::string &fileName, int nRows, int nCols,
+                double pointStep = 1e-4, double radiusStep = 1e-4, int directionBits = 16);
+
+    // Compress one subject and append it. The first subject fixes the spoke counts and the topology
+    bool AddSubject(const std::string &name, double crestShift, const vtkSrepFile::Spokes *sides);
+
+    // Write the topology and the index, then move the archive to its file name
+    bool Commit();
+
+private:
+    void Abort();
+
+    std::string mFileName;
+    std::string mTempFileName;
+    std::ofstream mStream;
+    vtkSrepArchiveHeader mHeader;
+    std::vector<vtkSrepArchiveEntry> mIndex;
+    std::vector<int32_t> mTopology;
+    std::string mNames;
+    std::set<std::string> mSubjectNames;
+    std::vector<unsigned char> mBuffer;
+
+    vtkSrepArchiveWriter(const vtkSrepArchiveWriter&); // Not implemented
+    void operator=(const vtkSrepArchiveWriter&); // Not implemented
+};
+
+#endif // VTKSREPARCHIVE_H
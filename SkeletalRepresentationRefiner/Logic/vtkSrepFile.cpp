@@ -0,0 +1,247 @@
+/*==============================================================================
+
+  Program: 3D Slicer
+
+  Portions (c) Copyright Brigham and Women's Hospital (BWH) All Rights Reserved.
+
+  See COPYRIGHT.txt
+  or http://www.slicer.org/copyright/copyright.txt for details.
+
+  Unless required by applicable law or agreed to in writing, software
+  distributed under the License is distributed on an "AS IS" BASIS,
+  WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+  See the License for the specific language governing permissions and
+  limitations under the License.
+
+==============================================================================*/
+
+#include "vtkSrepFile.h"
+
+#include <vtksys/SystemTools.hxx>
+
+#include <chrono>
+#include <cstdio>
+#include <cstring>
+#include <fstream>
+#include <iostream>
+#include <sstream>
+#include <thread>
+
+namespace
+{
+const char srepMagic[8] = {'S', 'R', 'E', 'P', 'B', 'I', 'N', '\0'};
+const uint32_t srepVersion = 1;
+// the version as a host of the other byte order reads it
+const uint32_t srepVersionSwapped = ((srepVersion & 0xFFu) << 24) | ((srepVersion & 0xFF00u) << 8)
+                                    | ((srepVersion >> 8) & 0xFF00u) | (srepVersion >> 24);
+static_assert(sizeof(vtkSrepFileHeader) == 128, "the header of s-rep containers must be 128 bytes");
+
+const char *sideNames[3] = {"up", "down", "crest"};
+
+// number of values of a section per spoke
+inline uint64_t SectionWidth(int section)
+{
+    return section == vtkSrepFile::Radii ? 1 : 3;
+}
+}
+
+vtkSrepFile::vtkSrepFile()
+{
+    std::memset(&mHeader, 0, sizeof(mHeader));
+}
+
+vtkSrepFile::~vtkSrepFile()
+{
+    Close();
+}
+
+bool vtkSrepFile::Open(const std::string &fileName)
+{
+    Close();
+    if(!mFile.Open(fileName))
+    {
+        std::cerr << "Cannot open the s-rep " << fileName << std::endl;
+        return false;
+    }
+    bool valid = mFile.GetSize() >= sizeof(vtkSrepFileHeader);
+    if(valid)
+    {
+        std::memcpy(&mHeader, mFile.GetData(), sizeof(mHeader));
+        valid = std::memcmp(mHeader.magic, srepMagic, sizeof(srepMagic)) == 0 && mHeader.version == srepVersion
+                && mHeader.nRows >= 0 && mHeader.nCols >= 0;
+    }
+    // every section has to lie within the file
+    const uint64_t size = mFile.GetSize();
+    for(int side = 0; side < 3 && valid; ++side)
+    {
+        for(int section = 0; section < 3 && valid; ++section)
+        {
+            const uint64_t offset = mHeader.offsets[side][section];
+            const uint64_t numValues = SectionWidth(section) * mHeader.numSpokes[side];
+            valid = offset % sizeof(double) == 0 && offset >= sizeof(vtkSrepFileHeader) && offset <= size
+                    && mHeader.numSpokes[side] <= size && (size - offset) / sizeof(double) >= numValues;
+        }
+    }
+    if(!valid && std::memcmp(mHeader.magic, srepMagic, sizeof(srepMagic)) == 0
+            && mHeader.version == srepVersionSwapped)
+    {
+        std::cerr << fileName << " was written on a host of the other byte order." << std::endl;
+        Close();
+        return false;
+    }
+    if(!valid)
+    {
+        std::cerr << fileName << " is not a valid s-rep container." << std::endl;
+        Close();
+        return false;
+    }
+    return true;
+}
+
+void vtkSrepFile::Close()
+{
+    mFile.Close();
+    std::memset(&mHeader, 0, sizeof(mHeader));
+}
+
+const double *vtkSrepFile::GetSection(int side, int section) const
+{
+    if(!IsOpen())
+    {
+        return nullptr;
+    }
+    return reinterpret_cast<const double*>(mFile.GetData() + mHeader.offsets[side][section]);
+}
+
+void vtkSrepFile::GetSpokes(int side, Spokes *spokes) const
+{
+    const size_t numSpokes = GetNumberOfSpokes(side);
+    const double *points = GetSection(side, SkeletalPoints);
+    const double *directions = GetSection(side, Directions);
+    const double *radii = GetSection(side, Radii);
+    spokes->SkeletalPoints.assign(points, points + 3 * numSpokes);
+    spokes->Directions.assign(directions, directions + 3 * numSpokes);
+    spokes->Radii.assign(radii, radii + numSpokes);
+}
+
+bool vtkSrepFile::Write(const std::string &fileName, int nRows, int nCols, double crestShift, const Spokes *sides)
+{
+    vtkSrepFileHeader header;
+    std::memset(&header, 0, sizeof(header));
+    std::memcpy(header.magic, srepMagic, sizeof(srepMagic));
+    header.version = srepVersion;
+    header.nRows = nRows;
+    header.nCols = nCols;
+    header.crestShift = crestShift;
+    uint64_t offset = sizeof(header);
+    for(int side = 0; side < 3; ++side)
+    {
+        const Spokes &spokes = sides[side];
+        header.numSpokes[side] = spokes.Radii.size();
+        if(spokes.SkeletalPoints.size() != 3 * spokes.Radii.size() || spokes.Directions.size() != 3 * spokes.Radii.size())
+        {
+            std::cerr << "The " << sideNames[side] << " spokes of " << fileName << " are incomplete." << std::endl;
+            return false;
+        }
+        for(int section = 0; section < 3; ++section)
+        {
+            header.offsets[side][section] = offset;
+            offset += SectionWidth(section) * header.numSpokes[side] * sizeof(double);
+        }
+    }
+
+    // unique temporary name per process and thread
+    std::stringstream tempName;
+    tempName << fileName << ".tmp" << std::chrono::steady_clock::now().time_since_epoch().count()
+             << "_" << std::this_thread::get_id();
+    {
+        std::ofstream file(tempName.str().c_str(), std::ios::binary);
+        file.write(reinterpret_cast<const char*>(&header), sizeof(header));
+        for(int side = 0; side < 3; ++side)
+        {
+            const std::vector<double> *sections[3] = {&sides[side].SkeletalPoints, &sides[side].Directions,
+                                                      &sides[side].Radii};
+            for(int section = 0; section < 3; ++section)
+            {
+                file.write(reinterpret_cast<const char*>(sections[section]->data()),
+                           static_cast<std::streamsize>(sections[section]->size() * sizeof(double)));
+            }
+        }
+        if(!file)
+        {
+            std::cerr << "Failed to write the s-rep " << tempName.str() << std::endl;
+            file.close();
+            std::remove(tempName.str().c_str());
+            return false;
+        }
+    }
+    if(!vtkMappedFile::Replace(tempName.str(), fileName))
+    {
+        std::cerr << "Failed to write the s-rep " << fileName << std::endl;
+        std::remove(tempName.str().c_str());
+        return false;
+    }
+    return true;
+}
+
+bool vtkSrepFile::WriteSide(const std::string &fileName, int side, const Spokes &spokes)
+{
+    Spokes sides[3];
+    int nRows = 0, nCols = 0;
+    double crestShift = 0.0;
+    {
+        vtkSrepFile srepFile;
+        if(!srepFile.Open(fileName))
+        {
+            return false;
+        }
+        nRows = srepFile.GetNumberOfRows();
+        nCols = srepFile.GetNumberOfColumns();
+        crestShift = srepFile.GetCrestShift();
+        for(int i = 0; i < 3; ++i)
+        {
+            if(i != side)
+            {
+                srepFile.GetSpokes(i, &sides[i]);
+            }
+        }
+    }
+    // the mapping is closed before the file is replaced
+    sides[side] = spokes;
+    return Write(fileName, nRows, nCols, crestShift, sides);
+}
+
+bool vtkSrepFile::IsSrepFile(const std::string &fileName)
+{
+    return vtksys::SystemTools::LowerCase(vtksys::SystemTools::GetFilenameLastExtension(fileName)) == ".srep";
+}
+
+const char *vtkSrepFile::GetSideName(int side)
+{
+    return sideNames[side];
+}
+
+std::string vtkSrepFile::GetSideFileName(const std::string &fileName, int side)
+{
+    return fileName + "#" + sideNames[side];
+}
+
+bool vtkSrepFile::SplitSideFileName(const std::string &sideFileName, std::string *fileName, int *side)
+{
+    const size_t separator = sideFileName.rfind('#');
+    if(separator == std::string::npos || !IsSrepFile(sideFileName.substr(0, separator)))
+    {
+        return false;
+    }
+    const std::string name = sideFileName.substr(separator + 1);
+    for(int i = 0; i < 3; ++i)
+    {
+        if(name == sideNames[i])
+        {
+            *fileName = sideFileName.substr(0, separator);
+            *side = i;
+            return true;
+        }
+    }
+    return false;
+}
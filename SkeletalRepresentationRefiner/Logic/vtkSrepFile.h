@@ -0,0 +1,126 @@
+/*==============================================================================
+
+  Program: 3D Slicer
+
+  Portions (c) Copyright Brigham and Women's Hospital (BWH) All Rights Reserved.
+
+  See COPYRIGHT.txt
+  or http://www.slicer.org/copyright/copyright.txt for details.
+
+  Unless required by applicable law or agreed to in writing, software
+  distributed under the License is distributed on an "AS IS" BASIS,
+  WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+  See the License for the specific language governing permissions and
+  limitations under the License.
+
+==============================================================================*/
+
+#ifndef VTKSREPFILE_H
+#define VTKSREPFILE_H
+
+#include "vtkSlicerSkeletalRepresentationRefinerModuleLogicExport.h"
+#include "vtkMappedFile.h"
+
+#include <stddef.h>
+#include <stdint.h>
+#include <string>
+#include <vector>
+
+// Fixed-size header of an s-rep container file. Numbers are in the byte order of the host that wrote the file,
+// so sections can be used in place; all supported platforms are little-endian. Open rejects the other order.
+// The header is followed by 9 sections of float64 values. For each of the up, down and crest spokes:
+// skeletal points (x, y, z per spoke), spoke directions (x, y, z per spoke) and radii (1 per spoke).
+// Sections start at multiples of 8 bytes, so they can be read in place from a mapping of the file.
+struct vtkSrepFileHeader
+{
+    char magic[8];           // "SREPBIN"
+    uint32_t version;
+    int32_t nRows;
+    int32_t nCols;
+    uint32_t reserved;
+    double crestShift;
+    uint64_t numSpokes[3];   // up, down, crest
+    uint64_t offsets[3][3];  // [side][section] in bytes from the start of the file
+};
+
+/**
+ * @brief The vtkSrepFile class
+ * Single-file binary container of an s-rep, the alternative to a header.xml with up, down and crest .vtp files.
+ * Opening maps the file and reads the header only, the pages of a section are read when it is accessed.
+ * The sides of a container have names like "model.srep#up", which stand for the spoke files wherever
+ * the XML header names one.
+ */
+class VTK_SLICER_SKELETALREPRESENTATIONREFINER_MODULE_LOGIC_EXPORT vtkSrepFile
+{
+public:
+    enum Side
+    {
+        Up = 0,
+        Down = 1,
+        Crest = 2
+    };
+
+    enum Section
+    {
+        SkeletalPoints = 0,
+        Directions = 1,
+        Radii = 2
+    };
+
+    // the spokes of one side, in the order of the spoke files
+    struct Spokes
+    {
+        std::vector<double> SkeletalPoints;
+        std::vector<double> Directions;
+        std::vector<double> Radii;
+    };
+
+    vtkSrepFile();
+    ~vtkSrepFile();
+
+    // Map the file and check its header. Return false if it is not a valid container
+    bool Open(const std::string &fileName);
+
+    // Unmap the file
+    void Close();
+
+    bool IsOpen() const { return mFile.IsOpen(); }
+
+    int GetNumberOfRows() const { return mHeader.nRows; }
+    int GetNumberOfColumns() const { return mHeader.nCols; }
+    double GetCrestShift() const { return mHeader.crestShift; }
+    size_t GetNumberOfSpokes(int side) const { return static_cast<size_t>(mHeader.numSpokes[side]); }
+
+    // The values of a section in the mapped file, 3 per spoke for points and directions, 1 for radii
+    const double *GetSection(int side, int section) const;
+
+    // Copy all sections of one side
+    void GetSpokes(int side, Spokes *spokes) const;
+
+    // Write a container. It is written under a temporary name and renamed, so readers never see a partial file
+    static bool Write(const std::string &fileName, int nRows, int nCols, double crestShift, const Spokes *sides);
+
+    // Replace the spokes of one side of an existing container
+    static bool WriteSide(const std::string &fileName, int side, const Spokes &spokes);
+
+    // true if fileName has the extension of containers, .srep
+    static bool IsSrepFile(const std::string &fileName);
+
+    // "up", "down" or "crest"
+    static const char *GetSideName(int side);
+
+    // the name that stands for the spoke file of one side of a container
+    static std::string GetSideFileName(const std::string &fileName, int side);
+
+    // Split a name made by GetSideFileName. Return false for any other name
+    static bool SplitSideFileName(const std::string &sideFileName, std::string *fileName, int *side);
+
+private:
+    vtkMappedFile mFile;
+    vtkSrepFileHeader mHeader;
+
+    vtkSrepFile(const vtkSrepFile&); // Not implemented
+    void operator=(const vtkSrepFile&); // Not implemented
+};
+
+#endif // VTKSREPFILE_H
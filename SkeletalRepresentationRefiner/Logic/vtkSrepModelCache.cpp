@@ -0,0 +1,203 @@
+/*==============================================================================
+
+  Program: 3D Slicer
+
+  Portions (c) Copyright Brigham and Women's Hospital (BWH) All Rights Reserved.
+
+  See COPYRIGHT.txt
+  or http://www.slicer.org/copyright/copyright.txt for details.
+
+  Unless required by applicable law or agreed to in writing, software
+  distributed under the License is distributed on an "AS IS" BASIS,
+  WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+  See the License for the specific language governing permissions and
+  limitations under the License.
+
+==============================================================================*/
+
+#include "vtkSrepModelCache.h"
+
+#include <vtkPolyData.h>
+
+vtkSrepModelCache::vtkSrepModelCache()
+{
+}
+
+const vtkSrepModelCache::Header *vtkSrepModelCache::FindHeader(const std::string &headerFileName)
+{
+    std::map<std::string, HeaderEntry>::iterator found = mHeaders.find(headerFileName);
+    if(found == mHeaders.end())
+    {
+        return nullptr;
+    }
+    if(!(found->second.HeaderStamp == GetStamp(headerFileName)))
+    {
+        mHeaders.erase(found);
+        return nullptr;
+    }
+    return &found->second.Contents;
+}
+
+const vtkSrepModelCache::Header *vtkSrepModelCache::StoreHeader(const std::string &headerFileName,
+                                                                const Header &header)
+{
+    HeaderEntry &entry = mHeaders[headerFileName];
+    entry.HeaderStamp = GetStamp(headerFileName);
+    entry.Contents = header;
+    entry.HasTransform = false;
+    entry.InterpolatedSpokes.clear();
+    return &entry.Contents;
+}
+
+const vtkSrepFile::Spokes *vtkSrepModelCache::FindSpokes(const std::string &spokeFileName)
+{
+    std::map<std::string, SpokesEntry>::iterator found = mSpokes.find(spokeFileName);
+    if(found == mSpokes.end())
+    {
+        return nullptr;
+    }
+    if(!(found->second.SpokesStamp == GetStamp(spokeFileName)))
+    {
+        mSpokes.erase(found);
+        return nullptr;
+    }
+    return &found->second.Contents;
+}
+
+const vtkSrepFile::Spokes *vtkSrepModelCache::StoreSpokes(const std::string &spokeFileName,
+                                                          const vtkSrepFile::Spokes &spokes)
+{
+    SpokesEntry &entry = mSpokes[spokeFileName];
+    entry.SpokesStamp = GetStamp(spokeFileName);
+    entry.Contents = spokes;
+    return &entry.Contents;
+}
+
+bool vtkSrepModelCache::FindTransform(const std::string &headerFileName, double transform[4][4])
+{
+    const Header *header = FindHeader(headerFileName);
+    if(header == nullptr || !mHeaders[headerFileName].HasTransform)
+    {
+        return false;
+    }
+    const HeaderEntry &entry = mHeaders[headerFileName];
+    if(!(entry.TransformStamps[0] == entry.HeaderStamp && entry.TransformStamps[1] == GetStamp(header->UpFileName)
+         && entry.TransformStamps[2] == GetStamp(header->DownFileName)
+         && entry.TransformStamps[3] == GetStamp(header->CrestFileName)))
+    {
+        return false;
+    }
+    for(int i = 0; i < 4; ++i)
+    {
+        for(int j = 0; j < 4; ++j)
+        {
+            transform[i][j] = entry.Transform[i][j];
+        }
+    }
+    return true;
+}
+
+void vtkSrepModelCache::StoreTransform(const std::string &headerFileName, const double transform[4][4])
+{
+    const Header *header = FindHeader(headerFileName);
+    if(header == nullptr)
+    {
+        return;
+    }
+    HeaderEntry &entry = mHeaders[headerFileName];
+    entry.HasTransform = true;
+    entry.TransformStamps[0] = entry.HeaderStamp;
+    entry.TransformStamps[1] = GetStamp(header->UpFileName);
+    entry.TransformStamps[2] = GetStamp(header->DownFileName);
+    entry.TransformStamps[3] = GetStamp(header->CrestFileName);
+    for(int i = 0; i < 4; ++i)
+    {
+        for(int j = 0; j < 4; ++j)
+        {
+            entry.Transform[i][j] = transform[i][j];
+        }
+    }
+}
+
+vtkPolyData *vtkSrepModelCache::FindInterpolatedSpokes(const std::string &headerFileName, int interpolationLevel)
+{
+    const Header *header = FindHeader(headerFileName);
+    if(header == nullptr)
+    {
+        return nullptr;
+    }
+    std::map<int, InterpolatedEntry> &interpolated = mHeaders[headerFileName].InterpolatedSpokes;
+    std::map<int, InterpolatedEntry>::iterator found = interpolated.find(interpolationLevel);
+    if(found == interpolated.end())
+    {
+        return nullptr;
+    }
+    if(!(found->second.UpStamp == GetStamp(header->UpFileName)))
+    {
+        interpolated.erase(found);
+        return nullptr;
+    }
+    return found->second.Spokes.GetPointer();
+}
+
+void vtkSrepModelCache::StoreInterpolatedSpokes(const std::string &headerFileName, int interpolationLevel,
+                                                vtkPolyData *spokes)
+{
+    const Header *header = FindHeader(headerFileName);
+    if(header == nullptr)
+    {
+        return;
+    }
+    InterpolatedEntry &entry = mHeaders[headerFileName].InterpolatedSpokes[interpolationLevel];
+    entry.UpStamp = GetStamp(header->UpFileName);
+    entry.Spokes = spokes;
+}
+
+void vtkSrepModelCache::Invalidate(const std::string &fileName)
+{
+    const std::string file = GetFile(fileName);
+    for(std::map<std::string, HeaderEntry>::iterator it = mHeaders.begin(); it != mHeaders.end();)
+    {
+        // the transformation depends on the spoke files as well
+        const Header &header = it->second.Contents;
+        if(GetFile(it->first) == file || GetFile(header.UpFileName) == file || GetFile(header.DownFileName) == file
+           || GetFile(header.CrestFileName) == file)
+        {
+            it = mHeaders.erase(it);
+        }
+        else
+        {
+            ++it;
+        }
+    }
+    for(std::map<std::string, SpokesEntry>::iterator it = mSpokes.begin(); it != mSpokes.end();)
+    {
+        if(GetFile(it->first) == file)
+        {
+            it = mSpokes.erase(it);
+        }
+        else
+        {
+            ++it;
+        }
+    }
+}
+
+void vtkSrepModelCache::Clear()
+{
+    mHeaders.clear();
+    mSpokes.clear();
+}
+
+vtkSrepModelCache::Stamp vtkSrepModelCache::GetStamp(const std::string &fileName)
+{
+    const std::string file = GetFile(fileName);
+    return vtkMappedFile::GetStamp(file);
+}
+
+std::string vtkSrepModelCache::GetFile(const std::string &fileName)
+{
+    std::string containerFileName;
+    int side = 0;
+    return vtkSrepFile::SplitSideFileName(fileName, &containerFileName, &side) ? containerFileName : fileName;
+}
@@ -0,0 +1,115 @@
+/*==============================================================================
+
+  Program: 3D Slicer
+
+  Portions (c) Copyright Brigham and Women's Hospital (BWH) All Rights Reserved.
+
+  See COPYRIGHT.txt
+  or http://www.slicer.org/copyright/copyright.txt for details.
+
+  Unless required by applicable law or agreed to in writing, software
+  distributed under the License is distributed on an "AS IS" BASIS,
+  WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+  See the License for the specific language governing permissions and
+  limitations under the License.
+
+==============================================================================*/
+
+#ifndef VTKSREPMODELCACHE_H
+#define VTKSREPMODELCACHE_H
+
+#include "vtkMappedFile.h"
+#include "vtkSrepFile.h"
+
+#include <vtkSmartPointer.h>
+
+#include <map>
+#include <string>
+
+class vtkPolyData;
+
+/**
+ * @brief The vtkSrepModelCache class
+ * The s-rep headers and spoke files parsed by a refiner logic, with data derived from them.
+ * An entry is used while the file it was parsed from keeps its vtkMappedFile::Stamp, the
+ * sides of a container share the stamp of the container. Files written by the logic itself
+ * are also invalidated explicitly.
+ */
+class vtkSrepModelCache
+{
+public:
+    // contents of a header.xml or of the header of a container
+    struct Header
+    {
+        int NumRows = 0;
+        int NumCols = 0;
+        double CrestShift = 0.0;
+        std::string UpFileName;
+        std::string DownFileName;
+        std::string CrestFileName;
+    };
+
+    vtkSrepModelCache();
+
+    // nullptr unless headerFileName was stored and has not changed since
+    const Header *FindHeader(const std::string &headerFileName);
+    const Header *StoreHeader(const std::string &headerFileName, const Header &header);
+
+    // nullptr unless spokeFileName was stored and has not changed since
+    const vtkSrepFile::Spokes *FindSpokes(const std::string &spokeFileName);
+    const vtkSrepFile::Spokes *StoreSpokes(const std::string &spokeFileName, const vtkSrepFile::Spokes &spokes);
+
+    // Transformation of the s-rep of headerFileName into the unit cube.
+    // Return false unless it was stored and neither the header nor its spoke files have changed since
+    bool FindTransform(const std::string &headerFileName, double transform[4][4]);
+    void StoreTransform(const std::string &headerFileName, const double transform[4][4]);
+
+    // Up spokes of the s-rep of headerFileName interpolated at interpolationLevel. The interpolation depends
+    // on the grid of the header as well as on the up spokes, so it is kept with the header.
+    // nullptr unless it was stored and neither the header nor its up file have changed since
+    vtkPolyData *FindInterpolatedSpokes(const std::string &headerFileName, int interpolationLevel);
+    void StoreInterpolatedSpokes(const std::string &headerFileName, int interpolationLevel, vtkPolyData *spokes);
+
+    // forget everything parsed from fileName, a header, a spoke file or a container
+    void Invalidate(const std::string &fileName);
+
+    void Clear();
+
+private:
+    typedef vtkMappedFile::Stamp Stamp;
+
+    struct InterpolatedEntry
+    {
+        // stamp of the up file when the interpolation was stored
+        Stamp UpStamp;
+        vtkSmartPointer<vtkPolyData> Spokes;
+    };
+
+    struct HeaderEntry
+    {
+        Stamp HeaderStamp;
+        Header Contents;
+        // stamps of the header and the up, down and crest files when the transformation was stored
+        bool HasTransform = false;
+        Stamp TransformStamps[4];
+        double Transform[4][4];
+        std::map<int, InterpolatedEntry> InterpolatedSpokes;
+    };
+
+    struct SpokesEntry
+    {
+        Stamp SpokesStamp;
+        vtkSrepFile::Spokes Contents;
+    };
+
+    // stamp of the file behind fileName, the container for the side of one
+    static Stamp GetStamp(const std::string &fileName);
+
+    // the file behind fileName
+    static std::string GetFile(const std::string &fileName);
+
+    std::map<std::string, HeaderEntry> mHeaders;
+    std::map<std::string, SpokesEntry> mSpokes;
+};
+
+#endif // VTKSREPMODELCACHE_H
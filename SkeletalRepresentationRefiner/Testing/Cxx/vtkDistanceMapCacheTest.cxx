@@ -0,0 +1,316 @@
+/*==============================================================================
+
+  Program: 3D Slicer
+
+  Portions (c) Copyright Brigham and Women's Hospital (BWH) All Rights Reserved.
+
+  See COPYRIGHT.txt
+  or http://www.slicer.org/copyright/copyright.txt for details.
+
+  Unless required by applicable law or agreed to in writing, software
+  distributed under the License is distributed on an "AS IS" BASIS,
+  WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+  See the License for the specific language governing permissions and
+  limitations under the License.
+
+==============================================================================*/
+
+
+// On-disk distance map cache: the key follows the mesh content and every parameter of the map, entries
+// load back as stored, the least recently used entries go first when the directory is over its size,
+// and a mapped entry is only opened if its header matches the file.
+// Usage: vtkDistanceMapCacheTest <temporaryDirectory>
+
+#include "vtkDistanceMapCache.h"
+#include "vtkDistanceSampler.h"
+#include "vtkMappedDistanceMap.h"
+
+#include <vtksys/SystemTools.hxx>
+
+// STD includes
+#include <chrono>
+#include <cstddef>
+#include <cstdlib>
+#include <cstring>
+#include <fstream>
+#include <iostream>
+#include <iterator>
+#include <string>
+#include <thread>
+#include <vector>
+
+namespace
+{
+
+typedef vtkDistanceMapCache::RealImage RealImage;
+typedef vtkDistanceMapCache::VectorImage VectorImage;
+
+// whole bricks of vtkBrickedLayout
+const int dims[3] = {16, 8, 8};
+const int numVoxels = dims[0] * dims[1] * dims[2];
+
+void WriteFile(const std::string &fileName, const std::string &contents)
+{
+    std::ofstream file(fileName.c_str(), std::ios::binary);
+    file << contents;
+}
+
+// a map of dims with distinct values, with its gradient if grad is given
+void MakeMap(float seed, RealImage::Pointer dist, VectorImage::Pointer grad)
+{
+    RealImage::RegionType region;
+    RealImage::SizeType size;
+    RealImage::IndexType start;
+    RealImage::SpacingType spacing;
+    RealImage::PointType origin;
+    for(int i = 0; i < 3; ++i)
+    {
+        size[i] = static_cast<RealImage::SizeValueType>(dims[i]);
+        start[i] = 0;
+        spacing[i] = 0.25;
+        origin[i] = -0.125 * (i + 1);
+    }
+    region.SetSize(size);
+    region.SetIndex(start);
+    dist->SetRegions(region);
+    dist->SetSpacing(spacing);
+    dist->SetOrigin(origin);
+    dist->Allocate();
+    for(int i = 0; i < numVoxels; ++i)
+    {
+        dist->GetBufferPointer()[i] = seed + 0.5f * i;
+    }
+    if(grad)
+    {
+        grad->SetRegions(region);
+        grad->SetSpacing(spacing);
+        grad->SetOrigin(origin);
+        grad->Allocate();
+        for(int i = 0; i < numVoxels; ++i)
+        {
+            for(int k = 0; k < 3; ++k)
+            {
+                grad->GetBufferPointer()[i][k] = seed - i + 0.25f * k;
+            }
+        }
+    }
+}
+
+bool SameDistances(const float *a, const float *b)
+{
+    return std::memcmp(a, b, numVoxels * sizeof(float)) == 0;
+}
+
+// stamps in the cache directory are ordered by their modification time, leave it time to move
+void Wait()
+{
+    std::this_thread::sleep_for(std::chrono::milliseconds(20));
+}
+
+bool TestKey(const std::string &directory, const vtkDistanceMapCache &cache)
+{
+    const std::string meshFileName = directory + "/vtkDistanceMapCacheTest.vtk";
+    WriteFile(meshFileName, "a mesh");
+    const int gradient = vtkImageDistanceSampler::StoredGradient;
+    const std::string key = cache.ComputeKey(meshFileName, 0.01, 0.1, false, gradient);
+    if(key.empty() || key != cache.ComputeKey(meshFileName, 0.01, 0.1, false, gradient))
+    {
+        std::cerr << "The cache key of a mesh is not stable." << std::endl;
+        return false;
+    }
+    const std::string others[] = {
+        cache.ComputeKey(meshFileName, 0.02, 0.1, false, gradient),
+        cache.ComputeKey(meshFileName, 0.01, 0.2, false, gradient),
+        cache.ComputeKey(meshFileName, 0.01, 0.1, true, gradient),
+        cache.ComputeKey(meshFileName, 0.01, 0.1, false, vtkImageDistanceSampler::OctahedralNormals)};
+    for(const std::string &other : others)
+    {
+        if(other == key)
+        {
+            std::cerr << "A map of other parameters has the same cache key." << std::endl;
+            return false;
+        }
+    }
+    WriteFile(meshFileName, "a mesi");
+    if(cache.ComputeKey(meshFileName, 0.01, 0.1, false, gradient) == key)
+    {
+        std::cerr << "An edited mesh has the same cache key." << std::endl;
+        return false;
+    }
+    vtksys::SystemTools::RemoveFile(meshFileName);
+    if(!cache.ComputeKey(meshFileName, 0.01, 0.1, false, gradient).empty())
+    {
+        std::cerr << "A missing mesh has a cache key." << std::endl;
+        return false;
+    }
+    return true;
+}
+
+bool TestRoundTrip(const vtkDistanceMapCache &cache)
+{
+    RealImage::Pointer dist = RealImage::New();
+    VectorImage::Pointer grad = VectorImage::New();
+    MakeMap(1.0f, dist, grad);
+    const std::vector<unsigned int> noCodes;
+    std::vector<unsigned int> codes(numVoxels);
+    for(int i = 0; i < numVoxels; ++i)
+    {
+        codes[i] = 0x9e3779b9u * (i + 1);
+    }
+    if(!cache.Store("gradient", dist, grad, noCodes, false)
+            || !cache.Store("octahedral", dist, VectorImage::New(), codes, true))
+    {
+        std::cerr << "Failed to store the distance maps." << std::endl;
+        return false;
+    }
+    RealImage::Pointer unbricked = RealImage::New();
+    RealImage::RegionType region = dist->GetBufferedRegion();
+    RealImage::SizeType size = region.GetSize();
+    size[0] -= 1;
+    region.SetSize(size);
+    unbricked->SetRegions(region);
+    unbricked->Allocate();
+    if(cache.Store("unbricked", unbricked, VectorImage::New(), noCodes, true))
+    {
+        std::cerr << "A bricked map that is not a whole number of bricks was stored." << std::endl;
+        return false;
+    }
+    if(cache.Load("missing", RealImage::New(), VectorImage::New(), nullptr, nullptr))
+    {
+        std::cerr << "A missing entry was loaded." << std::endl;
+        return false;
+    }
+
+    RealImage::Pointer loadedDist = RealImage::New();
+    VectorImage::Pointer loadedGrad = VectorImage::New();
+    std::vector<unsigned int> loadedCodes;
+    bool bricked = true;
+    if(!cache.Load("gradient", loadedDist, loadedGrad, &loadedCodes, &bricked) || bricked || !loadedCodes.empty()
+            || !SameDistances(loadedDist->GetBufferPointer(), dist->GetBufferPointer())
+            || std::memcmp(loadedGrad->GetBufferPointer(), grad->GetBufferPointer(),
+                           3 * numVoxels * sizeof(float)) != 0
+            || loadedDist->GetSpacing()[0] != 0.25 || loadedDist->GetOrigin()[2] != -0.375)
+    {
+        std::cerr << "The distance map with its gradient did not load as stored." << std::endl;
+        return false;
+    }
+    loadedDist = RealImage::New();
+    VectorImage::Pointer untouched = VectorImage::New();
+    if(!cache.Load("octahedral", loadedDist, untouched, &loadedCodes, &bricked) || !bricked
+            || loadedCodes != codes || untouched->GetBufferPointer() != nullptr
+            || !SameDistances(loadedDist->GetBufferPointer(), dist->GetBufferPointer()))
+    {
+        std::cerr << "The distance map with its octahedral normals did not load as stored." << std::endl;
+        return false;
+    }
+    return true;
+}
+
+bool TestMapped(const std::string &directory, const vtkDistanceMapCache &cache)
+{
+    vtkMappedDistanceMap map;
+    if(!map.Open(cache.GetFileName("gradient")) || map.GetDimensions()[1] != dims[1] || map.GetSpacing() != 0.25
+            || map.IsBricked() || map.GetGradient() == nullptr || map.GetOctahedralNormals() != nullptr)
+    {
+        std::cerr << "The mapped distance map does not match the stored entry." << std::endl;
+        return false;
+    }
+    map.Close();
+
+    // a truncated file, one with an extra byte and one of another version are not mapped
+    std::ifstream in(cache.GetFileName("octahedral").c_str(), std::ios::binary);
+    const std::string bytes((std::istreambuf_iterator<char>(in)), std::istreambuf_iterator<char>());
+    std::string corrupt[3] = {bytes.substr(0, bytes.size() - 4), bytes + '\0', bytes};
+    corrupt[2][offsetof(vtkDistanceMapFileHeader, version)] += 1;
+    const std::string corruptFileName = directory + "/vtkDistanceMapCacheTestCorrupt.sdf";
+    for(const std::string &contents : corrupt)
+    {
+        WriteFile(corruptFileName, contents);
+        if(map.Open(corruptFileName))
+        {
+            std::cerr << "A corrupt distance map file was mapped." << std::endl;
+            return false;
+        }
+    }
+    vtksys::SystemTools::RemoveFile(corruptFileName);
+
+    // dims whose voxel count overflows 64 bits are not taken for a file that small
+    vtkDistanceMapFileHeader header;
+    std::memcpy(&header, bytes.data(), sizeof(header));
+    header.dims[0] = header.dims[1] = header.dims[2] = 0x7fffffff;
+    if(vtkDistanceMapCache::CheckHeader(header, sizeof(header) + 8ULL * numVoxels))
+    {
+        std::cerr << "A header with an overflowing voxel count was accepted." << std::endl;
+        return false;
+    }
+    return true;
+}
+
+bool TestLeastRecentlyUsed(const std::string &directory)
+{
+    // room for three entries of distances alone
+    const unsigned long long entrySize = sizeof(vtkDistanceMapFileHeader) + numVoxels * sizeof(float);
+    const vtkDistanceMapCache cache(directory + "/lru", 3 * entrySize);
+    RealImage::Pointer dist = RealImage::New();
+    MakeMap(3.0f, dist, nullptr);
+    const std::vector<unsigned int> noCodes;
+    const char *keys[] = {"first", "second", "third"};
+    for(const char *key : keys)
+    {
+        cache.Store(key, dist, VectorImage::New(), noCodes, false);
+        Wait();
+    }
+    // using the first entry leaves the second the least recently used
+    bool bricked = false;
+    cache.Load("first", RealImage::New(), VectorImage::New(), nullptr, &bricked);
+    Wait();
+    cache.Store("fourth", dist, VectorImage::New(), noCodes, false);
+    if(!vtksys::SystemTools::FileExists(cache.GetFileName("first"))
+            || vtksys::SystemTools::FileExists(cache.GetFileName("second"))
+            || !vtksys::SystemTools::FileExists(cache.GetFileName("third"))
+            || !vtksys::SystemTools::FileExists(cache.GetFileName("fourth")))
+    {
+        std::cerr << "The cache did not remove its least recently used entry." << std::endl;
+        return false;
+    }
+
+    // an entry larger than the cache stays alone
+    Wait();
+    RealImage::Pointer largeDist = RealImage::New();
+    VectorImage::Pointer largeGrad = VectorImage::New();
+    MakeMap(4.0f, largeDist, largeGrad);
+    cache.Store("large", largeDist, largeGrad, noCodes, false);
+    const char *remaining[] = {"first", "third", "fourth"};
+    for(const char *key : remaining)
+    {
+        if(vtksys::SystemTools::FileExists(cache.GetFileName(key)))
+        {
+            std::cerr << "The cache kept an entry over its size." << std::endl;
+            return false;
+        }
+    }
+    if(!vtksys::SystemTools::FileExists(cache.GetFileName("large")))
+    {
+        std::cerr << "The cache removed the entry it just stored." << std::endl;
+        return false;
+    }
+    vtksys::SystemTools::RemoveADirectory(directory + "/lru");
+    return true;
+}
+
+} // end of anonymous namespace
+
+int vtkDistanceMapCacheTest(int argc, char* argv[])
+{
+    if(argc < 2)
+    {
+        std::cerr << "Usage: " << argv[0] << " <temporaryDirectory>" << std::endl;
+        return EXIT_FAILURE;
+    }
+    const std::string directory = argv[1];
+    const vtkDistanceMapCache cache(directory + "/vtkDistanceMapCacheTest");
+    const bool passed = TestKey(directory, cache) && TestRoundTrip(cache) && TestMapped(directory, cache)
+                        && TestLeastRecentlyUsed(directory);
+    vtksys::SystemTools::RemoveADirectory(directory + "/vtkDistanceMapCacheTest");
+    return passed ? EXIT_SUCCESS : EXIT_FAILURE;
+}
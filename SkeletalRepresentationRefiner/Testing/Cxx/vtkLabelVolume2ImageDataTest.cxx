@@ -0,0 +1,302 @@
+/*==============================================================================
+
+  Program: 3D Slicer
+
+  Portions (c) Copyright Brigham and Women's Hospital (BWH) All Rights Reserved.
+
+  See COPYRIGHT.txt
+  or http://www.slicer.org/copyright/copyright.txt for details.
+
+  Unless required by applicable law or agreed to in writing, software
+  distributed under the License is distributed on an "AS IS" BASIS,
+  WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+  See the License for the specific language governing permissions and
+  limitations under the License.
+
+==============================================================================*/
+
+
+// Label volume to mask: the slices of the volume are read once and in order, the bounds of its inside voxels
+// match the corners of those voxels under an oblique index to world map, and resampling at the voxel centers
+// gives the labels back on any number of threads. A label volume file converts to a mask with inside voxels
+// away from the border of the grid.
+// Usage: vtkLabelVolume2ImageDataTest <temporaryDirectory>
+
+#include "vtkLabelVolume2ImageData.h"
+
+#include <vtkImageData.h>
+#include <vtkSmartPointer.h>
+
+// STD includes
+#include <algorithm>
+#include <cstdio>
+#include <cstdlib>
+#include <fstream>
+#include <iostream>
+#include <limits>
+#include <math.h>
+#include <string>
+#include <vector>
+
+namespace
+{
+
+const int labelDims[3] = {9, 7, 6};
+
+// an ellipsoid of inside voxels off the center of the volume
+bool IsInside(int x, int y, int z)
+{
+    const double u = (x - 4.5) / 3.5, v = (y - 3.0) / 2.5, w = (z - 2.2) / 2.0;
+    return u * u + v * v + w * w <= 1.0;
+}
+
+bool IsBitSet(const vtkLabelVolume2ImageData::InsideBits &inside, size_t n)
+{
+    return ((inside[n >> 3] >> (n & 7)) & 1) != 0;
+}
+
+size_t Index(int x, int y, int z)
+{
+    return static_cast<size_t>(x) + static_cast<size_t>(labelDims[0]) * (y + static_cast<size_t>(labelDims[1]) * z);
+}
+
+bool TestBounds()
+{
+    // rotated about z, anisotropic voxels and an offset origin
+    const double c = cos(0.3), s = sin(0.3);
+    const double indexToWorld[3][4] = {{0.8 * c, -1.1 * s, 0.0, 10.0},
+                                       {0.8 * s, 1.1 * c, 0.0, -4.0},
+                                       {0.0, 0.0, 2.5, 7.0}};
+    std::vector<int> slicesRead;
+    vtkLabelVolume2ImageData::SliceReader reader = [&](int slice, unsigned char *inside) -> bool
+    {
+        slicesRead.push_back(slice);
+        for(int y = 0; y < labelDims[1]; ++y)
+        {
+            for(int x = 0; x < labelDims[0]; ++x)
+            {
+                *inside++ = IsInside(x, y, slice) ? 1 : 0;
+            }
+        }
+        return true;
+    };
+    double bounds[6];
+    vtkLabelVolume2ImageData::InsideBits inside;
+    if(!vtkLabelVolume2ImageData::ComputeBounds(reader, labelDims, indexToWorld, bounds, &inside))
+    {
+        std::cerr << "The bounds of the label volume were not computed." << std::endl;
+        return false;
+    }
+    for(int z = 0; z < labelDims[2]; ++z)
+    {
+        if(slicesRead.size() != static_cast<size_t>(labelDims[2]) || slicesRead[z] != z)
+        {
+            std::cerr << "The slices of the label volume were not read once in order." << std::endl;
+            return false;
+        }
+    }
+
+    // the corners of every inside voxel
+    double expected[6];
+    for(int r = 0; r < 3; ++r)
+    {
+        expected[2 * r] = std::numeric_limits<double>::max();
+        expected[2 * r + 1] = -std::numeric_limits<double>::max();
+    }
+    for(int z = 0; z < labelDims[2]; ++z)
+    {
+        for(int y = 0; y < labelDims[1]; ++y)
+        {
+            for(int x = 0; x < labelDims[0]; ++x)
+            {
+                if(IsBitSet(inside, Index(x, y, z)) != IsInside(x, y, z))
+                {
+                    std::cerr << "Voxel (" << x << ", " << y << ", " << z << ") has the wrong inside bit." << std::endl;
+                    return false;
+                }
+                if(!IsInside(x, y, z))
+                {
+                    continue;
+                }
+                for(int corner = 0; corner < 8; ++corner)
+                {
+                    const double p[3] = {x + ((corner & 1) ? 0.5 : -0.5), y + ((corner & 2) ? 0.5 : -0.5),
+                                         z + ((corner & 4) ? 0.5 : -0.5)};
+                    for(int r = 0; r < 3; ++r)
+                    {
+                        const double w = indexToWorld[r][0] * p[0] + indexToWorld[r][1] * p[1]
+                                       + indexToWorld[r][2] * p[2] + indexToWorld[r][3];
+                        expected[2 * r] = std::min(expected[2 * r], w);
+                        expected[2 * r + 1] = std::max(expected[2 * r + 1], w);
+                    }
+                }
+            }
+        }
+    }
+    for(int i = 0; i < 6; ++i)
+    {
+        if(fabs(bounds[i] - expected[i]) > 1e-9)
+        {
+            std::cerr << "Bound " << i << " is " << bounds[i] << " instead of " << expected[i] << std::endl;
+            return false;
+        }
+    }
+
+    // a slice that can't be read and a volume without labels fail
+    vtkLabelVolume2ImageData::SliceReader failing = [&](int slice, unsigned char *inside) -> bool
+    {
+        return slice < 3 && reader(slice, inside);
+    };
+    vtkLabelVolume2ImageData::SliceReader empty = [&](int, unsigned char *inside) -> bool
+    {
+        std::fill(inside, inside + labelDims[0] * labelDims[1], 0);
+        return true;
+    };
+    if(vtkLabelVolume2ImageData::ComputeBounds(failing, labelDims, indexToWorld, bounds, &inside)
+            || vtkLabelVolume2ImageData::ComputeBounds(empty, labelDims, indexToWorld, bounds, &inside))
+    {
+        std::cerr << "A volume with an unreadable slice or no label has bounds." << std::endl;
+        return false;
+    }
+    return true;
+}
+
+bool TestResample()
+{
+    vtkLabelVolume2ImageData::InsideBits inside((Index(0, 0, labelDims[2]) + 7) / 8, 0);
+    for(int z = 0; z < labelDims[2]; ++z)
+    {
+        for(int y = 0; y < labelDims[1]; ++y)
+        {
+            for(int x = 0; x < labelDims[0]; ++x)
+            {
+                const size_t n = Index(x, y, z);
+                inside[n >> 3] |= static_cast<unsigned char>((IsInside(x, y, z) ? 1 : 0) << (n & 7));
+            }
+        }
+    }
+
+    // a grid of twice the resolution has the labels at its even voxels, on one thread or several
+    const double halfVoxels[3][4] = {{0.5, 0, 0, 0}, {0, 0.5, 0, 0}, {0, 0, 0.5, 0}};
+    const int dims[3] = {2 * labelDims[0] - 1, 2 * labelDims[1] - 1, 2 * labelDims[2] - 1};
+    const size_t numVoxels = static_cast<size_t>(dims[0]) * dims[1] * dims[2];
+    std::vector<unsigned char> mask(numVoxels), threadedMask(numVoxels);
+    vtkLabelVolume2ImageData::Resample(inside, labelDims, halfVoxels, dims, mask.data(), 1);
+    vtkLabelVolume2ImageData::Resample(inside, labelDims, halfVoxels, dims, threadedMask.data(), 5);
+    if(mask != threadedMask)
+    {
+        std::cerr << "The resampled mask depends on the number of threads." << std::endl;
+        return false;
+    }
+    for(int z = 0; z < labelDims[2]; ++z)
+    {
+        for(int y = 0; y < labelDims[1]; ++y)
+        {
+            for(int x = 0; x < labelDims[0]; ++x)
+            {
+                const size_t n = 2 * static_cast<size_t>(x) + dims[0] * (2 * static_cast<size_t>(y)
+                                 + static_cast<size_t>(dims[1]) * 2 * z);
+                if(mask[n] != (IsInside(x, y, z) ? 255 : 0))
+                {
+                    std::cerr << "The mask at voxel (" << x << ", " << y << ", " << z
+                              << ") of the label volume is " << static_cast<int>(mask[n]) << std::endl;
+                    return false;
+                }
+            }
+        }
+    }
+
+    // a grid beyond the volume is outside
+    const double beyond[3][4] = {{1, 0, 0, labelDims[0] + 1.0}, {0, 1, 0, 0}, {0, 0, 1, 0}};
+    vtkLabelVolume2ImageData::Resample(inside, labelDims, beyond, dims, mask.data(), 3);
+    if(std::count(mask.begin(), mask.end(), 0) != static_cast<std::ptrdiff_t>(numVoxels))
+    {
+        std::cerr << "A voxel beyond the label volume is inside." << std::endl;
+        return false;
+    }
+    return true;
+}
+
+// uncompressed MetaImage of the labels, empty if requested
+bool WriteLabelVolume(const std::string &fileName, bool empty)
+{
+    std::ofstream file(fileName.c_str(), std::ios::binary);
+    file << "ObjectType = Image\nNDims = 3\nBinaryData = True\nBinaryDataByteOrderMSB = False\n"
+         << "DimSize = " << labelDims[0] << " " << labelDims[1] << " " << labelDims[2] << "\n"
+         << "ElementSpacing = 0.5 0.5 1\nOffset = 1 2 3\nElementType = MET_UCHAR\nElementDataFile = LOCAL\n";
+    for(int z = 0; z < labelDims[2]; ++z)
+    {
+        for(int y = 0; y < labelDims[1]; ++y)
+        {
+            for(int x = 0; x < labelDims[0]; ++x)
+            {
+                file.put(!empty && IsInside(x, y, z) ? 3 : 0);
+            }
+        }
+    }
+    return static_cast<bool>(file);
+}
+
+bool TestConvert(const std::string &directory)
+{
+    const std::string fileName = directory + "/vtkLabelVolume2ImageDataTest.mha";
+    vtkLabelVolume2ImageData converter;
+    if(!vtkLabelVolume2ImageData::IsLabelVolumeFile(fileName) || vtkLabelVolume2ImageData::IsLabelVolumeFile("a.vtk"))
+    {
+        std::cerr << "Label volume files are not told from meshes." << std::endl;
+        return false;
+    }
+    vtkSmartPointer<vtkImageData> image = vtkSmartPointer<vtkImageData>::New();
+    if(!WriteLabelVolume(fileName, false) || !converter.Convert(fileName, image))
+    {
+        std::cerr << "Failed to convert " << fileName << std::endl;
+        return false;
+    }
+    int dims[3];
+    image->GetDimensions(dims);
+    const unsigned char *mask = static_cast<unsigned char*>(image->GetScalarPointer());
+    size_t numInside = 0;
+    for(int z = 0; z < dims[2]; ++z)
+    {
+        for(int y = 0; y < dims[1]; ++y)
+        {
+            for(int x = 0; x < dims[0]; ++x)
+            {
+                const bool inside = *mask++ != 0;
+                const bool border = x == 0 || y == 0 || z == 0 || x == dims[0] - 1 || y == dims[1] - 1
+                                    || z == dims[2] - 1;
+                if(inside && border)
+                {
+                    std::cerr << "The mask of " << fileName << " is inside at the border of its grid." << std::endl;
+                    return false;
+                }
+                numInside += inside ? 1 : 0;
+            }
+        }
+    }
+    if(numInside == 0)
+    {
+        std::cerr << "The mask of " << fileName << " has no inside voxel." << std::endl;
+        return false;
+    }
+    if(!WriteLabelVolume(fileName, true) || converter.Convert(fileName, image)
+            || converter.Convert(directory + "/missing.mha", image))
+    {
+        std::cerr << "A label volume without labels or file was converted." << std::endl;
+        return false;
+    }
+    std::remove(fileName.c_str());
+    return true;
+}
+
+} // end of anonymous namespace
+
+int vtkLabelVolume2ImageDataTest(int argc, char* argv[])
+{
+    if(argc < 2)
+    {
+        std::cerr << "Usage: " << argv[0] << " <temporaryDirectory>" << std::endl;
+        return EXIT_FAILURE;
+    }
+    return TestBounds() && TestResample() && TestConvert(argv[1]) ? EXIT_SUCCESS : EXIT_FAILURE;
+}
@@ -0,0 +1,219 @@
+/*==============================================================================
+
+  Program: 3D Slicer
+
+  Portions (c) Copyright Brigham and Women's Hospital (BWH) All Rights Reserved.
+
+  See COPYRIGHT.txt
+  or http://www.slicer.org/copyright/copyright.txt for details.
+
+  Unless required by applicable law or agreed to in writing, software
+  distributed under the License is distributed on an "AS IS" BASIS,
+  WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+  See the License for the specific language governing permissions and
+  limitations under the License.
+
+==============================================================================*/
+
+
+// Exact mesh distance against brute force: the distance from the bounding volume hierarchy has to be
+// the smallest distance to any triangle of a torus, and its sign has to follow the winding number,
+// also right next to its vertices and edges. The torus given inward facing has to give the same answers.
+// Usage: vtkMeshDistanceOracleTest
+
+#include "vtkMeshDistanceOracle.h"
+
+// STD includes
+#include <algorithm>
+#include <cstdlib>
+#include <iostream>
+#include <math.h>
+#include <random>
+#include <vector>
+
+namespace
+{
+
+const double pi = 3.14159265358979323846;
+
+// outward facing torus around the z axis through (0.5, 0.5, 0.5)
+void MakeTorus(int numMajor, int numMinor, std::vector<float> &points, std::vector<int> &triangles)
+{
+    for(int i = 0; i < numMajor; ++i)
+    {
+        const double u = 2 * pi * i / numMajor;
+        for(int j = 0; j < numMinor; ++j)
+        {
+            const double v = 2 * pi * j / numMinor;
+            const double r = 0.3 + 0.12 * cos(v);
+            points.push_back(static_cast<float>(0.5 + r * cos(u)));
+            points.push_back(static_cast<float>(0.5 + r * sin(u)));
+            points.push_back(static_cast<float>(0.5 + 0.12 * sin(v)));
+        }
+    }
+    for(int i = 0; i < numMajor; ++i)
+    {
+        for(int j = 0; j < numMinor; ++j)
+        {
+            const int a = i * numMinor + j, b = ((i + 1) % numMajor) * numMinor + j;
+            const int c = ((i + 1) % numMajor) * numMinor + (j + 1) % numMinor, d = i * numMinor + (j + 1) % numMinor;
+            const int quad[6] = {a, b, c, a, c, d};
+            triangles.insert(triangles.end(), quad, quad + 6);
+        }
+    }
+}
+
+double SegmentDistanceSquared(const double *p, const double *a, const double *b)
+{
+    double ab[3], ap[3];
+    for(int i = 0; i < 3; ++i)
+    {
+        ab[i] = b[i] - a[i];
+        ap[i] = p[i] - a[i];
+    }
+    const double lengthSquared = ab[0] * ab[0] + ab[1] * ab[1] + ab[2] * ab[2];
+    const double t = lengthSquared > 0 ? std::max(0.0, std::min(1.0, (ap[0] * ab[0] + ap[1] * ab[1] + ap[2] * ab[2])
+                                                                      / lengthSquared)) : 0.0;
+    double d = 0.0;
+    for(int i = 0; i < 3; ++i)
+    {
+        const double diff = ap[i] - t * ab[i];
+        d += diff * diff;
+    }
+    return d;
+}
+
+// distance to the plane of the triangle if p projects into it, else to its nearest edge
+double TriangleDistance(const double *p, const double *a, const double *b, const double *c)
+{
+    const double ab[3] = {b[0] - a[0], b[1] - a[1], b[2] - a[2]};
+    const double ac[3] = {c[0] - a[0], c[1] - a[1], c[2] - a[2]};
+    const double n[3] = {ab[1] * ac[2] - ab[2] * ac[1], ab[2] * ac[0] - ab[0] * ac[2], ab[0] * ac[1] - ab[1] * ac[0]};
+    const double nn = n[0] * n[0] + n[1] * n[1] + n[2] * n[2];
+    const double ap[3] = {p[0] - a[0], p[1] - a[1], p[2] - a[2]};
+    const double height = (ap[0] * n[0] + ap[1] * n[1] + ap[2] * n[2]) / nn;
+    const double q[3] = {ap[0] - height * n[0], ap[1] - height * n[1], ap[2] - height * n[2]};
+    // barycentric coordinates of the projection
+    const double d00 = ab[0] * ab[0] + ab[1] * ab[1] + ab[2] * ab[2], d01 = ab[0] * ac[0] + ab[1] * ac[1] + ab[2] * ac[2];
+    const double d11 = ac[0] * ac[0] + ac[1] * ac[1] + ac[2] * ac[2];
+    const double d20 = q[0] * ab[0] + q[1] * ab[1] + q[2] * ab[2], d21 = q[0] * ac[0] + q[1] * ac[1] + q[2] * ac[2];
+    const double denom = d00 * d11 - d01 * d01;
+    const double v = (d11 * d20 - d01 * d21) / denom, w = (d00 * d21 - d01 * d20) / denom;
+    if(v >= 0 && w >= 0 && v + w <= 1)
+    {
+        return fabs(height) * sqrt(nn);
+    }
+    return sqrt(std::min(SegmentDistanceSquared(p, a, b),
+                         std::min(SegmentDistanceSquared(p, b, c), SegmentDistanceSquared(p, c, a))));
+}
+
+// signed distance by brute force, the sign from the winding number of the mesh around p
+double BruteForce(const std::vector<float> &points, const std::vector<int> &triangles, const double *p)
+{
+    double best = 1e300, winding = 0.0;
+    for(size_t t = 0; t < triangles.size(); t += 3)
+    {
+        double v[3][3], length[3];
+        for(int k = 0; k < 3; ++k)
+        {
+            for(int i = 0; i < 3; ++i)
+            {
+                v[k][i] = points[3 * static_cast<size_t>(triangles[t + k]) + i];
+            }
+        }
+        best = std::min(best, TriangleDistance(p, v[0], v[1], v[2]));
+        for(int k = 0; k < 3; ++k)
+        {
+            for(int i = 0; i < 3; ++i)
+            {
+                v[k][i] -= p[i];
+            }
+            length[k] = sqrt(v[k][0] * v[k][0] + v[k][1] * v[k][1] + v[k][2] * v[k][2]);
+        }
+        const double det = v[0][0] * (v[1][1] * v[2][2] - v[1][2] * v[2][1])
+                         - v[0][1] * (v[1][0] * v[2][2] - v[1][2] * v[2][0])
+                         + v[0][2] * (v[1][0] * v[2][1] - v[1][1] * v[2][0]);
+        auto dot = [&v](int a, int b) { return v[a][0] * v[b][0] + v[a][1] * v[b][1] + v[a][2] * v[b][2]; };
+        winding += 2 * atan2(det, length[0] * length[1] * length[2] + dot(0, 1) * length[2] + dot(1, 2) * length[0]
+                                  + dot(2, 0) * length[1]);
+    }
+    return winding / (4 * pi) > 0.5 ? -best : best;
+}
+
+bool CheckPoints(const vtkMeshDistanceOracle &oracle, const std::vector<float> &points,
+                 const std::vector<int> &triangles, const std::vector<double> &queries, const char *name)
+{
+    for(size_t q = 0; q < queries.size(); q += 3)
+    {
+        const double *p = &queries[q];
+        double closest[3], normal[3];
+        const double distance = oracle.Query(p, closest, normal);
+        const double expected = BruteForce(points, triangles, p);
+        const double gap = sqrt((p[0] - closest[0]) * (p[0] - closest[0]) + (p[1] - closest[1]) * (p[1] - closest[1])
+                                + (p[2] - closest[2]) * (p[2] - closest[2]));
+        const double normalLength = sqrt(normal[0] * normal[0] + normal[1] * normal[1] + normal[2] * normal[2]);
+        if(fabs(distance - expected) > 1e-9 || fabs(gap - fabs(distance)) > 1e-9 || fabs(normalLength - 1) > 1e-9)
+        {
+            std::cerr << "The " << name << " at (" << p[0] << ", " << p[1] << ", " << p[2] << ") is " << distance
+                      << " away, brute force finds " << expected << "." << std::endl;
+            return false;
+        }
+    }
+    return true;
+}
+
+} // end of anonymous namespace
+
+int vtkMeshDistanceOracleTest(int, char*[])
+{
+    std::vector<float> points;
+    std::vector<int> triangles;
+    MakeTorus(36, 14, points, triangles);
+    const size_t numPoints = points.size() / 3, numTriangles = triangles.size() / 3;
+
+    // random points around the torus and points scattered around its vertices and edge midpoints
+    std::mt19937 random(1);
+    std::uniform_real_distribution<double> uniform(0.0, 1.0);
+    std::vector<double> queries;
+    for(int i = 0; i < 1500; ++i)
+    {
+        queries.push_back(0.05 + 0.9 * uniform(random));
+        queries.push_back(0.05 + 0.9 * uniform(random));
+        queries.push_back(0.25 + 0.5 * uniform(random));
+    }
+    std::normal_distribution<double> normal(0.0, 1e-3);
+    for(size_t t = 0; t < triangles.size(); t += 3)
+    {
+        const float *a = &points[3 * static_cast<size_t>(triangles[t])];
+        const float *b = &points[3 * static_cast<size_t>(triangles[t + 1])];
+        for(int i = 0; i < 3; ++i)
+        {
+            queries.push_back(a[i] + normal(random));
+        }
+        for(int i = 0; i < 3; ++i)
+        {
+            queries.push_back(0.5 * (a[i] + b[i]) + normal(random));
+        }
+    }
+
+    vtkMeshDistanceOracle oracle;
+    oracle.Build(points.data(), numPoints, triangles.data(), numTriangles);
+    if(oracle.GetNumberOfTriangles() != numTriangles || !CheckPoints(oracle, points, triangles, queries, "torus"))
+    {
+        return EXIT_FAILURE;
+    }
+
+    // the same torus facing inward is flipped by Build
+    std::vector<int> flipped(triangles);
+    for(size_t t = 0; t < flipped.size(); t += 3)
+    {
+        std::swap(flipped[t + 1], flipped[t + 2]);
+    }
+    vtkMeshDistanceOracle flippedOracle;
+    flippedOracle.Build(points.data(), numPoints, flipped.data(), numTriangles);
+    if(!CheckPoints(flippedOracle, points, triangles, queries, "inward torus"))
+    {
+        return EXIT_FAILURE;
+    }
+    return EXIT_SUCCESS;
+}
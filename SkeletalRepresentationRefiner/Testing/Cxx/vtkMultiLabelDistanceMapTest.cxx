@@ -0,0 +1,131 @@
+/*==============================================================================
+
+  Program: 3D Slicer
+
+  Portions (c) Copyright Brigham and Women's Hospital (BWH) All Rights Reserved.
+
+  See COPYRIGHT.txt
+  or http://www.slicer.org/copyright/copyright.txt for details.
+
+  Unless required by applicable law or agreed to in writing, software
+  distributed under the License is distributed on an "AS IS" BASIS,
+  WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+  See the License for the specific language governing permissions and
+  limitations under the License.
+
+==============================================================================*/
+
+
+// Distance maps of two boxes that touch: each object's band is computed from its own boundary,
+// so the distance to one box on the side of the other one is the true distance, not the band.
+// Usage: vtkMultiLabelDistanceMapTest <temporaryDirectory>
+
+#include "vtkDistanceSampler.h"
+#include "vtkMultiLabelDistanceMap.h"
+
+// STD includes
+#include <cstdio>
+#include <cstdlib>
+#include <fstream>
+#include <iostream>
+#include <math.h>
+#include <string>
+#include <vector>
+
+namespace
+{
+
+// legacy file of the box [x0, x0 + 1] x [0, 1] x [0, 1] in 12 triangles
+bool WriteBox(const std::string &fileName, double x0)
+{
+    std::ofstream out(fileName.c_str());
+    out << "# vtk DataFile Version 3.0\nbox\nASCII\nDATASET POLYDATA\nPOINTS 8 double\n";
+    for(int i = 0; i < 8; ++i)
+    {
+        out << x0 + (i & 1) << " " << ((i >> 1) & 1) << " " << ((i >> 2) & 1) << "\n";
+    }
+    const int faces[12][3] = {{0, 2, 1}, {1, 2, 3}, {4, 5, 6}, {5, 7, 6}, {0, 1, 4}, {1, 5, 4},
+                              {2, 6, 3}, {3, 6, 7}, {0, 4, 2}, {2, 4, 6}, {1, 3, 5}, {3, 7, 5}};
+    out << "POLYGONS 12 48\n";
+    for(int i = 0; i < 12; ++i)
+    {
+        out << "3 " << faces[i][0] << " " << faces[i][1] << " " << faces[i][2] << "\n";
+    }
+    if(!out)
+    {
+        std::cerr << "Can't write " << fileName << std::endl;
+        return false;
+    }
+    return true;
+}
+
+// point and expected distance in the unit cube of the object, which is the box itself for unit boxes
+bool CheckDistance(const vtkMultiLabelDistanceMap &maps, int object, const double *point, double expected,
+                   double tolerance)
+{
+    double normal[3];
+    const double distance = maps.GetSampler(object)->Sample(point, normal);
+    if(fabs(distance - expected) > tolerance)
+    {
+        std::cerr << "Object " << object << " at (" << point[0] << ", " << point[1] << ", " << point[2]
+                  << ") is " << distance << " away, not " << expected << "." << std::endl;
+        return false;
+    }
+    return true;
+}
+
+} // end of anonymous namespace
+
+int vtkMultiLabelDistanceMapTest(int argc, char* argv[])
+{
+    if(argc < 2)
+    {
+        std::cerr << "Usage: " << argv[0] << " <temporaryDirectory>" << std::endl;
+        return EXIT_FAILURE;
+    }
+    std::vector<std::string> fileNames;
+    fileNames.push_back(std::string(argv[1]) + "/vtkMultiLabelDistanceMapTestA.vtk");
+    fileNames.push_back(std::string(argv[1]) + "/vtkMultiLabelDistanceMapTestB.vtk");
+    // box A is [0, 1] in x, box B [1, 2], they share the face at x = 1
+    if(!WriteBox(fileNames[0], 0.0) || !WriteBox(fileNames[1], 1.0))
+    {
+        return EXIT_FAILURE;
+    }
+
+    // the common unit cube halves the boxes, so the band is 0.5 and the voxels 0.02 in the unit cube of a box
+    const double spacing = 0.01;
+    const double band = 0.25;
+    vtkMultiLabelDistanceMap maps;
+    if(!maps.Build(fileNames, spacing, band))
+    {
+        return EXIT_FAILURE;
+    }
+    if(maps.GetNumberOfObjects() != 2 || maps.FindObject(fileNames[1]) != 1)
+    {
+        std::cerr << "The maps don't hold both boxes." << std::endl;
+        return EXIT_FAILURE;
+    }
+
+    // the boundary is placed between voxels and sampled at the nearest one, both within a voxel
+    const double tolerance = 2.0 * 2.0 * spacing;
+    for(int i = 1; i <= 4; ++i)
+    {
+        const double depth = 0.1 * i;
+        // A on the side of B, B shifted into its own unit cube is at x - 1
+        const double insideB[3] = {1.0 + depth, 0.5, 0.5};
+        const double insideA[3] = {1.0 - depth, 0.5, 0.5};
+        const double insideAOfB[3] = {-depth, 0.5, 0.5};
+        const double insideBOfB[3] = {depth, 0.5, 0.5};
+        if(!CheckDistance(maps, 0, insideB, depth, tolerance) || !CheckDistance(maps, 0, insideA, -depth, tolerance)
+                || !CheckDistance(maps, 1, insideAOfB, depth, tolerance)
+                || !CheckDistance(maps, 1, insideBOfB, -depth, tolerance))
+        {
+            return EXIT_FAILURE;
+        }
+    }
+
+    maps.Clear();
+    std::remove(fileNames[0].c_str());
+    std::remove(fileNames[1].c_str());
+    return EXIT_SUCCESS;
+}
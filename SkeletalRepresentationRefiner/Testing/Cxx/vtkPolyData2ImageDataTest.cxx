@@ -0,0 +1,229 @@
+/*==============================================================================
+
+  Program: 3D Slicer
+
+  Portions (c) Copyright Brigham and Women's Hospital (BWH) All Rights Reserved.
+
+  See COPYRIGHT.txt
+  or http://www.slicer.org/copyright/copyright.txt for details.
+
+  Unless required by applicable law or agreed to in writing, software
+  distributed under the License is distributed on an "AS IS" BASIS,
+  WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+  See the License for the specific language governing permissions and
+  limitations under the License.
+
+==============================================================================*/
+
+
+// Scanline voxelizer against the winding number of closed meshes: a torus and an octahedron whose
+// vertices and edges lie on rows of voxel centers, so rays run through shared edges and vertices.
+// Every voxel center off the surface has to be inside exactly when the mesh winds around it,
+// and the mask must not depend on the number of threads. A cancelled voxelization leaves the mask empty.
+// Usage: vtkPolyData2ImageDataTest
+
+#include "vtkMeshDistanceOracle.h"
+#include "vtkPolyData2ImageData.h"
+
+// STD includes
+#include <algorithm>
+#include <atomic>
+#include <cstdlib>
+#include <iostream>
+#include <math.h>
+#include <string>
+#include <vector>
+
+namespace
+{
+
+struct TestMesh
+{
+    std::string name;
+    std::vector<float> points;
+    std::vector<int> triangles;
+};
+
+// outward facing torus around the z axis through center
+TestMesh MakeTorus(const double *center, double majorRadius, double minorRadius, int numMajor, int numMinor)
+{
+    const double pi = 3.14159265358979323846;
+    TestMesh mesh;
+    mesh.name = "torus";
+    for(int i = 0; i < numMajor; ++i)
+    {
+        const double u = 2 * pi * i / numMajor;
+        for(int j = 0; j < numMinor; ++j)
+        {
+            const double v = 2 * pi * j / numMinor;
+            const double r = majorRadius + minorRadius * cos(v);
+            mesh.points.push_back(static_cast<float>(center[0] + r * cos(u)));
+            mesh.points.push_back(static_cast<float>(center[1] + r * sin(u)));
+            mesh.points.push_back(static_cast<float>(center[2] + minorRadius * sin(v)));
+        }
+    }
+    for(int i = 0; i < numMajor; ++i)
+    {
+        for(int j = 0; j < numMinor; ++j)
+        {
+            const int a = i * numMinor + j, b = ((i + 1) % numMajor) * numMinor + j;
+            const int c = ((i + 1) % numMajor) * numMinor + (j + 1) % numMinor, d = i * numMinor + (j + 1) % numMinor;
+            const int quad[6] = {a, b, c, a, c, d};
+            mesh.triangles.insert(mesh.triangles.end(), quad, quad + 6);
+        }
+    }
+    return mesh;
+}
+
+// outward facing octahedron, radii[i] is the distance of its vertices on axis i from center
+TestMesh MakeOctahedron(const double *center, const double *radii)
+{
+    TestMesh mesh;
+    mesh.name = "octahedron";
+    for(int axis = 0; axis < 3; ++axis)
+    {
+        for(int side = 0; side < 2; ++side)
+        {
+            for(int i = 0; i < 3; ++i)
+            {
+                const double offset = i == axis ? (side == 0 ? radii[i] : -radii[i]) : 0.0;
+                mesh.points.push_back(static_cast<float>(center[i] + offset));
+            }
+        }
+    }
+    // vertices 0/1 are +x/-x, 2/3 are +y/-y, 4/5 are +z/-z
+    const int faces[8][3] = {{0, 2, 4}, {2, 1, 4}, {1, 3, 4}, {3, 0, 4},
+                             {2, 0, 5}, {1, 2, 5}, {3, 1, 5}, {0, 3, 5}};
+    for(int f = 0; f < 8; ++f)
+    {
+        mesh.triangles.insert(mesh.triangles.end(), faces[f], faces[f] + 3);
+    }
+    return mesh;
+}
+
+// sum of the signed solid angles of the triangles seen from p over 4 pi, Van Oosterom and Strackee
+double WindingNumber(const TestMesh &mesh, const double *p)
+{
+    const double pi = 3.14159265358979323846;
+    double sum = 0.0;
+    for(size_t t = 0; t < mesh.triangles.size(); t += 3)
+    {
+        double v[3][3], length[3];
+        for(int k = 0; k < 3; ++k)
+        {
+            const float *q = &mesh.points[3 * static_cast<size_t>(mesh.triangles[t + k])];
+            for(int i = 0; i < 3; ++i)
+            {
+                v[k][i] = q[i] - p[i];
+            }
+            length[k] = sqrt(v[k][0] * v[k][0] + v[k][1] * v[k][1] + v[k][2] * v[k][2]);
+        }
+        const double det = v[0][0] * (v[1][1] * v[2][2] - v[1][2] * v[2][1])
+                         - v[0][1] * (v[1][0] * v[2][2] - v[1][2] * v[2][0])
+                         + v[0][2] * (v[1][0] * v[2][1] - v[1][1] * v[2][0]);
+        auto dot = [&v](int a, int b) { return v[a][0] * v[b][0] + v[a][1] * v[b][1] + v[a][2] * v[b][2]; };
+        const double denom = length[0] * length[1] * length[2] + dot(0, 1) * length[2] + dot(1, 2) * length[0]
+                           + dot(2, 0) * length[1];
+        sum += 2 * atan2(det, denom);
+    }
+    return sum / (4 * pi);
+}
+
+double SurfaceDistance(const TestMesh &mesh, const double *p)
+{
+    double best = 1e300;
+    for(size_t t = 0; t < mesh.triangles.size(); t += 3)
+    {
+        double v[3][3], closest[3];
+        for(int k = 0; k < 3; ++k)
+        {
+            const float *q = &mesh.points[3 * static_cast<size_t>(mesh.triangles[t + k])];
+            v[k][0] = q[0];
+            v[k][1] = q[1];
+            v[k][2] = q[2];
+        }
+        vtkMeshDistanceOracle::ClosestPointOnTriangle(p, v[0], v[1], v[2], closest);
+        const double d[3] = {p[0] - closest[0], p[1] - closest[1], p[2] - closest[2]};
+        best = std::min(best, sqrt(d[0] * d[0] + d[1] * d[1] + d[2] * d[2]));
+    }
+    return best;
+}
+
+bool CheckMesh(const TestMesh &mesh, const int *dims, const double *origin, double spacing)
+{
+    const size_t numVoxels = static_cast<size_t>(dims[0]) * dims[1] * dims[2];
+    const size_t numTriangles = mesh.triangles.size() / 3;
+    std::vector<unsigned char> mask(numVoxels, 7), threadedMask(numVoxels, 7);
+    vtkPolyData2ImageData::Voxelize(mesh.points.data(), mesh.triangles.data(), numTriangles, dims, origin, spacing,
+                                    mask.data(), 1);
+    vtkPolyData2ImageData::Voxelize(mesh.points.data(), mesh.triangles.data(), numTriangles, dims, origin, spacing,
+                                    threadedMask.data(), 3);
+    if(mask != threadedMask)
+    {
+        std::cerr << "The mask of the " << mesh.name << " changes with the number of threads." << std::endl;
+        return false;
+    }
+    size_t numInside = 0;
+    for(size_t i = 0; i < numVoxels; ++i)
+    {
+        if(mask[i] != 0 && mask[i] != 255)
+        {
+            std::cerr << "Voxel " << i << " of the " << mesh.name << " was not written." << std::endl;
+            return false;
+        }
+        const double p[3] = {origin[0] + static_cast<double>(i % dims[0]) * spacing,
+                             origin[1] + static_cast<double>(i / dims[0] % dims[1]) * spacing,
+                             origin[2] + static_cast<double>(i / dims[0] / dims[1]) * spacing};
+        // centers on the surface may go either way
+        if(SurfaceDistance(mesh, p) < 1e-6 * spacing)
+        {
+            continue;
+        }
+        const bool inside = WindingNumber(mesh, p) > 0.5;
+        if(inside != (mask[i] != 0))
+        {
+            std::cerr << "Voxel (" << p[0] << ", " << p[1] << ", " << p[2] << ") of the " << mesh.name << " is "
+                      << (inside ? "inside" : "outside") << " but not in the mask." << std::endl;
+            return false;
+        }
+        numInside += inside ? 1 : 0;
+    }
+    if(numInside == 0)
+    {
+        std::cerr << "No voxel is inside the " << mesh.name << "." << std::endl;
+        return false;
+    }
+
+    const std::atomic<bool> cancel(true);
+    vtkPolyData2ImageData::Voxelize(mesh.points.data(), mesh.triangles.data(), numTriangles, dims, origin, spacing,
+                                    threadedMask.data(), 3, &cancel);
+    if(std::count(threadedMask.begin(), threadedMask.end(), 0) != static_cast<std::ptrdiff_t>(numVoxels))
+    {
+        std::cerr << "The cancelled mask of the " << mesh.name << " is not empty." << std::endl;
+        return false;
+    }
+    return true;
+}
+
+} // end of anonymous namespace
+
+int vtkPolyData2ImageDataTest(int, char*[])
+{
+    // integer voxel centers keep the float vertices of the octahedron exactly on rows of voxels
+    const int dims[3] = {24, 22, 21};
+    const double origin[3] = {-2.0, -1.0, -1.0};
+    const double spacing = 1.0;
+
+    const double torusCenter[3] = {9.3, 9.6, 9.1};
+    if(!CheckMesh(MakeTorus(torusCenter, 6.5, 2.7, 40, 16), dims, origin, spacing))
+    {
+        return EXIT_FAILURE;
+    }
+    const double octahedronCenter[3] = {10.37, 10.0, 9.0};
+    const double radii[3] = {8.0, 7.0, 6.0};
+    if(!CheckMesh(MakeOctahedron(octahedronCenter, radii), dims, origin, spacing))
+    {
+        return EXIT_FAILURE;
+    }
+    return EXIT_SUCCESS;
+}
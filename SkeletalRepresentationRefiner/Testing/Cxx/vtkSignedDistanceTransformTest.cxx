@@ -0,0 +1,142 @@
+/*==============================================================================
+
+  Program: 3D Slicer
+
+  Portions (c) Copyright Brigham and Women's Hospital (BWH) All Rights Reserved.
+
+  See COPYRIGHT.txt
+  or http://www.slicer.org/copyright/copyright.txt for details.
+
+  Unless required by applicable law or agreed to in writing, software
+  distributed under the License is distributed on an "AS IS" BASIS,
+  WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+  See the License for the specific language governing permissions and
+  limitations under the License.
+
+==============================================================================*/
+
+
+// Exact signed distance transform against brute force: every voxel of a few masks on anisotropic grids
+// is compared with the distance to the nearest voxel on the other side, for one and several threads.
+// Usage: vtkSignedDistanceTransformTest
+
+#include "vtkSignedDistanceTransform.h"
+
+// STD includes
+#include <algorithm>
+#include <atomic>
+#include <cstdlib>
+#include <iostream>
+#include <limits>
+#include <math.h>
+#include <random>
+#include <vector>
+
+namespace
+{
+
+// a ball, a box touching the border of the grid and random voxels
+void MakeMask(const int *dims, std::mt19937 &random, std::vector<unsigned char> &inside)
+{
+    std::uniform_int_distribution<int> coin(0, 19);
+    inside.assign(static_cast<size_t>(dims[0]) * dims[1] * dims[2], 0);
+    for(int z = 0; z < dims[2]; ++z)
+    {
+        for(int y = 0; y < dims[1]; ++y)
+        {
+            for(int x = 0; x < dims[0]; ++x)
+            {
+                const double dx = x - 0.4 * dims[0], dy = y - 0.5 * dims[1], dz = z - 0.5 * dims[2];
+                const bool ball = dx * dx + dy * dy + dz * dz < 0.08 * dims[0] * dims[0];
+                const bool box = x >= dims[0] - 4 && y < dims[1] / 3;
+                inside[(static_cast<size_t>(z) * dims[1] + y) * dims[0] + x] = ball || box || coin(random) == 0;
+            }
+        }
+    }
+}
+
+// signed distance of every voxel to the nearest voxel center on the other side, minus half a voxel
+void BruteForce(const unsigned char *inside, const int *dims, const double *spacing, std::vector<double> &dist)
+{
+    const size_t numVoxels = static_cast<size_t>(dims[0]) * dims[1] * dims[2];
+    const double halfVoxel = 0.5 * std::min(spacing[0], std::min(spacing[1], spacing[2]));
+    dist.resize(numVoxels);
+    for(size_t i = 0; i < numVoxels; ++i)
+    {
+        const int xi = static_cast<int>(i % dims[0]), yi = static_cast<int>(i / dims[0] % dims[1]);
+        const int zi = static_cast<int>(i / dims[0] / dims[1]);
+        double best = std::numeric_limits<double>::infinity();
+        for(size_t j = 0; j < numVoxels; ++j)
+        {
+            if((inside[j] != 0) == (inside[i] != 0))
+            {
+                continue;
+            }
+            const double dx = (static_cast<int>(j % dims[0]) - xi) * spacing[0];
+            const double dy = (static_cast<int>(j / dims[0] % dims[1]) - yi) * spacing[1];
+            const double dz = (static_cast<int>(j / dims[0] / dims[1]) - zi) * spacing[2];
+            best = std::min(best, dx * dx + dy * dy + dz * dz);
+        }
+        const double d = sqrt(best) - halfVoxel;
+        dist[i] = inside[i] != 0 ? -d : d;
+    }
+}
+
+} // end of anonymous namespace
+
+int vtkSignedDistanceTransformTest(int, char*[])
+{
+    const int grids[3][3] = {{19, 16, 13}, {8, 23, 11}, {1, 17, 9}};
+    const double spacings[3][3] = {{1.0, 1.0, 1.0}, {0.5, 0.75, 1.25}, {2.0, 0.3, 0.3}};
+    const unsigned int threadCounts[2] = {1, 5};
+    std::mt19937 random(1);
+    for(int g = 0; g < 3; ++g)
+    {
+        std::vector<unsigned char> inside;
+        MakeMask(grids[g], random, inside);
+        std::vector<double> expected;
+        BruteForce(inside.data(), grids[g], spacings[g], expected);
+        for(int t = 0; t < 2; ++t)
+        {
+            std::vector<float> dist(inside.size());
+            if(!vtkSignedDistanceTransform::Compute(inside.data(), grids[g], spacings[g], dist.data(),
+                                                    threadCounts[t]))
+            {
+                std::cerr << "Grid " << g << " has no surface." << std::endl;
+                return EXIT_FAILURE;
+            }
+            for(size_t i = 0; i < dist.size(); ++i)
+            {
+                if(fabs(dist[i] - expected[i]) > 1e-4 * (1 + fabs(expected[i])))
+                {
+                    std::cerr << "Voxel " << i << " of grid " << g << " on " << threadCounts[t] << " threads is "
+                              << dist[i] << " away, not " << expected[i] << "." << std::endl;
+                    return EXIT_FAILURE;
+                }
+            }
+        }
+    }
+
+    // without a surface there is nothing to measure from
+    const int dims[3] = {4, 4, 4};
+    const double spacing[3] = {1.0, 1.0, 1.0};
+    std::vector<unsigned char> full(64, 1);
+    std::vector<float> dist(64);
+    if(vtkSignedDistanceTransform::Compute(full.data(), dims, spacing, dist.data(), 2))
+    {
+        std::cerr << "The transform accepted a full mask." << std::endl;
+        return EXIT_FAILURE;
+    }
+
+    // a cancelled build stops before the first pass is done
+    std::vector<unsigned char> inside;
+    MakeMask(grids[0], random, inside);
+    std::vector<float> cancelledDist(inside.size());
+    const std::atomic<bool> cancel(true);
+    if(vtkSignedDistanceTransform::Compute(inside.data(), grids[0], spacings[0], cancelledDist.data(), 3, &cancel))
+    {
+        std::cerr << "The transform finished although it was cancelled." << std::endl;
+        return EXIT_FAILURE;
+    }
+    return EXIT_SUCCESS;
+}
@@ -0,0 +1,197 @@
+/*==============================================================================
+
+  Program: 3D Slicer
+
+  Portions (c) Copyright Brigham and Women's Hospital (BWH) All Rights Reserved.
+
+  See COPYRIGHT.txt
+  or http://www.slicer.org/copyright/copyright.txt for details.
+
+  Unless required by applicable law or agreed to in writing, software
+  distributed under the License is distributed on an "AS IS" BASIS,
+  WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+  See the License for the specific language governing permissions and
+  limitations under the License.
+
+==============================================================================*/
+
+
+// Narrow band distance map against the dense one: within the band a map kept from a dense volume has
+// to sample like vtkImageDistanceSampler for every interpolation, beyond it it reads +/- band.
+// A map built from the triangles of a box has the exact distance to the box at the voxels of the band.
+// Usage: vtkSparseDistanceMapTest
+
+#include "vtkDistanceSampler.h"
+#include "vtkSparseDistanceMap.h"
+
+// STD includes
+#include <algorithm>
+#include <cstdlib>
+#include <iostream>
+#include <math.h>
+#include <random>
+#include <vector>
+
+namespace
+{
+
+const double ballCenter[3] = {0.52, 0.47, 0.5};
+const double ballRadius = 0.3;
+
+double BallDistance(const double *p)
+{
+    const double d[3] = {p[0] - ballCenter[0], p[1] - ballCenter[1], p[2] - ballCenter[2]};
+    return sqrt(d[0] * d[0] + d[1] * d[1] + d[2] * d[2]) - ballRadius;
+}
+
+// signed distance to the box [lo, hi]
+double BoxDistance(const double *p, const double *lo, const double *hi)
+{
+    double outside = 0.0, inside = 1e300;
+    for(int i = 0; i < 3; ++i)
+    {
+        const double below = lo[i] - p[i], above = p[i] - hi[i];
+        const double gap = std::max(below, above);
+        outside += gap > 0 ? gap * gap : 0.0;
+        inside = std::min(inside, -gap);
+    }
+    return outside > 0 ? sqrt(outside) : -inside;
+}
+
+bool CompareWithDense(const std::vector<float> &dist, const int *dims, const double *origin, double spacing,
+                      double band)
+{
+    vtkImageDistanceSampler dense;
+    dense.SetDistanceVolume(dist.data(), dims, origin, spacing);
+    vtkSparseDistanceMap sparse;
+    sparse.BuildFromDense(dist.data(), dims, origin, spacing, band);
+    if(sparse.IsEmpty() || sparse.GetMemorySize() >= dist.size() * sizeof(float))
+    {
+        std::cerr << "The narrow band map holds " << sparse.GetMemorySize() << " bytes." << std::endl;
+        return false;
+    }
+    std::mt19937 random(1);
+    std::uniform_real_distribution<double> uniform(-1.0, 1.0);
+    const vtkImageDistanceSampler::Interpolation modes[3] = {vtkImageDistanceSampler::Nearest,
+                                                             vtkImageDistanceSampler::Trilinear,
+                                                             vtkImageDistanceSampler::TricubicBSpline};
+    for(int m = 0; m < 3; ++m)
+    {
+        dense.SetInterpolation(modes[m]);
+        sparse.SetInterpolation(modes[m]);
+        for(int i = 0; i < 2000; ++i)
+        {
+            // points on shells around the ball, all stencils of the samples stay within the band
+            double direction[3] = {uniform(random), uniform(random), uniform(random)};
+            const double length = sqrt(direction[0] * direction[0] + direction[1] * direction[1]
+                                       + direction[2] * direction[2]);
+            const double radius = ballRadius + 0.5 * (band - 2 * spacing) * uniform(random);
+            double p[3];
+            for(int k = 0; k < 3; ++k)
+            {
+                p[k] = ballCenter[k] + radius * direction[k] / length;
+            }
+            double denseNormal[3], sparseNormal[3];
+            const double expected = dense.Sample(p, denseNormal);
+            const double sampled = sparse.Sample(p, sparseNormal);
+            const double normalLength = sqrt(denseNormal[0] * denseNormal[0] + denseNormal[1] * denseNormal[1]
+                                             + denseNormal[2] * denseNormal[2]);
+            double normalError = 0.0;
+            for(int k = 0; k < 3; ++k)
+            {
+                normalError = std::max(normalError, fabs(denseNormal[k] / normalLength - sparseNormal[k]));
+            }
+            if(fabs(sampled - expected) > 1e-6 || normalError > 1e-5)
+            {
+                std::cerr << "Interpolation " << m << " at (" << p[0] << ", " << p[1] << ", " << p[2]
+                          << ") reads " << sampled << " instead of " << expected << ", normals differ by "
+                          << normalError << "." << std::endl;
+                return false;
+            }
+        }
+    }
+
+    // the center is far inside, the corner of the grid far outside
+    sparse.SetInterpolation(vtkImageDistanceSampler::Nearest);
+    double normal[3];
+    const double farOutside[3] = {origin[0], origin[1], origin[2]};
+    if(fabs(sparse.Sample(ballCenter, normal) + band) > 1e-6 || fabs(sparse.Sample(farOutside, normal) - band) > 1e-6)
+    {
+        std::cerr << "Beyond the band the map doesn't read +/- the band." << std::endl;
+        return false;
+    }
+    return true;
+}
+
+bool CheckBox(const int *dims, const double *origin, double spacing, double band)
+{
+    const double lo[3] = {0.23, 0.31, 0.27}, hi[3] = {0.71, 0.64, 0.78};
+    std::vector<float> points;
+    for(int i = 0; i < 8; ++i)
+    {
+        points.push_back(static_cast<float>((i & 1) ? hi[0] : lo[0]));
+        points.push_back(static_cast<float>((i & 2) ? hi[1] : lo[1]));
+        points.push_back(static_cast<float>((i & 4) ? hi[2] : lo[2]));
+    }
+    const int triangles[36] = {0, 2, 1, 1, 2, 3, 4, 5, 6, 5, 7, 6, 0, 1, 4, 1, 5, 4,
+                               2, 6, 3, 3, 6, 7, 0, 4, 2, 2, 4, 6, 1, 3, 5, 3, 7, 5};
+    const size_t numVoxels = static_cast<size_t>(dims[0]) * dims[1] * dims[2];
+    std::vector<unsigned char> inside(numVoxels);
+    for(size_t v = 0; v < numVoxels; ++v)
+    {
+        const double p[3] = {origin[0] + static_cast<double>(v % dims[0]) * spacing,
+                             origin[1] + static_cast<double>(v / dims[0] % dims[1]) * spacing,
+                             origin[2] + static_cast<double>(v / dims[0] / dims[1]) * spacing};
+        inside[v] = BoxDistance(p, lo, hi) < 0 ? 255 : 0;
+    }
+    vtkSparseDistanceMap sparse;
+    sparse.Build(points.data(), triangles, 12, inside.data(), dims, origin, spacing, band);
+    for(int z = 0; z < dims[2]; ++z)
+    {
+        for(int y = 0; y < dims[1]; ++y)
+        {
+            for(int x = 0; x < dims[0]; ++x)
+            {
+                const double p[3] = {origin[0] + x * spacing, origin[1] + y * spacing, origin[2] + z * spacing};
+                const double expected = BoxDistance(p, lo, hi);
+                const double value = sparse.GetValue(x, y, z);
+                if(fabs(expected) < band ? fabs(value - expected) > 1e-6 : fabs(value) < band - 1e-6)
+                {
+                    std::cerr << "Voxel (" << x << ", " << y << ", " << z << ") of the box is " << value
+                              << " away, not " << expected << "." << std::endl;
+                    return false;
+                }
+            }
+        }
+    }
+    return true;
+}
+
+} // end of anonymous namespace
+
+int vtkSparseDistanceMapTest(int, char*[])
+{
+    // a grid that doesn't split into whole bricks
+    const int dims[3] = {45, 41, 43};
+    const double spacing = 0.025;
+    const double origin[3] = {-0.05, -0.025, -0.05};
+    const double band = 0.1;
+
+    std::vector<float> dist(static_cast<size_t>(dims[0]) * dims[1] * dims[2]);
+    for(size_t v = 0; v < dist.size(); ++v)
+    {
+        const double p[3] = {origin[0] + static_cast<double>(v % dims[0]) * spacing,
+                             origin[1] + static_cast<double>(v / dims[0] % dims[1]) * spacing,
+                             origin[2] + static_cast<double>(v / dims[0] / dims[1]) * spacing};
+        dist[v] = static_cast<float>(BallDistance(p));
+    }
+    if(!CompareWithDense(dist, dims, origin, spacing, band))
+    {
+        return EXIT_FAILURE;
+    }
+    if(!CheckBox(dims, origin, spacing, band))
+    {
+        return EXIT_FAILURE;
+    }
+    return EXIT_SUCCESS;
+}
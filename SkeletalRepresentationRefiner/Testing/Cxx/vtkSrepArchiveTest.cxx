@@ -0,0 +1,226 @@
+/*==============================================================================
+
+  Program: 3D Slicer
+
+  Portions (c) Copyright Brigham and Women's Hospital (BWH) All Rights Reserved.
+
+  See COPYRIGHT.txt
+  or http://www.slicer.org/copyright/copyright.txt for details.
+
+  Unless required by applicable law or agreed to in writing, software
+  distributed under the License is distributed on an "AS IS" BASIS,
+  WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+  See the License for the specific language governing permissions and
+  limitations under the License.
+
+==============================================================================*/
+
+// Round trip of the s-rep archive: quantization, prediction and range coding of a population
+// of synthetic s-reps. Every decoded value has to stay within half a quantization step.
+// Usage: vtkSrepArchiveTest <temporaryDirectory>
+
+#include "vtkSpoke.h"
+#include "vtkSrep.h"
+#include "vtkSrepArchive.h"
+
+// STD includes
+#include <algorithm>
+#include <cstdio>
+#include <cstdlib>
+#include <iostream>
+#include <math.h>
+#include <random>
+#include <string>
+#include <vector>
+
+namespace
+{
+
+const int testRows = 5;
+const int testCols = 9;
+
+void AddSpoke(vtkSrepFile::Spokes &spokes, const double *point, const double *direction, double radius)
+{
+    const double length = sqrt(direction[0] * direction[0] + direction[1] * direction[1] + direction[2] * direction[2]);
+    for(int k = 0; k < 3; ++k)
+    {
+        spokes.SkeletalPoints.push_back(point[k]);
+        spokes.Directions.push_back(direction[k] / length);
+    }
+    spokes.Radii.push_back(radius);
+}
+
+// A bent sheet of up and down spokes on the grid and a ring of crest spokes around it, with noise
+void MakeSubject(std::mt19937 &random, vtkSrepFile::Spokes *sides)
+{
+    std::normal_distribution<double> noise(0.0, 1.0);
+    const double scale = 1.0 + 0.1 * noise(random);
+    for(int r = 0; r < testRows; ++r)
+    {
+        for(int c = 0; c < testCols; ++c)
+        {
+            const double point[3] = {10.0 * scale * r + 0.01 * noise(random) + 50.0,
+                                     5.0 * scale * c + 0.01 * noise(random) - 20.0,
+                                     0.3 * r * c + 0.01 * noise(random)};
+            for(int side = vtkSrepFile::Up; side <= vtkSrepFile::Down; ++side)
+            {
+                const double direction[3] = {0.1 * noise(random), 0.1 * noise(random),
+                                             side == vtkSrepFile::Up ? 1.0 : -1.0};
+                AddSpoke(sides[side], point, direction, 3.0 + 0.2 * noise(random));
+            }
+        }
+    }
+    const std::vector<double> &upPoints = sides[vtkSrepFile::Up].SkeletalPoints;
+    for(int i = 0; i < 2 * (testRows + testCols - 2); ++i)
+    {
+        const size_t up = static_cast<size_t>(i % (testRows * testCols));
+        const double point[3] = {upPoints[3 * up] + 0.5, upPoints[3 * up + 1] + 0.5, upPoints[3 * up + 2] + 0.5};
+        const double direction[3] = {noise(random), noise(random), noise(random)};
+        AddSpoke(sides[vtkSrepFile::Crest], point, direction, 2.0 + 0.1 * noise(random));
+    }
+}
+
+bool CheckSubject(const vtkSrepFile::Spokes *original, const vtkSrepFile::Spokes *decoded,
+                  double pointStep, double radiusStep, double angleBound)
+{
+    const double tolerance = 1e-9;
+    for(int side = 0; side < 3; ++side)
+    {
+        if(decoded[side].Radii.size() != original[side].Radii.size()
+                || decoded[side].SkeletalPoints.size() != original[side].SkeletalPoints.size()
+                || decoded[side].Directions.size() != original[side].Directions.size())
+        {
+            std::cerr << "The " << vtkSrepFile::GetSideName(side) << " spokes have the wrong count." << std::endl;
+            return false;
+        }
+        for(size_t i = 0; i < original[side].SkeletalPoints.size(); ++i)
+        {
+            if(fabs(decoded[side].SkeletalPoints[i] - original[side].SkeletalPoints[i]) > 0.5 * pointStep + tolerance)
+            {
+                std::cerr << "Skeletal point " << i / 3 << " of the " << vtkSrepFile::GetSideName(side)
+                          << " spokes is off by more than half a step." << std::endl;
+                return false;
+            }
+        }
+        for(size_t i = 0; i < original[side].Radii.size(); ++i)
+        {
+            if(fabs(decoded[side].Radii[i] - original[side].Radii[i]) > 0.5 * radiusStep + tolerance)
+            {
+                std::cerr << "Radius " << i << " of the " << vtkSrepFile::GetSideName(side)
+                          << " spokes is off by more than half a step." << std::endl;
+                return false;
+            }
+            const double *a = &original[side].Directions[3 * i];
+            const double *b = &decoded[side].Directions[3 * i];
+            const double cross[3] = {a[1] * b[2] - a[2] * b[1], a[2] * b[0] - a[0] * b[2], a[0] * b[1] - a[1] * b[0]};
+            const double angle = atan2(sqrt(cross[0] * cross[0] + cross[1] * cross[1] + cross[2] * cross[2]),
+                                       a[0] * b[0] + a[1] * b[1] + a[2] * b[2]);
+            if(angle > angleBound)
+            {
+                std::cerr << "Direction " << i << " of the " << vtkSrepFile::GetSideName(side) << " spokes is off by "
+                          << angle << " rad." << std::endl;
+                return false;
+            }
+        }
+    }
+    return true;
+}
+
+} // end of anonymous namespace
+
+int vtkSrepArchiveTest(int argc, char* argv[])
+{
+    if(argc < 2)
+    {
+        std::cerr << "Usage: " << argv[0] << " <temporaryDirectory>" << std::endl;
+        return EXIT_FAILURE;
+    }
+    const std::string archiveFileName = std::string(argv[1]) + "/vtkSrepArchiveTest.sreps";
+    const double pointStep = 1e-3;
+    const double radiusStep = 1e-3;
+    const int directionBits = 12;
+    // the octahedral coordinates are rounded by half a step, which turns a direction by less than two steps
+    const double angleBound = 2.0 / ((1 << (directionBits - 1)) - 1);
+    const int numSubjects = 20;
+
+    std::mt19937 random(1);
+    std::vector<std::vector<vtkSrepFile::Spokes> > subjects(numSubjects, std::vector<vtkSrepFile::Spokes>(3));
+    vtkSrepArchiveWriter writer;
+    if(!writer.Create(archiveFileName, testRows, testCols, pointStep, radiusStep, directionBits))
+    {
+        return EXIT_FAILURE;
+    }
+    for(int i = 0; i < numSubjects; ++i)
+    {
+        MakeSubject(random, subjects[i].data());
+        if(!writer.AddSubject("subject" + std::to_string(i), 0.1 * i, subjects[i].data()))
+        {
+            return EXIT_FAILURE;
+        }
+    }
+
+    // a subject with other spoke counts can't join the archive
+    std::vector<vtkSrepFile::Spokes> other(subjects[0]);
+    other[vtkSrepFile::Crest].Radii.pop_back();
+    other[vtkSrepFile::Crest].SkeletalPoints.resize(other[vtkSrepFile::Crest].SkeletalPoints.size() - 3);
+    other[vtkSrepFile::Crest].Directions.resize(other[vtkSrepFile::Crest].Directions.size() - 3);
+    if(writer.AddSubject("other", 0.0, other.data()))
+    {
+        std::cerr << "The archive took a subject with other spoke counts." << std::endl;
+        return EXIT_FAILURE;
+    }
+    if(!writer.Commit())
+    {
+        return EXIT_FAILURE;
+    }
+
+    vtkSrepArchive archive;
+    if(!archive.Open(archiveFileName))
+    {
+        return EXIT_FAILURE;
+    }
+    if(archive.GetNumberOfSubjects() != static_cast<size_t>(numSubjects) || archive.GetNumberOfRows() != testRows
+            || archive.GetNumberOfColumns() != testCols)
+    {
+        std::cerr << "The archive has the wrong layout." << std::endl;
+        return EXIT_FAILURE;
+    }
+    // decode in reverse order, subjects don't depend on each other
+    for(int i = numSubjects - 1; i >= 0; --i)
+    {
+        const long long subject = archive.FindSubject("subject" + std::to_string(i));
+        if(subject != i || fabs(archive.GetCrestShift(static_cast<size_t>(subject)) - 0.1 * i) > 1e-12)
+        {
+            std::cerr << "Subject " << i << " is missing from the index." << std::endl;
+            return EXIT_FAILURE;
+        }
+        vtkSrepFile::Spokes decoded[3];
+        if(!archive.ReadSubject(static_cast<size_t>(subject), decoded)
+                || !CheckSubject(subjects[i].data(), decoded, pointStep, radiusStep, angleBound))
+        {
+            std::cerr << "Subject " << i << " did not survive the round trip." << std::endl;
+            return EXIT_FAILURE;
+        }
+    }
+    if(archive.FindSubject("other") >= 0)
+    {
+        std::cerr << "The rejected subject is in the archive." << std::endl;
+        return EXIT_FAILURE;
+    }
+
+    // the s-rep decoded directly has the spokes of all sides
+    vtkSrep *srep = archive.ReadSrep(3);
+    if(srep == nullptr || srep->GetNumRows() != testRows || srep->GetNumCols() != testCols
+            || srep->GetAllSpokes().size() != subjects[3][0].Radii.size() + subjects[3][1].Radii.size()
+                                              + subjects[3][2].Radii.size())
+    {
+        std::cerr << "The s-rep of subject 3 is incomplete." << std::endl;
+        delete srep;
+        return EXIT_FAILURE;
+    }
+    delete srep;
+
+    archive.Close();
+    std::remove(archiveFileName.c_str());
+    return EXIT_SUCCESS;
+}
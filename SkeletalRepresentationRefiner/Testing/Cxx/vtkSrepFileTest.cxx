@@ -0,0 +1,211 @@
+/*==============================================================================
+
+  Program: 3D Slicer
+
+  Portions (c) Copyright Brigham and Women's Hospital (BWH) All Rights Reserved.
+
+  See COPYRIGHT.txt
+  or http://www.slicer.org/copyright/copyright.txt for details.
+
+  Unless required by applicable law or agreed to in writing, software
+  distributed under the License is distributed on an "AS IS" BASIS,
+  WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+  See the License for the specific language governing permissions and
+  limitations under the License.
+
+==============================================================================*/
+
+
+// Round trip of the single-file s-rep container and rejection of corrupt headers: sections pointing
+// outside the file or between values, spoke counts whose sections would overflow the size, a truncated
+// file and a file of the other byte order must not open.
+// Usage: vtkSrepFileTest <temporaryDirectory>
+
+#include "vtkSrepFile.h"
+
+// STD includes
+#include <cstddef>
+#include <cstdint>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <fstream>
+#include <iostream>
+#include <iterator>
+#include <string>
+#include <vector>
+
+namespace
+{
+
+void MakeSpokes(int numSpokes, double seed, vtkSrepFile::Spokes *spokes)
+{
+    for(int i = 0; i < numSpokes; ++i)
+    {
+        for(int k = 0; k < 3; ++k)
+        {
+            spokes->SkeletalPoints.push_back(seed + 0.1 * i + k);
+            spokes->Directions.push_back(k == 2 ? 1.0 : 0.01 * i);
+        }
+        spokes->Radii.push_back(seed + 0.5 + 0.25 * i);
+    }
+}
+
+bool SameSpokes(const vtkSrepFile &srepFile, int side, const vtkSrepFile::Spokes &expected)
+{
+    vtkSrepFile::Spokes spokes;
+    srepFile.GetSpokes(side, &spokes);
+    const double *radii = srepFile.GetSection(side, vtkSrepFile::Radii);
+    if(spokes.SkeletalPoints != expected.SkeletalPoints || spokes.Directions != expected.Directions
+            || spokes.Radii != expected.Radii || reinterpret_cast<size_t>(radii) % sizeof(double) != 0)
+    {
+        std::cerr << "The " << vtkSrepFile::GetSideName(side) << " spokes did not survive the round trip."
+                  << std::endl;
+        return false;
+    }
+    return true;
+}
+
+bool ReadBytes(const std::string &fileName, std::vector<char> &bytes)
+{
+    std::ifstream in(fileName.c_str(), std::ios::binary);
+    bytes.assign(std::istreambuf_iterator<char>(in), std::istreambuf_iterator<char>());
+    return !bytes.empty();
+}
+
+bool WriteBytes(const std::string &fileName, const std::vector<char> &bytes)
+{
+    std::ofstream out(fileName.c_str(), std::ios::binary);
+    out.write(bytes.data(), static_cast<std::streamsize>(bytes.size()));
+    return static_cast<bool>(out);
+}
+
+// write a copy of the container with value at byte offset of its header and check that it doesn't open
+template<typename T>
+bool RejectsCorruption(const std::vector<char> &bytes, const std::string &fileName, size_t offset, T value,
+                       const char *what)
+{
+    std::vector<char> corrupt(bytes);
+    std::memcpy(&corrupt[offset], &value, sizeof(value));
+    vtkSrepFile srepFile;
+    if(!WriteBytes(fileName, corrupt) || srepFile.Open(fileName))
+    {
+        std::cerr << "A container with " << what << " was opened." << std::endl;
+        return false;
+    }
+    return true;
+}
+
+} // end of anonymous namespace
+
+int vtkSrepFileTest(int argc, char* argv[])
+{
+    if(argc < 2)
+    {
+        std::cerr << "Usage: " << argv[0] << " <temporaryDirectory>" << std::endl;
+        return EXIT_FAILURE;
+    }
+    const std::string fileName = std::string(argv[1]) + "/vtkSrepFileTest.srep";
+    const std::string corruptFileName = std::string(argv[1]) + "/vtkSrepFileTestCorrupt.srep";
+    const int nRows = 5, nCols = 9;
+    vtkSrepFile::Spokes sides[3];
+    MakeSpokes(nRows * nCols, 1.0, &sides[vtkSrepFile::Up]);
+    MakeSpokes(nRows * nCols, 2.0, &sides[vtkSrepFile::Down]);
+    MakeSpokes(2 * (nRows + nCols) - 4, 3.0, &sides[vtkSrepFile::Crest]);
+
+    // incomplete spokes are not written
+    vtkSrepFile::Spokes incomplete[3] = {sides[0], sides[1], sides[2]};
+    incomplete[vtkSrepFile::Down].Radii.pop_back();
+    if(vtkSrepFile::Write(fileName, nRows, nCols, 0.5, incomplete))
+    {
+        std::cerr << "Spokes without all their radii were written." << std::endl;
+        return EXIT_FAILURE;
+    }
+
+    if(!vtkSrepFile::Write(fileName, nRows, nCols, 0.5, sides))
+    {
+        return EXIT_FAILURE;
+    }
+    {
+        vtkSrepFile srepFile;
+        if(!srepFile.Open(fileName) || srepFile.GetNumberOfRows() != nRows || srepFile.GetNumberOfColumns() != nCols
+                || srepFile.GetCrestShift() != 0.5)
+        {
+            std::cerr << "The header of the container did not survive the round trip." << std::endl;
+            return EXIT_FAILURE;
+        }
+        for(int side = 0; side < 3; ++side)
+        {
+            if(!SameSpokes(srepFile, side, sides[side]))
+            {
+                return EXIT_FAILURE;
+            }
+        }
+    }
+
+    // replacing one side keeps the others
+    vtkSrepFile::Spokes newDown;
+    MakeSpokes(nRows * nCols, 7.0, &newDown);
+    if(!vtkSrepFile::WriteSide(fileName, vtkSrepFile::Down, newDown))
+    {
+        return EXIT_FAILURE;
+    }
+    {
+        vtkSrepFile srepFile;
+        if(!srepFile.Open(fileName) || !SameSpokes(srepFile, vtkSrepFile::Up, sides[vtkSrepFile::Up])
+                || !SameSpokes(srepFile, vtkSrepFile::Down, newDown)
+                || !SameSpokes(srepFile, vtkSrepFile::Crest, sides[vtkSrepFile::Crest]))
+        {
+            return EXIT_FAILURE;
+        }
+    }
+
+    // side names stand for the spoke files
+    std::string containerName;
+    int side = -1;
+    if(!vtkSrepFile::SplitSideFileName(vtkSrepFile::GetSideFileName(fileName, vtkSrepFile::Crest),
+                                       &containerName, &side)
+            || containerName != fileName || side != vtkSrepFile::Crest
+            || vtkSrepFile::SplitSideFileName(fileName + "#left", &containerName, &side)
+            || vtkSrepFile::SplitSideFileName("up.vtp#up", &containerName, &side))
+    {
+        std::cerr << "The side file names of the container don't split." << std::endl;
+        return EXIT_FAILURE;
+    }
+
+    std::vector<char> bytes;
+    if(!ReadBytes(fileName, bytes))
+    {
+        std::cerr << "Can't read " << fileName << std::endl;
+        return EXIT_FAILURE;
+    }
+    const size_t downRadii = offsetof(vtkSrepFileHeader, offsets) + (3 * vtkSrepFile::Down + vtkSrepFile::Radii)
+                             * sizeof(uint64_t);
+    const size_t crestCount = offsetof(vtkSrepFileHeader, numSpokes) + vtkSrepFile::Crest * sizeof(uint64_t);
+    const uint64_t fileSize = bytes.size();
+    if(!RejectsCorruption(bytes, corruptFileName, downRadii, fileSize + 8, "a section past its end")
+            || !RejectsCorruption(bytes, corruptFileName, downRadii, fileSize - 8, "a section running past its end")
+            || !RejectsCorruption(bytes, corruptFileName, downRadii, static_cast<uint64_t>(132), "a misaligned section")
+            || !RejectsCorruption(bytes, corruptFileName, downRadii, static_cast<uint64_t>(8),
+                                  "a section in its header")
+            || !RejectsCorruption(bytes, corruptFileName, crestCount, static_cast<uint64_t>(1) << 62,
+                                  "a spoke count overflowing its size")
+            || !RejectsCorruption(bytes, corruptFileName, offsetof(vtkSrepFileHeader, version),
+                                  static_cast<uint32_t>(1) << 24, "the other byte order")
+            || !RejectsCorruption(bytes, corruptFileName, offsetof(vtkSrepFileHeader, nRows), static_cast<int32_t>(-1),
+                                  "a negative row count"))
+    {
+        return EXIT_FAILURE;
+    }
+    std::vector<char> truncated(bytes.begin(), bytes.begin() + static_cast<std::ptrdiff_t>(bytes.size() - 8));
+    vtkSrepFile truncatedFile;
+    if(!WriteBytes(corruptFileName, truncated) || truncatedFile.Open(corruptFileName))
+    {
+        std::cerr << "A truncated container was opened." << std::endl;
+        return EXIT_FAILURE;
+    }
+
+    std::remove(corruptFileName.c_str());
+    std::remove(fileName.c_str());
+    return EXIT_SUCCESS;
+}
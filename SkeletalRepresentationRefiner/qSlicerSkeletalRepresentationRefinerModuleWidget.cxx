@@ -26,6 +26,8 @@
 
 #include <QFileDialog>
 #include <QMessageBox>
+#include <QSettings>
+#include <QStandardPaths>
 
 //-----------------------------------------------------------------------------
 /// \ingroup Slicer_QtModules_ExtensionTemplate
@@ -77,7 +79,17 @@ qSlicerSkeletalRepresentationRefinerModuleWidget::~qSlicerSkeletalRepresentation
 void qSlicerSkeletalRepresentationRefinerModuleWidget::SelectImage()
 {
     Q_D(qSlicerSkeletalRepresentationRefinerModuleWidget);
-    QString fileName = QFileDialog::getOpenFileName(this, "Select image file");
+    // surface meshes of vtkSurfaceMeshReader and label volumes of vtkLabelVolume2ImageData
+    QString fileName = QFileDialog::getOpenFileName(this, "Select image file", QString(),
+                                                    "Meshes and label volumes (*.vtk *.vtp *.stl *.ply *.nrrd *.mha);;"
+                                                    "Meshes (*.vtk *.vtp *.stl *.ply);;"
+                                                    "Label volumes (*.nrrd *.mha);;"
+                                                    "All files (*)");
+    // a cancelled dialog keeps the current image and its distance map
+    if(fileName.isEmpty())
+    {
+        return;
+    }
     d->lb_imagePath->setText(fileName.toUtf8().constData());
     d->logic()->SetImageFileName(fileName.toUtf8().constData());
 }
@@ -149,6 +161,21 @@ void qSlicerSkeletalRepresentationRefinerModuleWidget::setup()
   Q_D(qSlicerSkeletalRepresentationRefinerModuleWidget);
   d->setupUi(this);
   this->Superclass::setup();
+  // distance maps of target meshes can be reused across refinements and sessions, the disk cache
+  // is opt-in through the application settings
+  QSettings settings;
+  if(settings.value("SkeletalRepresentationRefiner/DistanceMapCache", false).toBool())
+  {
+    QString defaultCacheDir = QStandardPaths::writableLocation(QStandardPaths::CacheLocation) + "/SRepDistanceMaps";
+    QString cacheDir = settings.value("SkeletalRepresentationRefiner/DistanceMapCacheDirectory",
+                                      defaultCacheDir).toString();
+    d->logic()->SetDistanceMapCacheDirectory(cacheDir.toUtf8().constData());
+    // the size limit is given in MB
+    const unsigned long long defaultSizeMB = vtkDistanceMapCache::DefaultMaximumSize >> 20;
+    const unsigned long long cacheSizeMB = settings.value("SkeletalRepresentationRefiner/DistanceMapCacheSize",
+                                                          defaultSizeMB).toULongLong();
+    d->logic()->SetDistanceMapCacheSize(cacheSizeMB << 20);
+  }
   QObject::connect(d->btn_browseImage, SIGNAL(clicked()), this, SLOT(SelectImage()));
   QObject::connect(d->btn_browseSrep, SIGNAL(clicked()), this, SLOT(SelectSrep()));
   QObject::connect(d->btn_output, SIGNAL(clicked()), this, SLOT(SelectOutputPath()));